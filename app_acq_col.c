@@ -0,0 +1,190 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_acq_col.c
+ *  @brief beeinformed columnar block codec for acquisition records,
+ *         delta of delta timestamps and zig-zag varint value deltas
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** static functions */
+
+/**
+ *  @fn acq_col_zigzag()
+ *  @brief maps small signed values to small unsigned ones
+ *  @param
+ *  @return
+ */
+static inline uint32_t acq_col_zigzag(int32_t v)
+{
+    return(((uint32_t)v << 1) ^ (uint32_t)(v >> 31));
+}
+
+/**
+ *  @fn acq_col_unzigzag()
+ *  @brief inverse of acq_col_zigzag()
+ *  @param
+ *  @return
+ */
+static inline int32_t acq_col_unzigzag(uint32_t v)
+{
+    return((int32_t)(v >> 1) ^ -(int32_t)(v & 1));
+}
+
+/**
+ *  @fn acq_col_put()
+ *  @brief writes a varint
+ *  @param
+ *  @return
+ */
+static inline uint8_t *acq_col_put(uint8_t *p, uint32_t v)
+{
+    while(v >= 0x80) {
+        *p++ = (uint8_t)v | 0x80;
+        v >>= 7;
+    }
+    *p++ = (uint8_t)v;
+    return(p);
+}
+
+/**
+ *  @fn acq_col_get()
+ *  @brief reads a varint
+ *  @param
+ *  @return NULL when the buffer ends first
+ */
+static inline const uint8_t *acq_col_get(const uint8_t *p, const uint8_t *end, uint32_t *v)
+{
+    uint32_t r = 0;
+
+    for(int shift = 0; shift < 7 * ACQ_COL_VARINT_MAX; shift += 7) {
+        if(p == end) {
+            return(NULL);
+        }
+        r |= (uint32_t)(*p & 0x7F) << shift;
+        if(!(*p++ & 0x80)) {
+            *v = r;
+            return(p);
+        }
+    }
+    return(NULL);
+}
+
+/**
+ *  @fn acq_col_load()
+ *  @brief field of a record as raw bits, every field is 32 bit wide
+ *  @param
+ *  @return
+ */
+static inline uint32_t acq_col_load(const acq_record_t *rec, int field)
+{
+    uint32_t v;
+
+    memcpy(&v, (const uint8_t *)rec + offsetof(acq_record_t, val) + field * sizeof(v), sizeof(v));
+    return(v);
+}
+
+/**
+ *  @fn acq_col_store()
+ *  @brief inverse of acq_col_load()
+ *  @param
+ *  @return
+ */
+static inline void acq_col_store(acq_record_t *rec, int field, uint32_t v)
+{
+    memcpy((uint8_t *)rec + offsetof(acq_record_t, val) + field * sizeof(v), &v, sizeof(v));
+}
+
+
+/** public functions */
+size_t acq_col_encode(const acq_record_t *rec, uint16_t count, uint8_t *out)
+{
+    acq_block_hdr_t *hdr = (acq_block_hdr_t *)out;
+    acq_col_hdr_t *col = (acq_col_hdr_t *)(out + sizeof(acq_block_hdr_t));
+    uint8_t *p = out + sizeof(acq_block_hdr_t) + sizeof(acq_col_hdr_t);
+    int32_t delta = 0;
+
+    assert(rec != NULL && out != NULL && count && count <= ACQ_BLOCK_RECORDS);
+
+    hdr->magic = ACQ_BLOCK_MAGIC;
+    hdr->version = ACQ_BLOCK_VERSION_COLUMNAR;
+    hdr->count = count;
+    hdr->first_ts = rec[0].timestamp;
+    hdr->last_ts = rec[count - 1].timestamp;
+
+    /* a steady acquisition period makes every entry a single zero byte */
+    for(int i = 1; i < count; i++) {
+        int32_t d = (int32_t)(rec[i].timestamp - rec[i - 1].timestamp);
+        p = acq_col_put(p, acq_col_zigzag(d - delta));
+        delta = d;
+    }
+
+    /* values move slowly, so each one is kept as the change from the last */
+    for(int f = 0; f < ACQ_COL_FIELDS; f++) {
+        uint32_t prev = 0;
+        int64_t lo = INT64_MAX;
+        int64_t hi = INT64_MIN;
+
+        for(int i = 0; i < count; i++) {
+            uint32_t v = acq_col_load(&rec[i], f);
+            int64_t sv = (f == ACQ_COL_SIGNED_FIELD) ? (int32_t)v : (int64_t)v;
+
+            p = acq_col_put(p, acq_col_zigzag((int32_t)(v - prev)));
+            prev = v;
+            lo = (sv < lo) ? sv : lo;
+            hi = (sv > hi) ? sv : hi;
+        }
+
+        /* per block ranges let queries on values skip whole blocks */
+        prev = (uint32_t)lo;
+        memcpy((uint8_t *)col + offsetof(acq_col_hdr_t, min) + f * sizeof(prev), &prev, sizeof(prev));
+        prev = (uint32_t)hi;
+        memcpy((uint8_t *)col + offsetof(acq_col_hdr_t, max) + f * sizeof(prev), &prev, sizeof(prev));
+    }
+
+    hdr->size = p - out;
+    hdr->crc = 0;
+    return(hdr->size);
+}
+
+int acq_col_decode(const uint8_t *blk, size_t size, acq_record_t *rec)
+{
+    const acq_block_hdr_t *hdr = (const acq_block_hdr_t *)blk;
+    const uint8_t *p = blk + sizeof(acq_block_hdr_t) + sizeof(acq_col_hdr_t);
+    const uint8_t *end;
+    int32_t delta = 0;
+    uint32_t v;
+
+    assert(blk != NULL && rec != NULL);
+
+    if(size < sizeof(acq_block_hdr_t) + sizeof(acq_col_hdr_t) || hdr->magic != ACQ_BLOCK_MAGIC ||
+        hdr->version != ACQ_BLOCK_VERSION_COLUMNAR || !hdr->count || hdr->count > ACQ_BLOCK_RECORDS ||
+        hdr->size > size) {
+        return(-1);
+    }
+    end = blk + hdr->size;
+
+    rec[0].timestamp = hdr->first_ts;
+    for(int i = 1; i < hdr->count; i++) {
+        if((p = acq_col_get(p, end, &v)) == NULL) {
+            return(-1);
+        }
+        delta += acq_col_unzigzag(v);
+        rec[i].timestamp = rec[i - 1].timestamp + delta;
+    }
+
+    for(int f = 0; f < ACQ_COL_FIELDS; f++) {
+        uint32_t prev = 0;
+
+        for(int i = 0; i < hdr->count; i++) {
+            if((p = acq_col_get(p, end, &v)) == NULL) {
+                return(-1);
+            }
+            prev += (uint32_t)acq_col_unzigzag(v);
+            acq_col_store(&rec[i], f, prev);
+        }
+    }
+
+    return((p == end) ? hdr->count : -1);
+}
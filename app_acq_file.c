@@ -1,30 +1,1413 @@
 /**
  *          THE BeeInformed Team
- *  @file app_acq_file.h
- *  @brief beeinformed acquisition file definitions 
+ *  @file app_acq_file.c
+ *  @brief beeinformed acquisition file, append only records written
+ *         in blocks and synced in groups
  */
 
- #include "beeinformed_gateway.h"
+#include "beeinformed_gateway.h"
 
 
- /** static variables */
+/** tiers rebuilt from the data at startup, per tier buckets in the order
+ *  the files were read */
+typedef struct {
+    acq_rollup_t *b[k_acq_rollup_tiers];
+    size_t count[k_acq_rollup_tiers];
+    size_t cap[k_acq_rollup_tiers];
+    bool failed;
+}acq_rollup_rebuild_t;
 
 
- /** static functions */
+/** static variables */
+static pthread_t acq_flush_thread;
+static pthread_mutex_t acq_files_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t acq_flush_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t acq_files_idle_cond = PTHREAD_COND_INITIALIZER;
+static k_list_t acq_files = SYS_DLIST_STATIC_INIT(&acq_files);
+static bool acq_flush_should_run = false;
+static _Atomic uint32_t acq_commit_ms = ACQ_FILE_DEF_COMMIT_MS;
 
+static const uint32_t acq_rollup_period[k_acq_rollup_tiers] = { 60, 60 * 60, 24 * 60 * 60 };
+static const char *acq_rollup_ext[k_acq_rollup_tiers] = { ".r1m", ".r1h", ".r1d" };
 
- /** public functions */
-int acq_file_append_val(acqui_st_t *aq, FILE *f, uint32_t timestamp)
+
+/** static functions */
+
+/**
+ *  @fn acq_file_sidecar_path()
+ *  @brief path of a file kept next to the data, its extension replaced
+ *  @param
+ *  @return 0 on success, -1 if it does not fit, a cut name is another file
+ */
+static int acq_file_sidecar_path(const char *path, const char *ext, char *out, size_t size)
 {
-    int ret = 0;
+    size_t len = strlen(path);
+    const char *dot = strrchr(path, '.');
 
-    return(ret);
+    if(dot != NULL && strchr(dot, '/') == NULL) {
+        len = dot - path;
+    }
+    if(len + strlen(ext) >= size) {
+        return(-1);
+    }
+    memcpy(out, path, len);
+    strcpy(out + len, ext);
+    return(0);
+}
+
+/**
+ *  @fn acq_rollup_reading()
+ *  @brief accounts a reading in a bucket
+ *  @param
+ *  @return
+ */
+static void acq_rollup_reading(acq_rollup_t *b, uint32_t start, const acqui_st_t *v)
+{
+    acq_rollup_t one;
+
+    one.start = start;
+    one.count = 1;
+    one.min = *v;
+    one.max = *v;
+    one.sum[0] = v->temperature;
+    one.sum[1] = v->pressure;
+    one.sum[2] = v->luminosity;
+    one.sum[3] = v->humidity;
+    acq_rollup_merge(b, &one);
+}
+
+/**
+ *  @fn acq_rollup_add()
+ *  @brief accounts a reading in the open bucket of a tier, with file locked
+ *  @param
+ *  @return
+ */
+static void acq_rollup_add(acq_rollup_file_t *t, uint32_t period, uint32_t timestamp, const acqui_st_t *v)
+{
+    uint32_t start = timestamp - timestamp % period;
+    acq_rollup_t *b = &t->cur;
+
+    /* a clock stepping back keeps filling the open bucket */
+    if(b->count && start > b->start) {
+        t->done[t->done_count] = *b;
+        t->done_slot[t->done_count] = t->cur_slot;
+        t->done_count++;
+        t->cur_slot++;
+        b->count = 0;
+    }
+    acq_rollup_reading(b, start, v);
+}
+
+/**
+ *  @fn acq_rollup_full()
+ *  @brief checks if a tier can take no more closed buckets, with file locked
+ *  @param
+ *  @return
+ */
+static inline bool acq_rollup_full(acq_file_t *f)
+{
+    for(int i = 0; i < k_acq_rollup_tiers; i++) {
+        if(f->rollup[i].done_count == ACQ_ROLLUP_PENDING) {
+            return(true);
+        }
+    }
+    return(false);
+}
+
+/**
+ *  @fn acq_rollup_open()
+ *  @brief opens a tier and resumes its last bucket
+ *  @param
+ *  @return
+ */
+static int acq_rollup_open(acq_rollup_file_t *t, const char *path)
+{
+    off_t size;
+
+    t->fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(t->fd < 0) {
+        return(-1);
+    }
+
+    size = lseek(t->fd, 0, SEEK_END);
+    t->cur_slot = size / sizeof(acq_rollup_t);
+    if(t->cur_slot && pread(t->fd, &t->cur, sizeof(t->cur), (t->cur_slot - 1) * sizeof(acq_rollup_t)) == sizeof(t->cur)) {
+        /* the bucket may still be open, reconnecting within it extends it */
+        t->cur_slot--;
+    } else {
+        t->cur.count = 0;
+    }
+    return(0);
 }
 
-int acq_file_get_data(void *data, size_t size, uint32_t timestamp)
+/**
+ *  @fn acq_block_disk_size()
+ *  @brief on disk size of a block, from its header
+ *  @param left - bytes left in the file from the block
+ *  @return 0 if the header is not valid or the block does not fit
+ */
+static size_t acq_block_disk_size(const acq_block_hdr_t *hdr, uint64_t left)
 {
-    int ret = 0;
+    if(hdr->magic != ACQ_BLOCK_MAGIC || !hdr->count || hdr->count > ACQ_BLOCK_RECORDS) {
+        return(0);
+    }
+
+    if(hdr->version == ACQ_BLOCK_VERSION) {
+        if(hdr->size != ACQ_BLOCK_SIZE(hdr->count)) {
+            return(0);
+        }
+    } else if(hdr->version == ACQ_BLOCK_VERSION_COLUMNAR) {
+        if(hdr->size < sizeof(acq_block_hdr_t) + sizeof(acq_col_hdr_t) || hdr->size > ACQ_COL_MAX_SIZE(hdr->count)) {
+            return(0);
+        }
+    } else {
+        return(0);
+    }
+
+    return((hdr->size <= left) ? hdr->size : 0);
+}
+
+/**
+ *  @fn acq_block_check()
+ *  @brief reads a whole block and checks its header and crc
+ *  @param left - bytes left in the file from the block
+ *  @return disk size of the block, 0 if it is torn
+ */
+static size_t acq_block_check(int fd, uint8_t *blk, uint64_t off, uint64_t left)
+{
+    acq_block_hdr_t *hdr = (acq_block_hdr_t *)blk;
+    size_t size;
+
+    if(left < sizeof(acq_block_hdr_t) || pread(fd, hdr, sizeof(acq_block_hdr_t), off) != sizeof(acq_block_hdr_t)) {
+        return(0);
+    }
+    size = acq_block_disk_size(hdr, left);
+    if(!size || pread(fd, blk + sizeof(acq_block_hdr_t), size - sizeof(acq_block_hdr_t),
+        off + sizeof(acq_block_hdr_t)) != (ssize_t)(size - sizeof(acq_block_hdr_t))) {
+        return(0);
+    }
+    return((acq_block_crc(blk) == hdr->crc) ? size : 0);
+}
+
+/**
+ *  @fn acq_file_recover_fds()
+ *  @brief cuts data and index back to the last block that made it to disk
+ *
+ *  Writers append an index entry only once its block is synced, so the
+ *  last indexed block that checks out vouches for everything before it.
+ *  Whatever follows it is validated block by block and indexed, up to the
+ *  first torn one, where the data is cut.
+ *
+ *  @param end - receives the data size kept
+ *  @return number of bytes dropped, -1 on failure
+ */
+static int64_t acq_file_recover_fds(int fd, int idx_fd, uint64_t *end)
+{
+    uint8_t blk[ACQ_COL_MAX_SIZE(ACQ_BLOCK_RECORDS)];
+    acq_block_hdr_t *hdr = (acq_block_hdr_t *)blk;
+    acq_index_entry_t idx[64];
+    acq_index_entry_t e;
+    struct stat st;
+    off_t isize;
+    off_t chain = 0;
+    uint64_t off = 0;
+    size_t size;
+    ssize_t n;
+
+    if(fstat(fd, &st) < 0) {
+        return(-1);
+    }
+
+    /* entries must chain from the start of the data and fit in it, the
+     * first one that does not ends what the index can be trusted for */
+    isize = lseek(idx_fd, 0, SEEK_END);
+    isize -= isize % sizeof(e);
+    while(chain < isize) {
+        n = pread(idx_fd, idx, sizeof(idx), chain);
+        if(n < (ssize_t)sizeof(e)) {
+            return(-1);
+        }
+        for(int i = 0; i < n / (ssize_t)sizeof(e) && chain < isize; i++) {
+            if(idx[i].offset != off || !idx[i].size || off + idx[i].size > (uint64_t)st.st_size) {
+                isize = chain;
+                break;
+            }
+            off += idx[i].size;
+            chain += sizeof(e);
+        }
+    }
+
+    /* only unsynced blocks can be torn, normally the last entry checks out */
+    off = 0;
+    while(isize > 0) {
+        if(pread(idx_fd, &e, sizeof(e), isize - sizeof(e)) != sizeof(e)) {
+            return(-1);
+        }
+        if(acq_block_check(fd, blk, e.offset, e.size) == e.size) {
+            off = e.offset + e.size;
+            break;
+        }
+        isize -= sizeof(e);
+    }
+    if(ftruncate(idx_fd, isize) < 0) {
+        return(-1);
+    }
+
+    /* blocks past the index were never vouched for, each one is checked */
+    while((size = acq_block_check(fd, blk, off, st.st_size - off)) != 0) {
+        e.offset = off;
+        e.first_ts = hdr->first_ts;
+        e.last_ts = hdr->last_ts;
+        e.count = hdr->count;
+        e.size = size;
+        if(pwrite(idx_fd, &e, sizeof(e), isize) != sizeof(e)) {
+            return(-1);
+        }
+        isize += sizeof(e);
+        off += size;
+    }
+
+    if((uint64_t)st.st_size != off && ftruncate(fd, off) < 0) {
+        return(-1);
+    }
+
+    *end = off;
+    return(st.st_size - off);
+}
+
+/**
+ *  @fn acq_file_index_repair()
+ *  @brief brings data and index of a writer back in line after a crash
+ *  @param
+ *  @return
+ */
+static int acq_file_index_repair(acq_file_t *f)
+{
+    int64_t dropped = acq_file_recover_fds(f->fd, f->idx_fd, &f->offset);
+    acq_index_entry_t e;
+    off_t isize;
+
+    if(dropped > 0) {
+        fprintf(stderr, "ERROR: Dropped %lld bytes of torn acquisition data.\n", (long long)dropped);
+    }
+    if(dropped < 0) {
+        return(-1);
+    }
+
+    /* the time range of the live file decides when it rotates */
+    isize = lseek(f->idx_fd, 0, SEEK_END);
+    if(isize >= (off_t)sizeof(e)) {
+        if(pread(f->idx_fd, &e, sizeof(e), 0) == sizeof(e)) {
+            f->seg_first = e.first_ts;
+        }
+        if(pread(f->idx_fd, &e, sizeof(e), isize - sizeof(e)) == sizeof(e)) {
+            f->seg_last = e.last_ts;
+        }
+    }
+    return(0);
+}
+
+/**
+ *  @fn acq_file_sync()
+ *  @brief syncs the data written so far and only then indexes it, with
+ *         io locked
+ *  @param
+ *  @return
+ */
+static void acq_file_sync(acq_file_t *f)
+{
+    ssize_t size = f->pending_count * sizeof(acq_index_entry_t);
+
+    if(!f->pending_count) {
+        return;
+    }
 
+    /* a failed sync keeps the entries, recovery indexes the blocks anyway */
+    if(fdatasync(f->fd) < 0) {
+        fprintf(stderr, "ERROR: Failed to sync acquisition file %s.\n", f->path);
+        return;
+    }
+    if(write(f->idx_fd, f->pending, size) != size) {
+        fprintf(stderr, "ERROR: Failed to write acquisition index.\n");
+    }
+    f->pending_count = 0;
+
+    pthread_mutex_lock(&f->lock);
+    f->stats.syncs++;
+    pthread_mutex_unlock(&f->lock);
+}
+
+/**
+ *  @fn acq_file_rotate()
+ *  @brief turns the live file into a segment and starts a new one, with
+ *         io locked
+ *  @param
+ *  @return
+ */
+static int acq_file_rotate(acq_file_t *f)
+{
+    char seg_path[MAX_PATH_SIZE];
+    char idx_path[MAX_PATH_SIZE];
+    char seg_idx_path[MAX_PATH_SIZE];
+    const char *base = strrchr(f->path, '/');
+    int dir_len = (base != NULL) ? base - f->path + 1 : 0;
+
+    if(snprintf(seg_path, sizeof(seg_path), "%.*s" ACQ_SEGMENT_FMT ".dat", dir_len, f->path,
+        f->seg_first, f->seg_last) >= (int)sizeof(seg_path) ||
+        acq_file_sidecar_path(seg_path, ".idx", seg_idx_path, sizeof(seg_idx_path)) < 0 ||
+        acq_file_sidecar_path(f->path, ".idx", idx_path, sizeof(idx_path)) < 0) {
+        fprintf(stderr, "ERROR: Segment path of acquisition file %s is too long.\n", f->path);
+        return(-1);
+    }
+
+    /* segments are immutable, so they are made durable once here; data
+     * moves first, a segment without index is still readable */
+    acq_file_sync(f);
+    fdatasync(f->idx_fd);
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        fdatasync(f->rollup[t].fd);
+    }
+    if(rename(f->path, seg_path) < 0 || rename(idx_path, seg_idx_path) < 0) {
+        fprintf(stderr, "ERROR: Failed to rotate acquisition file %s.\n", f->path);
+        return(-1);
+    }
+    close(f->fd);
+    close(f->idx_fd);
+
+    f->fd = open(f->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    f->idx_fd = open(idx_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    f->offset = 0;
+    f->stats.segments++;
+    if(f->fd < 0 || f->idx_fd < 0) {
+        fprintf(stderr, "ERROR: Failed to reopen acquisition file %s.\n", f->path);
+        return(-1);
+    }
+    return(0);
+}
+
+/**
+ *  @fn acq_file_write()
+ *  @brief writes the sealed blocks of a file with a single call
+ *  @param partial - also seals and writes the block being filled
+ *  @return bytes written, -1 on failure
+ */
+static ssize_t acq_file_write(acq_file_t *f, bool partial)
+{
+    struct iovec iov[ACQ_FILE_BLOCKS];
+    acq_block_t *blocks[ACQ_FILE_BLOCKS];
+    acq_index_entry_t idx[ACQ_FILE_BLOCKS];
+    acq_rollup_t rollup[k_acq_rollup_tiers][ACQ_ROLLUP_PENDING + 1];
+    uint32_t slot[k_acq_rollup_tiers][ACQ_ROLLUP_PENDING + 1];
+    int rollups[k_acq_rollup_tiers];
+    k_list_t *node;
+    ssize_t total = 0;
+    ssize_t ret = 0;
+    int n = 0;
+    int i = 0;
+
+    /* io lock is kept until the blocks are back on the free list, so an
+     * append waiting on it always finds a block to fill afterwards */
+    pthread_mutex_lock(&f->io_lock);
+
+    pthread_mutex_lock(&f->lock);
+    if(partial && f->filling != NULL && f->filling->hdr.count) {
+        sys_dlist_append(&f->sealed, &f->filling->link);
+        f->filling = NULL;
+    }
+    while((node = sys_dlist_get(&f->sealed)) != NULL) {
+        blocks[n] = CONTAINER_OF(node, acq_block_t, link);
+        n++;
+    }
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        acq_rollup_file_t *r = &f->rollup[t];
+
+        rollups[t] = r->done_count;
+        memcpy(rollup[t], r->done, r->done_count * sizeof(acq_rollup_t));
+        memcpy(slot[t], r->done_slot, r->done_count * sizeof(uint32_t));
+        r->done_count = 0;
+
+        /* readers see the open bucket as of the last commit */
+        if(partial && r->cur.count) {
+            rollup[t][rollups[t]] = r->cur;
+            slot[t][rollups[t]] = r->cur_slot;
+            rollups[t]++;
+        }
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    /* rollups are only synced at rotation, startup rebuilds the day of the
+     * live file from the data */
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        for(int j = 0; j < rollups[t]; j++) {
+            if(pwrite(f->rollup[t].fd, &rollup[t][j], sizeof(acq_rollup_t),
+                (off_t)slot[t][j] * sizeof(acq_rollup_t)) != sizeof(acq_rollup_t)) {
+                fprintf(stderr, "ERROR: Failed to write acquisition rollup.\n");
+            }
+        }
+    }
+
+    if(!n) {
+        goto cleanup;
+    }
+
+    if(f->offset && (blocks[0]->hdr.first_ts / ACQ_SEGMENT_PERIOD != f->seg_first / ACQ_SEGMENT_PERIOD ||
+        f->offset >= ACQ_SEGMENT_MAX_SIZE)) {
+        /* on failure the blocks still go wherever the live file is */
+        acq_file_rotate(f);
+    }
+    if(!f->offset) {
+        f->seg_first = blocks[0]->hdr.first_ts;
+    }
+
+    for(int j = 0; j < n; j++) {
+        if(f->format == k_acq_format_columnar) {
+            iov[j].iov_base = f->enc + j * ACQ_COL_MAX_SIZE(ACQ_BLOCK_RECORDS);
+            iov[j].iov_len = acq_col_encode(blocks[j]->rec, blocks[j]->hdr.count, iov[j].iov_base);
+        } else {
+            blocks[j]->hdr.size = ACQ_BLOCK_SIZE(blocks[j]->hdr.count);
+            iov[j].iov_base = &blocks[j]->hdr;
+            iov[j].iov_len = blocks[j]->hdr.size;
+        }
+        ((acq_block_hdr_t *)iov[j].iov_base)->crc = acq_block_crc(iov[j].iov_base);
+        idx[j].offset = f->offset + total;
+        idx[j].first_ts = blocks[j]->hdr.first_ts;
+        idx[j].last_ts = blocks[j]->hdr.last_ts;
+        idx[j].count = blocks[j]->hdr.count;
+        idx[j].size = iov[j].iov_len;
+        total += iov[j].iov_len;
+    }
+
+    /* O_APPEND keeps every block contiguous, short writes just resume */
+    while(i < n) {
+        ret = writev(f->fd, &iov[i], n - i);
+        if(ret < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: Failed to write acquisition blocks.\n");
+            break;
+        }
+        while(i < n && (size_t)ret >= iov[i].iov_len) {
+            ret -= iov[i].iov_len;
+            i++;
+        }
+        if(i < n) {
+            iov[i].iov_base = (uint8_t *)iov[i].iov_base + ret;
+            iov[i].iov_len -= ret;
+        }
+    }
+
+    /* the index waits for the next sync of the data, a crash in between
+     * is fixed on open */
+    if(i == n) {
+        f->offset += total;
+        f->seg_last = blocks[n - 1]->hdr.last_ts;
+        if(f->pending_count + n > ACQ_FILE_PENDING) {
+            acq_file_sync(f);
+        }
+        if(f->pending_count + n <= ACQ_FILE_PENDING) {
+            memcpy(&f->pending[f->pending_count], idx, n * sizeof(idx[0]));
+            f->pending_count += n;
+        }
+    }
+
+    pthread_mutex_lock(&f->lock);
+    for(int j = 0; j < n; j++) {
+        sys_dlist_append(&f->free, &blocks[j]->link);
+    }
+    if(i == n) {
+        f->stats.blocks += n;
+        f->stats.bytes += total;
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    ret = (i == n) ? total : -1;
+
+cleanup:
+    pthread_mutex_unlock(&f->io_lock);
     return(ret);
 }
- 
+
+/**
+ *  @fn acq_file_release()
+ *  @brief closes whatever a writer has open and frees it
+ *  @param
+ *  @return
+ */
+static void acq_file_release(acq_file_t *f)
+{
+    if(f->fd >= 0) {
+        close(f->fd);
+    }
+    if(f->idx_fd >= 0) {
+        close(f->idx_fd);
+    }
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        if(f->rollup[t].fd >= 0) {
+            close(f->rollup[t].fd);
+        }
+    }
+    free(f->enc);
+    free(f);
+}
+
+/**
+ *  @fn acq_file_commit()
+ *  @brief writes every open file and syncs the ones that changed, with
+ *         files list locked
+ *
+ *  The list lock is dropped around the io of each file, so devices
+ *  opening or closing their files wait for one file at most, not for the
+ *  whole group. The file worked on holds a reference, which keeps it on
+ *  the list until it is done.
+ *
+ *  @param
+ *  @return
+ */
+static void acq_file_commit(void)
+{
+    k_list_t *node = sys_dlist_peek_head(&acq_files);
+    acq_file_t *f;
+
+    while(node != NULL) {
+        f = CONTAINER_OF(node, acq_file_t, link);
+        f->refs++;
+        pthread_mutex_unlock(&acq_files_mutex);
+
+        acq_file_write(f, true);
+        pthread_mutex_lock(&f->io_lock);
+        acq_file_sync(f);
+        pthread_mutex_unlock(&f->io_lock);
+
+        pthread_mutex_lock(&acq_files_mutex);
+        node = sys_dlist_peek_next(&acq_files, node);
+        if(!--f->refs) {
+            pthread_cond_broadcast(&acq_files_idle_cond);
+        }
+    }
+}
+
+/**
+ *  @fn acq_file_flush_thread()
+ *  @brief group commit thread
+ *  @param
+ *  @return
+ */
+static void *acq_file_flush_thread(void *args)
+{
+    struct timespec ts;
+    uint32_t ms;
+
+    (void)args;
+
+    pthread_mutex_lock(&acq_files_mutex);
+    while(acq_flush_should_run) {
+        ms = atomic_load_explicit(&acq_commit_ms, memory_order_relaxed);
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_sec += ms / 1000;
+        ts.tv_nsec += (ms % 1000) * 1000000L;
+        if(ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        /* woken early only when a file ran out of free blocks */
+        pthread_cond_timedwait(&acq_flush_cond, &acq_files_mutex, &ts);
+        acq_file_commit();
+    }
+    pthread_mutex_unlock(&acq_files_mutex);
+
+    return(NULL);
+}
+
+/**
+ *  @fn acq_file_get_first()
+ *  @brief scan callback keeping the first record only
+ *  @param
+ *  @return
+ */
+static bool acq_file_get_first(const acq_record_t *rec, size_t count, void *arg)
+{
+    (void)count;
+    memcpy(arg, rec, sizeof(acq_record_t));
+    return(false);
+}
+
+
+/**
+ *  @fn acq_rollup_rebuild_cb()
+ *  @brief scan callback accounting records in the rebuilt tiers
+ *  @param
+ *  @return
+ */
+static bool acq_rollup_rebuild_cb(const acq_record_t *rec, size_t count, void *arg)
+{
+    acq_rollup_rebuild_t *rb = arg;
+    acq_rollup_t *grown;
+    acqui_st_t v;
+    uint32_t start;
+    size_t n;
+
+    for(size_t i = 0; i < count && !rb->failed; i++) {
+        v = rec[i].val;
+        for(int t = 0; t < k_acq_rollup_tiers; t++) {
+            start = rec[i].timestamp - rec[i].timestamp % acq_rollup_period[t];
+            n = rb->count[t];
+            if(!n || rb->b[t][n - 1].start != start) {
+                if(n == rb->cap[t]) {
+                    rb->cap[t] = rb->cap[t] ? rb->cap[t] * 2 : 64;
+                    grown = realloc(rb->b[t], rb->cap[t] * sizeof(acq_rollup_t));
+                    if(grown == NULL) {
+                        rb->failed = true;
+                        break;
+                    }
+                    rb->b[t] = grown;
+                }
+                rb->b[t][n].count = 0;
+                rb->count[t] = ++n;
+            }
+            acq_rollup_reading(&rb->b[t][n - 1], start, &v);
+        }
+    }
+    return(!rb->failed);
+}
+
+/**
+ *  @fn acq_rollup_cmp()
+ *  @brief orders buckets by time
+ *  @param
+ *  @return
+ */
+static int acq_rollup_cmp(const void *a, const void *b)
+{
+    const acq_rollup_t *ba = a;
+    const acq_rollup_t *bb = b;
+
+    return((ba->start > bb->start) - (ba->start < bb->start));
+}
+
+/**
+ *  @fn acq_rollup_rebuild_scan()
+ *  @brief accounts the records of a data file from a time on
+ *  @param
+ *  @return
+ */
+static void acq_rollup_rebuild_scan(acq_rollup_rebuild_t *rb, const char *path, uint32_t from)
+{
+    acq_reader_t *r = acq_reader_open(path);
+
+    if(r == NULL) {
+        rb->failed = true;
+        return;
+    }
+    acq_file_scan(r, from, UINT32_MAX, acq_rollup_rebuild_cb, rb);
+    acq_reader_close(r);
+}
+
+/**
+ *  @fn acq_rollup_rebuild()
+ *  @brief rewrites the buckets of every tier from the day of the live file
+ *         on, out of the data that survived recovery
+ *
+ *  Tiers are synced only when the live file rotates, so a crash can leave
+ *  them behind the data, ahead of it, or torn. The day of the live file
+ *  covers every bucket written since, it is rebuilt from that day's
+ *  segments and the live file, and buckets past the last intact block go.
+ *
+ *  @param path - live data file, already recovered
+ *  @return number of tiers rewritten, -1 on failure
+ */
+static int acq_rollup_rebuild(const char *path)
+{
+    char dir[MAX_PATH_SIZE];
+    char side_path[MAX_PATH_SIZE + NAME_MAX + 1];
+    const char *base = strrchr(path, '/');
+    acq_rollup_rebuild_t rb;
+    acq_rollup_t *old;
+    acq_reader_t *r;
+    struct dirent *de;
+    struct stat st;
+    uint32_t first, last;
+    uint32_t from = 0;
+    size_t slot, slots;
+    size_t n;
+    bool found = false;
+    bool same;
+    int fixed = 0;
+    int len;
+    int fd;
+    DIR *d;
+
+    memset(&rb, 0, sizeof(rb));
+    snprintf(dir, sizeof(dir), "%.*s", (base != NULL) ? (int)(base - path) : 1, (base != NULL) ? path : ".");
+    d = opendir(dir);
+    if(d == NULL) {
+        return(-1);
+    }
+
+    /* the day of the live file, or of the last segment when it is empty */
+    r = acq_reader_open(path);
+    if(r != NULL && r->blocks) {
+        from = r->idx[0].first_ts;
+        found = true;
+    }
+    acq_reader_close(r);
+    while(!found && (de = readdir(d)) != NULL) {
+        len = 0;
+        if(sscanf(de->d_name, ACQ_SEGMENT_SCAN, &first, &last, &len) == 2 && !de->d_name[len] && last >= from) {
+            from = last;
+        }
+    }
+    rewinddir(d);
+    from -= from % ACQ_SEGMENT_PERIOD;
+
+    /* segments of the same day were rotated out by size */
+    while((de = readdir(d)) != NULL) {
+        len = 0;
+        if(sscanf(de->d_name, ACQ_SEGMENT_SCAN, &first, &last, &len) == 2 && !de->d_name[len] && last >= from) {
+            snprintf(side_path, sizeof(side_path), "%s/%s", dir, de->d_name);
+            acq_rollup_rebuild_scan(&rb, side_path, from);
+            found = true;
+        }
+    }
+    closedir(d);
+
+    /* no data at all, the tiers are all the history left */
+    if(!found) {
+        return(0);
+    }
+    acq_rollup_rebuild_scan(&rb, path, from);
+    if(rb.failed) {
+        fixed = -1;
+        goto cleanup;
+    }
+
+    for(int t = 0; t < k_acq_rollup_tiers && fixed >= 0; t++) {
+        /* files are read in any order, a bucket cut across two merges */
+        n = 0;
+        if(rb.count[t]) {
+            qsort(rb.b[t], rb.count[t], sizeof(acq_rollup_t), acq_rollup_cmp);
+            for(size_t i = 1; i < rb.count[t]; i++) {
+                if(rb.b[t][i].start == rb.b[t][n].start) {
+                    acq_rollup_merge(&rb.b[t][n], &rb.b[t][i]);
+                } else {
+                    rb.b[t][++n] = rb.b[t][i];
+                }
+            }
+            n++;
+        }
+
+        fd = (acq_file_sidecar_path(path, acq_rollup_ext[t], side_path, sizeof(side_path)) == 0) ?
+            open(side_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+        if(fd < 0 || fstat(fd, &st) < 0) {
+            fixed = -1;
+            goto next;
+        }
+
+        /* buckets of earlier days stay, from the last one of them on the
+         * tier has to read exactly as rebuilt */
+        slots = st.st_size / sizeof(acq_rollup_t);
+        old = (slots) ? mmap(NULL, slots * sizeof(acq_rollup_t), PROT_READ, MAP_SHARED, fd, 0) : NULL;
+        if(old == MAP_FAILED) {
+            fixed = -1;
+            goto next;
+        }
+        for(slot = slots; slot > 0 && (!old[slot - 1].count || old[slot - 1].start >= from); slot--) {
+        }
+        same = slots - slot == n && st.st_size % sizeof(acq_rollup_t) == 0 &&
+            (!n || !memcmp(&old[slot], rb.b[t], n * sizeof(acq_rollup_t)));
+        if(old != NULL) {
+            munmap(old, slots * sizeof(acq_rollup_t));
+        }
+        if(same) {
+            goto next;
+        }
+
+        if(pwrite(fd, rb.b[t], n * sizeof(acq_rollup_t), slot * sizeof(acq_rollup_t)) != (ssize_t)(n * sizeof(acq_rollup_t)) ||
+            ftruncate(fd, (slot + n) * sizeof(acq_rollup_t)) < 0 || fdatasync(fd) < 0) {
+            fixed = -1;
+            goto next;
+        }
+        fixed++;
+
+next:
+        if(fd >= 0) {
+            close(fd);
+        }
+    }
+
+cleanup:
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        free(rb.b[t]);
+    }
+    return(fixed);
+}
+
+/** public functions */
+int acq_file_start(void)
+{
+    acq_flush_should_run = true;
+    if(pthread_create(&acq_flush_thread, NULL, acq_file_flush_thread, NULL)) {
+        acq_flush_should_run = false;
+        fprintf(stderr, "ERROR: Failed to start the acquisition file commit thread.\n");
+        return(-1);
+    }
+    return(0);
+}
+
+void acq_file_finish(void)
+{
+    pthread_mutex_lock(&acq_files_mutex);
+    if(!acq_flush_should_run) {
+        pthread_mutex_unlock(&acq_files_mutex);
+        return;
+    }
+    acq_flush_should_run = false;
+    pthread_cond_signal(&acq_flush_cond);
+    pthread_mutex_unlock(&acq_files_mutex);
+
+    pthread_join(acq_flush_thread, NULL);
+}
+
+void acq_file_set_commit_interval(uint32_t ms)
+{
+    atomic_store_explicit(&acq_commit_ms, ms ? ms : 1, memory_order_relaxed);
+}
+
+acq_file_t *acq_file_open(const char *path, acq_file_format_t format)
+{
+    char side_path[MAX_PATH_SIZE];
+    acq_file_t *f;
+
+    assert(path != NULL);
+
+    f = calloc(1, sizeof(acq_file_t));
+    if(f == NULL) {
+        return(NULL);
+    }
+
+    f->fd = -1;
+    f->idx_fd = -1;
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        f->rollup[t].fd = -1;
+    }
+    if(snprintf(f->path, sizeof(f->path), "%s", path) >= (int)sizeof(f->path)) {
+        goto cleanup;
+    }
+
+    f->format = format;
+    if(format == k_acq_format_columnar) {
+        f->enc = malloc(ACQ_FILE_BLOCKS * ACQ_COL_MAX_SIZE(ACQ_BLOCK_RECORDS));
+        if(f->enc == NULL) {
+            goto cleanup;
+        }
+    }
+
+    if(acq_file_sidecar_path(path, ".idx", side_path, sizeof(side_path)) < 0) {
+        goto cleanup;
+    }
+    f->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    f->idx_fd = open(side_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(f->fd < 0 || f->idx_fd < 0 || acq_file_index_repair(f) < 0) {
+        goto cleanup;
+    }
+    f->last_ts = f->seg_last;
+
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        if(acq_file_sidecar_path(path, acq_rollup_ext[t], side_path, sizeof(side_path)) < 0 ||
+            acq_rollup_open(&f->rollup[t], side_path) < 0) {
+            goto cleanup;
+        }
+    }
+
+    pthread_mutex_init(&f->lock, NULL);
+    pthread_mutex_init(&f->io_lock, NULL);
+    sys_dlist_init(&f->sealed);
+    sys_dlist_init(&f->free);
+    for(int i = 0; i < ACQ_FILE_BLOCKS; i++) {
+        f->blocks[i].hdr.magic = ACQ_BLOCK_MAGIC;
+        f->blocks[i].hdr.version = ACQ_BLOCK_VERSION;
+        sys_dlist_append(&f->free, &f->blocks[i].link);
+    }
+
+    pthread_mutex_lock(&acq_files_mutex);
+    sys_dlist_append(&acq_files, &f->link);
+    pthread_mutex_unlock(&acq_files_mutex);
+
+    return(f);
+
+cleanup:
+    fprintf(stderr, "ERROR: Failed to open acquisition file %s.\n", path);
+    acq_file_release(f);
+    return(NULL);
+}
+
+void acq_file_close(acq_file_t *f, acq_file_stats_t *s)
+{
+    if(f == NULL) {
+        return;
+    }
+
+    /* a commit working on the file finishes it first, the others skip it */
+    pthread_mutex_lock(&acq_files_mutex);
+    while(f->refs) {
+        pthread_cond_wait(&acq_files_idle_cond, &acq_files_mutex);
+    }
+    sys_dlist_remove(&f->link);
+    pthread_mutex_unlock(&acq_files_mutex);
+
+    acq_file_write(f, true);
+    pthread_mutex_lock(&f->io_lock);
+    acq_file_sync(f);
+    pthread_mutex_unlock(&f->io_lock);
+
+    if(s != NULL) {
+        *s = f->stats;
+    }
+
+    pthread_mutex_destroy(&f->lock);
+    pthread_mutex_destroy(&f->io_lock);
+    acq_file_release(f);
+}
+
+void acq_file_get_stats(acq_file_t *f, acq_file_stats_t *s)
+{
+    assert(f != NULL && s != NULL);
+
+    pthread_mutex_lock(&f->lock);
+    *s = f->stats;
+    pthread_mutex_unlock(&f->lock);
+}
+
+int acq_file_append_val(acqui_st_t *aq, acq_file_t *f, uint32_t timestamp)
+{
+    acq_block_t *b;
+    k_list_t *node;
+    bool kick = false;
+
+    assert(aq != NULL && f != NULL);
+
+    pthread_mutex_lock(&f->lock);
+    while(f->filling == NULL || acq_rollup_full(f)) {
+        node = (f->filling == NULL) ? sys_dlist_get(&f->free) : NULL;
+        if(node != NULL) {
+            f->filling = CONTAINER_OF(node, acq_block_t, link);
+            f->filling->hdr.count = 0;
+            continue;
+        }
+
+        /* everything buffered is waiting for the disk, write it from here */
+        f->stats.stalls++;
+        pthread_mutex_unlock(&f->lock);
+        if(acq_file_write(f, false) < 0) {
+            return(-1);
+        }
+        pthread_mutex_lock(&f->lock);
+    }
+
+    /* lookups bisect on time, a reading stamped before the last one, as
+     * when the first gps fix sets the clock back, joins it instead */
+    timestamp = (timestamp < f->last_ts) ? f->last_ts : timestamp;
+    f->last_ts = timestamp;
+
+    b = f->filling;
+    if(!b->hdr.count) {
+        b->hdr.first_ts = timestamp;
+    }
+    b->hdr.last_ts = timestamp;
+    b->rec[b->hdr.count].timestamp = timestamp;
+    b->rec[b->hdr.count].val = *aq;
+    b->hdr.count++;
+    f->stats.records++;
+
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        acq_rollup_add(&f->rollup[t], acq_rollup_period[t], timestamp, aq);
+    }
+
+    if(b->hdr.count == ACQ_BLOCK_RECORDS) {
+        sys_dlist_append(&f->sealed, &b->link);
+        f->filling = NULL;
+        kick = sys_dlist_is_empty(&f->free);
+    }
+    pthread_mutex_unlock(&f->lock);
+
+    if(kick) {
+        pthread_cond_signal(&acq_flush_cond);
+    }
+
+    return(0);
+}
+
+uint32_t acq_block_crc(const uint8_t *blk)
+{
+    const acq_block_hdr_t *hdr = (const acq_block_hdr_t *)blk;
+    uint32_t crc = crc32c(0, blk, offsetof(acq_block_hdr_t, crc));
+
+    return(crc32c(crc, blk + sizeof(acq_block_hdr_t), hdr->size - sizeof(acq_block_hdr_t)));
+}
+
+int acq_file_recover(const char *root)
+{
+    char path[MAX_PATH_SIZE];
+    char idx_path[MAX_PATH_SIZE];
+    struct timespec t0, t1;
+    struct dirent *de;
+    uint64_t kept = 0;
+    uint64_t end;
+    int64_t dropped;
+    int files = 0;
+    int tiers;
+    int fd, idx_fd;
+    DIR *dir;
+
+    assert(root != NULL);
+
+    dir = opendir(root);
+    if(dir == NULL) {
+        return(-1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while((de = readdir(dir)) != NULL) {
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s/%s", root, de->d_name, ACQ_FILE_NAME);
+        fd = open(path, O_RDWR | O_CLOEXEC);
+        if(fd < 0) {
+            continue;
+        }
+        idx_fd = (acq_file_sidecar_path(path, ".idx", idx_path, sizeof(idx_path)) == 0) ?
+            open(idx_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644) : -1;
+        dropped = -1;
+        if(idx_fd >= 0) {
+            dropped = acq_file_recover_fds(fd, idx_fd, &end);
+            if(dropped > 0) {
+                printf("%s: %s dropped %lld torn bytes \n\r", __func__, path, (long long)dropped);
+            }
+            if(dropped >= 0) {
+                kept += end;
+                files++;
+            }
+            close(idx_fd);
+        }
+        close(fd);
+
+        /* the tiers follow whatever data recovery kept */
+        tiers = (dropped >= 0) ? acq_rollup_rebuild(path) : 0;
+        if(tiers > 0) {
+            printf("%s: %s rebuilt %d rollup tiers \n\r", __func__, path, tiers);
+        }
+    }
+    closedir(dir);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+
+    printf("%s: %d acquisition files, %llu MiB checked in %.1f ms \n\r", __func__, files,
+        (unsigned long long)(kept >> 20), (t1.tv_sec - t0.tv_sec) * 1e3 + (t1.tv_nsec - t0.tv_nsec) / 1e6);
+    return(files);
+}
+
+acq_reader_t *acq_reader_open(const char *path)
+{
+    char idx_path[MAX_PATH_SIZE];
+    const acq_block_hdr_t *hdr;
+    acq_reader_t *r;
+    struct stat st;
+    uint64_t off = 0;
+    size_t size;
+    size_t cap;
+    int fd = -1;
+    int idx_fd = -1;
+
+    assert(path != NULL);
+
+    r = calloc(1, sizeof(acq_reader_t));
+    if(r == NULL) {
+        return(NULL);
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        goto cleanup;
+    }
+    r->dev = st.st_dev;
+    r->ino = st.st_ino;
+    r->size = st.st_size;
+    if(r->size) {
+        r->base = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+        if(r->base == MAP_FAILED) {
+            r->base = NULL;
+            goto cleanup;
+        }
+        madvise((void *)r->base, r->size, MADV_RANDOM);
+    }
+
+    /* the whole index is a few bytes per block, load it at once */
+    if(acq_file_sidecar_path(path, ".idx", idx_path, sizeof(idx_path)) < 0) {
+        goto cleanup;
+    }
+    idx_fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+    if(idx_fd >= 0 && fstat(idx_fd, &st) == 0) {
+        cap = st.st_size / sizeof(acq_index_entry_t);
+        r->idx = malloc((cap + 16) * sizeof(acq_index_entry_t));
+        if(r->idx == NULL) {
+            goto cleanup;
+        }
+        if(cap && pread(idx_fd, r->idx, cap * sizeof(acq_index_entry_t), 0) != (ssize_t)(cap * sizeof(acq_index_entry_t))) {
+            cap = 0;
+        }
+        while(r->blocks < cap && r->idx[r->blocks].offset + r->idx[r->blocks].size <= r->size) {
+            r->blocks++;
+        }
+        cap += 16;
+    } else {
+        cap = 16;
+        r->idx = malloc(cap * sizeof(acq_index_entry_t));
+        if(r->idx == NULL) {
+            goto cleanup;
+        }
+    }
+
+    if(r->blocks) {
+        off = r->idx[r->blocks - 1].offset + r->idx[r->blocks - 1].size;
+    }
+
+    /* a writer may be ahead of its index, only that tail is walked */
+    while(off < r->size) {
+        hdr = (const acq_block_hdr_t *)(r->base + off);
+        size = (off + sizeof(acq_block_hdr_t) <= r->size) ? acq_block_disk_size(hdr, r->size - off) : 0;
+        if(!size) {
+            break;
+        }
+        if(r->blocks == cap) {
+            acq_index_entry_t *idx = realloc(r->idx, 2 * cap * sizeof(acq_index_entry_t));
+            if(idx == NULL) {
+                break;
+            }
+            r->idx = idx;
+            cap *= 2;
+        }
+        r->idx[r->blocks].offset = off;
+        r->idx[r->blocks].first_ts = hdr->first_ts;
+        r->idx[r->blocks].last_ts = hdr->last_ts;
+        r->idx[r->blocks].count = hdr->count;
+        r->idx[r->blocks].size = size;
+        r->blocks++;
+        off += size;
+    }
+
+    /* tiers are optional, a missing one just answers nothing */
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        int tier_fd;
+
+        if(acq_file_sidecar_path(path, acq_rollup_ext[t], idx_path, sizeof(idx_path)) < 0) {
+            goto cleanup;
+        }
+        tier_fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+        if(tier_fd < 0) {
+            continue;
+        }
+        if(fstat(tier_fd, &st) == 0 && st.st_size >= (off_t)sizeof(acq_rollup_t)) {
+            r->rollup[t] = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, tier_fd, 0);
+            if(r->rollup[t] == MAP_FAILED) {
+                r->rollup[t] = NULL;
+            } else {
+                r->rollups[t] = st.st_size / sizeof(acq_rollup_t);
+            }
+        }
+        close(tier_fd);
+    }
+
+    close(fd);
+    if(idx_fd >= 0) {
+        close(idx_fd);
+    }
+    return(r);
+
+cleanup:
+    if(fd >= 0) {
+        close(fd);
+    }
+    if(idx_fd >= 0) {
+        close(idx_fd);
+    }
+    acq_reader_close(r);
+    return(NULL);
+}
+
+void acq_reader_close(acq_reader_t *r)
+{
+    if(r == NULL) {
+        return;
+    }
+    if(r->base != NULL) {
+        munmap((void *)r->base, r->size);
+    }
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        if(r->rollup[t] != NULL) {
+            munmap((void *)r->rollup[t], r->rollups[t] * sizeof(acq_rollup_t));
+        }
+    }
+    free(r->idx);
+    free(r);
+}
+
+size_t acq_file_scan(acq_reader_t *r, uint32_t t0, uint32_t t1, acq_scan_cb_t cb, void *arg)
+{
+    acq_record_t dec[ACQ_BLOCK_RECORDS];
+    const acq_block_hdr_t *hdr;
+    const acq_record_t *rec;
+    size_t lo = 0;
+    size_t hi;
+    size_t total = 0;
+    size_t first;
+    size_t last;
+    size_t mid;
+
+    assert(r != NULL && cb != NULL);
+
+    /* first block that may hold t0, blocks are in time order */
+    hi = r->blocks;
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(r->idx[mid].last_ts < t0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    for(size_t b = lo; b < r->blocks && r->idx[b].first_ts <= t1; b++) {
+        hdr = (const acq_block_hdr_t *)(r->base + r->idx[b].offset);
+        if(hdr->version == ACQ_BLOCK_VERSION_COLUMNAR) {
+            /* only columnar blocks are copied, decoded on the stack */
+            if(acq_col_decode((const uint8_t *)hdr, r->idx[b].size, dec) != (int)r->idx[b].count) {
+                continue;
+            }
+            rec = dec;
+        } else {
+            rec = (const acq_record_t *)(r->base + r->idx[b].offset + sizeof(acq_block_hdr_t));
+        }
+
+        /* and inside it, the first and past the last record of the range */
+        first = 0;
+        hi = r->idx[b].count;
+        while(first < hi) {
+            mid = first + (hi - first) / 2;
+            if(rec[mid].timestamp < t0) {
+                first = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        last = first;
+        hi = r->idx[b].count;
+        while(last < hi) {
+            mid = last + (hi - last) / 2;
+            if(rec[mid].timestamp <= t1) {
+                last = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+
+        if(last > first) {
+            total += last - first;
+            if(!cb(&rec[first], last - first, arg)) {
+                break;
+            }
+        }
+    }
+
+    return(total);
+}
+
+size_t acq_file_scan_rollup(acq_reader_t *r, acq_rollup_tier_t tier, uint32_t t0, uint32_t t1,
+            acq_rollup_cb_t cb, void *arg)
+{
+    const acq_rollup_t *b;
+    size_t lo = 0;
+    size_t hi;
+    size_t end;
+    size_t mid;
+
+    assert(r != NULL && cb != NULL && tier < k_acq_rollup_tiers);
+
+    b = r->rollup[tier];
+    t0 -= t0 % acq_rollup_period[tier];
+
+    /* buckets are in time order, so only the range edges are searched */
+    hi = r->rollups[tier];
+    while(lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if(b[mid].start < t0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    end = lo;
+    hi = r->rollups[tier];
+    while(end < hi) {
+        mid = end + (hi - end) / 2;
+        if(b[mid].start <= t1) {
+            end = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    if(end > lo) {
+        cb(&b[lo], end - lo, arg);
+    }
+    return(end - lo);
+}
+
+void acq_rollup_merge(acq_rollup_t *dst, const acq_rollup_t *src)
+{
+    assert(dst != NULL && src != NULL);
+
+    if(!src->count) {
+        return;
+    }
+    if(!dst->count) {
+        *dst = *src;
+        return;
+    }
+
+    dst->count += src->count;
+    for(int i = 0; i < 4; i++) {
+        dst->sum[i] += src->sum[i];
+    }
+    if(src->min.temperature < dst->min.temperature) {
+        dst->min.temperature = src->min.temperature;
+    }
+    if(src->max.temperature > dst->max.temperature) {
+        dst->max.temperature = src->max.temperature;
+    }
+    if(src->min.pressure < dst->min.pressure) {
+        dst->min.pressure = src->min.pressure;
+    }
+    if(src->max.pressure > dst->max.pressure) {
+        dst->max.pressure = src->max.pressure;
+    }
+    if(src->min.luminosity < dst->min.luminosity) {
+        dst->min.luminosity = src->min.luminosity;
+    }
+    if(src->max.luminosity > dst->max.luminosity) {
+        dst->max.luminosity = src->max.luminosity;
+    }
+    if(src->min.humidity < dst->min.humidity) {
+        dst->min.humidity = src->min.humidity;
+    }
+    if(src->max.humidity > dst->max.humidity) {
+        dst->max.humidity = src->max.humidity;
+    }
+}
+
+int acq_file_get_data(acq_reader_t *r, uint32_t timestamp, acq_record_t *rec)
+{
+    assert(rec != NULL);
+
+    return(acq_file_scan(r, timestamp, UINT32_MAX, acq_file_get_first, rec) ? 0 : -1);
+}
@@ -0,0 +1,769 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_acq_store.c
+ *  @brief beeinformed acquisition segments store, merges small segments into
+ *         columnar ones in background and keeps the data under a disk budget
+ */
+
+#include "beeinformed_gateway.h"
+
+/** a device directory, the root and one name below it */
+#define ACQ_STORE_DIR_SIZE          (MAX_NAME_SIZE + NAME_MAX + 1)
+
+/** merge output being built */
+typedef struct {
+    int fd;
+    int idx_fd;
+    uint64_t offset;
+    uint16_t count;
+    bool failed;
+    acq_record_t rec[ACQ_BLOCK_RECORDS];
+    uint8_t enc[ACQ_COL_MAX_SIZE(ACQ_BLOCK_RECORDS)];
+}acq_store_merge_t;
+
+/** scan across the files of a device */
+typedef struct {
+    acq_scan_cb_t cb;
+    void *arg;
+    bool stop;
+}acq_store_scan_t;
+
+
+/** segments of one kind of a device, oldest first */
+typedef struct {
+    char path[ACQ_STORE_DIR_SIZE];
+    acq_segment_t *segs;
+    int count;
+    int next;
+}acq_store_dir_t;
+
+
+/** static variables */
+static pthread_t acq_store_thread;
+static pthread_mutex_t acq_store_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t acq_store_cond = PTHREAD_COND_INITIALIZER;
+static bool acq_store_should_run = false;
+static char acq_store_root[MAX_NAME_SIZE];
+static uint64_t acq_store_budget;
+static uint32_t acq_store_rate;
+static double acq_store_tokens;
+static struct timespec acq_store_refill;
+static acq_store_stats_t acq_store_stats;
+
+/** segments kept under the budget, sensor data and audio, and the files
+ *  a segment may have next to its data */
+static const char *acq_store_kinds[] = { ACQ_SEGMENT_SCAN, AUDIO_SEGMENT_SCAN };
+static const char *acq_store_sidecars[] = { ".idx", ".feat" };
+
+
+/** static functions */
+
+/**
+ *  @fn acq_store_wait()
+ *  @brief sleeps up to ms unless the store is stopped, with store locked
+ *  @param
+ *  @return false once the store has to stop
+ */
+static bool acq_store_wait(uint32_t ms)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    if(acq_store_should_run) {
+        pthread_cond_timedwait(&acq_store_cond, &acq_store_mutex, &ts);
+    }
+    return(acq_store_should_run);
+}
+
+/**
+ *  @fn acq_store_throttle()
+ *  @brief token bucket holding the compactor io to the configured rate,
+ *         with store locked
+ *  @param
+ *  @return false once the store has to stop
+ */
+static bool acq_store_throttle(size_t bytes)
+{
+    struct timespec now;
+    double wait;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    acq_store_tokens += ((now.tv_sec - acq_store_refill.tv_sec) +
+        (now.tv_nsec - acq_store_refill.tv_nsec) / 1e9) * acq_store_rate;
+    acq_store_refill = now;
+
+    /* at most one second worth of burst, acquisition writes come first */
+    if(acq_store_tokens > acq_store_rate) {
+        acq_store_tokens = acq_store_rate;
+    }
+    acq_store_tokens -= bytes;
+    if(acq_store_tokens >= 0) {
+        return(acq_store_should_run);
+    }
+
+    wait = -acq_store_tokens * 1e3 / acq_store_rate;
+    acq_store_stats.throttled_ms += (uint64_t)wait;
+    return(acq_store_wait((uint32_t)wait + 1));
+}
+
+/**
+ *  @fn acq_store_segment_cmp()
+ *  @brief orders segments by time
+ *  @param
+ *  @return
+ */
+static int acq_store_segment_cmp(const void *a, const void *b)
+{
+    const acq_segment_t *sa = a;
+    const acq_segment_t *sb = b;
+
+    if(sa->first != sb->first) {
+        return((sa->first < sb->first) ? -1 : 1);
+    }
+    return((sa->last < sb->last) ? -1 : (sa->last > sb->last));
+}
+
+/**
+ *  @fn acq_store_list()
+ *  @brief gets the segments of a kind of a device directory in time order
+ *  @param dir - device directory
+ *  @param scan - segment names, as ACQ_SEGMENT_SCAN
+ *  @param segs - receives an allocated array, to be released by the caller
+ *  @param bytes - if not NULL, receives the size of the whole directory
+ *  @return number of segments, -1 on failure
+ */
+static int acq_store_list(const char *dir, const char *scan, acq_segment_t **segs, uint64_t *bytes)
+{
+    char path[MAX_PATH_SIZE];
+    acq_segment_t *s = NULL;
+    acq_segment_t *grown;
+    struct dirent *de;
+    struct stat st;
+    int count = 0;
+    int cap = 0;
+    uint32_t first, last;
+    int len;
+    DIR *d;
+
+    d = opendir(dir);
+    if(d == NULL) {
+        return(-1);
+    }
+
+    while((de = readdir(d)) != NULL) {
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+        if(stat(path, &st) < 0 || !S_ISREG(st.st_mode)) {
+            continue;
+        }
+        if(bytes != NULL) {
+            *bytes += st.st_size;
+        }
+
+        /* sidecar sizes are accounted above, segments are listed by data file */
+        len = 0;
+        if(sscanf(de->d_name, scan, &first, &last, &len) != 2 ||
+            de->d_name[len] != 0 || len >= (int)sizeof(s->name)) {
+            continue;
+        }
+
+        if(count == cap) {
+            cap = cap ? cap * 2 : 16;
+            grown = realloc(s, cap * sizeof(acq_segment_t));
+            if(grown == NULL) {
+                free(s);
+                closedir(d);
+                return(-1);
+            }
+            s = grown;
+        }
+        s[count].first = first;
+        s[count].last = last;
+        s[count].size = st.st_size;
+        memcpy(s[count].name, de->d_name, len + 1);
+        count++;
+    }
+    closedir(d);
+
+    if(count) {
+        qsort(s, count, sizeof(acq_segment_t), acq_store_segment_cmp);
+    }
+    *segs = s;
+    return(count);
+}
+
+/**
+ *  @fn acq_store_unlink_segment()
+ *  @brief removes a segment, sidecars first so a leftover data file still
+ *         reads
+ *  @param
+ *  @return bytes freed
+ */
+static uint64_t acq_store_unlink_segment(const char *dir, const char *name)
+{
+    char path[MAX_PATH_SIZE];
+    int len = strlen(name) - strlen(".dat");
+    uint64_t freed = 0;
+    struct stat st;
+
+    for(size_t i = 0; i < sizeof(acq_store_sidecars) / sizeof(acq_store_sidecars[0]); i++) {
+        snprintf(path, sizeof(path), "%s/%.*s%s", dir, len, name, acq_store_sidecars[i]);
+        if(stat(path, &st) == 0 && unlink(path) == 0) {
+            freed += st.st_size;
+        }
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    if(stat(path, &st) == 0 && unlink(path) == 0) {
+        freed += st.st_size;
+    }
+    return(freed);
+}
+
+/**
+ *  @fn acq_store_apply()
+ *  @brief publishes the merge recorded in the intent log of a directory,
+ *         can be repeated any number of times after a crash
+ *  @param
+ *  @return 0 when the directory is clean, -1 on failure
+ */
+static int acq_store_apply(const char *dir)
+{
+    char path[MAX_PATH_SIZE];
+    char tmp[MAX_PATH_SIZE];
+    char tmp_idx[MAX_PATH_SIZE];
+    char dst[MAX_PATH_SIZE];
+    char dst_idx[MAX_PATH_SIZE];
+    char name[sizeof(((acq_segment_t *)0)->name)] = "";
+    bool tmp_ok, tmp_idx_ok;
+    FILE *log;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, ACQ_STORE_LOG);
+    snprintf(tmp, sizeof(tmp), "%s/%s", dir, ACQ_STORE_TMP);
+    snprintf(tmp_idx, sizeof(tmp_idx), "%s/%s", dir, ACQ_STORE_TMP_IDX);
+
+    log = fopen(path, "r");
+    if(log == NULL) {
+        /* a merge that never reached its log is thrown away */
+        unlink(tmp_idx);
+        unlink(tmp);
+        return(0);
+    }
+
+    /* a log torn before its end marker counts as never written */
+    while(fscanf(log, "%31s", name) == 1 && strcmp(name, ACQ_STORE_LOG_END)) {
+    }
+    if(strcmp(name, ACQ_STORE_LOG_END) || fseek(log, 0, SEEK_SET) || fscanf(log, "%31s", name) != 1) {
+        fclose(log);
+        unlink(tmp_idx);
+        unlink(tmp);
+        unlink(path);
+        return(0);
+    }
+    snprintf(dst, sizeof(dst), "%s/%s", dir, name);
+    snprintf(dst_idx, sizeof(dst_idx), "%s/%.*s.idx", dir, (int)(strlen(name) - strlen(".dat")), name);
+
+    /* the merged segment may take the name of its first source, so the
+     * old index goes first, it must never describe the new data */
+    tmp_ok = access(tmp, F_OK) == 0;
+    tmp_idx_ok = access(tmp_idx, F_OK) == 0;
+    if(tmp_idx_ok) {
+        unlink(dst_idx);
+    }
+    if(tmp_ok && rename(tmp, dst) < 0) {
+        goto cleanup;
+    }
+    if(tmp_idx_ok && rename(tmp_idx, dst_idx) < 0) {
+        goto cleanup;
+    }
+
+    while(fscanf(log, "%31s", name) == 1 && strcmp(name, ACQ_STORE_LOG_END)) {
+        if(strcmp(dst + strlen(dir) + 1, name)) {
+            acq_store_unlink_segment(dir, name);
+        }
+    }
+    fclose(log);
+    unlink(path);
+    return(0);
+
+cleanup:
+    fprintf(stderr, "ERROR: Failed to publish the compaction of %s.\n", dir);
+    fclose(log);
+    return(-1);
+}
+
+/**
+ *  @fn acq_store_merge_flush()
+ *  @brief encodes and writes the pending records as one block
+ *  @param
+ *  @return
+ */
+static void acq_store_merge_flush(acq_store_merge_t *m)
+{
+    acq_block_hdr_t *hdr = (acq_block_hdr_t *)m->enc;
+    acq_index_entry_t e;
+    size_t size;
+
+    if(!m->count || m->failed) {
+        return;
+    }
+
+    size = acq_col_encode(m->rec, m->count, m->enc);
+    hdr->crc = acq_block_crc(m->enc);
+
+    e.offset = m->offset;
+    e.first_ts = hdr->first_ts;
+    e.last_ts = hdr->last_ts;
+    e.count = hdr->count;
+    e.size = size;
+
+    if(write(m->fd, m->enc, size) != (ssize_t)size || write(m->idx_fd, &e, sizeof(e)) != sizeof(e)) {
+        m->failed = true;
+    }
+    m->offset += size;
+    m->count = 0;
+    if(!acq_store_throttle(size)) {
+        m->failed = true;
+    }
+}
+
+/**
+ *  @fn acq_store_merge_cb()
+ *  @brief scan callback feeding the merge output
+ *  @param
+ *  @return
+ */
+static bool acq_store_merge_cb(const acq_record_t *rec, size_t count, void *arg)
+{
+    acq_store_merge_t *m = arg;
+    size_t n;
+
+    while(count && !m->failed) {
+        n = ACQ_BLOCK_RECORDS - m->count;
+        n = (n < count) ? n : count;
+        memcpy(&m->rec[m->count], rec, n * sizeof(acq_record_t));
+        m->count += n;
+        rec += n;
+        count -= n;
+        if(m->count == ACQ_BLOCK_RECORDS) {
+            acq_store_merge_flush(m);
+        }
+    }
+    return(!m->failed);
+}
+
+/**
+ *  @fn acq_store_merge()
+ *  @brief rewrites a run of segments as a single columnar one, with store
+ *         locked, the lock is only dropped while throttled
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+static int acq_store_merge(const char *dir, const acq_segment_t *run, int count)
+{
+    char path[MAX_PATH_SIZE];
+    char name[sizeof(run->name)];
+    acq_store_merge_t *m;
+    acq_reader_t *r;
+    uint64_t in = 0;
+    FILE *log = NULL;
+    int ret = -1;
+
+    m = calloc(1, sizeof(acq_store_merge_t));
+    if(m == NULL) {
+        return(-1);
+    }
+    snprintf(path, sizeof(path), "%s/%s", dir, ACQ_STORE_TMP);
+    m->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    snprintf(path, sizeof(path), "%s/%s", dir, ACQ_STORE_TMP_IDX);
+    m->idx_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(m->fd < 0 || m->idx_fd < 0) {
+        goto cleanup;
+    }
+
+    for(int i = 0; i < count && !m->failed; i++) {
+        snprintf(path, sizeof(path), "%s/%s", dir, run[i].name);
+        if(!acq_store_throttle(run[i].size)) {
+            goto cleanup;
+        }
+        r = acq_reader_open(path);
+        if(r == NULL) {
+            goto cleanup;
+        }
+        acq_file_scan(r, 0, UINT32_MAX, acq_store_merge_cb, m);
+        acq_reader_close(r);
+        in += run[i].size;
+    }
+    acq_store_merge_flush(m);
+    if(m->failed || fdatasync(m->fd) < 0 || fdatasync(m->idx_fd) < 0) {
+        goto cleanup;
+    }
+
+    /* from here on the merge survives a crash, the log names the result
+     * and then every source it replaces */
+    snprintf(name, sizeof(name), ACQ_SEGMENT_FMT ".dat", run[0].first, run[count - 1].last);
+    snprintf(path, sizeof(path), "%s/%s", dir, ACQ_STORE_LOG);
+    log = fopen(path, "w");
+    if(log == NULL) {
+        goto cleanup;
+    }
+    fprintf(log, "%s\n", name);
+    for(int i = 0; i < count; i++) {
+        fprintf(log, "%s\n", run[i].name);
+    }
+    fprintf(log, "%s\n", ACQ_STORE_LOG_END);
+    if(fflush(log) || fdatasync(fileno(log)) < 0) {
+        fclose(log);
+        unlink(path);
+        goto cleanup;
+    }
+    fclose(log);
+
+    close(m->fd);
+    close(m->idx_fd);
+    m->fd = m->idx_fd = -1;
+    ret = acq_store_apply(dir);
+    if(!ret) {
+        acq_store_stats.merged += count;
+        acq_store_stats.bytes_in += in;
+        acq_store_stats.bytes_out += m->offset;
+    }
+
+cleanup:
+    if(m->fd >= 0) {
+        close(m->fd);
+    }
+    if(m->idx_fd >= 0) {
+        close(m->idx_fd);
+    }
+    if(ret < 0 && log == NULL) {
+        snprintf(path, sizeof(path), "%s/%s", dir, ACQ_STORE_TMP_IDX);
+        unlink(path);
+        snprintf(path, sizeof(path), "%s/%s", dir, ACQ_STORE_TMP);
+        unlink(path);
+    }
+    free(m);
+    return(ret);
+}
+
+/**
+ *  @fn acq_store_is_raw()
+ *  @brief checks whether a segment still holds raw blocks
+ *  @param
+ *  @return
+ */
+static bool acq_store_is_raw(const char *dir, const acq_segment_t *s)
+{
+    char path[MAX_PATH_SIZE];
+    acq_block_hdr_t hdr;
+    bool raw = false;
+    int fd;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, s->name);
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd >= 0) {
+        raw = pread(fd, &hdr, sizeof(hdr), 0) == sizeof(hdr) && hdr.version == ACQ_BLOCK_VERSION;
+        close(fd);
+    }
+    return(raw);
+}
+
+/**
+ *  @fn acq_store_compact()
+ *  @brief merges the runs of small or raw segments of a device directory
+ *  @param
+ *  @return
+ */
+static void acq_store_compact(const char *dir)
+{
+    acq_segment_t *segs = NULL;
+    uint64_t run_size;
+    int count;
+    int start, end;
+
+    if(acq_store_apply(dir) < 0) {
+        return;
+    }
+    count = acq_store_list(dir, ACQ_SEGMENT_SCAN, &segs, NULL);
+    if(count <= 0) {
+        free(segs);
+        return;
+    }
+
+    /* a segment near the target size is final, so each record is only
+     * rewritten a few times on its way there */
+    for(start = 0; start < count && acq_store_should_run; start = end) {
+        run_size = 0;
+        end = start;
+        while(end < count && segs[end].size < ACQ_STORE_COMPACT_TARGET / 2 &&
+            run_size + segs[end].size <= ACQ_STORE_COMPACT_TARGET) {
+            run_size += segs[end].size;
+            end++;
+        }
+        if(end == start) {
+            end++;
+            continue;
+        }
+        if(end - start > 1 || acq_store_is_raw(dir, &segs[start])) {
+            acq_store_merge(dir, &segs[start], end - start);
+        }
+    }
+    free(segs);
+}
+
+/**
+ *  @fn acq_store_retain()
+ *  @brief drops the oldest sensor and audio segments of every device until
+ *         the device directories fit the budget, the rollup tiers keep the
+ *         history they summarize, files next to them like the log keep to
+ *         their own limits
+ *  @param
+ *  @return
+ */
+static void acq_store_retain(void)
+{
+    char path[ACQ_STORE_DIR_SIZE];
+    struct dirent *de;
+    struct stat st;
+    acq_store_dir_t *dirs = NULL;
+    acq_store_dir_t *grown;
+    acq_segment_t *s;
+    uint64_t total = 0;
+    uint64_t freed;
+    int count = 0;
+    int cap = 0;
+    int oldest;
+    DIR *d;
+
+    d = opendir(acq_store_root);
+    if(d == NULL) {
+        return;
+    }
+    while((de = readdir(d)) != NULL) {
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", acq_store_root, de->d_name);
+        if(stat(path, &st) < 0 || !S_ISDIR(st.st_mode)) {
+            continue;
+        }
+
+        /* every kind is its own oldest first list, the directory size is
+         * accounted once */
+        for(size_t k = 0; k < sizeof(acq_store_kinds) / sizeof(acq_store_kinds[0]); k++) {
+            if(count == cap) {
+                cap = cap ? cap * 2 : 16;
+                grown = realloc(dirs, cap * sizeof(acq_store_dir_t));
+                if(grown == NULL) {
+                    goto cleanup;
+                }
+                dirs = grown;
+            }
+            dirs[count].next = 0;
+            dirs[count].count = acq_store_list(path, acq_store_kinds[k], &dirs[count].segs, (k) ? NULL : &total);
+            if(dirs[count].count < 0) {
+                break;
+            }
+            snprintf(dirs[count].path, sizeof(dirs[count].path), "%s", path);
+            count++;
+        }
+    }
+
+    /* the live files are never touched, only closed segments go */
+    while(total > acq_store_budget) {
+        oldest = -1;
+        for(int i = 0; i < count; i++) {
+            if(dirs[i].next < dirs[i].count && (oldest < 0 ||
+                dirs[i].segs[dirs[i].next].last < dirs[oldest].segs[dirs[oldest].next].last)) {
+                oldest = i;
+            }
+        }
+        if(oldest < 0) {
+            break;
+        }
+
+        s = &dirs[oldest].segs[dirs[oldest].next++];
+        freed = acq_store_unlink_segment(dirs[oldest].path, s->name);
+        total -= (freed < total) ? freed : total;
+        acq_store_stats.dropped++;
+        acq_store_stats.dropped_bytes += freed;
+        printf("%s: dropped %s/%s to fit the disk budget \n\r", __func__, dirs[oldest].path, s->name);
+    }
+    acq_store_stats.disk_bytes = total;
+
+cleanup:
+    closedir(d);
+    for(int i = 0; i < count; i++) {
+        free(dirs[i].segs);
+    }
+    free(dirs);
+}
+
+/**
+ *  @fn acq_store_pass()
+ *  @brief one compaction and retention pass over the root, with store locked
+ *  @param
+ *  @return
+ */
+static void acq_store_pass(void)
+{
+    char dir[ACQ_STORE_DIR_SIZE];
+    struct dirent *de;
+    struct stat st;
+    DIR *d;
+
+    d = opendir(acq_store_root);
+    if(d == NULL) {
+        return;
+    }
+    while((de = readdir(d)) != NULL && acq_store_should_run) {
+        if(de->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(dir, sizeof(dir), "%s/%s", acq_store_root, de->d_name);
+        if(stat(dir, &st) == 0 && S_ISDIR(st.st_mode)) {
+            acq_store_compact(dir);
+        }
+    }
+    closedir(d);
+
+    if(acq_store_should_run) {
+        acq_store_retain();
+    }
+    acq_store_stats.passes++;
+}
+
+/**
+ *  @fn acq_store_compact_thread()
+ *  @brief background compactor
+ *  @param
+ *  @return
+ */
+static void *acq_store_compact_thread(void *args)
+{
+    (void)args;
+
+    pthread_mutex_lock(&acq_store_mutex);
+    clock_gettime(CLOCK_MONOTONIC, &acq_store_refill);
+    acq_store_tokens = acq_store_rate;
+
+    /* the first pass finishes whatever a crash interrupted */
+    while(acq_store_should_run) {
+        acq_store_pass();
+        acq_store_wait(ACQ_STORE_PERIOD_MS);
+    }
+    pthread_mutex_unlock(&acq_store_mutex);
+
+    return(NULL);
+}
+
+/**
+ *  @fn acq_store_scan_cb()
+ *  @brief forwards records to the caller and remembers when it stopped
+ *  @param
+ *  @return
+ */
+static bool acq_store_scan_cb(const acq_record_t *rec, size_t count, void *arg)
+{
+    acq_store_scan_t *s = arg;
+
+    if(!s->cb(rec, count, s->arg)) {
+        s->stop = true;
+    }
+    return(!s->stop);
+}
+
+
+/** public functions */
+int acq_store_start(const char *root, uint64_t budget, uint32_t rate)
+{
+    assert(root != NULL && rate);
+
+    snprintf(acq_store_root, sizeof(acq_store_root), "%s", root);
+    acq_store_budget = budget;
+    acq_store_rate = rate;
+
+    acq_store_should_run = true;
+    if(pthread_create(&acq_store_thread, NULL, acq_store_compact_thread, NULL)) {
+        acq_store_should_run = false;
+        fprintf(stderr, "ERROR: Failed to start the acquisition compactor thread.\n");
+        return(-1);
+    }
+    return(0);
+}
+
+void acq_store_finish(void)
+{
+    pthread_mutex_lock(&acq_store_mutex);
+    if(!acq_store_should_run) {
+        pthread_mutex_unlock(&acq_store_mutex);
+        return;
+    }
+    acq_store_should_run = false;
+    pthread_cond_signal(&acq_store_cond);
+    pthread_mutex_unlock(&acq_store_mutex);
+
+    pthread_join(acq_store_thread, NULL);
+}
+
+void acq_store_get_stats(acq_store_stats_t *s)
+{
+    assert(s != NULL);
+
+    pthread_mutex_lock(&acq_store_mutex);
+    *s = acq_store_stats;
+    pthread_mutex_unlock(&acq_store_mutex);
+}
+
+size_t acq_store_scan(const char *dir, uint32_t t0, uint32_t t1, acq_scan_cb_t cb, void *arg)
+{
+    char path[MAX_PATH_SIZE];
+    acq_store_scan_t s = { cb, arg, false };
+    acq_segment_t *segs = NULL;
+    acq_reader_t *live;
+    acq_reader_t *r;
+    size_t found = 0;
+    int count;
+
+    assert(dir != NULL && cb != NULL);
+
+    /* the live file is taken first, a rotation after that lists it as a
+     * segment too and it is then read only once, as the live file at the
+     * end, so no record falls between the two */
+    snprintf(path, sizeof(path), "%s/%s", dir, ACQ_FILE_NAME);
+    live = acq_reader_open(path);
+
+    /* the store lock keeps the compactor from swapping files under us */
+    pthread_mutex_lock(&acq_store_mutex);
+    count = acq_store_list(dir, ACQ_SEGMENT_SCAN, &segs, NULL);
+    for(int i = 0; i < count && !s.stop; i++) {
+        if(segs[i].last < t0 || segs[i].first > t1) {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, segs[i].name);
+        r = acq_reader_open(path);
+        if(r != NULL) {
+            if(live == NULL || r->ino != live->ino || r->dev != live->dev) {
+                found += acq_file_scan(r, t0, t1, acq_store_scan_cb, &s);
+            }
+            acq_reader_close(r);
+        }
+    }
+    free(segs);
+    pthread_mutex_unlock(&acq_store_mutex);
+
+    if(live != NULL) {
+        if(!s.stop) {
+            found += acq_file_scan(live, t0, t1, acq_store_scan_cb, &s);
+        }
+        acq_reader_close(live);
+    }
+    return(found);
+}
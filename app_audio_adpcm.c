@@ -0,0 +1,156 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_audio_adpcm.c
+ *  @brief beeinformed IMA-ADPCM codec for hive audio captures, 4 bits per
+ *         sample in self contained frames
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** static variables */
+static const int16_t audio_adpcm_step[AUDIO_ADPCM_INDEX_MAX + 1] = {
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+    11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+    32767
+};
+
+static const int8_t audio_adpcm_index[16] = {
+    -1, -1, -1, -1, 2, 4, 6, 8, -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+
+/** static functions */
+
+/**
+ *  @fn audio_adpcm_step_code()
+ *  @brief applies a code to the predictor and the step index
+ *  @param
+ *  @return
+ */
+static inline void audio_adpcm_step_code(int32_t *pred, int32_t *index, uint8_t code)
+{
+    int32_t step = audio_adpcm_step[*index];
+    int32_t diff = step >> 3;
+
+    if(code & 4) {
+        diff += step;
+    }
+    if(code & 2) {
+        diff += step >> 1;
+    }
+    if(code & 1) {
+        diff += step >> 2;
+    }
+    *pred += (code & 8) ? -diff : diff;
+    *pred = (*pred > INT16_MAX) ? INT16_MAX : (*pred < INT16_MIN) ? INT16_MIN : *pred;
+
+    *index += audio_adpcm_index[code];
+    *index = (*index < 0) ? 0 : (*index > AUDIO_ADPCM_INDEX_MAX) ? AUDIO_ADPCM_INDEX_MAX : *index;
+}
+
+/**
+ *  @fn audio_adpcm_code()
+ *  @brief quantizes the prediction error of a sample
+ *  @param
+ *  @return
+ */
+static inline uint8_t audio_adpcm_code(int32_t pred, int32_t index, int32_t sample)
+{
+    int32_t step = audio_adpcm_step[index];
+    int32_t diff = sample - pred;
+    uint8_t code = 0;
+
+    if(diff < 0) {
+        code = 8;
+        diff = -diff;
+    }
+    if(diff >= step) {
+        code |= 4;
+        diff -= step;
+    }
+    step >>= 1;
+    if(diff >= step) {
+        code |= 2;
+        diff -= step;
+    }
+    step >>= 1;
+    if(diff >= step) {
+        code |= 1;
+    }
+    return(code);
+}
+
+
+/** public functions */
+size_t audio_adpcm_encode(audio_adpcm_state_t *st, const int16_t *pcm, size_t count, uint8_t *out)
+{
+    uint8_t *start = out;
+
+    assert(st != NULL && pcm != NULL && out != NULL);
+
+    while(count) {
+        audio_adpcm_hdr_t *hdr = (audio_adpcm_hdr_t *)out;
+        size_t n = (count < AUDIO_ADPCM_FRAME_SAMPLES) ? count : AUDIO_ADPCM_FRAME_SAMPLES;
+        uint8_t *p = out + sizeof(audio_adpcm_hdr_t);
+        int32_t pred = pcm[0];
+        int32_t index = st->index;
+        uint8_t lo = 0;
+
+        /* the header restarts the predictor, so any frame is a seek point */
+        hdr->sample = pcm[0];
+        hdr->index = (uint8_t)index;
+        hdr->reserved = 0;
+
+        for(size_t i = 1; i < AUDIO_ADPCM_FRAME_SAMPLES; i++) {
+            int32_t sample = (i < n) ? pcm[i] : 0;
+            uint8_t code = audio_adpcm_code(pred, index, sample);
+
+            audio_adpcm_step_code(&pred, &index, code);
+            if(i & 1) {
+                lo = code;
+            } else {
+                *p++ = lo | (code << 4);
+            }
+        }
+
+        st->index = index;
+        pcm += n;
+        count -= n;
+        out += AUDIO_ADPCM_FRAME_SIZE;
+    }
+
+    return(out - start);
+}
+
+int audio_adpcm_decode(const uint8_t *frame, int16_t *pcm)
+{
+    const audio_adpcm_hdr_t *hdr = (const audio_adpcm_hdr_t *)frame;
+    const uint8_t *p = frame + sizeof(audio_adpcm_hdr_t);
+    int32_t pred;
+    int32_t index;
+
+    assert(frame != NULL && pcm != NULL);
+
+    if(hdr->index > AUDIO_ADPCM_INDEX_MAX || hdr->reserved) {
+        return(-1);
+    }
+    pred = hdr->sample;
+    index = hdr->index;
+    pcm[0] = (int16_t)pred;
+
+    for(size_t i = 1; i < AUDIO_ADPCM_FRAME_SAMPLES; i += 2) {
+        uint8_t b = *p++;
+
+        audio_adpcm_step_code(&pred, &index, b & 0x0F);
+        pcm[i] = (int16_t)pred;
+        audio_adpcm_step_code(&pred, &index, b >> 4);
+        pcm[i + 1] = (int16_t)pred;
+    }
+
+    return(AUDIO_ADPCM_FRAME_SAMPLES);
+}
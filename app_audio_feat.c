@@ -0,0 +1,783 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_audio_feat.c
+ *  @brief beeinformed hive audio spectral features, a streaming real fft
+ *         whose power is folded into the bands where swarming and
+ *         queenless colonies show up
+ */
+
+#include "beeinformed_gateway.h"
+#include <math.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+/** the real fft of N samples runs as a complex one of N / 2 points */
+#define AUDIO_FEAT_HALF             (AUDIO_FEAT_FFT_SIZE / 2)
+
+/** mean square of a full scale sine, the 0 dB reference */
+#define AUDIO_FEAT_FULL_SCALE       (32768.0 * 32768.0 / 2.0)
+
+/** band energies never go below this, in centi dB */
+#define AUDIO_FEAT_FLOOR_CDB        (-12000)
+
+typedef void (*audio_feat_fn_t)(audio_feat_t *a, const int16_t *pcm);
+
+/** static variables */
+static float feat_win_re[AUDIO_FEAT_HALF] __attribute__((aligned(32)));
+static float feat_win_im[AUDIO_FEAT_HALF] __attribute__((aligned(32)));
+static float feat_tw_re[AUDIO_FEAT_HALF] __attribute__((aligned(32)));
+static float feat_tw_im[AUDIO_FEAT_HALF] __attribute__((aligned(32)));
+static float feat_post_re[AUDIO_FEAT_HALF] __attribute__((aligned(32)));
+static float feat_post_im[AUDIO_FEAT_HALF] __attribute__((aligned(32)));
+static uint8_t feat_swap[AUDIO_FEAT_HALF / 2][2];
+static uint32_t feat_swaps;
+static uint16_t feat_band_bin[AUDIO_FEAT_BANDS + 1];
+static double feat_win_power;
+static pthread_once_t feat_once = PTHREAD_ONCE_INIT;
+static audio_feat_fn_t feat_fn = NULL;
+static const char *feat_name = "none";
+
+
+/** static functions */
+
+/**
+ *  @fn audio_feat_now_ns()
+ *  @brief cpu time of the calling thread in nanoseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t audio_feat_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ *  @fn audio_feat_stage_scalar()
+ *  @brief one decimation in frequency stage of butterflies h apart
+ *  @param
+ *  @return
+ */
+static void audio_feat_stage_scalar(float *re, float *im, uint32_t h)
+{
+    const float *wr = feat_tw_re + h - 1;
+    const float *wi = feat_tw_im + h - 1;
+
+    for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k += 2 * h) {
+        for(uint32_t j = 0; j < h; j++) {
+            float ar = re[k + j], ai = im[k + j];
+            float br = re[k + j + h], bi = im[k + j + h];
+            float dr = ar - br, di = ai - bi;
+
+            re[k + j] = ar + br;
+            im[k + j] = ai + bi;
+            re[k + j + h] = dr * wr[j] - di * wi[j];
+            im[k + j + h] = dr * wi[j] + di * wr[j];
+        }
+    }
+}
+
+/**
+ *  @fn audio_feat_unscramble()
+ *  @brief puts the bit reversed fft output back in order, the spare slot
+ *         repeats the first bin so Z[N / 2 - k] needs no special case
+ *  @param
+ *  @return
+ */
+static void audio_feat_unscramble(float *re, float *im)
+{
+    for(uint32_t s = 0; s < feat_swaps; s++) {
+        uint32_t i = feat_swap[s][0];
+        uint32_t j = feat_swap[s][1];
+        float t = re[i];
+
+        re[i] = re[j];
+        re[j] = t;
+        t = im[i];
+        im[i] = im[j];
+        im[j] = t;
+    }
+    re[AUDIO_FEAT_HALF] = re[0];
+    im[AUDIO_FEAT_HALF] = im[0];
+}
+
+/**
+ *  @fn audio_feat_post_scalar()
+ *  @brief splits the half size spectrum into the real signal one and
+ *         accumulates its power from bin k on, nyquist included
+ *  @param
+ *  @return
+ */
+static void audio_feat_post_scalar(audio_feat_t *a, uint32_t k)
+{
+    const float *re = a->re;
+    const float *im = a->im;
+    float x;
+
+    /* everything here is twice the spectrum, emit scales it back */
+    for(; k < AUDIO_FEAT_HALF; k++) {
+        float ar = re[k], ai = im[k];
+        float rr = re[AUDIO_FEAT_HALF - k], ri = im[AUDIO_FEAT_HALF - k];
+        float er = ar + rr, ei = ai - ri;
+        float orr = ai + ri, oi = rr - ar;
+        float xr = er + feat_post_re[k] * orr - feat_post_im[k] * oi;
+        float xi = ei + feat_post_re[k] * oi + feat_post_im[k] * orr;
+
+        a->acc[k] += xr * xr + xi * xi;
+    }
+
+    x = 2.0f * (re[0] - im[0]);
+    a->acc[AUDIO_FEAT_HALF] += x * x;
+}
+
+/**
+ *  @fn audio_feat_frame_scalar()
+ *  @brief portable reference implementation
+ *  @param
+ *  @return
+ */
+static void audio_feat_frame_scalar(audio_feat_t *a, const int16_t *pcm)
+{
+    /* even samples make the real part, odd ones the imaginary part */
+    for(uint32_t m = 0; m < AUDIO_FEAT_HALF; m++) {
+        a->re[m] = pcm[2 * m] * feat_win_re[m];
+        a->im[m] = pcm[2 * m + 1] * feat_win_im[m];
+    }
+    for(uint32_t h = AUDIO_FEAT_HALF / 2; h; h >>= 1) {
+        audio_feat_stage_scalar(a->re, a->im, h);
+    }
+    audio_feat_unscramble(a->re, a->im);
+    audio_feat_post_scalar(a, 0);
+}
+
+#if defined(__x86_64__)
+/**
+ *  @fn audio_feat_window_sse()
+ *  @brief windows a frame and splits even and odd samples, 8 per step
+ *  @param
+ *  @return
+ */
+static inline void audio_feat_window_sse(float *re, float *im, const int16_t *pcm)
+{
+    for(uint32_t m = 0; m < AUDIO_FEAT_HALF; m += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(pcm + 2 * m));
+        __m128 lo = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16));
+        __m128 hi = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16));
+
+        _mm_store_ps(re + m, _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0)), _mm_load_ps(feat_win_re + m)));
+        _mm_store_ps(im + m, _mm_mul_ps(_mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1)), _mm_load_ps(feat_win_im + m)));
+    }
+}
+
+/**
+ *  @fn audio_feat_stage_sse()
+ *  @brief butterflies at least 4 apart, 4 per step
+ *  @param
+ *  @return
+ */
+static inline void audio_feat_stage_sse(float *re, float *im, uint32_t h)
+{
+    const float *wr = feat_tw_re + h - 1;
+    const float *wi = feat_tw_im + h - 1;
+
+    for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k += 2 * h) {
+        for(uint32_t j = 0; j < h; j += 4) {
+            __m128 ar = _mm_load_ps(re + k + j), ai = _mm_load_ps(im + k + j);
+            __m128 br = _mm_load_ps(re + k + j + h), bi = _mm_load_ps(im + k + j + h);
+            __m128 tr = _mm_loadu_ps(wr + j), ti = _mm_loadu_ps(wi + j);
+            __m128 dr = _mm_sub_ps(ar, br), di = _mm_sub_ps(ai, bi);
+
+            _mm_store_ps(re + k + j, _mm_add_ps(ar, br));
+            _mm_store_ps(im + k + j, _mm_add_ps(ai, bi));
+            _mm_store_ps(re + k + j + h, _mm_sub_ps(_mm_mul_ps(dr, tr), _mm_mul_ps(di, ti)));
+            _mm_store_ps(im + k + j + h, _mm_add_ps(_mm_mul_ps(dr, ti), _mm_mul_ps(di, tr)));
+        }
+    }
+}
+
+/**
+ *  @fn audio_feat_radix4_sse()
+ *  @brief last two stages, each group of 4 points is a lane after a
+ *         transpose, so 4 groups go per step
+ *  @param
+ *  @return
+ */
+static inline void audio_feat_radix4_sse(float *re, float *im)
+{
+    for(uint32_t g = 0; g < AUDIO_FEAT_HALF; g += 16) {
+        __m128 r0 = _mm_load_ps(re + g), r1 = _mm_load_ps(re + g + 4);
+        __m128 r2 = _mm_load_ps(re + g + 8), r3 = _mm_load_ps(re + g + 12);
+        __m128 i0 = _mm_load_ps(im + g), i1 = _mm_load_ps(im + g + 4);
+        __m128 i2 = _mm_load_ps(im + g + 8), i3 = _mm_load_ps(im + g + 12);
+        __m128 yr0, yi0, yr1, yi1, yr2, yi2, yr3, yi3;
+
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _MM_TRANSPOSE4_PS(i0, i1, i2, i3);
+
+        /* 2 apart, the second twiddle is -i */
+        yr0 = _mm_add_ps(r0, r2);
+        yi0 = _mm_add_ps(i0, i2);
+        yr1 = _mm_add_ps(r1, r3);
+        yi1 = _mm_add_ps(i1, i3);
+        yr2 = _mm_sub_ps(r0, r2);
+        yi2 = _mm_sub_ps(i0, i2);
+        yr3 = _mm_sub_ps(i1, i3);
+        yi3 = _mm_sub_ps(r3, r1);
+
+        /* 1 apart, no twiddle */
+        r0 = _mm_add_ps(yr0, yr1);
+        i0 = _mm_add_ps(yi0, yi1);
+        r1 = _mm_sub_ps(yr0, yr1);
+        i1 = _mm_sub_ps(yi0, yi1);
+        r2 = _mm_add_ps(yr2, yr3);
+        i2 = _mm_add_ps(yi2, yi3);
+        r3 = _mm_sub_ps(yr2, yr3);
+        i3 = _mm_sub_ps(yi2, yi3);
+
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        _MM_TRANSPOSE4_PS(i0, i1, i2, i3);
+        _mm_store_ps(re + g, r0);
+        _mm_store_ps(re + g + 4, r1);
+        _mm_store_ps(re + g + 8, r2);
+        _mm_store_ps(re + g + 12, r3);
+        _mm_store_ps(im + g, i0);
+        _mm_store_ps(im + g + 4, i1);
+        _mm_store_ps(im + g + 8, i2);
+        _mm_store_ps(im + g + 12, i3);
+    }
+}
+
+/**
+ *  @fn audio_feat_frame_sse()
+ *  @brief SSE2 implementation, 4 lanes
+ *  @param
+ *  @return
+ */
+static void audio_feat_frame_sse(audio_feat_t *a, const int16_t *pcm)
+{
+    float *re = a->re;
+    float *im = a->im;
+
+    audio_feat_window_sse(re, im, pcm);
+    for(uint32_t h = AUDIO_FEAT_HALF / 2; h >= 4; h >>= 1) {
+        audio_feat_stage_sse(re, im, h);
+    }
+    audio_feat_radix4_sse(re, im);
+    audio_feat_unscramble(re, im);
+
+    for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k += 4) {
+        __m128 ar = _mm_load_ps(re + k), ai = _mm_load_ps(im + k);
+        __m128 rr = _mm_loadu_ps(re + AUDIO_FEAT_HALF - k - 3);
+        __m128 ri = _mm_loadu_ps(im + AUDIO_FEAT_HALF - k - 3);
+        __m128 pr = _mm_load_ps(feat_post_re + k), pi = _mm_load_ps(feat_post_im + k);
+        __m128 er, ei, orr, oi, xr, xi;
+
+        rr = _mm_shuffle_ps(rr, rr, _MM_SHUFFLE(0, 1, 2, 3));
+        ri = _mm_shuffle_ps(ri, ri, _MM_SHUFFLE(0, 1, 2, 3));
+        er = _mm_add_ps(ar, rr);
+        ei = _mm_sub_ps(ai, ri);
+        orr = _mm_add_ps(ai, ri);
+        oi = _mm_sub_ps(rr, ar);
+        xr = _mm_sub_ps(_mm_add_ps(er, _mm_mul_ps(pr, orr)), _mm_mul_ps(pi, oi));
+        xi = _mm_add_ps(_mm_add_ps(ei, _mm_mul_ps(pr, oi)), _mm_mul_ps(pi, orr));
+        _mm_store_ps(a->acc + k, _mm_add_ps(_mm_load_ps(a->acc + k),
+            _mm_add_ps(_mm_mul_ps(xr, xr), _mm_mul_ps(xi, xi))));
+    }
+    audio_feat_post_scalar(a, AUDIO_FEAT_HALF);
+}
+
+/**
+ *  @fn audio_feat_frame_avx()
+ *  @brief AVX implementation, 8 lanes where butterflies are far enough
+ *         apart, the SSE kernels below that
+ *  @param
+ *  @return
+ */
+__attribute__((target("avx")))
+static void audio_feat_frame_avx(audio_feat_t *a, const int16_t *pcm)
+{
+    float *re = a->re;
+    float *im = a->im;
+    uint32_t h;
+
+    audio_feat_window_sse(re, im, pcm);
+    for(h = AUDIO_FEAT_HALF / 2; h >= 8; h >>= 1) {
+        const float *wr = feat_tw_re + h - 1;
+        const float *wi = feat_tw_im + h - 1;
+
+        for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k += 2 * h) {
+            for(uint32_t j = 0; j < h; j += 8) {
+                __m256 ar = _mm256_load_ps(re + k + j), ai = _mm256_load_ps(im + k + j);
+                __m256 br = _mm256_load_ps(re + k + j + h), bi = _mm256_load_ps(im + k + j + h);
+                __m256 tr = _mm256_loadu_ps(wr + j), ti = _mm256_loadu_ps(wi + j);
+                __m256 dr = _mm256_sub_ps(ar, br), di = _mm256_sub_ps(ai, bi);
+
+                _mm256_store_ps(re + k + j, _mm256_add_ps(ar, br));
+                _mm256_store_ps(im + k + j, _mm256_add_ps(ai, bi));
+                _mm256_store_ps(re + k + j + h, _mm256_sub_ps(_mm256_mul_ps(dr, tr), _mm256_mul_ps(di, ti)));
+                _mm256_store_ps(im + k + j + h, _mm256_add_ps(_mm256_mul_ps(dr, ti), _mm256_mul_ps(di, tr)));
+            }
+        }
+    }
+    audio_feat_stage_sse(re, im, h);
+    audio_feat_radix4_sse(re, im);
+    audio_feat_unscramble(re, im);
+
+    for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k += 8) {
+        __m256 ar = _mm256_load_ps(re + k), ai = _mm256_load_ps(im + k);
+        __m256 rr = _mm256_loadu_ps(re + AUDIO_FEAT_HALF - k - 7);
+        __m256 ri = _mm256_loadu_ps(im + AUDIO_FEAT_HALF - k - 7);
+        __m256 pr = _mm256_load_ps(feat_post_re + k), pi = _mm256_load_ps(feat_post_im + k);
+        __m256 er, ei, orr, oi, xr, xi;
+
+        /* reversed across the lanes, then within each half */
+        rr = _mm256_permute_ps(_mm256_permute2f128_ps(rr, rr, 1), _MM_SHUFFLE(0, 1, 2, 3));
+        ri = _mm256_permute_ps(_mm256_permute2f128_ps(ri, ri, 1), _MM_SHUFFLE(0, 1, 2, 3));
+        er = _mm256_add_ps(ar, rr);
+        ei = _mm256_sub_ps(ai, ri);
+        orr = _mm256_add_ps(ai, ri);
+        oi = _mm256_sub_ps(rr, ar);
+        xr = _mm256_sub_ps(_mm256_add_ps(er, _mm256_mul_ps(pr, orr)), _mm256_mul_ps(pi, oi));
+        xi = _mm256_add_ps(_mm256_add_ps(ei, _mm256_mul_ps(pr, oi)), _mm256_mul_ps(pi, orr));
+        _mm256_store_ps(a->acc + k, _mm256_add_ps(_mm256_load_ps(a->acc + k),
+            _mm256_add_ps(_mm256_mul_ps(xr, xr), _mm256_mul_ps(xi, xi))));
+    }
+    audio_feat_post_scalar(a, AUDIO_FEAT_HALF);
+}
+#elif defined(__aarch64__)
+/**
+ *  @fn audio_feat_frame_neon()
+ *  @brief NEON implementation, 4 lanes, the structured loads do the even
+ *         and odd split and the last two stages transpose
+ *  @param
+ *  @return
+ */
+static void audio_feat_frame_neon(audio_feat_t *a, const int16_t *pcm)
+{
+    float *re = a->re;
+    float *im = a->im;
+
+    for(uint32_t m = 0; m < AUDIO_FEAT_HALF; m += 4) {
+        int16x4x2_t v = vld2_s16(pcm + 2 * m);
+
+        vst1q_f32(re + m, vmulq_f32(vcvtq_f32_s32(vmovl_s16(v.val[0])), vld1q_f32(feat_win_re + m)));
+        vst1q_f32(im + m, vmulq_f32(vcvtq_f32_s32(vmovl_s16(v.val[1])), vld1q_f32(feat_win_im + m)));
+    }
+
+    for(uint32_t h = AUDIO_FEAT_HALF / 2; h >= 4; h >>= 1) {
+        const float *wr = feat_tw_re + h - 1;
+        const float *wi = feat_tw_im + h - 1;
+
+        for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k += 2 * h) {
+            for(uint32_t j = 0; j < h; j += 4) {
+                float32x4_t ar = vld1q_f32(re + k + j), ai = vld1q_f32(im + k + j);
+                float32x4_t br = vld1q_f32(re + k + j + h), bi = vld1q_f32(im + k + j + h);
+                float32x4_t tr = vld1q_f32(wr + j), ti = vld1q_f32(wi + j);
+                float32x4_t dr = vsubq_f32(ar, br), di = vsubq_f32(ai, bi);
+
+                vst1q_f32(re + k + j, vaddq_f32(ar, br));
+                vst1q_f32(im + k + j, vaddq_f32(ai, bi));
+                vst1q_f32(re + k + j + h, vsubq_f32(vmulq_f32(dr, tr), vmulq_f32(di, ti)));
+                vst1q_f32(im + k + j + h, vaddq_f32(vmulq_f32(dr, ti), vmulq_f32(di, tr)));
+            }
+        }
+    }
+
+    for(uint32_t g = 0; g < AUDIO_FEAT_HALF; g += 16) {
+        float32x4x4_t r = vld4q_f32(re + g);
+        float32x4x4_t i = vld4q_f32(im + g);
+        float32x4_t yr0 = vaddq_f32(r.val[0], r.val[2]), yi0 = vaddq_f32(i.val[0], i.val[2]);
+        float32x4_t yr1 = vaddq_f32(r.val[1], r.val[3]), yi1 = vaddq_f32(i.val[1], i.val[3]);
+        float32x4_t yr2 = vsubq_f32(r.val[0], r.val[2]), yi2 = vsubq_f32(i.val[0], i.val[2]);
+        float32x4_t yr3 = vsubq_f32(i.val[1], i.val[3]), yi3 = vsubq_f32(r.val[3], r.val[1]);
+
+        r.val[0] = vaddq_f32(yr0, yr1);
+        i.val[0] = vaddq_f32(yi0, yi1);
+        r.val[1] = vsubq_f32(yr0, yr1);
+        i.val[1] = vsubq_f32(yi0, yi1);
+        r.val[2] = vaddq_f32(yr2, yr3);
+        i.val[2] = vaddq_f32(yi2, yi3);
+        r.val[3] = vsubq_f32(yr2, yr3);
+        i.val[3] = vsubq_f32(yi2, yi3);
+        vst4q_f32(re + g, r);
+        vst4q_f32(im + g, i);
+    }
+    audio_feat_unscramble(re, im);
+
+    for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k += 4) {
+        float32x4_t ar = vld1q_f32(re + k), ai = vld1q_f32(im + k);
+        float32x4_t rr = vrev64q_f32(vld1q_f32(re + AUDIO_FEAT_HALF - k - 3));
+        float32x4_t ri = vrev64q_f32(vld1q_f32(im + AUDIO_FEAT_HALF - k - 3));
+        float32x4_t pr = vld1q_f32(feat_post_re + k), pi = vld1q_f32(feat_post_im + k);
+        float32x4_t er, ei, orr, oi, xr, xi;
+
+        rr = vcombine_f32(vget_high_f32(rr), vget_low_f32(rr));
+        ri = vcombine_f32(vget_high_f32(ri), vget_low_f32(ri));
+        er = vaddq_f32(ar, rr);
+        ei = vsubq_f32(ai, ri);
+        orr = vaddq_f32(ai, ri);
+        oi = vsubq_f32(rr, ar);
+        xr = vsubq_f32(vaddq_f32(er, vmulq_f32(pr, orr)), vmulq_f32(pi, oi));
+        xi = vaddq_f32(vaddq_f32(ei, vmulq_f32(pr, oi)), vmulq_f32(pi, orr));
+        vst1q_f32(a->acc + k, vaddq_f32(vld1q_f32(a->acc + k),
+            vaddq_f32(vmulq_f32(xr, xr), vmulq_f32(xi, xi))));
+    }
+    audio_feat_post_scalar(a, AUDIO_FEAT_HALF);
+}
+#endif
+
+/**
+ *  @fn audio_feat_init()
+ *  @brief builds the tables and picks the fastest implementation the cpu
+ *         runs
+ *  @param
+ *  @return
+ */
+static void audio_feat_init(void)
+{
+    const uint32_t edges[AUDIO_FEAT_BANDS + 1] = AUDIO_FEAT_BAND_EDGES;
+    uint32_t bits = 0;
+
+    while((1U << bits) < AUDIO_FEAT_HALF) {
+        bits++;
+    }
+
+    /* periodic hann window */
+    feat_win_power = 0.0;
+    for(uint32_t n = 0; n < AUDIO_FEAT_FFT_SIZE; n++) {
+        double w = 0.5 - 0.5 * cos(2.0 * M_PI * n / AUDIO_FEAT_FFT_SIZE);
+
+        if(n & 1) {
+            feat_win_im[n / 2] = (float)w;
+        } else {
+            feat_win_re[n / 2] = (float)w;
+        }
+        feat_win_power += w * w;
+    }
+
+    /* stage twiddles of butterflies h apart start at h - 1 */
+    for(uint32_t h = 1; h < AUDIO_FEAT_HALF; h <<= 1) {
+        for(uint32_t j = 0; j < h; j++) {
+            feat_tw_re[h - 1 + j] = (float)cos(M_PI * j / h);
+            feat_tw_im[h - 1 + j] = (float)-sin(M_PI * j / h);
+        }
+    }
+
+    for(uint32_t k = 0; k < AUDIO_FEAT_HALF; k++) {
+        uint32_t r = 0;
+
+        feat_post_re[k] = (float)cos(2.0 * M_PI * k / AUDIO_FEAT_FFT_SIZE);
+        feat_post_im[k] = (float)-sin(2.0 * M_PI * k / AUDIO_FEAT_FFT_SIZE);
+        for(uint32_t b = 0; b < bits; b++) {
+            r |= ((k >> b) & 1) << (bits - 1 - b);
+        }
+        if(k < r) {
+            feat_swap[feat_swaps][0] = (uint8_t)k;
+            feat_swap[feat_swaps][1] = (uint8_t)r;
+            feat_swaps++;
+        }
+    }
+
+    /* first bin of each band, the nyquist one closes the last */
+    for(uint32_t b = 0; b < AUDIO_FEAT_BANDS; b++) {
+        feat_band_bin[b] = (edges[b] * AUDIO_FEAT_FFT_SIZE + AUDIO_SAMPLE_RATE - 1) / AUDIO_SAMPLE_RATE;
+    }
+    feat_band_bin[AUDIO_FEAT_BANDS] = AUDIO_FEAT_BINS;
+
+    feat_fn = audio_feat_frame_scalar;
+    feat_name = "scalar";
+#if defined(__x86_64__)
+    feat_fn = audio_feat_frame_sse;
+    feat_name = "sse";
+    if(__builtin_cpu_supports("avx")) {
+        feat_fn = audio_feat_frame_avx;
+        feat_name = "avx";
+    }
+#elif defined(__aarch64__)
+    feat_fn = audio_feat_frame_neon;
+    feat_name = "neon";
+#endif
+}
+
+/**
+ *  @fn audio_feat_flush()
+ *  @brief appends the pending records with a single write
+ *  @param
+ *  @return
+ */
+static void audio_feat_flush(audio_feat_t *a)
+{
+    size_t size = a->pending_count * sizeof(audio_feat_record_t);
+
+    if(size && write(a->fd, a->pending, size) != (ssize_t)size) {
+        fprintf(stderr, "ERROR: Failed to write %u audio feature records.\n", a->pending_count);
+    }
+    a->pending_count = 0;
+}
+
+/**
+ *  @fn audio_feat_emit()
+ *  @brief turns the power accumulated since the last record into one
+ *  @param
+ *  @return
+ */
+static void audio_feat_emit(audio_feat_t *a)
+{
+    const double hz = (double)AUDIO_SAMPLE_RATE / AUDIO_FEAT_FFT_SIZE;
+    double p[AUDIO_FEAT_BINS];
+    double total = 0.0, moment = 0.0, logs = 0.0;
+    audio_feat_record_t *r;
+    uint32_t peak = 1;
+    double norm;
+
+    if(a->pending_count == AUDIO_FEAT_PENDING) {
+        audio_feat_flush(a);
+    }
+    r = &a->pending[a->pending_count++];
+    memset(r, 0, sizeof(*r));
+    r->magic = AUDIO_FEAT_MAGIC;
+    r->timestamp = a->timestamp + a->seconds++;
+    r->frames = (uint16_t)a->frames;
+
+    /* mean square per bin, the fft ran at twice the scale and only half
+     * the spectrum is kept, so all but dc and nyquist count twice */
+    norm = 2.0 / (4.0 * AUDIO_FEAT_FFT_SIZE * feat_win_power * a->frames);
+    for(uint32_t k = 0; k < AUDIO_FEAT_BINS; k++) {
+        p[k] = a->acc[k] * norm;
+    }
+    p[0] *= 0.5;
+    p[AUDIO_FEAT_HALF] *= 0.5;
+
+    for(uint32_t b = 0; b < AUDIO_FEAT_BANDS; b++) {
+        double e = 0.0;
+        double cdb;
+
+        for(uint32_t k = feat_band_bin[b]; k < feat_band_bin[b + 1]; k++) {
+            e += p[k];
+        }
+        cdb = (e > 0.0) ? 1000.0 * log10(e / AUDIO_FEAT_FULL_SCALE) : AUDIO_FEAT_FLOOR_CDB;
+        r->band_cdb[b] = (int16_t)((cdb < AUDIO_FEAT_FLOOR_CDB) ? AUDIO_FEAT_FLOOR_CDB : (cdb > 0.0) ? 0 : lrint(cdb));
+    }
+
+    /* dc says nothing about the hive, it stays out of the rest */
+    for(uint32_t k = 1; k < AUDIO_FEAT_BINS; k++) {
+        total += p[k];
+        moment += p[k] * k;
+        logs += log(p[k] + 1e-12);
+        peak = (p[k] > p[peak]) ? k : peak;
+    }
+
+    if(total > 0.0) {
+        double pos = peak;
+        double mean = total / (AUDIO_FEAT_BINS - 1);
+
+        /* a parabola through the peak and its neighbours beats the bin width */
+        if(peak > 1 && peak < AUDIO_FEAT_HALF) {
+            double d = p[peak - 1] - 2.0 * p[peak] + p[peak + 1];
+
+            if(d < 0.0) {
+                pos += 0.5 * (p[peak - 1] - p[peak + 1]) / d;
+            }
+        }
+        r->dominant_hz = (uint16_t)lrint(pos * hz);
+        r->centroid_hz = (uint16_t)lrint(moment / total * hz);
+        r->flatness = (uint16_t)lrint(fmin(exp(logs / (AUDIO_FEAT_BINS - 1)) / mean, 1.0) * UINT16_MAX);
+    }
+    r->crc = crc32c(0, r, offsetof(audio_feat_record_t, crc));
+
+    memset(a->acc, 0, sizeof(a->acc));
+    a->frames = 0;
+}
+
+/**
+ *  @fn audio_feat_record_ok()
+ *  @brief checks a feature record
+ *  @param
+ *  @return
+ */
+static bool audio_feat_record_ok(const audio_feat_record_t *r)
+{
+    return(r->magic == AUDIO_FEAT_MAGIC && r->crc == crc32c(0, r, offsetof(audio_feat_record_t, crc)));
+}
+
+
+/** public functions */
+audio_feat_t *audio_feat_open(const char *path)
+{
+    audio_feat_record_t r;
+    audio_feat_t *a;
+    off_t size, keep;
+
+    assert(path != NULL);
+
+    pthread_once(&feat_once, audio_feat_init);
+
+    /* the fft buffers inside need vector alignment */
+    if(posix_memalign((void **)&a, 32, sizeof(audio_feat_t))) {
+        return(NULL);
+    }
+    memset(a, 0, sizeof(audio_feat_t));
+
+    a->fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(a->fd < 0) {
+        fprintf(stderr, "ERROR: Failed to open audio feature file %s.\n", path);
+        free(a);
+        return(NULL);
+    }
+    snprintf(a->path, sizeof(a->path), "%s", path);
+
+    /* records are written whole, only the last one can be torn */
+    size = lseek(a->fd, 0, SEEK_END);
+    size = (size < 0) ? 0 : size;
+    keep = size - size % sizeof(r);
+    while(keep >= (off_t)sizeof(r)) {
+        if(pread(a->fd, &r, sizeof(r), keep - sizeof(r)) == sizeof(r) && audio_feat_record_ok(&r)) {
+            break;
+        }
+        keep -= sizeof(r);
+    }
+    if(keep != size && ftruncate(a->fd, keep) < 0) {
+        fprintf(stderr, "ERROR: Failed to repair audio feature file %s.\n", path);
+    }
+    return(a);
+}
+
+int audio_feat_rotate(audio_feat_t *a, const char *path)
+{
+    int fd;
+
+    assert(a != NULL && path != NULL);
+
+    if(a->fill || a->pending_count) {
+        audio_feat_end(a);
+    }
+    if(rename(a->path, path) < 0) {
+        fprintf(stderr, "ERROR: Failed to rotate audio feature file %s.\n", a->path);
+        return(-1);
+    }
+    fd = open(a->path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "ERROR: Failed to reopen audio feature file %s.\n", a->path);
+        return(-1);
+    }
+    close(a->fd);
+    a->fd = fd;
+    return(0);
+}
+
+void audio_feat_close(audio_feat_t *a)
+{
+    if(a == NULL) {
+        return;
+    }
+    audio_feat_end(a);
+    close(a->fd);
+    free(a);
+}
+
+void audio_feat_begin(audio_feat_t *a, uint32_t timestamp)
+{
+    assert(a != NULL);
+
+    /* a capture whose end never came still gets its records out */
+    if(a->fill || a->pending_count) {
+        audio_feat_end(a);
+    }
+    a->timestamp = timestamp;
+    a->seconds = 0;
+}
+
+void audio_feat_push(audio_feat_t *a, const int16_t *pcm, size_t count)
+{
+    uint64_t start;
+    size_t n;
+
+    assert(a != NULL && pcm != NULL);
+
+    start = audio_feat_now_ns();
+    while(count) {
+        n = AUDIO_FEAT_FFT_SIZE - a->fill;
+        n = (n < count) ? n : count;
+        memcpy(a->pcm + a->fill, pcm, n * sizeof(int16_t));
+        a->fill += n;
+        pcm += n;
+        count -= n;
+        if(a->fill < AUDIO_FEAT_FFT_SIZE) {
+            break;
+        }
+
+        /* frames overlap, the tail of this one starts the next */
+        audio_feat_frame(a, a->pcm);
+        memmove(a->pcm, a->pcm + AUDIO_FEAT_HOP, (AUDIO_FEAT_FFT_SIZE - AUDIO_FEAT_HOP) * sizeof(int16_t));
+        a->fill = AUDIO_FEAT_FFT_SIZE - AUDIO_FEAT_HOP;
+        if(++a->frames == AUDIO_FEAT_RECORD_FRAMES) {
+            audio_feat_emit(a);
+        }
+    }
+    a->cpu_ns += audio_feat_now_ns() - start;
+}
+
+void audio_feat_end(audio_feat_t *a)
+{
+    assert(a != NULL);
+
+    /* a short tail still makes a record if it covers a quarter second */
+    if(a->frames >= AUDIO_FEAT_RECORD_FRAMES / 4) {
+        audio_feat_emit(a);
+    }
+    memset(a->acc, 0, sizeof(a->acc));
+    a->frames = 0;
+    a->fill = 0;
+
+    if(a->pending_count) {
+        audio_feat_flush(a);
+        fdatasync(a->fd);
+    }
+}
+
+void audio_feat_frame(audio_feat_t *a, const int16_t *pcm)
+{
+    assert(a != NULL && pcm != NULL);
+
+    pthread_once(&feat_once, audio_feat_init);
+    feat_fn(a, pcm);
+    a->total_frames++;
+}
+
+int audio_feat_select(const char *name)
+{
+    assert(name != NULL);
+
+    pthread_once(&feat_once, audio_feat_init);
+    if(!strcmp(name, "scalar")) {
+        feat_fn = audio_feat_frame_scalar;
+        feat_name = "scalar";
+#if defined(__x86_64__)
+    } else if(!strcmp(name, "sse")) {
+        feat_fn = audio_feat_frame_sse;
+        feat_name = "sse";
+    } else if(!strcmp(name, "avx") && __builtin_cpu_supports("avx")) {
+        feat_fn = audio_feat_frame_avx;
+        feat_name = "avx";
+#elif defined(__aarch64__)
+    } else if(!strcmp(name, "neon")) {
+        feat_fn = audio_feat_frame_neon;
+        feat_name = "neon";
+#endif
+    } else {
+        return(-1);
+    }
+    return(0);
+}
+
+const char *audio_feat_impl_name(void)
+{
+    pthread_once(&feat_once, audio_feat_init);
+    return(feat_name);
+}
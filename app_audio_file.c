@@ -0,0 +1,989 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_audio_file.c
+ *  @brief beeinformed hive audio capture file, fragments are reassembled
+ *         straight into aligned buffers that a writer thread puts on disk
+ */
+
+/* O_DIRECT */
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "beeinformed_gateway.h"
+
+#define AUDIO_FILE_ALIGN_UP(x)      (((x) + AUDIO_FILE_ALIGN - 1) & ~(uint64_t)(AUDIO_FILE_ALIGN - 1))
+
+/** index entry as written before captures could be compressed */
+typedef struct __attribute__((packed)) {
+    uint64_t offset;
+    uint32_t timestamp;
+    uint32_t size;
+    uint32_t gaps;
+}audio_index_entry_v1_t;
+
+/** static variables */
+static pthread_t audio_writer_thread;
+static pthread_mutex_t audio_files_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t audio_writer_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t audio_files_idle_cond = PTHREAD_COND_INITIALIZER;
+static k_list_t audio_files = SYS_DLIST_STATIC_INIT(&audio_files);
+static bool audio_writer_should_run = false;
+
+
+/** static functions */
+
+/**
+ *  @fn audio_file_now_us()
+ *  @brief monotonic time in microseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t audio_file_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+/**
+ *  @fn audio_file_cpu_ns()
+ *  @brief cpu time of the calling thread in nanoseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t audio_file_cpu_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ *  @fn audio_file_sidecar_path()
+ *  @brief path of a file kept next to the data, its extension replaced
+ *  @param
+ *  @return
+ */
+static void audio_file_sidecar_path(const char *path, const char *ext, char *out, size_t size)
+{
+    char *dot;
+
+    snprintf(out, size, "%s", path);
+    dot = strrchr(out, '.');
+    if(dot != NULL && strchr(dot, '/') == NULL) {
+        *dot = 0;
+    }
+    strncat(out, ext, size - strlen(out) - 1);
+}
+
+/**
+ *  @fn audio_file_segment_path()
+ *  @brief path the audio file takes once it becomes a segment
+ *  @param
+ *  @return
+ */
+static void audio_file_segment_path(audio_file_t *f, const char *ext, char *out, size_t size)
+{
+    const char *base = strrchr(f->path, '/');
+    int dir_len = (base != NULL) ? base - f->path + 1 : 0;
+
+    snprintf(out, size, "%.*s" AUDIO_SEGMENT_FMT "%s", dir_len, f->path, f->seg_first, f->seg_last, ext);
+}
+
+/**
+ *  @fn audio_file_account()
+ *  @brief extends the range of the live file with a capture
+ *  @param
+ *  @return
+ */
+static void audio_file_account(audio_file_t *f, const audio_index_entry_t *e)
+{
+    if(!f->seg_captures++) {
+        f->seg_first = e->timestamp;
+    }
+    f->seg_last = e->timestamp + e->size / (AUDIO_SAMPLE_RATE * AUDIO_SAMPLE_BYTES);
+}
+
+/**
+ *  @fn audio_file_span()
+ *  @brief gets the range of the captures an index holds
+ *  @param
+ *  @return
+ */
+static void audio_file_span(audio_file_t *f, int idx_fd)
+{
+    audio_index_entry_t e;
+    off_t isize = lseek(idx_fd, 0, SEEK_END);
+
+    f->seg_captures = 0;
+    isize = (isize < 0) ? 0 : isize - isize % (off_t)sizeof(e);
+    if(isize < (off_t)sizeof(e) || pread(idx_fd, &e, sizeof(e), 0) != sizeof(e) || e.magic != AUDIO_INDEX_MAGIC) {
+        return;
+    }
+    audio_file_account(f, &e);
+    if(pread(idx_fd, &e, sizeof(e), isize - sizeof(e)) == sizeof(e)) {
+        audio_file_account(f, &e);
+    }
+    f->seg_captures = isize / sizeof(e);
+}
+
+/**
+ *  @fn audio_file_open_data()
+ *  @brief opens the data of the live file
+ *  @param
+ *  @return the descriptor, -1 on failure
+ */
+static int audio_file_open_data(audio_file_t *f)
+{
+    int fd = -1;
+
+    /* full aligned buffers let the data bypass the page cache */
+    f->direct = false;
+#ifdef O_DIRECT
+    fd = open(f->path, O_RDWR | O_CREAT | O_CLOEXEC | O_DIRECT, 0644);
+    f->direct = (fd >= 0);
+#endif
+    if(fd < 0) {
+        fd = open(f->path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    }
+    return(fd);
+}
+
+/**
+ *  @fn audio_file_rotate()
+ *  @brief turns the live file into a segment and starts a new one, by the
+ *         writer between captures
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+static int audio_file_rotate(audio_file_t *f)
+{
+    char idx_path[MAX_PATH_SIZE];
+    char seg_path[MAX_PATH_SIZE];
+    char seg_idx_path[MAX_PATH_SIZE];
+
+    audio_file_sidecar_path(f->path, ".idx", idx_path, sizeof(idx_path));
+    audio_file_segment_path(f, ".dat", seg_path, sizeof(seg_path));
+    audio_file_segment_path(f, ".idx", seg_idx_path, sizeof(seg_idx_path));
+
+    /* data moves first, open names an index left behind after the
+     * captures it holds */
+    if(rename(f->path, seg_path) < 0 || rename(idx_path, seg_idx_path) < 0) {
+        fprintf(stderr, "ERROR: Failed to rotate audio file %s.\n", f->path);
+        return(-1);
+    }
+    if(f->feat != NULL) {
+        audio_file_segment_path(f, ".feat", seg_path, sizeof(seg_path));
+        audio_feat_rotate(f->feat, seg_path);
+    }
+    close(f->fd);
+    close(f->idx_fd);
+
+    f->fd = audio_file_open_data(f);
+    f->idx_fd = open(idx_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    f->tail = 0;
+    f->seg_captures = 0;
+    pthread_mutex_lock(&f->lock);
+    f->stats.segments++;
+    pthread_mutex_unlock(&f->lock);
+    if(f->fd < 0 || f->idx_fd < 0) {
+        fprintf(stderr, "ERROR: Failed to reopen audio file %s.\n", f->path);
+        return(-1);
+    }
+    return(0);
+}
+
+/**
+ *  @fn audio_file_resume()
+ *  @brief finishes a rotation cut between its renames, an index whose
+ *         data is gone is moved to the segment its captures name
+ *  @param
+ *  @return
+ */
+static void audio_file_resume(audio_file_t *f, const char *idx_path)
+{
+    char seg_idx_path[MAX_PATH_SIZE];
+    int fd;
+
+    if(access(f->path, F_OK) == 0) {
+        return;
+    }
+    fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return;
+    }
+    audio_file_span(f, fd);
+    close(fd);
+
+    if(f->seg_captures) {
+        audio_file_segment_path(f, ".idx", seg_idx_path, sizeof(seg_idx_path));
+        if(rename(idx_path, seg_idx_path) == 0) {
+            printf("%s: finished the rotation of %s \n\r", __func__, f->path);
+        }
+    }
+    f->seg_captures = 0;
+}
+
+/**
+ *  @fn audio_file_seal()
+ *  @brief queues the buffer being filled for the writer, with file locked
+ *  @param
+ *  @return
+ */
+static void audio_file_seal(audio_file_t *f)
+{
+    sys_dlist_append(&f->sealed, &f->fill->link);
+    f->fill = NULL;
+}
+
+/**
+ *  @fn audio_file_take()
+ *  @brief makes a free buffer the one being filled, with file locked
+ *  @param
+ *  @return 0 on success, -1 if every buffer waits for the writer
+ */
+static int audio_file_take(audio_file_t *f)
+{
+    k_list_t *node = sys_dlist_get(&f->free);
+
+    if(node == NULL) {
+        f->stats.overruns++;
+        return(-1);
+    }
+    f->fill = CONTAINER_OF(node, audio_buf_t, link);
+    f->fill->len = 0;
+    f->fill->first = f->fresh;
+    f->fill->last = false;
+    f->fill->entry.timestamp = f->cur.timestamp;
+    f->fresh = false;
+    return(0);
+}
+
+/**
+ *  @fn audio_file_copy()
+ *  @brief copies samples into the write buffers, silence when data is NULL
+ *  @param
+ *  @return 0 on success, -1 if no buffer was free
+ */
+static int audio_file_copy(audio_file_t *f, const uint8_t *data, size_t size, bool *kick)
+{
+    audio_buf_t *b;
+    size_t n;
+    int ret;
+
+    while(size) {
+        if(f->fill == NULL) {
+            pthread_mutex_lock(&f->lock);
+            ret = audio_file_take(f);
+            pthread_mutex_unlock(&f->lock);
+            if(ret < 0) {
+                return(-1);
+            }
+        }
+
+        /* only the producer touches the buffer being filled */
+        b = f->fill;
+        n = f->capacity - b->len;
+        n = (n < size) ? n : size;
+        if(data != NULL) {
+            memcpy(b->data + b->len, data, n);
+            data += n;
+        } else {
+            memset(b->data + b->len, 0, n);
+        }
+        b->len += n;
+        f->cur.size += n;
+        size -= n;
+
+        if(b->len == f->capacity) {
+            pthread_mutex_lock(&f->lock);
+            audio_file_seal(f);
+            pthread_mutex_unlock(&f->lock);
+            *kick = true;
+        }
+    }
+    return(0);
+}
+
+/**
+ *  @fn audio_file_index_flush()
+ *  @brief makes the written data durable, then indexes its captures
+ *  @param
+ *  @return
+ */
+static void audio_file_index_flush(audio_file_t *f, const audio_index_entry_t *done, int count)
+{
+    fdatasync(f->fd);
+    if(!count) {
+        return;
+    }
+    if(write(f->idx_fd, done, count * sizeof(audio_index_entry_t)) != (ssize_t)(count * sizeof(audio_index_entry_t))) {
+        fprintf(stderr, "ERROR: Failed to write the audio index.\n");
+    }
+    fdatasync(f->idx_fd);
+}
+
+/**
+ *  @fn audio_file_drain()
+ *  @brief encodes and writes the sealed buffers of a file, then the index
+ *         entries of the captures they complete, by the writer holding a
+ *         reference or by the closer once the file is off the list
+ *  @param
+ *  @return
+ */
+static void audio_file_drain(audio_file_t *f)
+{
+    audio_index_entry_t done[AUDIO_FILE_BUFFERS];
+    uint64_t cpu = audio_file_cpu_ns();
+    const uint8_t *data;
+    k_list_t *node;
+    audio_buf_t *b;
+    bool wrote = false;
+    int count = 0;
+    size_t len;
+
+    for(;;) {
+        pthread_mutex_lock(&f->lock);
+        node = sys_dlist_get(&f->sealed);
+        pthread_mutex_unlock(&f->lock);
+        if(node == NULL) {
+            break;
+        }
+
+        /* the writer alone knows where things land on disk */
+        b = CONTAINER_OF(node, audio_buf_t, link);
+        if(b->first) {
+            if(f->seg_captures && (f->tail >= AUDIO_SEGMENT_MAX_SIZE ||
+                b->entry.timestamp / AUDIO_SEGMENT_PERIOD != f->seg_first / AUDIO_SEGMENT_PERIOD)) {
+                audio_file_index_flush(f, done, count);
+                count = 0;
+                audio_file_rotate(f);
+            }
+            f->capture_offset = f->tail;
+            f->enc_state.index = 0;
+        }
+
+        /* features come from the samples before the codec touches them */
+        if(f->feat != NULL) {
+            if(b->first) {
+                audio_feat_begin(f->feat, b->entry.timestamp);
+            }
+            audio_feat_push(f->feat, (const int16_t *)b->data, b->len / AUDIO_SAMPLE_BYTES);
+            if(b->last) {
+                audio_feat_end(f->feat);
+            }
+        }
+
+        data = b->data;
+        len = b->len;
+        if(f->format == k_audio_format_adpcm) {
+            len = audio_adpcm_encode(&f->enc_state, (const int16_t *)b->data, b->len / AUDIO_SAMPLE_BYTES, f->enc);
+            data = f->enc;
+        }
+
+        /* only the end of a capture is short, padding keeps the next one
+         * and every write aligned */
+        if(b->last) {
+            memset((uint8_t *)data + len, 0, AUDIO_FILE_ALIGN_UP(len) - len);
+            len = AUDIO_FILE_ALIGN_UP(len);
+        }
+        if(len && pwrite(f->fd, data, len, f->tail) != (ssize_t)len) {
+            fprintf(stderr, "ERROR: Failed to write %zu bytes of audio.\n", len);
+        }
+        f->tail += len;
+        wrote = true;
+
+        if(b->last) {
+            done[count] = b->entry;
+            done[count].offset = f->capture_offset;
+            done[count].crc = crc32c(0, &done[count], offsetof(audio_index_entry_t, crc));
+            audio_file_account(f, &done[count]);
+            if(++count == AUDIO_FILE_BUFFERS) {
+                audio_file_index_flush(f, done, count);
+                count = 0;
+            }
+        }
+
+        pthread_mutex_lock(&f->lock);
+        f->stats.writes += (len != 0);
+        f->stats.disk_bytes += len;
+        sys_dlist_append(&f->free, &b->link);
+        pthread_mutex_unlock(&f->lock);
+    }
+    if(!wrote) {
+        return;
+    }
+    audio_file_index_flush(f, done, count);
+
+    pthread_mutex_lock(&f->lock);
+    f->stats.write_cpu_ns += audio_file_cpu_ns() - cpu;
+    if(f->feat != NULL) {
+        f->stats.feat_frames = f->feat->total_frames;
+        f->stats.feat_cpu_ns = f->feat->cpu_ns;
+    }
+    pthread_mutex_unlock(&f->lock);
+}
+
+/**
+ *  @fn audio_file_drain_all()
+ *  @brief drains every open file, with files list locked
+ *
+ *  The list lock is dropped around the io of each file, so devices
+ *  opening, closing or analyzing their files wait for one file at most,
+ *  not for the whole pass. The file worked on holds a reference, which
+ *  keeps it on the list until it is done.
+ *
+ *  @param
+ *  @return
+ */
+static void audio_file_drain_all(void)
+{
+    k_list_t *node = sys_dlist_peek_head(&audio_files);
+    audio_file_t *f;
+
+    while(node != NULL) {
+        f = CONTAINER_OF(node, audio_file_t, link);
+        f->refs++;
+        pthread_mutex_unlock(&audio_files_mutex);
+
+        audio_file_drain(f);
+
+        pthread_mutex_lock(&audio_files_mutex);
+        node = sys_dlist_peek_next(&audio_files, node);
+        if(!--f->refs) {
+            pthread_cond_broadcast(&audio_files_idle_cond);
+        }
+    }
+}
+
+/**
+ *  @fn audio_file_writer_thread()
+ *  @brief audio writer thread
+ *  @param
+ *  @return
+ */
+static void *audio_file_writer_thread(void *args)
+{
+    struct timespec ts;
+
+    (void)args;
+
+    pthread_mutex_lock(&audio_files_mutex);
+    while(audio_writer_should_run) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += AUDIO_FILE_WRITER_MS * 1000000L;
+        if(ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+
+        /* woken as buffers fill, the period only covers a missed wakeup */
+        pthread_cond_timedwait(&audio_writer_cond, &audio_files_mutex, &ts);
+        audio_file_drain_all();
+    }
+    pthread_mutex_unlock(&audio_files_mutex);
+
+    return(NULL);
+}
+
+/**
+ *  @fn audio_file_index_upgrade()
+ *  @brief rewrites an index of uncompressed captures in the current layout
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+static int audio_file_index_upgrade(const char *idx_path)
+{
+    char tmp_path[MAX_PATH_SIZE + sizeof(".tmp")];
+    audio_index_entry_v1_t *old = NULL;
+    audio_index_entry_t e;
+    struct stat st;
+    uint32_t magic;
+    size_t count;
+    int fd, out = -1;
+    int ret = -1;
+
+    /* a cut name would be another file, and the cleanup unlinks it */
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", idx_path) >= (int)sizeof(tmp_path)) {
+        return(-1);
+    }
+    fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return(0);
+    }
+    if(fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(magic) ||
+        pread(fd, &magic, sizeof(magic), 0) != sizeof(magic) || magic == AUDIO_INDEX_MAGIC) {
+        close(fd);
+        return(0);
+    }
+
+    count = st.st_size / sizeof(audio_index_entry_v1_t);
+    old = malloc(count * sizeof(audio_index_entry_v1_t) + 1);
+    out = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(old == NULL || out < 0 || pread(fd, old, count * sizeof(audio_index_entry_v1_t), 0) !=
+        (ssize_t)(count * sizeof(audio_index_entry_v1_t))) {
+        goto cleanup;
+    }
+
+    for(size_t i = 0; i < count; i++) {
+        memset(&e, 0, sizeof(e));
+        e.magic = AUDIO_INDEX_MAGIC;
+        e.format = k_audio_format_pcm;
+        e.offset = old[i].offset;
+        e.timestamp = old[i].timestamp;
+        e.size = old[i].size;
+        e.gaps = old[i].gaps;
+        e.crc = crc32c(0, &e, offsetof(audio_index_entry_t, crc));
+        if(write(out, &e, sizeof(e)) != sizeof(e)) {
+            goto cleanup;
+        }
+    }
+    if(fdatasync(out) < 0 || rename(tmp_path, idx_path) < 0) {
+        goto cleanup;
+    }
+    printf("%s: %s upgraded, %zu captures \n\r", __func__, idx_path, count);
+    ret = 0;
+
+cleanup:
+    if(out >= 0) {
+        close(out);
+    }
+    if(ret < 0) {
+        unlink(tmp_path);
+    }
+    close(fd);
+    free(old);
+    return(ret);
+}
+
+/**
+ *  @fn audio_file_entry_ok()
+ *  @brief checks an index entry and the extent of its data
+ *  @param
+ *  @return
+ */
+static bool audio_file_entry_ok(const audio_index_entry_t *e, uint64_t size)
+{
+    return(e->magic == AUDIO_INDEX_MAGIC && e->crc == crc32c(0, e, offsetof(audio_index_entry_t, crc)) &&
+        e->offset + audio_index_disk_size(e) <= size);
+}
+
+/**
+ *  @fn audio_file_repair()
+ *  @brief drops the index entries torn or pointing past the end of the data
+ *  @param
+ *  @return end of the data
+ */
+static uint64_t audio_file_repair(int fd, int idx_fd)
+{
+    audio_index_entry_t e;
+    off_t size = lseek(fd, 0, SEEK_END);
+    off_t isize = lseek(idx_fd, 0, SEEK_END);
+    off_t keep = isize - isize % sizeof(e);
+
+    size = (size < 0) ? 0 : size;
+    while(keep >= (off_t)sizeof(e)) {
+        if(pread(idx_fd, &e, sizeof(e), keep - sizeof(e)) == sizeof(e) && audio_file_entry_ok(&e, size)) {
+            break;
+        }
+        keep -= sizeof(e);
+    }
+    if(keep != isize && ftruncate(idx_fd, keep) < 0) {
+        fprintf(stderr, "ERROR: Failed to repair the audio index.\n");
+    }
+    return(size);
+}
+
+/**
+ *  @fn audio_file_release()
+ *  @brief releases a file and whatever it got to open
+ *  @param
+ *  @return
+ */
+static void audio_file_release(audio_file_t *f)
+{
+    if(f->fd >= 0) {
+        close(f->fd);
+    }
+    if(f->idx_fd >= 0) {
+        close(f->idx_fd);
+    }
+    audio_feat_close(f->feat);
+    free(f->mem);
+    free(f->enc);
+    free(f);
+}
+
+
+/** public functions */
+int audio_file_start(void)
+{
+    audio_writer_should_run = true;
+    if(pthread_create(&audio_writer_thread, NULL, audio_file_writer_thread, NULL)) {
+        audio_writer_should_run = false;
+        fprintf(stderr, "ERROR: Failed to start the audio writer thread.\n");
+        return(-1);
+    }
+    return(0);
+}
+
+void audio_file_finish(void)
+{
+    pthread_mutex_lock(&audio_files_mutex);
+    if(!audio_writer_should_run) {
+        pthread_mutex_unlock(&audio_files_mutex);
+        return;
+    }
+    audio_writer_should_run = false;
+    pthread_cond_signal(&audio_writer_cond);
+    pthread_mutex_unlock(&audio_files_mutex);
+
+    pthread_join(audio_writer_thread, NULL);
+}
+
+audio_file_t *audio_file_open(const char *path, audio_file_format_t format)
+{
+    char idx_path[MAX_PATH_SIZE];
+    audio_file_t *f;
+
+    assert(path != NULL);
+
+    f = calloc(1, sizeof(audio_file_t));
+    if(f == NULL) {
+        return(NULL);
+    }
+    f->fd = -1;
+    f->idx_fd = -1;
+    snprintf(f->path, sizeof(f->path), "%s", path);
+
+    audio_file_sidecar_path(path, ".idx", idx_path, sizeof(idx_path));
+    audio_file_resume(f, idx_path);
+    if(audio_file_index_upgrade(idx_path) < 0) {
+        goto cleanup;
+    }
+
+    f->fd = audio_file_open_data(f);
+    f->idx_fd = open(idx_path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(f->fd < 0 || f->idx_fd < 0) {
+        goto cleanup;
+    }
+    f->tail = AUDIO_FILE_ALIGN_UP(audio_file_repair(f->fd, f->idx_fd));
+    audio_file_span(f, f->idx_fd);
+
+    if(posix_memalign((void **)&f->mem, AUDIO_FILE_ALIGN, AUDIO_FILE_BUFFERS * AUDIO_FILE_BUFFER_SIZE)) {
+        f->mem = NULL;
+        goto cleanup;
+    }
+
+    /* compressed buffers hold whole frames, so none spans two writes */
+    f->format = format;
+    f->capacity = AUDIO_FILE_BUFFER_SIZE;
+    if(format == k_audio_format_adpcm) {
+        f->capacity = AUDIO_FILE_BUFFER_FRAMES * AUDIO_ADPCM_FRAME_SAMPLES * AUDIO_SAMPLE_BYTES;
+        if(posix_memalign((void **)&f->enc, AUDIO_FILE_ALIGN,
+            AUDIO_FILE_ALIGN_UP(AUDIO_FILE_BUFFER_FRAMES * AUDIO_ADPCM_FRAME_SIZE))) {
+            f->enc = NULL;
+            goto cleanup;
+        }
+    }
+
+    pthread_mutex_init(&f->lock, NULL);
+    sys_dlist_init(&f->sealed);
+    sys_dlist_init(&f->free);
+    for(int i = 0; i < AUDIO_FILE_BUFFERS; i++) {
+        f->bufs[i].data = f->mem + i * AUDIO_FILE_BUFFER_SIZE;
+        sys_dlist_append(&f->free, &f->bufs[i].link);
+    }
+
+    pthread_mutex_lock(&audio_files_mutex);
+    sys_dlist_append(&audio_files, &f->link);
+    pthread_mutex_unlock(&audio_files_mutex);
+
+    return(f);
+
+cleanup:
+    fprintf(stderr, "ERROR: Failed to open audio file %s.\n", path);
+    audio_file_release(f);
+    return(NULL);
+}
+
+int audio_file_analyze(audio_file_t *f, const char *path)
+{
+    audio_feat_t *feat;
+
+    assert(f != NULL && path != NULL);
+
+    feat = audio_feat_open(path);
+    if(feat == NULL) {
+        return(-1);
+    }
+
+    /* the writer may be draining this file right now, it takes no new
+     * reference while the list is locked */
+    pthread_mutex_lock(&audio_files_mutex);
+    while(f->refs) {
+        pthread_cond_wait(&audio_files_idle_cond, &audio_files_mutex);
+    }
+    audio_feat_close(f->feat);
+    f->feat = feat;
+    pthread_mutex_unlock(&audio_files_mutex);
+    return(0);
+}
+
+void audio_file_close(audio_file_t *f, audio_file_stats_t *s)
+{
+    if(f == NULL) {
+        return;
+    }
+
+    audio_file_end(f, NULL);
+
+    /* a drain working on the file finishes it first, the others skip it */
+    pthread_mutex_lock(&audio_files_mutex);
+    while(f->refs) {
+        pthread_cond_wait(&audio_files_idle_cond, &audio_files_mutex);
+    }
+    sys_dlist_remove(&f->link);
+    pthread_mutex_unlock(&audio_files_mutex);
+
+    audio_file_drain(f);
+
+    if(s != NULL) {
+        *s = f->stats;
+    }
+
+    pthread_mutex_destroy(&f->lock);
+    audio_file_release(f);
+}
+
+void audio_file_begin(audio_file_t *f, uint32_t timestamp)
+{
+    assert(f != NULL);
+
+    if(f->capturing) {
+        audio_file_end(f, NULL);
+    }
+
+    f->capturing = true;
+    f->fresh = true;
+    f->seq = 0;
+    f->begin_us = audio_file_now_us();
+    memset(&f->cur, 0, sizeof(f->cur));
+    f->cur.magic = AUDIO_INDEX_MAGIC;
+    f->cur.format = f->format;
+    f->cur.frame_size = (f->format == k_audio_format_adpcm) ? AUDIO_ADPCM_FRAME_SIZE : 0;
+    f->cur.timestamp = timestamp;
+}
+
+int audio_file_put(audio_file_t *f, uint8_t seq, const uint8_t *data, size_t size)
+{
+    uint8_t lost;
+    bool kick = false;
+    int ret = -1;
+
+    assert(f != NULL && data != NULL);
+
+    if(!f->capturing) {
+        return(-1);
+    }
+
+    /* a fragment from behind the stream is a duplicate or came too late,
+     * its place was already filled */
+    lost = seq - f->seq;
+    if(lost >= AUDIO_FRAGMENT_LATE) {
+        return(0);
+    }
+
+    /* keeps the samples after a gap where they belong in time, only the
+     * last fragment of a capture is short */
+    f->seq = seq + 1;
+    if(lost) {
+        f->cur.gaps += lost;
+        if(audio_file_copy(f, NULL, (size_t)lost * AUDIO_FRAGMENT_SIZE, &kick) < 0) {
+            goto cleanup;
+        }
+    }
+    ret = audio_file_copy(f, data, size, &kick);
+
+cleanup:
+    if(kick) {
+        pthread_cond_signal(&audio_writer_cond);
+    }
+    return(ret);
+}
+
+void audio_file_end(audio_file_t *f, audio_index_entry_t *entry)
+{
+    assert(f != NULL);
+
+    if(!f->capturing) {
+        return;
+    }
+    f->capturing = false;
+
+    pthread_mutex_lock(&f->lock);
+
+    /* a capture ending on a buffer boundary still needs a buffer to carry
+     * its entry to the writer */
+    if(f->cur.size && (f->fill != NULL || audio_file_take(f) == 0)) {
+        f->fill->last = true;
+        f->fill->entry = f->cur;
+        audio_file_seal(f);
+    }
+    f->stats.captures++;
+    f->stats.bytes += f->cur.size;
+    f->stats.gaps += f->cur.gaps;
+    f->stats.stream_us += audio_file_now_us() - f->begin_us;
+    pthread_mutex_unlock(&f->lock);
+
+    if(entry != NULL) {
+        *entry = f->cur;
+    }
+    pthread_cond_signal(&audio_writer_cond);
+}
+
+void audio_file_get_stats(audio_file_t *f, audio_file_stats_t *s)
+{
+    assert(f != NULL && s != NULL);
+
+    pthread_mutex_lock(&f->lock);
+    *s = f->stats;
+    pthread_mutex_unlock(&f->lock);
+}
+
+uint64_t audio_index_disk_size(const audio_index_entry_t *e)
+{
+    assert(e != NULL);
+
+    if(e->format == k_audio_format_adpcm) {
+        return((uint64_t)AUDIO_ADPCM_FRAMES(e->size / AUDIO_SAMPLE_BYTES) * e->frame_size);
+    }
+    return(e->size);
+}
+
+audio_reader_t *audio_reader_open(const char *path)
+{
+    char idx_path[MAX_PATH_SIZE];
+    audio_reader_t *r;
+    struct stat st;
+    size_t count;
+    int fd = -1;
+    int idx_fd = -1;
+
+    assert(path != NULL);
+
+    r = calloc(1, sizeof(audio_reader_t));
+    if(r == NULL) {
+        return(NULL);
+    }
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || fstat(fd, &st) < 0) {
+        goto cleanup;
+    }
+    r->size = st.st_size;
+    if(r->size) {
+        r->base = mmap(NULL, r->size, PROT_READ, MAP_SHARED, fd, 0);
+        if(r->base == MAP_FAILED) {
+            r->base = NULL;
+            goto cleanup;
+        }
+    }
+
+    audio_file_sidecar_path(path, ".idx", idx_path, sizeof(idx_path));
+    idx_fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+    if(idx_fd >= 0 && fstat(idx_fd, &st) == 0) {
+        count = st.st_size / sizeof(audio_index_entry_t);
+        r->idx = malloc(count * sizeof(audio_index_entry_t) + 1);
+        if(r->idx == NULL) {
+            goto cleanup;
+        }
+        if(count && pread(idx_fd, r->idx, count * sizeof(audio_index_entry_t), 0) !=
+            (ssize_t)(count * sizeof(audio_index_entry_t))) {
+            count = 0;
+        }
+
+        /* a writer may still be appending, only whole intact entries count */
+        while(r->captures < count && audio_file_entry_ok(&r->idx[r->captures], r->size)) {
+            r->captures++;
+        }
+    }
+
+    if(idx_fd >= 0) {
+        close(idx_fd);
+    }
+    close(fd);
+    return(r);
+
+cleanup:
+    if(idx_fd >= 0) {
+        close(idx_fd);
+    }
+    if(fd >= 0) {
+        close(fd);
+    }
+    audio_reader_close(r);
+    return(NULL);
+}
+
+void audio_reader_close(audio_reader_t *r)
+{
+    if(r == NULL) {
+        return;
+    }
+    if(r->base != NULL) {
+        munmap((void *)r->base, r->size);
+    }
+    free(r->idx);
+    free(r);
+}
+
+ssize_t audio_reader_read(audio_reader_t *r, size_t capture, size_t sample, int16_t *pcm, size_t count)
+{
+    int16_t frame[AUDIO_ADPCM_FRAME_SAMPLES];
+    const audio_index_entry_t *e;
+    const uint8_t *p;
+    size_t total;
+    size_t skip;
+    size_t done = 0;
+    size_t n;
+
+    assert(r != NULL && pcm != NULL);
+
+    if(capture >= r->captures) {
+        return(-1);
+    }
+    e = &r->idx[capture];
+    total = e->size / AUDIO_SAMPLE_BYTES;
+    if(sample >= total) {
+        return(0);
+    }
+    count = (count < total - sample) ? count : total - sample;
+
+    if(e->format == k_audio_format_pcm) {
+        memcpy(pcm, r->base + e->offset + sample * AUDIO_SAMPLE_BYTES, count * AUDIO_SAMPLE_BYTES);
+        return(count);
+    }
+    if(e->format != k_audio_format_adpcm || e->frame_size != AUDIO_ADPCM_FRAME_SIZE) {
+        return(-1);
+    }
+
+    /* fixed size frames make the frame holding any sample a multiply away */
+    p = r->base + e->offset + (sample / AUDIO_ADPCM_FRAME_SAMPLES) * AUDIO_ADPCM_FRAME_SIZE;
+    skip = sample % AUDIO_ADPCM_FRAME_SAMPLES;
+    while(done < count) {
+        if(audio_adpcm_decode(p, frame) < 0) {
+            return(-1);
+        }
+        n = AUDIO_ADPCM_FRAME_SAMPLES - skip;
+        n = (n < count - done) ? n : count - done;
+        memcpy(pcm + done, frame + skip, n * sizeof(int16_t));
+        done += n;
+        skip = 0;
+        p += AUDIO_ADPCM_FRAME_SIZE;
+    }
+    return(done);
+}
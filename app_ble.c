@@ -11,19 +11,40 @@
 /** scan timeout value */
 #define BEEINFO_BLE_DEF_TIMEOUT         2
 
-/** defines the messaging max slot size */
-#define BLE_MESSAGE_SLOT_SIZE	sizeof(ble_data_t)
-
-
 /** define the sleep period in seconds */
 #define BEEINFO_BLE_SCAN_SLEEP_TIME     (1000 * 500)
 #define BEEINFO_BLE_ACQ_PERIOD          (1000 * 1)
 
-/** characteristics handle */
+/** hive audio capture length and period in seconds */
+#define BEEINFO_BLE_AUDIO_SECONDS       4
+#define BEEINFO_BLE_AUDIO_PERIOD        (60 * 10)
+
+/** format of new hive audio captures */
+#define BEEINFO_AUDIO_FILE_FORMAT       k_audio_format_adpcm
+
+/** block format of new acquisition data */
+#define BEEINFO_ACQ_FILE_FORMAT         k_acq_format_columnar
+
+/** threads running the blocking gatt operations, connect with discovery and
+ *  writes with response, so none of them holds a worker of the event loop.
+ *  Connects take at most BLE_LINK_MAX_CONNECTS of them, the polls of the
+ *  connected hives always find a free one */
+#define BLE_LINK_THREADS                4
+#define BLE_LINK_MAX_CONNECTS           (BLE_LINK_THREADS / 2)
+
+/** characteristics handle, used when discovery does not find them */
 #define BLE_TX_HANDLE                   0x0010
 #define BLE_RX_HANDLE                   0x0012
 #define BLE_NOTI_HANDLE                 0x0013
 
+/** characteristic properties telling the tx and rx characteristics apart */
+#define BLE_PROP_WRITE_NO_RSP           0x04
+#define BLE_PROP_WRITE                  0x08
+#define BLE_PROP_NOTIFY                 0x10
+
+/** database hash characteristic of the generic attribute service */
+#define BLE_DB_HASH_UUID                0x2B2A
+
 
 /** connected device manager structure */
 
@@ -31,106 +52,146 @@
 /** static variables */
 static pthread_t ble_conn_thread;
 static pthread_attr_t ble_conn_att;
-static pthread_mutex_t cfg_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_mutex_t scan_mutex = PTHREAD_MUTEX_INITIALIZER;
-static pthread_mutex_t gatt_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static pthread_t ble_link_threads[BLE_LINK_THREADS];
+static uint32_t ble_link_started = 0;
+static pthread_mutex_t ble_link_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ble_link_cond = PTHREAD_COND_INITIALIZER;
+static k_list_t ble_link_connects = SYS_DLIST_STATIC_INIT(&ble_link_connects);
+static k_list_t ble_link_writes = SYS_DLIST_STATIC_INIT(&ble_link_writes);
+static uint32_t ble_link_connecting = 0;
+static bool ble_link_should_run = true;
 
 static bool ble_conn_should_run = true;
 static void* hci_adapter = NULL;
 char *cfg;
 
-k_list_t ble_devices;
+/* senders may walk it before the manager starts, inside an epoch section */
+static devtab_t ble_devices = DEVTAB_STATIC_INIT;
 
 /** static funcions */
 
 /**
- *  @fn ble_comm_timeout()
- *  @brief handles communication timeout * 
+ *  @fn ble_now_us()
+ *  @brief monotonic time in microseconds
  *  @param
  *  @return
  */
-static void ble_comm_timeout(union sigval s) {
-    ble_device_handle_t *dev = (ble_device_handle_t *)s.sival_ptr;
+static inline uint64_t ble_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+/**
+ *  @fn ble_now_ns()
+ *  @brief monotonic time in nanoseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t ble_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ *  @fn ble_device_timer_handler()
+ *  @brief handles device timer expiration, acquisition period or
+ *         communication timeout depending on the device state
+ *  @param
+ *  @return
+ */
+static void ble_device_timer_handler(void *args) {
+    ble_device_handle_t *dev = (ble_device_handle_t *)args;
 
     if(dev != NULL) {
-        printf("%s : --------------- COMMUNICATION TIMEOUT ---------------\n\r\n\r", __func__);
-        ble_data_t packet;
-        packet.type = k_command_packet;
-        packet.id   = 0xFF;
-    
+        /* the ring has a single producer, so flag the timer beside it */
+        atomic_store(&dev->timer_fired, true);
+        ble_rx_ring_wakeup(&dev->rx);
+    }
+}
 
-        mqd_t mq;
-        struct mq_attr attr;
-        attr.mq_flags = O_NONBLOCK;
-    
-        char mq_str[32] = {0};
-        strcpy(mq_str, "/mq_");
-        strcat(mq_str, dev->bd_addr);
-    
-        mq = mq_open(mq_str,O_WRONLY, 0644, &attr);
-        mq_send(mq, (uint8_t *)&packet,  sizeof(packet) , 0);
-        mq_close(mq);
-        printf("%s : --------------- COMMUNICATION HANDLERED ---------------\n\r\n\r", __func__);
+/**
+ *  @fn ble_device_arm_timer()
+ *  @brief arms the device timer, period or communication timeout
+ *  @param
+ *  @return
+ */
+static inline void ble_device_arm_timer(ble_device_handle_t *h, uint32_t usec)
+{
+    app_timer_arm(&h->timer, usec);
+}
+
+/**
+ *  @fn ble_device_write()
+ *  @brief writes to the node rx characteristic and accounts for it
+ *  @param ack - waits for the write response
+ *  @return 0 on success, gattlib error otherwise
+ */
+static int ble_device_write(ble_device_handle_t *h, const void *data, size_t len, bool ack)
+{
+    int ret;
+
+    ret = (ack) ? gattlib_write_char_by_handle(h->conn_handle, h->tx_handle, data, len) :
+        gattlib_write_without_response_char_by_handle(h->conn_handle, h->tx_handle, data, len);
+    if(!ret) {
+        stats_add(&h->stats->tx_writes, 1);
+        stats_add(&h->stats->tx_bytes, len);
     }
+    return(ret);
 }
 
+/**
+ *  @fn ble_device_write_acked()
+ *  @brief prepares a write with response for the link threads, the device
+ *         leaves the event loop once its step ends and done runs on the
+ *         loop when it comes back
+ *  @param done - called with the result of the write
+ *  @return
+ */
+static void ble_device_write_acked(ble_device_handle_t *h, const void *data, size_t len,
+    void (*done)(ble_device_handle_t *h, int ret))
+{
+    assert(len <= sizeof(h->link_packet));
+
+    memcpy(&h->link_packet, data, len);
+    h->link_len = len;
+    h->link_done = done;
+    h->link_op = k_link_write;
+}
 
 
 /**
  *  @fn ble_add_device_to_list()
- *  @brief handles device discovering 
+ *  @brief looks the device up on the registry, adding it if unknown
  *  @param
- *  @return
+ *  @return true if the device was never seen before
  */
-static bool ble_add_device_to_list(char * path , ble_device_handle_t *h)
+static bool ble_add_device_to_list(ble_device_handle_t *h)
 {
-    bool ret = true;
-    ble_device_handle_t dev;
-    bool found = false;
-    int bread= 0;
-    FILE *fp = fopen(path, "rb");
+    registry_record_t rec;
+    bool is_new = false;
 
-    printf("%s:Config file: %s \n\r", __func__, path); 
-    
-    pthread_mutex_lock(&cfg_mutex);
     /* this should never happen */
     assert(h != NULL);
-    assert(fp != NULL);
-
-    for(;;){
-        /* reads one entry of the config file */
-        bread = fread( &dev, 1, sizeof(ble_device_handle_t), fp );
-
-        if(!bread) {
-            printf("%s: reached on end of file exiting  \n\r", __func__);                       
-            break;
-        } else {
-            printf("%s: Current device found: %s  \n\r", __func__, dev.bd_addr);                        
-            /* compare if the entry already exist */
-            if(!strcmp(h->bd_addr, dev.bd_addr)) {
-                printf("%s:----------------DEVICE FOUND IT ACQUISITION WILL BE RESTORED ------------\n\r", __func__);
-                found = true;
-                break;
-            }             
-        }
 
+    if(registry_lookup(h->bd_addr, &rec)) {
+        LOG_INFO("device found it acquisition will be restored");
+        h->addr_type = rec.addr_type;
+        return(false);
     }
 
-    fclose(fp);
-    
     /* if no such device, add it as a new one */
-    if(!found) {
-       printf("%s:----------------NEW BEEHIVE SENSOR ADDING IT ON KNOWNS LIST ------------\n\r", __func__); 
-       fp = fopen(path, "ab");  
-       fwrite (h, 1, sizeof(ble_device_handle_t), fp );
-       fclose(fp);
-       ret = true;
-    } else {
-        ret = false;
-    }
-
-    pthread_mutex_unlock(&cfg_mutex);
-    return(ret);
+    LOG_INFO("new beehive sensor adding it on knowns list");
+    h->addr_type = BDADDR_LE_PUBLIC;
+    registry_add(h->bd_addr, h->device_name, h->addr_type, &is_new);
+    return(is_new);
 }
 
 
@@ -144,209 +205,705 @@ static bool ble_add_device_to_list(char * path , ble_device_handle_t *h)
 static void ble_rx_handler(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data) 
 {
     ble_device_handle_t *dev = (ble_device_handle_t *)user_data;
-    ble_data_t dump;
+    (void)uuid;
     assert(dev != NULL);
 
-    memcpy(&dump, data, data_length);
-
-    //printf("%s: device: %s \n\r", __func__, dev->bd_addr );
-    //printf("%s: type: %d!! \n\r", __func__, dump.type);
-    //printf("%s: id: %d!! \n\r", __func__, dump.id);
-    //printf("%s: pack_amount: %d!! \n\r", __func__, dump.pack_amount);
-    //printf("%s: payload_size: %d!! \n\r", __func__, dump.payload_size);
-
-    /* data received, store on queue for furthre processing */
-    mqd_t mq;
-    struct mq_attr attr;
-    attr.mq_flags = O_NONBLOCK;
+    ble_device_ingest(dev, data, data_length);
+}
 
-    char mq_str[32] = {0};
-    strcpy(mq_str, "/mq_");
-    strcat(mq_str, dev->bd_addr);
 
-    mq = mq_open(mq_str,O_WRONLY, 0644, &attr);
-    if(mq_send(mq, (uint8_t *)&dump,  sizeof(dump) , 0) < 0) {
-        printf("%s: queue seems to be full! \n\r", __func__);    
+/**
+ *  @fn ble_device_sensors_sent()
+ *  @brief the node took the sensors command, its response is awaited
+ *  @param ret - result of the write
+ *  @return
+ */
+static void ble_device_sensors_sent(ble_device_handle_t *h, int ret)
+{
+    h->cycle[k_lat_write + 1] = h->link_ns;
+    if(ret) {
+        LOG_ERR("failed to send command to device");
+        atomic_store(&h->rx_stamp, false);
+        h->should_run = false;        
+    } else {
+        h->rx_offset = 0;
+        h->rx_pending = 0;
+        h->rx_started = false;
+        h->state = k_dev_wait_response;
+        ble_device_arm_timer(h, BLE_COMM_TIMEOUT * 1000 * 1000);
+        LOG_DEBUG("packet sent to device, waiting response");
     }
-    mq_close(mq);
 }
 
-
 /**
- *  @fn ble_device_handle_acquisition()
- *  @brief handles device acquisition  
+ *  @fn ble_device_request_sensors()
+ *  @brief sends the sensors command and waits the response on event loop
  *  @param
  *  @return
  */
-static inline void ble_device_handle_acquisition(ble_device_handle_t *h)
+static void ble_device_request_sensors(ble_device_handle_t *h)
 {
-    /* this should never happen */
-    assert(h != NULL);
     ble_data_t packet = {0};
-    uint8_t mq_data[sizeof(ble_data_t) * 2];    
-    ble_data_t *rx_packet = (ble_data_t *)&mq_data;
-    
-    int ret;
 
     packet.type = k_command_packet;
     packet.id   = k_get_sensors;
 
     /* send the command to the current sensor node */
-    printf("%s: sending command to sensor node\n\r", __func__);            
-    ret = gattlib_write_char_by_handle(h->conn_handle, BLE_TX_HANDLE, &packet, sizeof(packet));
+    LOG_DEBUG("sending command to sensor node");
+    h->cycle[0] = ble_now_ns();
+    atomic_store_explicit(&h->rx_first, 0, memory_order_relaxed);
+    atomic_store_explicit(&h->rx_stamp, true, memory_order_release);
+    ble_device_write_acked(h, &packet, sizeof(packet), ble_device_sensors_sent);
+}
+
+/**
+ *  @fn ble_device_cycle_done()
+ *  @brief records the phases of a completed sensor command cycle
+ *  @param
+ *  @return
+ */
+static void ble_device_cycle_done(ble_device_handle_t *h)
+{
+    uint64_t *t = h->cycle;
+    uint64_t first = atomic_load_explicit(&h->rx_first, memory_order_relaxed);
+
+    /* a notification may beat the write response, the phases stay back
+     * to back anyway */
+    if(first < t[k_lat_write + 1]) {
+        first = t[k_lat_write + 1];
+    }
+    if(first > t[k_lat_reassembly + 1]) {
+        first = t[k_lat_reassembly + 1];
+    }
+    t[k_lat_first + 1] = first;
+
+    for(uint32_t i = 0; i < k_lat_cycle; i++) {
+        app_hist_record(&h->stats->lat[i], t[i + 1] - t[i]);
+    }
+    app_hist_record(&h->stats->lat[k_lat_cycle], t[k_lat_cycle] - t[0]);
+
+    if(app_trace_enabled()) {
+        app_trace_cycle((uint32_t)(h->stats - app_stats_gateway()->dev), h->bd_addr, t);
+    }
+}
+
+/**
+ *  @fn ble_log_latency()
+ *  @brief logs the percentiles of a cycle phase
+ *  @param phase - stats_lat_t
+ *  @param bd_addr - device, NULL for the whole gateway
+ *  @return
+ */
+static void ble_log_latency(uint32_t phase, const char *bd_addr)
+{
+    app_hist_snap_t snap;
+
+    stats_latency(app_stats_gateway(), phase, bd_addr, &snap);
+    if(!snap.count) {
+        return;
+    }
+    LOG_INFO("%s %s latency of %llu cycles: p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us",
+        (bd_addr != NULL) ? bd_addr : "gateway", stats_lat_name(phase), (unsigned long long)snap.count,
+        app_hist_percentile(&snap, 0.5) / 1000.0, app_hist_percentile(&snap, 0.99) / 1000.0,
+        app_hist_percentile(&snap, 0.999) / 1000.0, snap.max_ns / 1000.0);
+}
+
+/**
+ *  @fn ble_device_audio_requested()
+ *  @brief the node took the audio command, the capture starts
+ *  @param ret - result of the write
+ *  @return
+ */
+static void ble_device_audio_requested(ble_device_handle_t *h, int ret)
+{
     if(ret) {
-        fprintf(stderr, "failed to send command to device .\n"); 
-        h->should_run = false;        
-        goto cleanup;       
+        LOG_ERR("failed to send command to device");
+        h->should_run = false;
     } else {
+        audio_file_begin(h->audio, app_clock_now());
+        h->state = k_dev_wait_audio;
+        ble_device_arm_timer(h, BLE_COMM_TIMEOUT * 1000 * 1000);
+    }
+}
 
-        h->timer.trigger.it_value.tv_sec = BLE_COMM_TIMEOUT;                
-        timer_settime(h->timer.timerid, 0, &h->timer.trigger, NULL);        
-        printf("%s: packet sent to device, waiting response\n\r", __func__);        
+/**
+ *  @fn ble_device_request_audio()
+ *  @brief asks the node for an audio capture, the fragments are streamed
+ *         back without waiting for each other
+ *  @param
+ *  @return
+ */
+static void ble_device_request_audio(ble_device_handle_t *h)
+{
+    ble_data_t packet = {0};
+    uint32_t size = AUDIO_SAMPLE_RATE * AUDIO_SAMPLE_BYTES * BEEINFO_BLE_AUDIO_SECONDS;
+
+    packet.type = k_command_packet;
+    packet.id   = k_get_audio;
+    packet.payload_size = BLE_AUDIO_REQ_SIZE;
+    memcpy(packet.pack_data, &size, BLE_AUDIO_REQ_SIZE);
+
+    LOG_DEBUG("requesting %u bytes of audio", size);
+    ble_device_write_acked(h, &packet, sizeof(packet), ble_device_audio_requested);
+}
+
+/**
+ *  @fn ble_device_ota_offered()
+ *  @brief the node took the firmware offer, its answer is awaited
+ *  @param ret - result of the write
+ *  @return
+ */
+static void ble_device_ota_offered(ble_device_handle_t *h, int ret)
+{
+    if(ret) {
+        LOG_ERR("failed to send command to device");
+        h->should_run = false;
+        return;
+    }
+
+    /* the answer may get lost, the offer is repeated until it comes */
+    ble_device_arm_timer(h, OTA_RTO_INIT_US);
+}
+
+/**
+ *  @fn ble_device_offer_ota()
+ *  @brief offers a firmware image to the node, it answers with how much
+ *         of it is already stored so an interrupted transfer resumes
+ *  @param
+ *  @return
+ */
+static void ble_device_offer_ota(ble_device_handle_t *h, const ota_image_t *img)
+{
+    ble_data_t packet = {0};
+
+    packet.type = k_command_packet;
+    packet.id   = k_fw_update;
+    packet.payload_size = BLE_OTA_REQ_SIZE;
+    memcpy(packet.pack_data, &img->size, sizeof(img->size));
+    memcpy(packet.pack_data + sizeof(img->size), &img->crc, sizeof(img->crc));
+
+    ble_device_write_acked(h, &packet, sizeof(packet), ble_device_ota_offered);
+}
+
+/**
+ *  @fn ble_device_request_ota()
+ *  @brief starts the firmware transfer of the node
+ *  @param
+ *  @return
+ */
+static void ble_device_request_ota(ble_device_handle_t *h, ota_image_t *img)
+{
+    LOG_DEBUG("offering firmware %08x to %s", img->crc, h->bd_addr);
+
+    /* a refused offer ends the session, and the image with it */
+    ota_session_begin(&h->ota, img, ble_now_us());
+    h->state = k_dev_ota;
+    ble_device_offer_ota(h, img);
+}
+
+/**
+ *  @fn ble_device_ota_rebooted()
+ *  @brief the reboot command went out or not, the session ends either way
+ *  @param ret - result of the write
+ *  @return
+ */
+static void ble_device_ota_rebooted(ble_device_handle_t *h, int ret)
+{
+    if(!ret) {
+        ota_job_done(h->bd_addr, h->ota.img);
+        h->ota_rebooted = true;
+    }
+    ota_session_end(&h->ota);
+    h->should_run = false;
+}
+
+/**
+ *  @fn ble_device_ota_done()
+ *  @brief the node holds the whole image, tells it to run it, the link
+ *         drops with the reboot and the next session finds it updated
+ *  @param
+ *  @return
+ */
+static void ble_device_ota_done(ble_device_handle_t *h)
+{
+    ble_data_t packet = {0};
+    ota_stats_t *st = &h->ota.stats;
+    double secs = (ble_now_us() - st->start_us) / 1e6;
+    uint32_t sent = h->ota.img->size - st->resumed_at * OTA_FRAG_SIZE;
+
+    LOG_INFO("firmware of %s, %u bytes in %.2f s, %.1f KB/s, resumed at fragment %u, %llu fragments sent, %llu retransmitted, %llu timeouts",
+        h->bd_addr, sent, secs, (secs > 0) ? sent / secs / 1000.0 : 0.0, st->resumed_at,
+        (unsigned long long)st->sent, (unsigned long long)st->retransmits, (unsigned long long)st->timeouts);
+
+    packet.type = k_command_packet;
+    packet.id   = k_reboot;
+    ble_device_write_acked(h, &packet, sizeof(packet), ble_device_ota_rebooted);
+}
+
+/**
+ *  @fn ble_device_handle_ota()
+ *  @brief takes the node acknowledgements and keeps the window full, the
+ *         timer runs the retransmission timeout of the oldest fragment
+ *  @param
+ *  @return
+ */
+static void ble_device_handle_ota(ble_device_handle_t *h)
+{
+    const ble_data_t *rx_packet;
+    ble_data_t packet;
+    bool synced = h->ota.synced;
+    uint64_t now = ble_now_us();
+    uint64_t deadline;
+    size_t len;
+
+    while((rx_packet = ble_rx_ring_peek(&h->rx)) != NULL) {
+        /* late sensor or audio fragments are not part of the transfer */
+        if(rx_packet->type == k_command_packet && rx_packet->id == k_fw_update &&
+            ota_session_ack(&h->ota, rx_packet->pack_data, rx_packet->payload_size, now) < 0) {
+            ble_rx_ring_release(&h->rx);
+            LOG_WARN("firmware rejected by %s", h->bd_addr);
+            h->should_run = false;
+            return;
+        }
+        ble_rx_ring_release(&h->rx);
     }
 
+    if(!synced && h->ota.synced && h->ota.stats.resumed_at) {
+        LOG_INFO("%s already holds %u of %u fragments, resuming",
+            h->bd_addr, h->ota.stats.resumed_at, h->ota.img->frags);
+    }
+
+    if(ota_session_complete(&h->ota)) {
+        ble_device_ota_done(h);
+        return;
+    }
 
-    if(mq_receive(h->mq, mq_data, sizeof(mq_data), NULL) < sizeof(rx_packet)) {
-        printf("%s: corrupt packet arrived, discarding!! \n\r", __func__);
-        printf("%s: type: %d!! \n\r", __func__, rx_packet->type);
-        printf("%s: id: %d!! \n\r", __func__, rx_packet->id);
-        printf("%s: pack_amount: %d!! \n\r", __func__, rx_packet->pack_amount);
-        
-        /* some error occurred, so destroy the thread and waits a reconnection */
+    if(atomic_exchange(&h->timer_fired, false)) {
+        if(now - h->ota.progress_us >= BLE_COMM_TIMEOUT * 1000000ULL) {
+            LOG_WARN("firmware transfer timeout with %s", h->bd_addr);
+            stats_add(&h->stats->timeouts, 1);
+            h->should_run = false;
+            return;
+        }
+        if(!h->ota.synced) {
+            ble_device_offer_ota(h, h->ota.img);
+            return;
+        }
+        ota_session_expire(&h->ota, now);
+    }
+
+    if(!h->ota.synced) {
+        return;
+    }
+
+    /* writes without response, only the window limits what is in flight */
+    while((len = ota_session_next(&h->ota, &packet, now)) != 0) {
+        if(ble_device_write(h, &packet, len, false)) {
+            LOG_ERR("failed to send firmware to device");
+            h->should_run = false;
+            return;
+        }
+    }
+
+    deadline = ota_session_deadline(&h->ota);
+    ble_device_arm_timer(h, (deadline > now) ? (uint32_t)(deadline - now) :
+        (deadline) ? 1 : BLE_COMM_TIMEOUT * 1000 * 1000);
+}
+
+/**
+ *  @fn ble_device_downstream_sent()
+ *  @brief a downstream frame was acknowledged, it spends one credit
+ *  @param ret - result of the write
+ *  @return
+ */
+static void ble_device_downstream_sent(ble_device_handle_t *h, int ret)
+{
+    if(ret) {
+        LOG_ERR("failed to send data to device");
         h->should_run = false;
-    } else {
+        return;
+    }
+    h->tx_credit--;
+}
 
+/**
+ *  @fn ble_device_send_downstream()
+ *  @brief writes the next downstream frame the last poll earned, one per
+ *         trip to the link threads, whatever is left waits for the next
+ *         acquisition cycle so a poll is never held up by more than
+ *         BLE_TX_FRAMES_PER_POLL writes
+ *  @param
+ *  @return
+ */
+static void ble_device_send_downstream(ble_device_handle_t *h)
+{
+    ble_data_t frame;
+    size_t len;
+
+    len = ble_tx_next_frame(&h->tx, &frame);
+    if(len) {
+        ble_device_write_acked(h, &frame, len, ble_device_downstream_sent);
+    }
+}
+
+/**
+ *  @fn ble_device_audio_done()
+ *  @brief ends the capture in progress and goes back to sensor polling
+ *  @param
+ *  @return
+ */
+static void ble_device_audio_done(ble_device_handle_t *h)
+{
+    audio_index_entry_t e;
+    audio_file_stats_t st;
+
+    audio_file_end(h->audio, &e);
+    audio_file_get_stats(h->audio, &st);
+    LOG_INFO("audio capture of %s, %u bytes, %u fragments lost, %.1f KB/s sustained",
+        h->bd_addr, e.size, e.gaps, (st.stream_us) ? st.bytes * 1000.0 / st.stream_us : 0.0);
+
+    h->audio_due = ble_now_us() + (uint64_t)BEEINFO_BLE_AUDIO_PERIOD * 1000000ULL;
+    atomic_store(&h->timer_fired, false);
+    h->state = k_dev_idle;
+    ble_device_arm_timer(h, BEEINFO_BLE_ACQ_PERIOD);
+}
+
+/**
+ *  @fn ble_device_handle_audio()
+ *  @brief drains audio fragments from the ring straight into the capture
+ *         buffers, the timeout is rearmed once per batch
+ *  @param
+ *  @return
+ */
+static void ble_device_handle_audio(ble_device_handle_t *h)
+{
+    const ble_data_t *rx_packet;
+    bool progress = false;
+
+    /* nothing in here blocks, so its wall time is the cpu it takes, read
+     * from a clock far cheaper than the thread cpu one */
+    uint64_t start = ble_now_ns();
+
+    while((rx_packet = ble_rx_ring_peek(&h->rx)) != NULL) {
         if(rx_packet->type == k_command_packet) {
-            /* a command packet here, indicate fault with communication, exit */
+            ble_rx_ring_release(&h->rx);
             h->should_run = false;
             goto cleanup;
         }
 
-        /* stops timer until packet processing */
-        h->timer.trigger.it_value.tv_sec = 0;        
-        timer_settime(h->timer.timerid, 0, &h->timer.trigger, NULL);        
-        
+        /* a late sensor response is not part of the capture */
+        if(rx_packet->type != k_sequence_packet) {
+            ble_rx_ring_release(&h->rx);
+            continue;
+        }
 
+        audio_file_put(h->audio, rx_packet->id, rx_packet->pack_data, rx_packet->payload_size);
+        progress = true;
+        if(rx_packet->pack_amount) {
+            ble_rx_ring_release(&h->rx);
+            ble_device_audio_done(h);
+            goto cleanup;
+        }
+        ble_rx_ring_release(&h->rx);
+    }
 
-        uint32_t packet_cnt = rx_packet->pack_amount - 1;
-        uint8_t *ptr = (uint8_t *)&h->data_env;
-        bool error = false;
+    if(atomic_exchange(&h->timer_fired, false)) {
+        LOG_WARN("audio stream timeout with %s", h->bd_addr);
+        stats_add(&h->stats->timeouts, 1);
+        audio_file_end(h->audio, NULL);
+        h->should_run = false;
+    } else if(progress) {
+        ble_device_arm_timer(h, BLE_COMM_TIMEOUT * 1000 * 1000);
+    }
 
-        memcpy(ptr, &rx_packet->pack_data, rx_packet->payload_size);
-        ptr += rx_packet->payload_size;
+cleanup:
+    h->audio_cpu_ns += ble_now_ns() - start;
+}
 
-        while (packet_cnt) {
+/**
+ *  @fn ble_device_handle_acquisition()
+ *  @brief handles device acquisition, never blocks: consumes whatever the
+ *         ring and the timer have for the device and returns
+ *  @param
+ *  @return
+ */
+static void ble_device_handle_acquisition(ble_device_handle_t *h)
+{
+    ble_data_t bad;
+    ota_image_t *img;
 
-            /* rearm timer to avoid deadlock */
-            h->timer.trigger.it_value.tv_sec = BLE_COMM_TIMEOUT;        
-            timer_settime(h->timer.timerid, 0, &h->timer.trigger, NULL);        
+    /* this should never happen */
+    assert(h != NULL);
 
-            if(mq_receive(h->mq, mq_data, sizeof(mq_data), NULL) < sizeof(rx_packet)) {
+    switch(h->state) {
+    case k_dev_idle:
+        /* nothing was asked, anything in the ring is stale */
+        while(ble_rx_ring_peek(&h->rx) != NULL) {
+            ble_rx_ring_release(&h->rx);
+        }
 
+        if(atomic_exchange(&h->timer_fired, false)) {
+            /* audio and firmware share the link, sensor polling resumes
+             * once they end */
+            if((img = ota_job_get(h->bd_addr)) != NULL) {
+                ble_device_request_ota(h, img);
+            } else if(h->first_reading_done && ble_now_us() >= h->audio_due) {
+                ble_device_request_audio(h);
+            } else {
+                ble_device_request_sensors(h);
+            }
+        } else if(h->tx_credit && ble_tx_pending(&h->tx)) {
+            /* the link is free until the next period */
+            ble_device_send_downstream(h);
+        }
+        break;
+
+    case k_dev_wait_response:
+        switch(ble_device_reassemble(h, &bad)) {
+        case k_rx_asm_bad:
+            /* a command packet here indicates a fault with communication */
+            if(bad.type != k_command_packet) {
+                LOG_WARN("corrupt packet arrived, discarding, type: %d, id: %d, pack_amount: %d",
+                    bad.type, bad.id, bad.pack_amount);
+            }
+            h->should_run = false;
+            goto cleanup;
 
-               /* stops timer until packet processing */
-               h->timer.trigger.it_value.tv_sec = 0;        
-               timer_settime(h->timer.timerid, 0, &h->timer.trigger, NULL);        
+        case k_rx_asm_done:
+            LOG_DEBUG("data sent by sensor_id %s: temperature %u [mdeg], humidity %u [percent], pressure %u [Pa], luminance %u [mLux]",
+                h->bd_addr, h->data_env.temperature, h->data_env.humidity, h->data_env.pressure,
+                h->data_env.luminosity);
 
+            h->cycle[k_lat_reassembly + 1] = ble_now_ns();
+            app_stats_rtt(h->stats, (h->cycle[k_lat_reassembly + 1] - h->cycle[0]) / 1000);
+            h->timestamp = app_clock_now();
+            if(acq_file_append_val(&h->data_env, h->acq, h->timestamp) < 0) {
+                LOG_ERR("failed to store the acquisition of %s", h->bd_addr);
+            }
+            h->cycle[k_lat_persist + 1] = ble_now_ns();
+            ble_device_cycle_done(h);
+
+            if(!h->first_reading_done) {
+                h->first_reading_done = true;
+                LOG_INFO("first reading %lu ms after connect, attributes %s",
+                    (unsigned long)((ble_now_us() - h->connect_start) / 1000),
+                    (h->gatt_cached) ? "cached" : "discovered");
+            }
 
-                if(rx_packet->type == k_command_packet) {
-                    /* a command packet here, indicate fault with communication, exit */
-                    h->should_run = false;
-                    goto cleanup;
-                }
-        
-                printf("%s: corrupt packet arrived, discarding!! \n\r", __func__);
-                h->should_run = false;
-                goto cleanup;                
-            } 
+            /* a late timeout must not cut the acquisition period */
+            atomic_store(&h->timer_fired, false);
+            h->tx_credit = BLE_TX_FRAMES_PER_POLL;
+            h->state = k_dev_idle;
+            ble_device_arm_timer(h, BEEINFO_BLE_ACQ_PERIOD);
+            goto cleanup;
 
-            /* stops timer until packet processing */
-            h->timer.trigger.it_value.tv_sec = 0;        
-            timer_settime(h->timer.timerid, 0, &h->timer.trigger, NULL);        
+        case k_rx_asm_progress:
+            /* rearm timer to avoid deadlock */
+            ble_device_arm_timer(h, BLE_COMM_TIMEOUT * 1000 * 1000);
+            break;
 
+        default:
+            break;
+        }
 
-            if(!error) {
-                memcpy(ptr, &rx_packet->pack_data, rx_packet->payload_size);
-                ptr += rx_packet->payload_size;        
-            }
-            packet_cnt--;
-            
+        if(atomic_exchange(&h->timer_fired, false)) {
+            LOG_WARN("communication timeout with %s", h->bd_addr);
+            stats_add(&h->stats->timeouts, 1);
+            h->should_run = false;
         }
-    }
+        break;
 
+    case k_dev_wait_audio:
+        ble_device_handle_audio(h);
+        break;
 
-    /* prints the data */
-    printf("%s: data sent by sensor_id: %s are:  \n\r", __func__, h->bd_addr); 
-    printf("Temperature: %u [mdeg] \n\r", h->data_env.temperature);  
-    printf("Humidity: %u  [percent]\n\r", h->data_env.humidity);            
-    printf("Pressure: %u  [Pa]\n\r",  h->data_env.pressure);
-    printf("Luminance: %u [mLux] \n\r", h->data_env.luminosity);
+    case k_dev_ota:
+        ble_device_handle_ota(h);
+        break;
+
+    default:
+        break;
+    }
 
-    
 cleanup:
     return;
 }
 
+/**
+ *  @fn ble_enable_listening()
+ *  @brief enables the device notifications and hooks the rx handler
+ *  @param
+ *  @return 0 on success, -1 if the device refused a descriptor write
+ */
+static int ble_enable_listening(ble_device_handle_t *h, uint16_t tx_cccd_handle, uint16_t noti_handle)
+{
+    int ret;
+    int err = 0;
+
+    /* enable listening by setting nofitication and read characteristic
+     * bitmask
+     */
+    uint16_t char_prop = 0x000C;
+
+	ret = gattlib_write_char_by_handle(h->conn_handle, tx_cccd_handle, &char_prop, sizeof(char_prop));
+    if(ret) {
+		LOG_ERR("failed set tx characteristic properties");
+        err = -1;
+    }
+
+    char_prop = 0x0003;
+	ret = gattlib_write_char_by_handle(h->conn_handle, noti_handle, &char_prop, sizeof(char_prop));
+    if(ret) {
+		LOG_ERR("failed set noti characteristic properties");
+        err = -1;
+    }
+    gattlib_register_notification(h->conn_handle, ble_rx_handler, h);
+
+    return(err);
+}
+
+/**
+ *  @fn ble_read_node_hash()
+ *  @brief reads the database hash the node computes over its attributes
+ *  @param
+ *  @return 0 on success, -1 if the node does not expose it
+ */
+static int ble_read_node_hash(ble_device_handle_t *h, uint8_t *hash)
+{
+    uuid_t uuid = CREATE_UUID16(BLE_DB_HASH_UUID);
+    size_t len = GATT_CACHE_NODE_HASH_SIZE;
+
+    if(gattlib_read_char_by_uuid(h->conn_handle, &uuid, hash, &len) || len != GATT_CACHE_NODE_HASH_SIZE) {
+        return(-1);
+    }
+    return(0);
+}
+
+/**
+ *  @fn ble_cache_matches()
+ *  @brief tells whether the node database is still the one cached, one
+ *         read of its database hash, or one discovery of its services for
+ *         nodes without it, instead of the full discovery
+ *  @param
+ *  @return
+ */
+static bool ble_cache_matches(ble_device_handle_t *h, const gatt_cache_record_t *rec)
+{
+    uint8_t hash[GATT_CACHE_NODE_HASH_SIZE];
+
+    if(rec->has_node_hash) {
+        return(!ble_read_node_hash(h, hash) && !memcmp(hash, rec->node_hash, sizeof(hash)));
+    }
+
+    if(gattlib_discover_primary(h->conn_handle, &h->services, &h->services_count)) {
+        return(false);
+    }
+    return(gatt_cache_hash(h->services, h->services_count, NULL, 0) == rec->services_hash);
+}
+
+/**
+ *  @fn ble_find_handles()
+ *  @brief takes the handles the gateway uses from the discovered
+ *         characteristics, the first writable one is tx, the first one
+ *         notifying is rx, their configuration descriptor follows the value
+ *  @param
+ *  @return true if the node has a database hash characteristic
+ */
+static bool ble_find_handles(ble_device_handle_t *h, gatt_cache_record_t *rec)
+{
+    bool tx = false;
+    bool rx = false;
+    bool db_hash = false;
+
+    rec->tx_handle = BLE_TX_HANDLE;
+    rec->tx_cccd_handle = BLE_TX_HANDLE + 1;
+    rec->noti_handle = BLE_NOTI_HANDLE;
+
+    for(int i = 0; i < h->characteristics_count; i++) {
+        const gattlib_characteristic_t *c = &h->characteristics[i];
+
+        if(c->uuid.type == SDP_UUID16 && c->uuid.value.uuid16 == BLE_DB_HASH_UUID) {
+            db_hash = true;
+        } else if(!tx && (c->properties & (BLE_PROP_WRITE | BLE_PROP_WRITE_NO_RSP))) {
+            rec->tx_handle = c->value_handle;
+            rec->tx_cccd_handle = c->value_handle + 1;
+            tx = true;
+        } else if(!rx && (c->properties & BLE_PROP_NOTIFY)) {
+            rec->noti_handle = c->value_handle + 1;
+            rx = true;
+        }
+    }
+
+    if(!tx || !rx) {
+        LOG_WARN("tx or rx characteristic not found, using the default handles");
+    }
+    return(db_hash);
+}
+
 /**
  *  @fn ble_discover_service_and_enable_listening()
- *  @brief discover device characteristics and enable notification
+ *  @brief discover device characteristics and enable notification, a device
+ *         found on the attribute cache skips straight to the descriptors
+ *         once its database is known to be unchanged
  *  @param
  *  @return
  */
 static void ble_discover_service_and_enable_listening(ble_device_handle_t *h)
 {
+    gatt_cache_record_t rec;
     int ret;
 
     /* this should never happen */
     assert(h != NULL);
     
+    if(gatt_cache_lookup(h->bd_addr, &rec)) {
+        if(!ble_cache_matches(h, &rec)) {
+            LOG_WARN("attribute database of the node changed, rediscovering");
+            gatt_cache_invalidate(h->bd_addr);
+        } else if(!ble_enable_listening(h, rec.tx_cccd_handle, rec.noti_handle)) {
+            LOG_INFO("attribute database restored from cache, hash: %08x", rec.db_hash);
+            h->tx_handle = rec.tx_handle;
+            h->gatt_cached = true;
+            goto cleanup;
+        } else {
+            LOG_WARN("cached attribute database rejected, rediscovering");
+            gatt_cache_invalidate(h->bd_addr);
+        }
+
+        /* the services of the check are discovered again below */
+        free(h->services);
+        h->services = NULL;
+    }
 
     /* discover device characteristic and services */
     ret = gattlib_discover_primary(h->conn_handle, &h->services, &h->services_count);
 	if (ret != 0) {
-		fprintf(stderr, "Fail to discover primary services.\n");
+		LOG_ERR("fail to discover primary services");
 		goto cleanup;
 	}
 
-	for (int i = 0; i < h->services_count; i++) {
-		gattlib_uuid_to_string(&h->services[i].uuid, h->uuid_str, sizeof(h->uuid_str));
-
-		printf("%s: service[%d] start_handle:%02x end_handle:%02x uuid:%s\n",__func__, i,
-				h->services[i].attr_handle_start, h->services[i].attr_handle_end,
-				h->uuid_str);
-	}
-
 	ret = gattlib_discover_char(h->conn_handle, &h->characteristics, &h->characteristics_count);
 	if (ret != 0) {
-		fprintf(stderr, "Fail to discover characteristics.\n");
+		LOG_ERR("fail to discover characteristics");
 		goto cleanup;
 	}
-	for (int i = 0; i < h->characteristics_count; i++) {
-		gattlib_uuid_to_string(&h->characteristics[i].uuid, h->uuid_str, sizeof(h->uuid_str));
-
-		printf("%s: characteristic[%d] properties:%02x value_handle:%04x uuid:%s\n", __func__, i,
-				h->characteristics[i].properties, h->characteristics[i].value_handle,
-				h->uuid_str);
-	}
-
-
-    /* enable listening by setting nofitication and read characteristic
-     * bitmask
-     */
-    uint16_t char_prop = 0x000C;
 
-	ret = gattlib_write_char_by_handle(h->conn_handle, BLE_TX_HANDLE+1, &char_prop, sizeof(char_prop));
-    if(ret) {
-		fprintf(stderr, "failed set tx characteristic properties.\n");        
+    memset(&rec, 0, sizeof(rec));
+    snprintf(rec.bd_addr, sizeof(rec.bd_addr), "%.*s", REGISTRY_ADDR_SIZE - 1, h->bd_addr);
+    rec.db_hash = gatt_cache_hash(h->services, h->services_count, h->characteristics, h->characteristics_count);
+    rec.services_hash = gatt_cache_hash(h->services, h->services_count, NULL, 0);
+    rec.services_count = (uint8_t)h->services_count;
+    rec.characteristics_count = (uint16_t)h->characteristics_count;
+    if(ble_find_handles(h, &rec)) {
+        rec.has_node_hash = !ble_read_node_hash(h, rec.node_hash);
     }
+    h->tx_handle = rec.tx_handle;
+    LOG_INFO("%d services, %d characteristics, hash: %08x, tx: %04x",
+        h->services_count, h->characteristics_count, rec.db_hash, rec.tx_handle);
 
-    char_prop = 0x0003;
-	ret = gattlib_write_char_by_handle(h->conn_handle, BLE_NOTI_HANDLE, &char_prop, sizeof(char_prop));
-    if(ret) {
-		fprintf(stderr, "failed set noti characteristic properties.\n");        
+    if(!ble_enable_listening(h, rec.tx_cccd_handle, rec.noti_handle)) {
+        gatt_cache_store(&rec);
     }
-    gattlib_register_notification(h->conn_handle, ble_rx_handler, h);
-
 
 cleanup:
     return;
@@ -354,117 +911,300 @@ cleanup:
 }
 
 /**
- *  @fn ble_device_manager_thread()
- *  @brief handles device discovering 
+ *  @fn ble_device_connect()
+ *  @brief sets the device environment up and connects to it, runs once
+ *         per session on a link thread
  *  @param
  *  @return
  */
-static void *ble_device_manager_thread(void *args)
+static void ble_device_connect(ble_device_handle_t *handle)
 {
-    ble_device_handle_t *handle = args;
- 
-    FILE *fp_acq;
-    FILE *fp_audio;
     char root_path[MAX_NAME_SIZE]={0};
     char aud_path[MAX_NAME_SIZE]={0};
     char acq_path[MAX_NAME_SIZE]={0};
+    char feat_path[MAX_NAME_SIZE]={0};
     
-    printf("%s:-------------- NEW DEVICE PROCESS STARTED! ----------------\n\r", __func__);
+    handle->connect_start = ble_now_us();
+    handle->tx_handle = BLE_TX_HANDLE;
+    LOG_INFO("new device process started for %s", handle->bd_addr);
     strcat(root_path, "beeinformed/");
     strcat(root_path, handle->bd_addr);
     strcat(aud_path, root_path);
-    strcat(aud_path,"/beeaudio.dat");
+    strcat(aud_path,"/" AUDIO_FILE_NAME);
     
     strcat(acq_path, root_path);
-    strcat(acq_path,"/beedata.dat");
+    strcat(acq_path,"/" ACQ_FILE_NAME);
 
-    printf("%s:-------------- SETTING BEE DEVICE ENVIRONMENT ----------------\n\r", __func__);
-    printf("%s: Audio File: %s \n\r", __func__, aud_path);
-    printf("%s: Hive environment File: %s \n\r", __func__, acq_path);
-    printf("%s:---------------------------------------------------------------\n\r", __func__);
+    strcat(feat_path, root_path);
+    strcat(feat_path,"/" AUDIO_FEAT_FILE_NAME);
+
+    LOG_DEBUG("audio file: %s, hive environment file: %s, hive acoustic features file: %s",
+        aud_path, acq_path, feat_path);
     
     if(handle->new_device) {
         mkdir(root_path,0644);
     }
     /* obtains the acquisition file of the device */
 
-    fp_acq =fopen(acq_path, "ab");
-    fp_audio =fopen(aud_path, "ab");
-    assert(fp_audio != NULL);
-    assert(fp_acq != NULL);
+    handle->acq = acq_file_open(acq_path, BEEINFO_ACQ_FILE_FORMAT);
+    handle->audio = audio_file_open(aud_path, BEEINFO_AUDIO_FILE_FORMAT);
+    assert(handle->audio != NULL);
+    assert(handle->acq != NULL);
+    if(audio_file_analyze(handle->audio, feat_path) < 0) {
+        LOG_ERR("hive audio will be stored without features");
+    }
 
     /* obtains device connection handle */
-    handle->conn_handle = gattlib_connect(NULL, handle->bd_addr, BDADDR_LE_PUBLIC, BT_SEC_LOW, 0, 200);
+    /* the registry remembers which address type worked last time */
+    uint8_t other_type = (handle->addr_type == BDADDR_LE_RANDOM) ? BDADDR_LE_PUBLIC : BDADDR_LE_RANDOM;
+
+    handle->conn_handle = gattlib_connect(NULL, handle->bd_addr, handle->addr_type, BT_SEC_LOW, 0, 200);
 	if (handle->conn_handle == NULL) {
-		handle->conn_handle = gattlib_connect(NULL, handle->bd_addr, BDADDR_LE_RANDOM, BT_SEC_LOW, 0, 200);
+		handle->conn_handle = gattlib_connect(NULL, handle->bd_addr, other_type, BT_SEC_LOW, 0, 200);
 		if (handle->conn_handle == NULL) {
-			fprintf(stderr, "Fail to connect to the bluetooth device.\n");
+			LOG_ERR("fail to connect to the bluetooth device");
 			goto cleanup;
 		} else {
-			printf("%s: Succeeded to connect to the bluetooth device with random address.\n\r", __func__);
+			LOG_INFO("succeeded to connect to the bluetooth device with %s address",
+                (other_type == BDADDR_LE_RANDOM) ? "random" : "public");
+            handle->addr_type = other_type;
+            registry_add(handle->bd_addr, handle->device_name, handle->addr_type, NULL);
 		}
 	} else {
-			printf("%s: Succeeded to connect to the bluetooth device.\n\r", __func__);
+			LOG_INFO("succeeded to connect to the bluetooth device");
 	}
 
     /* enable the notifications and gets the service database */
-    printf("%s:---------- DISCOVERING BEEINFORMED EDGE BLE DATABASE -----------\n\r", __func__);
+    LOG_DEBUG("discovering beeinformed edge ble database");
     ble_discover_service_and_enable_listening(handle);
-    printf("%s:---------- DISCOVERED BEEINFORMED EDGE BLE DATABASE -----------\n\r", __func__);
-
-    /* creates the timeout channel */
-    memset(&handle->timer.sev, 0, sizeof(struct sigevent));
-    memset(&handle->timer.trigger, 0, sizeof(struct itimerspec));
-    handle->timer.sev.sigev_notify = SIGEV_THREAD;
-    handle->timer.sev.sigev_notify_function = &ble_comm_timeout;
-    handle->timer.sev.sigev_value.sival_ptr = handle;
-    handle->timer.trigger.it_value.tv_sec = BLE_COMM_TIMEOUT;
-    if(timer_create(CLOCK_REALTIME, &handle->timer.sev, &handle->timer.timerid) < 0) {
-        /* failed to create timer, exit */
-        fprintf(stderr, "ERROR: Failed to create ble device timer.\n");        
-        goto cleanup;
+    LOG_DEBUG("discovered beeinformed edge ble database");
+
+    /* connection estabilished, first acquisition happens right away */
+    session_set_connected(handle->bd_addr);
+    stats_add(&handle->stats->connects, 1);
+    stats_set(&handle->stats->connected, 1);
+    handle->state = k_dev_idle;
+    atomic_store(&handle->timer_fired, true);
+    return;
+
+cleanup:
+    handle->should_run = false;
+}
+
+/**
+ *  @fn ble_link_submit()
+ *  @brief hands the operation the device step prepared to the link threads,
+ *         the step must not touch the device after it
+ *  @param
+ *  @return
+ */
+static void ble_link_submit(ble_device_handle_t *h)
+{
+    pthread_mutex_lock(&ble_link_mutex);
+    sys_dlist_append((h->link_op == k_link_connect) ? &ble_link_connects : &ble_link_writes,
+        &h->link);
+    pthread_cond_signal(&ble_link_cond);
+    pthread_mutex_unlock(&ble_link_mutex);
+}
+
+/**
+ *  @fn ble_link_thread()
+ *  @brief runs the blocking gatt operations of the devices and returns
+ *         each device to the event loop through its eventfd, writes go
+ *         first and connects never exceed BLE_LINK_MAX_CONNECTS
+ *  @param
+ *  @return
+ */
+static void *ble_link_thread(void *args)
+{
+    ble_device_handle_t *h;
+    k_list_t *node;
+    (void)args;
+
+    for(;;) {
+        pthread_mutex_lock(&ble_link_mutex);
+        for(;;) {
+            node = sys_dlist_get(&ble_link_writes);
+            if(node == NULL && ble_link_connecting < BLE_LINK_MAX_CONNECTS) {
+                node = sys_dlist_get(&ble_link_connects);
+                if(node != NULL) {
+                    ble_link_connecting++;
+                }
+            }
+            if(node != NULL || !ble_link_should_run) {
+                break;
+            }
+            pthread_cond_wait(&ble_link_cond, &ble_link_mutex);
+        }
+        pthread_mutex_unlock(&ble_link_mutex);
+
+        if(node == NULL) {
+            break;
+        }
+
+        h = CONTAINER_OF(node, ble_device_handle_t, link);
+        if(h->link_op == k_link_connect) {
+            if(h->should_run) {
+                ble_device_connect(h);
+            }
+            pthread_mutex_lock(&ble_link_mutex);
+            ble_link_connecting--;
+            pthread_cond_signal(&ble_link_cond);
+            pthread_mutex_unlock(&ble_link_mutex);
+        } else {
+            h->link_ret = ble_device_write(h, &h->link_packet, h->link_len, true);
+            h->link_ns = ble_now_ns();
+        }
+
+        /* the source was left disarmed, rearming it gives the device back */
+        eventfd_write(h->rx.efd, 1);
+        sched_rearm(&h->src);
     }
 
+    return(NULL);
+}
 
-    /* creates a messaging system to store messages */
-    handle->attr.mq_flags = 0;
-    handle->attr.mq_maxmsg = 128;
-    handle->attr.mq_msgsize = BLE_MESSAGE_SLOT_SIZE;
-    handle->attr.mq_curmsgs = 0;
-    
-    char mq_str[32] = {0};
-    strcpy(mq_str, "/mq_");
-    strcat(mq_str, handle->bd_addr);
-    printf("%s: mqueue name: %s \n\r", __func__, mq_str);
-    
-    /* close the mqueue before to use it, this will flushes the queue */
-    mq_unlink(mq_str);
-    handle->mq = mq_open(mq_str, O_CREAT | O_RDWR, 0644, &handle->attr);
+/**
+ *  @fn ble_device_release()
+ *  @brief frees a device once no sender can hold it anymore, runs on the
+ *         epoch reclaimer
+ *  @param
+ *  @return
+ */
+static void ble_device_release(epoch_node_t *node)
+{
+    ble_device_handle_t *handle = CONTAINER_OF(node, ble_device_handle_t, retire);
+
+    LOG_INFO("%s downstream %llu messages in %llu frames, %.1f bytes per frame, %llu replaced, %llu dropped",
+        handle->bd_addr,
+        (unsigned long long)handle->tx.stats.delivered, (unsigned long long)handle->tx.stats.frames,
+        (handle->tx.stats.frames) ? (double)handle->tx.stats.bytes / handle->tx.stats.frames : 0.0,
+        (unsigned long long)handle->tx.stats.replaced, (unsigned long long)handle->tx.stats.dropped);
+    ble_tx_deinit(&handle->tx);
+    ble_rx_ring_deinit(&handle->rx);
+    free(handle);
+}
+
+/**
+ *  @fn ble_device_disconnect()
+ *  @brief terminates the device session and releases its memory
+ *  @param
+ *  @return
+ */
+static void ble_device_disconnect(ble_device_handle_t *handle)
+{
+    LOG_INFO("edge device session of %s terminating", handle->bd_addr);
+    sched_remove(&handle->src);
+    stats_set(&handle->stats->connected, 0);
+    stats_set(&handle->stats->state, k_dev_disconnect);
+
+    /* after this the wheel will never touch the handle again */
+    app_timer_cancel(&handle->timer);
+    if(handle->conn_handle != NULL) {
+        gattlib_disconnect(handle->conn_handle);
+    }
+    if(handle->audio != NULL) {
+        audio_file_stats_t st;
+        double mb;
+
+        audio_file_close(handle->audio, &st);
+        mb = st.bytes / (1024.0 * 1024.0);
+        LOG_INFO("audio %llu captures, %.1f KiB in %.1f KiB, %.1f KB/s, %.2f ms cpu per MB, %llu writes, %llu segments, %llu lost, %llu overruns",
+            (unsigned long long)st.captures, st.bytes / 1024.0, st.disk_bytes / 1024.0,
+            (st.stream_us) ? st.bytes * 1000.0 / st.stream_us : 0.0,
+            (mb > 0) ? (handle->audio_cpu_ns + st.write_cpu_ns) / 1e6 / mb : 0.0,
+            (unsigned long long)st.writes, (unsigned long long)st.segments, (unsigned long long)st.gaps,
+            (unsigned long long)st.overruns);
+        LOG_INFO("audio features %llu frames, %.0f frames/s per core (%s)",
+            (unsigned long long)st.feat_frames, (st.feat_cpu_ns) ? st.feat_frames * 1e9 / st.feat_cpu_ns : 0.0,
+            audio_feat_impl_name());
+    }
+    if(handle->acq != NULL) {
+        acq_file_stats_t st;
+        double secs = (double)(ble_now_us() - handle->connect_start) / 1e6;
+
+        acq_file_close(handle->acq, &st);
+        LOG_INFO("%llu records, %.1f records/s, %.1f bytes/record, %llu blocks in %llu syncs, %llu stalls",
+            (unsigned long long)st.records, (secs > 0) ? st.records / secs : 0.0,
+            (st.records) ? (double)st.bytes / st.records : 0.0,
+            (unsigned long long)st.blocks, (unsigned long long)st.syncs, (unsigned long long)st.stalls);
+    }
+    if(handle->ota.img != NULL) {
+        LOG_INFO("firmware transfer stopped with %u of %u fragments stored",
+            handle->ota.cum, handle->ota.img->frags);
+        ota_session_end(&handle->ota);
+    }
 
-    if(handle->mq < 0) {
-        fprintf(stderr, "ERROR: Failed to create ble device managerqueue.\n");
-        goto cleanup;            
+    LOG_INFO("%u packets dropped by full ring", atomic_load(&handle->rx.overflows));
+    ble_log_latency(k_lat_cycle, handle->bd_addr);
+
+    /* a cached database that never gave a reading is not trusted anymore */
+    if(handle->gatt_cached && !handle->first_reading_done && ble_conn_should_run) {
+        gatt_cache_invalidate(handle->bd_addr);
     }
+    free(handle->services);
+    free(handle->characteristics);
+
+    /* anything but a gateway shutdown or a new firmware means the hive
+     * misbehaved */
+    session_end(handle->bd_addr, ble_conn_should_run && !handle->ota_rebooted);
+
+    /* a sender inside a walk may still wake the ring or queue a message,
+     * both go with the handle once every walk that could see it ended */
+    devtab_remove(&ble_devices, handle->slot);
+    epoch_retire(&handle->retire, ble_device_release);
+}
+
+/**
+ *  @fn ble_device_step()
+ *  @brief event loop handler of a device, advances its state machine
+ *         until there is nothing else to do without waiting
+ *  @param
+ *  @return
+ */
+static void ble_device_step(void *args)
+{
+    ble_device_handle_t *handle = args;
+    ble_link_op_t op = handle->link_op;
+
+    /* back from the link threads */
+    handle->link_op = k_link_none;
+    if(op == k_link_write) {
+        handle->link_done(handle, handle->link_ret);
+    }
+
+    if(handle->state == k_dev_connect && handle->should_run) {
+        handle->link_op = k_link_connect;
+        ble_link_submit(handle);
+        return;
+    }
+
+    for(;;) {
+        if(!handle->should_run) {
+            handle->state = k_dev_disconnect;
+            ble_device_disconnect(handle);
+            return;
+        }
 
-    /* connection estabilished, now just manages the device
-     * until connection closes
-     */
-     while(handle->should_run && (handle->conn_handle != NULL)) {
         ble_device_handle_acquisition(handle);
-        usleep(BEEINFO_BLE_ACQ_PERIOD);
-     }
 
-cleanup:
-    printf("%s:-------------- EDGE DEVICE THREAD TERMINATING! ----------------\n\r", __func__);
-    fclose(fp_audio);
-    fclose(fp_acq);
-    timer_delete(handle->timer.timerid);
-    mq_close(handle->mq);
-
-    mq_unlink(mq_str); 
-    gattlib_disconnect(handle->conn_handle);
-    free(handle);
-    return(NULL);
+        /* a write with response leaves the loop until it is acknowledged */
+        if(handle->link_op != k_link_none) {
+            stats_set(&handle->stats->state, handle->state);
+            ble_link_submit(handle);
+            return;
+        }
+
+        /* park only if no packet, timer, earned frame or stop request raced in */
+        if(ble_rx_ring_arm(&handle->rx) && !atomic_load(&handle->timer_fired) &&
+            handle->should_run && !(handle->state == k_dev_idle && handle->tx_credit &&
+            ble_tx_pending(&handle->tx))) {
+            break;
+        }
+    }
+
+    stats_set(&handle->stats->state, handle->state);
+    sched_rearm(&handle->src);
 }
 
 
@@ -475,38 +1215,68 @@ cleanup:
  *  @return
  */
 static void ble_discovered_device(const char* addr, const char* name) {
+    ble_device_handle_t *handle = NULL;
     int ret;
 
-    printf("%s:------------------ DEVICE DISCOVERED! ------------------\n\r", __func__);
-    printf("%s: NAME: %s \n\r", __func__, name);
-    printf("%s: BD_ADDRESS: %s \n\r", __func__, addr);
-    printf("%s:--------------------------------------------------------\n\r", __func__);
-
-    
-    if(!strcmp(name, "beeinformed_edge")) {
-        
-
-        ble_device_handle_t *handle = malloc(sizeof(ble_device_handle_t));
-        memset(handle, 0, sizeof(ble_device_handle_t));
-        assert(handle != NULL);
+    if(name == NULL || strcmp(name, "beeinformed_edge")) {
+        goto cleanup;
+    }
 
-        /* gets the device information */
-        strcpy(&handle->bd_addr[0], addr);
-        strcpy(&handle->device_name[0], name);
-        handle->new_device = ble_add_device_to_list(cfg, handle);
-        handle->should_run = true;
+    /* steady state scanning sees hives that already have a session */
+    if(!session_try_begin(addr)) {
+        goto cleanup;
+    }
 
-        /* add device on connected devices list */
-        sys_dlist_init(&handle->link);        
-        sys_dlist_append(&ble_devices, &handle->link);
+    LOG_INFO("device discovered, name: %s, bd_address: %s", name, addr);
+
+
+    /* the rx ring is cache line aligned */
+    ret = posix_memalign((void **)&handle, BLE_CACHE_LINE_SIZE, sizeof(ble_device_handle_t));
+    assert(ret == 0 && handle != NULL);
+    memset(handle, 0, sizeof(ble_device_handle_t));
+
+    /* gets the device information */
+    strcpy(&handle->bd_addr[0], addr);
+    strcpy(&handle->device_name[0], name);
+    handle->new_device = ble_add_device_to_list(handle);
+    handle->stats = app_stats_device(addr);
+    atomic_fetch_add(&app_stats_gateway()->discoveries, 1);
+    handle->should_run = true;
+    handle->state = k_dev_connect;
+    app_timer_init(&handle->timer, ble_device_timer_handler, handle);
+    ble_tx_init(&handle->tx);
+
+    /* the ring eventfd is what the event loop waits for */
+    if(ble_rx_ring_init(&handle->rx) < 0) {
+        LOG_ERR("failed to create ble device ring");
+        session_end(addr, true);
+        free(handle);
+        goto cleanup;
+    }
+    handle->src.fd = handle->rx.efd;
+    handle->src.handler = ble_device_step;
+    handle->src.arg = handle;
+
+    /* publishes the device, senders reach it from now on */
+    handle->slot = devtab_insert(&ble_devices, handle);
+    if(handle->slot < 0) {
+        LOG_ERR("device table full, %s is not connected", addr);
+        session_end(addr, true);
+        ble_rx_ring_deinit(&handle->rx);
+        ble_tx_deinit(&handle->tx);
+        free(handle);
+        goto cleanup;
+    }
 
-        /* creates and starts the device thread */
-        ret = pthread_create(&handle->ble_device_thread, &handle->ble_dev_att,ble_device_manager_thread, handle);
-        if(ret) {
-            fprintf(stderr, "ERROR: Failed to start ble device manager.\n");
-        }
-        
+    /* hands the device to the event loop, connection is its first step */
+    ret = sched_add(&handle->src);
+    if(ret) {
+        LOG_ERR("failed to start ble device manager");
+        handle->should_run = false;
+        ble_device_disconnect(handle);
+        goto cleanup;
     }
+    eventfd_write(handle->rx.efd, 1);
 cleanup:    
     return;    
 }
@@ -519,43 +1289,54 @@ cleanup:
  */
 static void *ble_connection_manager_thread(void *args)
 {
+    session_stats_t stats;
     int ret;
     (void)args;
-    printf("%s: starting beeinformed connection manager! \n\r", __func__);
+    LOG_INFO("starting beeinformed connection manager");
     
     while(ble_conn_should_run) {
         /* now we start the discovery and create connections thread 
          * to each new device 
          */    
-        printf("%s:-----------------SCANNING BLE DEVICES! -----------------------\n\r", __func__);        
+        LOG_DEBUG("scanning ble devices");
         pthread_mutex_lock(&scan_mutex);
         /* perform some basic initialization and open the bt adapter */
         ret = gattlib_adapter_open(BEEINFO_BLE_DEF_ADAPTER, &hci_adapter);
         if (ret) {
-            fprintf(stderr, "ERROR: Failed to open adapter.\n");
+            LOG_ERR("failed to open adapter");
             pthread_mutex_unlock(&scan_mutex);              
             continue;
         }
 
         ret = gattlib_adapter_scan_enable(hci_adapter, ble_discovered_device,BEEINFO_BLE_DEF_TIMEOUT);
         if(ret) 
-            fprintf(stderr, "ERROR: Failed to scan.\n");
+            LOG_ERR("failed to scan");
         gattlib_adapter_scan_disable(hci_adapter);
         gattlib_adapter_close(hci_adapter);        
         pthread_mutex_unlock(&scan_mutex);  
-        printf("%s:-----------------END OF SCANNING BLE DEVICES! -----------------------\n\r", __func__);               
+        session_get_stats(&stats);
+        atomic_fetch_add(&app_stats_gateway()->scans, 1);
+        LOG_DEBUG("end of scanning ble devices");
+        LOG_INFO("sessions started: %lu, discoveries suppressed: connecting %lu, connected %lu, backoff %lu",
+            (unsigned long)stats.started, (unsigned long)stats.suppressed_connecting,
+            (unsigned long)stats.suppressed_connected, (unsigned long)stats.suppressed_backoff);               
         usleep(BEEINFO_BLE_SCAN_SLEEP_TIME);
     }
 
 
     /* if application was terminated, disconnects all the devices */
     ble_device_handle_t *dev;
+    uint32_t i;
 
-    SYS_DLIST_FOR_EACH_CONTAINER(&ble_devices,dev , link) {
-        /* disconnects and free the memory */
+    epoch_enter();
+    DEVTAB_FOR_EACH(&ble_devices, i, dev) {
+        /* the device disconnects and frees itself on its next step */
         dev->should_run = false;
-        pthread_join(dev->ble_device_thread, NULL);        
-    } 
+        ble_rx_ring_wakeup(&dev->rx);
+    }
+    epoch_exit();
+
+    devtab_wait_empty(&ble_devices);
 
     return(NULL);
 }
@@ -565,16 +1346,41 @@ static void *ble_connection_manager_thread(void *args)
 void beeinformed_app_ble_start(char *path)        
 
 {
+    char gatt_path[MAX_NAME_SIZE];
+    char *ext;
     int ret = 0;
 
     cfg = path;
 
-    sys_dlist_init(&ble_devices);
+    /* known devices are indexed once, discovery never touches the disk */
+    if(registry_open(cfg) < 0) {
+        LOG_ERR("failed to load the devices registry");
+    }
+
+    /* attribute cache lives next to the registry */
+    snprintf(gatt_path, sizeof(gatt_path), "%s", cfg);
+    ext = strrchr(gatt_path, '.');
+    if(ext != NULL && strchr(ext, '/') == NULL) {
+        *ext = '\0';
+    }
+    strncat(gatt_path, ".gatt", sizeof(gatt_path) - strlen(gatt_path) - 1);
+    if(gatt_cache_open(gatt_path) < 0) {
+        LOG_ERR("failed to load the gatt attribute cache");
+    }
+
+    /* blocking gatt operations never run on the event loop workers */
+    for(ble_link_started = 0; ble_link_started < BLE_LINK_THREADS; ble_link_started++) {
+        ret = pthread_create(&ble_link_threads[ble_link_started], NULL, ble_link_thread, NULL);
+        if(ret) {
+            LOG_ERR("failed to start ble link thread");
+            goto cleanup;
+        }
+    }
 
     /* creates and starts the connman thread */
     ret = pthread_create(&ble_conn_thread, &ble_conn_att,ble_connection_manager_thread, NULL);
     if(ret) {
-		fprintf(stderr, "ERROR: Failed to start ble conn manager.\n");
+		LOG_ERR("failed to start ble conn manager");
         goto cleanup;        
     }
 
@@ -587,11 +1393,48 @@ void beeinformed_app_ble_finish(void)
     /* request conn man to terminate */
     ble_conn_should_run = false;
     pthread_join(ble_conn_thread, NULL);
+
+    /* every device is gone, so are the operations it could have queued */
+    pthread_mutex_lock(&ble_link_mutex);
+    ble_link_should_run = false;
+    pthread_cond_broadcast(&ble_link_cond);
+    pthread_mutex_unlock(&ble_link_mutex);
+    for(uint32_t i = 0; i < ble_link_started; i++) {
+        pthread_join(ble_link_threads[i], NULL);
+    }
+    epoch_barrier();
+    for(uint32_t i = 0; i < k_lat_phases; i++) {
+        ble_log_latency(i, NULL);
+    }
+    gatt_cache_close();
+    registry_close();
 }
 
 int  beeinformed_app_ble_send_data(void *data, size_t size, app_ble_data_tag_t tag)
 {
-    int ret;
-    /** TODO */
+    ble_device_handle_t *dev;
+    ble_tx_msg_t *m;
+    uint32_t i;
+    int ret = 0;
+
+    /* encoded once, every hive queues a reference */
+    m = ble_tx_msg_new((uint8_t)tag, data, size);
+    if(m == NULL) {
+        return(-1);
+    }
+
+    /* no lock, a session ending meanwhile frees its queues only after */
+    epoch_enter();
+    DEVTAB_FOR_EACH(&ble_devices, i, dev) {
+        if(!dev->should_run || ble_tx_enqueue(&dev->tx, m) < 0) {
+            continue;
+        }
+        ble_rx_ring_wakeup(&dev->rx);
+        ret++;
+    }
+    epoch_exit();
+
+    ble_tx_msg_put(m);
     return(ret);
 }
+
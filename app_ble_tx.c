@@ -0,0 +1,176 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_ble_tx.c
+ *  @brief downstream channel from the gateway to the edge nodes, shared
+ *         messages framed per device by priority
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** static variables */
+
+/* queue of each tag, a node requisition must not wait behind data */
+static const int8_t ble_tx_prio_of_tag[] = {
+    [k_ble_node_requisition_tag] = 0,
+    [k_ble_gps_tag] = 1,
+    [k_ble_user_data_tag] = 2,
+};
+
+
+/** static functions */
+
+/**
+ *  @fn ble_tx_pop()
+ *  @brief takes the most urgent queued message, with lock held
+ *  @param
+ *  @return the message with its queue reference, NULL if none
+ */
+static ble_tx_msg_t *ble_tx_pop(ble_tx_t *t)
+{
+    for(uint32_t p = 0; p < BLE_TX_PRIOS; p++) {
+        ble_tx_queue_t *q = &t->q[p];
+
+        if(q->head != q->tail) {
+            atomic_fetch_sub(&t->pending, 1);
+            return(q->slot[q->tail++ & BLE_TX_QUEUE_MASK]);
+        }
+    }
+    return(NULL);
+}
+
+
+/** public functions */
+ble_tx_msg_t *ble_tx_msg_new(uint8_t tag, const void *data, size_t size)
+{
+    ble_tx_msg_t *m;
+
+    if(tag < k_ble_gps_tag || tag > k_ble_node_requisition_tag || size > BLE_TX_MSG_MAX ||
+        (size && data == NULL)) {
+        return(NULL);
+    }
+
+    m = malloc(sizeof(*m) + BLE_TX_REC_HDR_SIZE + size);
+    if(m == NULL) {
+        return(NULL);
+    }
+
+    atomic_init(&m->refs, 1);
+    m->prio = (uint8_t)ble_tx_prio_of_tag[tag];
+    m->len = (uint16_t)(BLE_TX_REC_HDR_SIZE + size);
+    m->data[0] = tag;
+    m->data[1] = (uint8_t)size;
+    memcpy(&m->data[BLE_TX_REC_HDR_SIZE], data, size);
+    return(m);
+}
+
+void ble_tx_msg_put(ble_tx_msg_t *m)
+{
+    if(m != NULL && atomic_fetch_sub_explicit(&m->refs, 1, memory_order_acq_rel) == 1) {
+        free(m);
+    }
+}
+
+void ble_tx_init(ble_tx_t *t)
+{
+    memset(t, 0, sizeof(*t));
+    pthread_mutex_init(&t->lock, NULL);
+    atomic_init(&t->pending, 0);
+}
+
+void ble_tx_deinit(ble_tx_t *t)
+{
+    ble_tx_msg_t *m;
+
+    pthread_mutex_lock(&t->lock);
+    while((m = ble_tx_pop(t)) != NULL) {
+        ble_tx_msg_put(m);
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    ble_tx_msg_put(t->cur);
+    t->cur = NULL;
+    pthread_mutex_destroy(&t->lock);
+}
+
+int ble_tx_enqueue(ble_tx_t *t, ble_tx_msg_t *m)
+{
+    ble_tx_queue_t *q = &t->q[m->prio];
+    ble_tx_msg_t *old = NULL;
+    int ret = 0;
+
+    atomic_fetch_add_explicit(&m->refs, 1, memory_order_relaxed);
+
+    pthread_mutex_lock(&t->lock);
+    if(m->data[0] == k_ble_gps_tag && q->head != q->tail) {
+        /* only the latest fix is worth the air time */
+        old = q->slot[(q->head - 1) & BLE_TX_QUEUE_MASK];
+        q->slot[(q->head - 1) & BLE_TX_QUEUE_MASK] = m;
+        t->stats.replaced++;
+    } else if(q->head - q->tail >= BLE_TX_QUEUE_SLOTS) {
+        old = m;
+        t->stats.dropped++;
+        ret = -1;
+    } else {
+        q->slot[q->head++ & BLE_TX_QUEUE_MASK] = m;
+        t->stats.queued++;
+
+        /* the device step checks this after arming its wakeup */
+        atomic_fetch_add(&t->pending, 1);
+    }
+    pthread_mutex_unlock(&t->lock);
+
+    ble_tx_msg_put(old);
+    return(ret);
+}
+
+size_t ble_tx_next_frame(ble_tx_t *t, ble_data_t *f)
+{
+    uint32_t fill = 0;
+    uint8_t ended = 0;
+
+    while(fill < PACKET_MAX_PAYLOAD) {
+        uint32_t n;
+
+        if(t->cur == NULL) {
+            if(!atomic_load(&t->pending)) {
+                break;
+            }
+            pthread_mutex_lock(&t->lock);
+            t->cur = ble_tx_pop(t);
+            pthread_mutex_unlock(&t->lock);
+            t->cur_off = 0;
+            if(t->cur == NULL) {
+                break;
+            }
+        }
+
+        /* records are packed back to back, a frame boundary may split them */
+        n = t->cur->len - t->cur_off;
+        if(n > PACKET_MAX_PAYLOAD - fill) {
+            n = PACKET_MAX_PAYLOAD - fill;
+        }
+        memcpy(&f->pack_data[fill], &t->cur->data[t->cur_off], n);
+        fill += n;
+        t->cur_off += n;
+
+        if(t->cur_off == t->cur->len) {
+            ble_tx_msg_put(t->cur);
+            t->cur = NULL;
+            t->stats.delivered++;
+            ended++;
+        }
+    }
+
+    if(!fill) {
+        return(0);
+    }
+
+    f->type = k_data_packet;
+    f->id = t->seq++;
+    f->pack_amount = ended;
+    f->payload_size = (uint8_t)fill;
+    t->stats.frames++;
+    t->stats.bytes += fill;
+    return(BLE_PACKET_HDR_SIZE + fill);
+}
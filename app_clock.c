@@ -0,0 +1,219 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_clock.c
+ *  @brief beeinformed gateway time service, readings are stamped from
+ *         CLOCK_MONOTONIC through a mapping to utc that gps keeps honest,
+ *         so wall clock jumps never reorder them
+ */
+
+#include "beeinformed_gateway.h"
+
+#define APP_CLOCK_NS                1000000000LL
+
+/** the mapping is published word by word, 32 bit atomics are lock free
+ *  everywhere we run */
+#define APP_CLOCK_MAP_WORDS         (sizeof(app_clock_map_t) / sizeof(uint32_t))
+
+/** static variables */
+static pthread_once_t clock_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t clock_stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static atomic_uint clock_seq;
+static _Atomic uint32_t clock_words[APP_CLOCK_MAP_WORDS];
+static app_clock_map_t clock_map;
+static app_clock_stats_t clock_stats;
+static int64_t clock_obs_utc[APP_CLOCK_WINDOW];
+static int64_t clock_obs_mono[APP_CLOCK_WINDOW];
+static uint32_t clock_obs_count;
+static uint32_t clock_last_utc;
+
+
+/** static functions */
+
+/**
+ *  @fn app_clock_publish()
+ *  @brief makes the writer copy of the mapping visible to readers
+ *  @param
+ *  @return
+ */
+static void app_clock_publish(void)
+{
+    unsigned int seq = atomic_load_explicit(&clock_seq, memory_order_relaxed);
+    uint32_t w[APP_CLOCK_MAP_WORDS];
+
+    memcpy(w, &clock_map, sizeof(w));
+    atomic_store_explicit(&clock_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for(size_t i = 0; i < APP_CLOCK_MAP_WORDS; i++) {
+        atomic_store_explicit(&clock_words[i], w[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&clock_seq, seq + 2, memory_order_release);
+}
+
+/**
+ *  @fn app_clock_init()
+ *  @brief until gps speaks, the system clock at start is all we have
+ *  @param
+ *  @return
+ */
+static void app_clock_init(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    clock_map.base_mono = app_clock_mono_ns();
+    clock_map.base_utc = (int64_t)ts.tv_sec * APP_CLOCK_NS + ts.tv_nsec;
+    app_clock_publish();
+}
+
+/**
+ *  @fn app_clock_load()
+ *  @brief reads a consistent copy of the mapping
+ *  @param
+ *  @return
+ */
+static void app_clock_load(app_clock_map_t *m)
+{
+    uint32_t w[APP_CLOCK_MAP_WORDS];
+    unsigned int seq, now;
+
+    pthread_once(&clock_once, app_clock_init);
+
+    /* the writer runs once per gps epoch and holds the odd count for a
+     * handful of stores */
+    do {
+        seq = atomic_load_explicit(&clock_seq, memory_order_acquire);
+        for(size_t i = 0; i < APP_CLOCK_MAP_WORDS; i++) {
+            w[i] = atomic_load_explicit(&clock_words[i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        now = atomic_load_explicit(&clock_seq, memory_order_relaxed);
+    } while((seq & 1) || seq != now);
+
+    memcpy(m, w, sizeof(w));
+}
+
+/**
+ *  @fn app_clock_eval()
+ *  @brief utc of a monotonic instant under a mapping
+ *  @param
+ *  @return
+ */
+static int64_t app_clock_eval(const app_clock_map_t *m, int64_t mono_ns)
+{
+    int64_t d = mono_ns - m->base_mono;
+    int64_t s = (d < m->slew_ns) ? d : m->slew_ns;
+
+    /* split so the product can not overflow however long ago the base was */
+    return(m->base_utc + d + (s / APP_CLOCK_NS) * m->rate_ppb + (s % APP_CLOCK_NS) * m->rate_ppb / APP_CLOCK_NS);
+}
+
+/**
+ *  @fn app_clock_rebase()
+ *  @brief starts a new mapping at an instant, absorbing an offset
+ *  @param
+ *  @return true if the offset was stepped
+ */
+static bool app_clock_rebase(int64_t mono_ns, int64_t offset)
+{
+    int64_t utc = app_clock_eval(&clock_map, mono_ns);
+    int64_t rate = offset / (APP_CLOCK_SLEW_NS / APP_CLOCK_NS);
+    bool step = !clock_stats.synced || offset > APP_CLOCK_STEP_NS;
+
+    clock_map.base_mono = mono_ns;
+    clock_map.base_utc = utc;
+    clock_map.rate_ppb = 0;
+    clock_map.slew_ns = 0;
+
+    if(step) {
+        clock_map.base_utc += offset;
+    } else if(rate) {
+        /* large errors run at the cap for as long as they need */
+        rate = (rate > APP_CLOCK_SLEW_MAX_PPB) ? APP_CLOCK_SLEW_MAX_PPB :
+               (rate < -APP_CLOCK_SLEW_MAX_PPB) ? -APP_CLOCK_SLEW_MAX_PPB : rate;
+        clock_map.rate_ppb = rate;
+        clock_map.slew_ns = (offset / rate) * APP_CLOCK_NS + (offset % rate) * APP_CLOCK_NS / rate;
+    }
+    app_clock_publish();
+    return(step);
+}
+
+
+/** public functions */
+int64_t app_clock_mono_ns(void)
+{
+    struct timespec ts;
+
+    /* served from the vdso, no trip to the kernel */
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((int64_t)ts.tv_sec * APP_CLOCK_NS + ts.tv_nsec);
+}
+
+int64_t app_clock_from_mono(int64_t mono_ns)
+{
+    app_clock_map_t m;
+
+    app_clock_load(&m);
+    return(app_clock_eval(&m, mono_ns));
+}
+
+int64_t app_clock_now_ns(void)
+{
+    return(app_clock_from_mono(app_clock_mono_ns()));
+}
+
+uint32_t app_clock_now(void)
+{
+    return((uint32_t)(app_clock_now_ns() / APP_CLOCK_NS));
+}
+
+void app_clock_discipline(uint32_t utc, int64_t mono_ns)
+{
+    int64_t offset = INT64_MIN;
+    bool step;
+
+    pthread_once(&clock_once, app_clock_init);
+
+    /* one observation per epoch, the first sentence has the least delay */
+    if(utc == clock_last_utc) {
+        return;
+    }
+    clock_last_utc = utc;
+    clock_obs_utc[clock_obs_count % APP_CLOCK_WINDOW] = (int64_t)utc * APP_CLOCK_NS + APP_CLOCK_NMEA_DELAY_NS;
+    clock_obs_mono[clock_obs_count % APP_CLOCK_WINDOW] = mono_ns;
+    clock_obs_count++;
+
+    for(uint32_t i = 0; i < APP_CLOCK_WINDOW && i < clock_obs_count; i++) {
+        int64_t o = clock_obs_utc[i] - app_clock_eval(&clock_map, clock_obs_mono[i]);
+
+        offset = (o > offset) ? o : offset;
+    }
+
+    /* the first fix wins outright, the window restarts from it */
+    if(!clock_stats.synced) {
+        offset = clock_obs_utc[(clock_obs_count - 1) % APP_CLOCK_WINDOW] - app_clock_eval(&clock_map, mono_ns);
+        clock_obs_count = 1;
+        clock_obs_utc[0] = (int64_t)utc * APP_CLOCK_NS + APP_CLOCK_NMEA_DELAY_NS;
+        clock_obs_mono[0] = mono_ns;
+    }
+    step = app_clock_rebase(mono_ns, offset);
+
+    pthread_mutex_lock(&clock_stats_mutex);
+    if(step) {
+        printf("%s: clock stepped by %lld ms to gps time \n\r", __func__, (long long)(offset / 1000000));
+        clock_stats.steps++;
+    }
+    clock_stats.synced = true;
+    clock_stats.updates++;
+    clock_stats.offset_ns = offset;
+    clock_stats.rate_ppb = clock_map.rate_ppb;
+    pthread_mutex_unlock(&clock_stats_mutex);
+}
+
+void app_clock_get_stats(app_clock_stats_t *s)
+{
+    assert(s != NULL);
+
+    pthread_mutex_lock(&clock_stats_mutex);
+    *s = clock_stats;
+    pthread_mutex_unlock(&clock_stats_mutex);
+}
@@ -0,0 +1,86 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_devtab.c
+ *  @brief table of live devices, writer side
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** public functions */
+int devtab_insert(devtab_t *t, void *dev)
+{
+    uint32_t hwm;
+    int slot = -1;
+
+    pthread_mutex_lock(&t->mutex);
+    hwm = atomic_load_explicit(&t->hwm, memory_order_relaxed);
+    for(uint32_t i = 0; i < DEVTAB_SLOTS; i++) {
+        if(atomic_load_explicit(&t->slot[i], memory_order_relaxed) == NULL) {
+            slot = (int)i;
+            break;
+        }
+    }
+    if(slot < 0) {
+        goto cleanup;
+    }
+
+    /* the device is complete before a reader can find it, the mark only
+     * grows after the slot is filled */
+    atomic_store_explicit(&t->slot[slot], dev, memory_order_release);
+    if((uint32_t)slot >= hwm) {
+        atomic_store_explicit(&t->hwm, (uint32_t)slot + 1, memory_order_release);
+    }
+    t->count++;
+
+cleanup:
+    pthread_mutex_unlock(&t->mutex);
+    return(slot);
+}
+
+void devtab_remove(devtab_t *t, int slot)
+{
+    uint32_t hwm;
+
+    if(slot < 0 || slot >= DEVTAB_SLOTS) {
+        return;
+    }
+
+    pthread_mutex_lock(&t->mutex);
+    if(atomic_load_explicit(&t->slot[slot], memory_order_relaxed) != NULL) {
+        atomic_store_explicit(&t->slot[slot], NULL, memory_order_release);
+        t->count--;
+    }
+
+    /* walks stop at the last device, a reader past the new mark only
+     * sees empty slots or devices inserted since */
+    hwm = atomic_load_explicit(&t->hwm, memory_order_relaxed);
+    while(hwm && atomic_load_explicit(&t->slot[hwm - 1], memory_order_relaxed) == NULL) {
+        hwm--;
+    }
+    atomic_store_explicit(&t->hwm, hwm, memory_order_release);
+
+    if(!t->count) {
+        pthread_cond_broadcast(&t->cond);
+    }
+    pthread_mutex_unlock(&t->mutex);
+}
+
+uint32_t devtab_count(devtab_t *t)
+{
+    uint32_t count;
+
+    pthread_mutex_lock(&t->mutex);
+    count = t->count;
+    pthread_mutex_unlock(&t->mutex);
+    return(count);
+}
+
+void devtab_wait_empty(devtab_t *t)
+{
+    pthread_mutex_lock(&t->mutex);
+    while(t->count) {
+        pthread_cond_wait(&t->cond, &t->mutex);
+    }
+    pthread_mutex_unlock(&t->mutex);
+}
@@ -0,0 +1,250 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_epoch.c
+ *  @brief epoch based reclamation, reader slots and the reclaimer thread
+ */
+
+#include "beeinformed_gateway.h"
+
+/** static variables */
+_Atomic uint64_t epoch_global = 1;
+__thread epoch_reader_t *epoch_self = NULL;
+
+static epoch_reader_t epoch_readers[EPOCH_MAX_THREADS];
+static _Atomic uint32_t epoch_readers_hwm = 0;
+static pthread_key_t epoch_key;
+static pthread_once_t epoch_key_once = PTHREAD_ONCE_INIT;
+
+/* retired by any thread, taken whole by the reclaimer */
+static _Atomic(epoch_node_t *) epoch_retired = NULL;
+static _Atomic uint32_t epoch_retired_count = 0;
+
+/* owned by whoever holds epoch_reclaim_mutex */
+static pthread_mutex_t epoch_reclaim_mutex = PTHREAD_MUTEX_INITIALIZER;
+static epoch_node_t *epoch_pending = NULL;
+
+static pthread_t epoch_thread;
+static pthread_mutex_t epoch_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t epoch_cond = PTHREAD_COND_INITIALIZER;
+static bool epoch_should_run = false;
+static bool epoch_kicked = false;
+
+
+/** static functions */
+
+/**
+ *  @fn epoch_thread_exit()
+ *  @brief gives the slot of an exiting thread back
+ *  @param
+ *  @return
+ */
+static void epoch_thread_exit(void *arg)
+{
+    epoch_reader_t *r = arg;
+
+    atomic_store_explicit(&r->epoch, 0, memory_order_release);
+    r->nest = 0;
+    atomic_store_explicit(&r->used, false, memory_order_release);
+}
+
+/**
+ *  @fn epoch_key_create()
+ *  @brief
+ *  @param
+ *  @return
+ */
+static void epoch_key_create(void)
+{
+    pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+/**
+ *  @fn epoch_kick()
+ *  @brief wakes the reclaimer before its period
+ *  @param
+ *  @return
+ */
+static void epoch_kick(void)
+{
+    pthread_mutex_lock(&epoch_mutex);
+    epoch_kicked = true;
+    pthread_cond_signal(&epoch_cond);
+    pthread_mutex_unlock(&epoch_mutex);
+}
+
+/**
+ *  @fn epoch_reclaimer_thread()
+ *  @brief releases retired objects every period or when kicked
+ *  @param
+ *  @return
+ */
+static void *epoch_reclaimer_thread(void *args)
+{
+    struct timespec ts;
+    (void)args;
+
+    pthread_mutex_lock(&epoch_mutex);
+    while(epoch_should_run) {
+        if(!epoch_kicked) {
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_nsec += EPOCH_RECLAIM_PERIOD_MS * 1000000L;
+            if(ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec++;
+                ts.tv_nsec -= 1000000000L;
+            }
+            pthread_cond_timedwait(&epoch_cond, &epoch_mutex, &ts);
+        }
+        epoch_kicked = false;
+
+        pthread_mutex_unlock(&epoch_mutex);
+        epoch_reclaim();
+        pthread_mutex_lock(&epoch_mutex);
+    }
+    pthread_mutex_unlock(&epoch_mutex);
+
+    return(NULL);
+}
+
+
+/** public functions */
+epoch_reader_t *epoch_register(void)
+{
+    epoch_reader_t *r;
+    uint32_t hwm;
+    bool used;
+
+    pthread_once(&epoch_key_once, epoch_key_create);
+
+    /* a thread past the limit waits for one to exit, never skips */
+    for(;;) {
+        for(uint32_t i = 0; i < EPOCH_MAX_THREADS; i++) {
+            r = &epoch_readers[i];
+            used = false;
+            if(!atomic_load_explicit(&r->used, memory_order_relaxed) &&
+                atomic_compare_exchange_strong(&r->used, &used, true)) {
+                goto found;
+            }
+        }
+        sched_yield();
+    }
+
+found:
+    hwm = atomic_load(&epoch_readers_hwm);
+    while(hwm < (uint32_t)(r - epoch_readers) + 1 &&
+        !atomic_compare_exchange_weak(&epoch_readers_hwm, &hwm, (uint32_t)(r - epoch_readers) + 1)) {
+    }
+
+    r->nest = 0;
+    epoch_self = r;
+    pthread_setspecific(epoch_key, r);
+    return(r);
+}
+
+void epoch_retire(epoch_node_t *node, void (*release)(epoch_node_t *node))
+{
+    epoch_node_t *head = atomic_load_explicit(&epoch_retired, memory_order_relaxed);
+
+    node->release = release;
+
+    /* the unlink happened before the bump, a reader announcing a later
+     * epoch can not see the object */
+    node->epoch = atomic_fetch_add(&epoch_global, 1);
+
+    do {
+        node->next = head;
+    } while(!atomic_compare_exchange_weak_explicit(&epoch_retired, &head, node,
+        memory_order_release, memory_order_relaxed));
+
+    if(atomic_fetch_add_explicit(&epoch_retired_count, 1, memory_order_relaxed) + 1 == EPOCH_RECLAIM_BATCH) {
+        epoch_kick();
+    }
+}
+
+uint32_t epoch_reclaim(void)
+{
+    epoch_node_t *n;
+    epoch_node_t *next;
+    epoch_node_t *keep = NULL;
+    uint64_t min;
+    uint64_t e;
+    uint32_t hwm;
+    uint32_t kept = 0;
+
+    pthread_mutex_lock(&epoch_reclaim_mutex);
+
+    n = atomic_exchange_explicit(&epoch_retired, NULL, memory_order_acquire);
+    atomic_store_explicit(&epoch_retired_count, 0, memory_order_relaxed);
+
+    /* the newest retirement comes first, join the older ones after it */
+    if(n != NULL) {
+        epoch_node_t *tail = n;
+
+        while(tail->next != NULL) {
+            tail = tail->next;
+        }
+        tail->next = epoch_pending;
+        epoch_pending = n;
+    }
+    n = epoch_pending;
+
+    /* pairs with the fence of epoch_enter() */
+    atomic_thread_fence(memory_order_seq_cst);
+    min = atomic_load(&epoch_global);
+    hwm = atomic_load(&epoch_readers_hwm);
+    for(uint32_t i = 0; i < hwm; i++) {
+        e = atomic_load_explicit(&epoch_readers[i].epoch, memory_order_acquire);
+        if(e && e < min) {
+            min = e;
+        }
+    }
+
+    for(; n != NULL; n = next) {
+        next = n->next;
+        if(n->epoch < min) {
+            n->release(n);
+        } else {
+            n->next = keep;
+            keep = n;
+            kept++;
+        }
+    }
+    epoch_pending = keep;
+
+    pthread_mutex_unlock(&epoch_reclaim_mutex);
+    return(kept);
+}
+
+void epoch_barrier(void)
+{
+    /* what is retired now has an epoch below the current one, it goes as
+     * soon as the readers move past it */
+    while(epoch_reclaim() || atomic_load(&epoch_retired) != NULL) {
+        usleep(1000);
+    }
+}
+
+int epoch_start(void)
+{
+    epoch_should_run = true;
+    if(pthread_create(&epoch_thread, NULL, epoch_reclaimer_thread, NULL)) {
+        fprintf(stderr, "ERROR: Failed to create the epoch reclaimer thread.\n");
+        epoch_should_run = false;
+        return(-1);
+    }
+    return(0);
+}
+
+void epoch_finish(void)
+{
+    pthread_mutex_lock(&epoch_mutex);
+    if(!epoch_should_run) {
+        pthread_mutex_unlock(&epoch_mutex);
+        return;
+    }
+    epoch_should_run = false;
+    pthread_cond_signal(&epoch_cond);
+    pthread_mutex_unlock(&epoch_mutex);
+    pthread_join(epoch_thread, NULL);
+
+    epoch_barrier();
+}
@@ -0,0 +1,316 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_gatt_cache.c
+ *  @brief beeinformed per device gatt attribute cache, saves a full
+ *         service discovery on every reconnection
+ */
+
+#include "beeinformed_gateway.h"
+
+/** cache entry */
+typedef struct gatt_cache_entry_s {
+    k_list_t link;
+    gatt_cache_record_t rec;
+}gatt_cache_entry_t;
+
+/** static variables */
+static pthread_mutex_t gatt_cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static k_list_t gatt_cache_buckets[GATT_CACHE_BUCKETS];
+static int gatt_cache_fd = -1;
+
+
+/** static functions */
+
+/**
+ *  @fn gatt_cache_bucket()
+ *  @brief bucket of a device address
+ *  @param
+ *  @return
+ */
+static inline k_list_t *gatt_cache_bucket(const char *bd_addr)
+{
+    return(&gatt_cache_buckets[fnv1a_str(bd_addr) & (GATT_CACHE_BUCKETS - 1)]);
+}
+
+/**
+ *  @fn gatt_cache_find()
+ *  @brief finds the entry of a device, with cache locked
+ *  @param
+ *  @return
+ */
+static gatt_cache_entry_t *gatt_cache_find(const char *bd_addr)
+{
+    k_list_t *bucket = gatt_cache_bucket(bd_addr);
+    gatt_cache_entry_t *e;
+
+    SYS_DLIST_FOR_EACH_CONTAINER(bucket, e, link) {
+        if(!strcmp(e->rec.bd_addr, bd_addr)) {
+            return(e);
+        }
+    }
+    return(NULL);
+}
+
+/**
+ *  @fn gatt_cache_put()
+ *  @brief inserts or replaces an entry, with cache locked
+ *  @param
+ *  @return
+ */
+static int gatt_cache_put(const gatt_cache_record_t *rec)
+{
+    gatt_cache_entry_t *e = gatt_cache_find(rec->bd_addr);
+
+    if(e == NULL) {
+        e = calloc(1, sizeof(gatt_cache_entry_t));
+        if(e == NULL) {
+            return(-1);
+        }
+        sys_dlist_append(gatt_cache_bucket(rec->bd_addr), &e->link);
+    }
+
+    e->rec = *rec;
+    return(0);
+}
+
+/**
+ *  @fn gatt_cache_append()
+ *  @brief persists a record, with cache locked
+ *  @param
+ *  @return
+ */
+static int gatt_cache_append(gatt_cache_record_t *rec)
+{
+    rec->crc = crc32c(0, rec, offsetof(gatt_cache_record_t, crc));
+    if(gatt_cache_fd < 0 || write(gatt_cache_fd, rec, sizeof(*rec)) != sizeof(*rec)) {
+        fprintf(stderr, "ERROR: Failed to persist gatt cache entry.\n");
+        return(-1);
+    }
+    return(0);
+}
+
+/**
+ *  @fn gatt_cache_compact()
+ *  @brief rewrites the file with the live entries only, replaced and
+ *         invalidated records would otherwise pile up forever, with cache
+ *         locked
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+static int gatt_cache_compact(const char *path)
+{
+    char tmp_path[MAX_PATH_SIZE + sizeof(".tmp")];
+    gatt_cache_entry_t *e;
+    int ret = -1;
+    int fd;
+
+    if(snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path) >= (int)sizeof(tmp_path)) {
+        return(-1);
+    }
+    fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if(fd < 0) {
+        return(-1);
+    }
+
+    for(int i = 0; i < GATT_CACHE_BUCKETS; i++) {
+        SYS_DLIST_FOR_EACH_CONTAINER(&gatt_cache_buckets[i], e, link) {
+            if(e->rec.valid && write(fd, &e->rec, sizeof(e->rec)) != sizeof(e->rec)) {
+                goto cleanup;
+            }
+        }
+    }
+
+    /* the old file stays whole until the new one is durable */
+    if(fdatasync(fd) < 0 || rename(tmp_path, path) < 0) {
+        goto cleanup;
+    }
+    ret = 0;
+
+cleanup:
+    close(fd);
+    if(ret < 0) {
+        unlink(tmp_path);
+    }
+    return(ret);
+}
+
+/**
+ *  @fn gatt_cache_hash_uuid()
+ *  @brief extends a hash with an uuid, its type and the bytes of its value
+ *         only, the padding after the type is whatever the stack left
+ *  @param
+ *  @return
+ */
+static uint32_t gatt_cache_hash_uuid(uint32_t h, const uuid_t *uuid)
+{
+    h = fnv1a(h, &uuid->type, sizeof(uuid->type));
+    switch(uuid->type) {
+    case SDP_UUID16:
+        h = fnv1a(h, &uuid->value.uuid16, sizeof(uuid->value.uuid16));
+        break;
+    case SDP_UUID32:
+        h = fnv1a(h, &uuid->value.uuid32, sizeof(uuid->value.uuid32));
+        break;
+    case SDP_UUID128:
+        h = fnv1a(h, &uuid->value.uuid128, sizeof(uuid->value.uuid128));
+        break;
+    default:
+        break;
+    }
+    return(h);
+}
+
+
+/** public functions */
+int gatt_cache_open(const char *path)
+{
+    gatt_cache_record_t rec;
+    off_t valid = 0;
+    bool compacted = false;
+    FILE *fp;
+    int ret = 0;
+
+    pthread_mutex_lock(&gatt_cache_mutex);
+
+    for(int i = 0; i < GATT_CACHE_BUCKETS; i++) {
+        sys_dlist_init(&gatt_cache_buckets[i]);
+    }
+
+    fp = fopen(path, "rb");
+    if(fp != NULL) {
+        while(fread(&rec, 1, sizeof(rec), fp) == sizeof(rec)) {
+            if(rec.magic != GATT_CACHE_MAGIC || rec.version != GATT_CACHE_VERSION ||
+                rec.size != sizeof(rec) || memchr(rec.bd_addr, 0, REGISTRY_ADDR_SIZE) == NULL ||
+                crc32c(0, &rec, offsetof(gatt_cache_record_t, crc)) != rec.crc) {
+                break;
+            }
+            gatt_cache_put(&rec);
+            valid += sizeof(rec);
+        }
+        fclose(fp);
+
+        /* appends go to the compacted file, a failure leaves the old one */
+        if(gatt_cache_compact(path) < 0) {
+            fprintf(stderr, "ERROR: Failed to compact the gatt cache.\n");
+        } else {
+            compacted = true;
+        }
+    }
+
+    gatt_cache_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(gatt_cache_fd < 0) {
+        fprintf(stderr, "ERROR: Failed to open the gatt cache.\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    /* a cache is only a hint, whatever follows a bad record is dropped */
+    if(!compacted && ftruncate(gatt_cache_fd, valid) < 0) {
+        fprintf(stderr, "ERROR: Failed to truncate the gatt cache.\n");
+    }
+
+cleanup:
+    pthread_mutex_unlock(&gatt_cache_mutex);
+    return(ret);
+}
+
+void gatt_cache_close(void)
+{
+    pthread_mutex_lock(&gatt_cache_mutex);
+    for(int i = 0; i < GATT_CACHE_BUCKETS; i++) {
+        k_list_t *node;
+
+        if(gatt_cache_buckets[i].head == NULL) {
+            continue;
+        }
+        while((node = sys_dlist_get(&gatt_cache_buckets[i])) != NULL) {
+            free(CONTAINER_OF(node, gatt_cache_entry_t, link));
+        }
+    }
+
+    if(gatt_cache_fd >= 0) {
+        close(gatt_cache_fd);
+        gatt_cache_fd = -1;
+    }
+    pthread_mutex_unlock(&gatt_cache_mutex);
+}
+
+bool gatt_cache_lookup(const char *bd_addr, gatt_cache_record_t *rec)
+{
+    gatt_cache_entry_t *e;
+    bool found = false;
+
+    assert(bd_addr != NULL && rec != NULL);
+
+    pthread_mutex_lock(&gatt_cache_mutex);
+    e = gatt_cache_find(bd_addr);
+    if(e != NULL && e->rec.valid) {
+        *rec = e->rec;
+        found = true;
+    }
+    pthread_mutex_unlock(&gatt_cache_mutex);
+
+    return(found);
+}
+
+int gatt_cache_store(gatt_cache_record_t *rec)
+{
+    gatt_cache_entry_t *e;
+    int ret = 0;
+
+    assert(rec != NULL);
+
+    rec->magic = GATT_CACHE_MAGIC;
+    rec->version = GATT_CACHE_VERSION;
+    rec->size = sizeof(*rec);
+    rec->valid = 1;
+    rec->crc = crc32c(0, rec, offsetof(gatt_cache_record_t, crc));
+
+    pthread_mutex_lock(&gatt_cache_mutex);
+    e = gatt_cache_find(rec->bd_addr);
+    if(e == NULL || memcmp(&e->rec, rec, sizeof(*rec))) {
+        ret = gatt_cache_append(rec);
+        if(!ret) {
+            ret = gatt_cache_put(rec);
+        }
+    }
+    pthread_mutex_unlock(&gatt_cache_mutex);
+
+    return(ret);
+}
+
+void gatt_cache_invalidate(const char *bd_addr)
+{
+    gatt_cache_entry_t *e;
+
+    assert(bd_addr != NULL);
+
+    pthread_mutex_lock(&gatt_cache_mutex);
+    e = gatt_cache_find(bd_addr);
+    if(e != NULL && e->rec.valid) {
+        e->rec.valid = 0;
+        gatt_cache_append(&e->rec);
+    }
+    pthread_mutex_unlock(&gatt_cache_mutex);
+}
+
+uint32_t gatt_cache_hash(const gattlib_primary_service_t *services, int services_count,
+            const gattlib_characteristic_t *characteristics, int characteristics_count)
+{
+    uint32_t h = FNV1A_INIT;
+
+    for(int i = 0; i < services_count; i++) {
+        h = fnv1a(h, &services[i].attr_handle_start, sizeof(services[i].attr_handle_start));
+        h = fnv1a(h, &services[i].attr_handle_end, sizeof(services[i].attr_handle_end));
+        h = gatt_cache_hash_uuid(h, &services[i].uuid);
+    }
+
+    for(int i = 0; characteristics != NULL && i < characteristics_count; i++) {
+        h = fnv1a(h, &characteristics[i].handle, sizeof(characteristics[i].handle));
+        h = fnv1a(h, &characteristics[i].properties, sizeof(characteristics[i].properties));
+        h = fnv1a(h, &characteristics[i].value_handle, sizeof(characteristics[i].value_handle));
+        h = gatt_cache_hash_uuid(h, &characteristics[i].uuid);
+    }
+
+    return(h);
+}
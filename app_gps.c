@@ -6,20 +6,274 @@
 
  #include "beeinformed_gateway.h"
 
- /** public functions */
+/** the snapshot is published word by word */
+#define GPS_DATA_WORDS      (sizeof(gps_data_t) / sizeof(uint32_t))
+
+/** static variables */
+static pthread_t gps_thread;
+static pthread_mutex_t gps_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t gps_cond = PTHREAD_COND_INITIALIZER;
+static bool gps_should_run = false;
+static char gps_path[MAX_NAME_SIZE];
+static char gps_buf[GPS_NMEA_BUFFER_SIZE];
+static gps_nmea_t gps_nmea;
+static uint64_t gps_publishes;
+static uint32_t gps_sent_utc;
+
+/* twice the version of the last complete snapshot, plus one while the
+ * next one is written to the other slot */
+static atomic_uint gps_seq;
+static _Atomic uint32_t gps_slot[2][GPS_DATA_WORDS];
+
+
+/** static functions */
+
+/**
+ *  @fn gps_publish()
+ *  @brief makes a fix visible to readers, the slot readers use is never
+ *         the one being written
+ *  @param
+ *  @return
+ */
+static void gps_publish(const gps_data_t *g)
+{
+    unsigned int seq = atomic_load_explicit(&gps_seq, memory_order_relaxed);
+    _Atomic uint32_t *slot = gps_slot[((seq >> 1) + 1) & 1];
+    uint32_t w[GPS_DATA_WORDS];
+
+    memcpy(w, g, sizeof(w));
+    atomic_store_explicit(&gps_seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for(size_t i = 0; i < GPS_DATA_WORDS; i++) {
+        atomic_store_explicit(&slot[i], w[i], memory_order_relaxed);
+    }
+    atomic_store_explicit(&gps_seq, seq + 2, memory_order_release);
+    gps_publishes++;
+}
+
+/**
+ *  @fn gps_wait()
+ *  @brief sleeps unless asked to stop, zero only checks
+ *  @param
+ *  @return false once the manager is finishing
+ */
+static bool gps_wait(uint32_t ms)
+{
+    struct timespec ts;
+    bool run;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_sec += ms / 1000;
+    ts.tv_nsec += (ms % 1000) * 1000000L;
+    if(ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&gps_mutex);
+    if(gps_should_run && ms) {
+        pthread_cond_timedwait(&gps_cond, &gps_mutex, &ts);
+    }
+    run = gps_should_run;
+    pthread_mutex_unlock(&gps_mutex);
+    return(run);
+}
+
+/**
+ *  @fn gps_open()
+ *  @brief opens the receiver, a tty is switched to raw mode
+ *  @param
+ *  @return the descriptor, -1 on failure
+ */
+static int gps_open(bool *replay)
+{
+    struct termios tio;
+    struct stat st;
+    int fd;
+
+    fd = open(gps_path, O_RDONLY | O_NOCTTY | O_CLOEXEC);
+    if(fd < 0) {
+        return(-1);
+    }
+    *replay = (fstat(fd, &st) == 0 && S_ISREG(st.st_mode));
+    if(!*replay && tcgetattr(fd, &tio) == 0) {
+        cfmakeraw(&tio);
+        cfsetispeed(&tio, GPS_BAUDRATE);
+        cfsetospeed(&tio, GPS_BAUDRATE);
+        tio.c_cflag |= CLOCAL | CREAD;
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    printf("%s: reading NMEA from %s%s \n\r", __func__, gps_path, (*replay) ? ", replaying" : "");
+    return(fd);
+}
 
-void beeinformed_app_gps_start(void)
+/**
+ *  @fn gps_consume()
+ *  @brief parses the complete lines of the buffer, mono is when they
+ *         arrived
+ *  @param
+ *  @return bytes of a partial line left at the start of the buffer
+ */
+static size_t gps_consume(size_t fill, bool replay, int64_t mono)
+{
+    uint32_t utc = gps_nmea.data.utc_timestamp;
+    size_t start = 0;
+    char *nl;
+
+    while((nl = memchr(gps_buf + start, '\n', fill - start)) != NULL) {
+        char *s = memchr(gps_buf + start, '$', nl - (gps_buf + start));
+
+        /* line noise before the '$' is skipped */
+        if(s != NULL && gps_nmea_parse(&gps_nmea, s, nl - s) > 0) {
+            if(replay && utc && gps_nmea.data.utc_timestamp != utc) {
+                if(!gps_wait(GPS_REPLAY_EPOCH_MS)) {
+                    return(0);
+                }
+                mono = app_clock_mono_ns();
+            }
+            utc = gps_nmea.data.utc_timestamp;
+            gps_publish(&gps_nmea.data);
+
+            /* only a fix vouches for the time, the hives get it once per epoch */
+            if(gps_nmea.data.fix && utc) {
+                if(utc != gps_sent_utc) {
+                    gps_sent_utc = utc;
+                    beeinformed_app_ble_send_data(&gps_nmea.data, sizeof(gps_nmea.data), k_ble_gps_tag);
+                }
+                app_clock_discipline(utc, mono);
+            }
+        }
+        start = nl + 1 - gps_buf;
+    }
+
+    /* a line this long is not NMEA */
+    if(start == 0 && fill == sizeof(gps_buf)) {
+        return(0);
+    }
+    memmove(gps_buf, gps_buf + start, fill - start);
+    return(fill - start);
+}
+
+/**
+ *  @fn gps_reader_thread()
+ *  @brief gps reader thread
+ *  @param
+ *  @return
+ */
+static void *gps_reader_thread(void *args)
+{
+    struct pollfd pfd;
+    uint64_t rewound = 0;
+    bool replay = false;
+    bool warned = false;
+    size_t fill = 0;
+    ssize_t got;
+    int fd = -1;
+
+    (void)args;
+
+    while(gps_wait(0)) {
+        if(fd < 0) {
+            fd = gps_open(&replay);
+            if(fd < 0) {
+                if(!warned) {
+                    fprintf(stderr, "ERROR: No gps receiver at %s, retrying.\n", gps_path);
+                    warned = true;
+                }
+                gps_wait(GPS_RETRY_MS);
+                continue;
+            }
+            warned = false;
+            fill = 0;
+        }
+
+        /* polled so a quiet receiver still lets the thread finish */
+        if(!replay) {
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            if(poll(&pfd, 1, GPS_POLL_MS) <= 0) {
+                continue;
+            }
+        }
+
+        got = read(fd, gps_buf + fill, sizeof(gps_buf) - fill);
+        if(got == 0 && replay) {
+            /* a replay loops, unless it holds nothing to parse */
+            if(gps_nmea.accepted == rewound) {
+                gps_wait(GPS_RETRY_MS);
+            }
+            rewound = gps_nmea.accepted;
+            lseek(fd, 0, SEEK_SET);
+            fill = 0;
+            continue;
+        }
+        if(got < 0 && (errno == EINTR || errno == EAGAIN)) {
+            continue;
+        }
+        if(got <= 0) {
+            fprintf(stderr, "ERROR: Lost the gps receiver at %s.\n", gps_path);
+            close(fd);
+            fd = -1;
+            continue;
+        }
+        fill = gps_consume(fill + got, replay, app_clock_mono_ns());
+    }
+
+    if(fd >= 0) {
+        close(fd);
+    }
+    return(NULL);
+}
+
+
+ /** public functions */
+void beeinformed_app_gps_start(const char *path)
 {
+    assert(path != NULL);
 
+    snprintf(gps_path, sizeof(gps_path), "%s", path);
+    gps_should_run = true;
+    if(pthread_create(&gps_thread, NULL, gps_reader_thread, NULL)) {
+        gps_should_run = false;
+        fprintf(stderr, "ERROR: Failed to start the gps reader thread.\n");
+    }
 }
 
 void beeinformed_app_gps_finish(void)
 {
+    pthread_mutex_lock(&gps_mutex);
+    if(!gps_should_run) {
+        pthread_mutex_unlock(&gps_mutex);
+        return;
+    }
+    gps_should_run = false;
+    pthread_cond_signal(&gps_cond);
+    pthread_mutex_unlock(&gps_mutex);
 
+    pthread_join(gps_thread, NULL);
+    printf("%s: %llu sentences, %llu accepted, %llu malformed, %llu fixes published \n\r", __func__,
+        (unsigned long long)gps_nmea.sentences, (unsigned long long)gps_nmea.accepted,
+        (unsigned long long)gps_nmea.bad, (unsigned long long)gps_publishes);
 }
 
 int beeinformed_app_gps_get_data(gps_data_t *g)
 {
-    int ret;
-    return(ret);
+    uint32_t w[GPS_DATA_WORDS];
+    unsigned int seq, now;
+
+    assert(g != NULL);
+
+    /* only a writer lapping the copy, a whole fix and the start of the
+     * next one, makes it go again */
+    do {
+        seq = atomic_load_explicit(&gps_seq, memory_order_acquire);
+        for(size_t i = 0; i < GPS_DATA_WORDS; i++) {
+            w[i] = atomic_load_explicit(&gps_slot[(seq >> 1) & 1][i], memory_order_relaxed);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        now = atomic_load_explicit(&gps_seq, memory_order_relaxed);
+    } while(now - (seq & ~1U) > 2);
+
+    memcpy(g, w, sizeof(w));
+    return((g->fix) ? 0 : -1);
 }
@@ -0,0 +1,329 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_gps_nmea.c
+ *  @brief NMEA sentence parser of the gps manager, fields are parsed in
+ *         place with no allocation
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** static functions */
+
+/**
+ *  @fn gps_nmea_hex()
+ *  @brief value of a hex digit
+ *  @param
+ *  @return -1 if not one
+ */
+static inline int gps_nmea_hex(char c)
+{
+    if(c >= '0' && c <= '9') {
+        return(c - '0');
+    }
+    if(c >= 'A' && c <= 'F') {
+        return(c - 'A' + 10);
+    }
+    return(-1);
+}
+
+/**
+ *  @fn gps_nmea_fixed()
+ *  @brief parses a decimal field as an integer scaled by 10^digits, extra
+ *         fraction digits are truncated
+ *  @param
+ *  @return false if empty or malformed
+ */
+static bool gps_nmea_fixed(const char *f, size_t len, uint32_t digits, uint64_t *v)
+{
+    const char *end = f + len;
+    uint64_t x = 0;
+    bool any = false;
+
+    while(f < end && *f != '.') {
+        if(*f < '0' || *f > '9') {
+            return(false);
+        }
+        x = x * 10 + (*f++ - '0');
+        any = true;
+    }
+    if(f < end) {
+        f++;
+    }
+    for(; digits; digits--) {
+        x *= 10;
+        if(f < end) {
+            if(*f < '0' || *f > '9') {
+                return(false);
+            }
+            x += *f++ - '0';
+            any = true;
+        }
+    }
+    *v = x;
+    return(any);
+}
+
+/**
+ *  @fn gps_nmea_coord()
+ *  @brief parses a [d]ddmm.mmmm field and its hemisphere into 1e-7 degrees
+ *  @param
+ *  @return false if empty or malformed
+ */
+static bool gps_nmea_coord(const char *f, size_t len, const char *h, size_t hlen, int32_t *v)
+{
+    uint64_t x;
+    int64_t deg;
+
+    if(!gps_nmea_fixed(f, len, 7, &x) || hlen != 1) {
+        return(false);
+    }
+
+    /* whole degrees sit above the two minute digits */
+    deg = (int64_t)(x / 1000000000ULL) * 10000000LL + (int64_t)((x % 1000000000ULL) + 30) / 60;
+    if(*h == 'S' || *h == 'W') {
+        deg = -deg;
+    } else if(*h != 'N' && *h != 'E') {
+        return(false);
+    }
+    *v = (int32_t)deg;
+    return(true);
+}
+
+/**
+ *  @fn gps_nmea_digits()
+ *  @brief value of the two decimal digits at f
+ *  @param
+ *  @return
+ */
+static inline uint32_t gps_nmea_digits(const char *f)
+{
+    return((f[0] - '0') * 10 + (f[1] - '0'));
+}
+
+/**
+ *  @fn gps_nmea_clock()
+ *  @brief parses a hhmmss[.ss] field into seconds of the day
+ *  @param
+ *  @return false if empty or malformed
+ */
+static bool gps_nmea_clock(const char *f, size_t len, uint32_t *tod)
+{
+    if(len < 6) {
+        return(false);
+    }
+    for(int i = 0; i < 6; i++) {
+        if(f[i] < '0' || f[i] > '9') {
+            return(false);
+        }
+    }
+    *tod = gps_nmea_digits(f) * 3600 + gps_nmea_digits(f + 2) * 60 + gps_nmea_digits(f + 4);
+    return(*tod <= 86400);
+}
+
+/**
+ *  @fn gps_nmea_date()
+ *  @brief parses a ddmmyy field into days since the epoch
+ *  @param
+ *  @return false if empty or malformed
+ */
+static bool gps_nmea_date(const char *f, size_t len, uint32_t *days)
+{
+    int32_t y, m, d, era, yoe, doy;
+
+    if(len != 6) {
+        return(false);
+    }
+    for(int i = 0; i < 6; i++) {
+        if(f[i] < '0' || f[i] > '9') {
+            return(false);
+        }
+    }
+    d = gps_nmea_digits(f);
+    m = gps_nmea_digits(f + 2);
+    y = 2000 + gps_nmea_digits(f + 4);
+    if(m < 1 || m > 12 || d < 1 || d > 31) {
+        return(false);
+    }
+
+    /* proleptic gregorian days, march based so leap days come last */
+    y -= (m <= 2);
+    era = y / 400;
+    yoe = y - era * 400;
+    doy = (153 * (m + ((m > 2) ? -3 : 9)) + 2) / 5 + d - 1;
+    *days = (uint32_t)(era * 146097 + yoe * 365 + yoe / 4 - yoe / 100 + doy - 719468);
+    return(true);
+}
+
+/**
+ *  @fn gps_nmea_time()
+ *  @brief updates the fix time, it only counts once a date is known
+ *  @param
+ *  @return
+ */
+static void gps_nmea_time(gps_nmea_t *n, uint32_t tod)
+{
+    if(n->days) {
+        n->data.utc_timestamp = n->days * 86400 + tod;
+    }
+}
+
+/**
+ *  @fn gps_nmea_gga()
+ *  @brief time, position, fix quality and hdop
+ *  @param
+ *  @return
+ */
+static int gps_nmea_gga(gps_nmea_t *n, const char **fld, const uint8_t *flen, int count)
+{
+    uint32_t tod, quality;
+    uint64_t v;
+    int32_t lat, lon;
+
+    if(count < 10 || !gps_nmea_fixed(fld[6], flen[6], 0, &v)) {
+        return(-1);
+    }
+    quality = (uint32_t)v;
+    if(!quality) {
+        n->data.fix = 0;
+        return(1);
+    }
+    if(!gps_nmea_clock(fld[1], flen[1], &tod) ||
+        !gps_nmea_coord(fld[2], flen[2], fld[3], flen[3], &lat) ||
+        !gps_nmea_coord(fld[4], flen[4], fld[5], flen[5], &lon)) {
+        return(-1);
+    }
+    if(gps_nmea_fixed(fld[8], flen[8], 2, &v)) {
+        n->data.hdop = (uint32_t)v;
+    }
+
+    n->data.lati = lat;
+    n->data.longi = lon;
+    n->data.fix = quality;
+    gps_nmea_time(n, tod);
+    return(1);
+}
+
+/**
+ *  @fn gps_nmea_rmc()
+ *  @brief time, date, validity and position
+ *  @param
+ *  @return
+ */
+static int gps_nmea_rmc(gps_nmea_t *n, const char **fld, const uint8_t *flen, int count)
+{
+    uint32_t tod, days;
+    int32_t lat, lon;
+
+    if(count < 10 || flen[2] != 1) {
+        return(-1);
+    }
+    if(gps_nmea_clock(fld[1], flen[1], &tod) && gps_nmea_date(fld[9], flen[9], &days)) {
+        n->days = days;
+        gps_nmea_time(n, tod);
+    }
+    if(fld[2][0] != 'A') {
+        n->data.fix = 0;
+        return(1);
+    }
+    if(!gps_nmea_coord(fld[3], flen[3], fld[4], flen[4], &lat) ||
+        !gps_nmea_coord(fld[5], flen[5], fld[6], flen[6], &lon)) {
+        return(-1);
+    }
+
+    n->data.lati = lat;
+    n->data.longi = lon;
+    n->data.fix = (n->data.fix) ? n->data.fix : 1;
+    return(1);
+}
+
+/**
+ *  @fn gps_nmea_gsa()
+ *  @brief dilution of precision of the satellites in use
+ *  @param
+ *  @return
+ */
+static int gps_nmea_gsa(gps_nmea_t *n, const char **fld, const uint8_t *flen, int count)
+{
+    uint64_t pdop, hdop;
+
+    if(count < 18 || flen[2] != 1) {
+        return(-1);
+    }
+
+    /* without a fix the dops are empty or meaningless */
+    if(fld[2][0] < '2') {
+        return(0);
+    }
+    if(!gps_nmea_fixed(fld[15], flen[15], 2, &pdop) || !gps_nmea_fixed(fld[16], flen[16], 2, &hdop)) {
+        return(-1);
+    }
+    n->data.pdop = (uint32_t)pdop;
+    n->data.hdop = (uint32_t)hdop;
+    return(1);
+}
+
+
+/** public functions */
+int gps_nmea_parse(gps_nmea_t *n, const char *s, size_t len)
+{
+    const char *fld[GPS_NMEA_MAX_FIELDS];
+    uint8_t flen[GPS_NMEA_MAX_FIELDS];
+    const char *star;
+    const char *p;
+    uint8_t sum = 0;
+    int count = 0;
+    int hi, lo;
+    int ret = 0;
+
+    assert(n != NULL && s != NULL);
+
+    n->sentences++;
+    while(len && (s[len - 1] == '\r' || s[len - 1] == '\n')) {
+        len--;
+    }
+    if(len < 9 || len > 82 || s[0] != '$' || s[len - 3] != '*') {
+        goto cleanup;
+    }
+
+    /* the checksum covers everything between '$' and '*' */
+    star = s + len - 3;
+    for(p = s + 1; p < star; p++) {
+        sum ^= (uint8_t)*p;
+    }
+    hi = gps_nmea_hex(star[1]);
+    lo = gps_nmea_hex(star[2]);
+    if(hi < 0 || lo < 0 || ((hi << 4) | lo) != sum) {
+        goto cleanup;
+    }
+
+    /* fields point into the sentence, nothing is copied */
+    fld[0] = s + 1;
+    for(p = s + 1; p < star && count < GPS_NMEA_MAX_FIELDS - 1; p++) {
+        if(*p == ',') {
+            flen[count] = (uint8_t)(p - fld[count]);
+            fld[++count] = p + 1;
+        }
+    }
+    flen[count] = (uint8_t)(star - fld[count]);
+    count++;
+
+    /* any talker, proprietary sentences are not ours */
+    if(flen[0] == 5 && !memcmp(fld[0] + 2, "GGA", 3)) {
+        ret = gps_nmea_gga(n, fld, flen, count);
+    } else if(flen[0] == 5 && !memcmp(fld[0] + 2, "RMC", 3)) {
+        ret = gps_nmea_rmc(n, fld, flen, count);
+    } else if(flen[0] == 5 && !memcmp(fld[0] + 2, "GSA", 3)) {
+        ret = gps_nmea_gsa(n, fld, flen, count);
+    }
+    if(ret > 0) {
+        n->accepted++;
+    } else if(ret < 0) {
+        n->bad++;
+    }
+    return(ret);
+
+cleanup:
+    n->bad++;
+    return(-1);
+}
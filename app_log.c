@@ -0,0 +1,592 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_log.c
+ *  @brief asynchronous binary logger, per thread buffers merged by a
+ *         drainer thread into a self describing binary file
+ */
+
+#include "beeinformed_gateway.h"
+
+/** per thread buffer, single producer, the drainer is its consumer */
+typedef struct app_log_buf_s {
+    /* producer side */
+    _Atomic uint64_t head __attribute__((aligned(BLE_CACHE_LINE_SIZE)));
+    _Atomic uint64_t dropped;
+
+    /* drainer side */
+    _Atomic uint64_t tail __attribute__((aligned(BLE_CACHE_LINE_SIZE)));
+    uint64_t dropped_seen;
+    _Atomic bool orphan;
+    uint32_t tid;
+    struct app_log_buf_s *next;
+
+    uint8_t data[LOG_BUF_SIZE] __attribute__((aligned(BLE_CACHE_LINE_SIZE)));
+}app_log_buf_t;
+
+/** static variables */
+_Atomic int app_log_level = LOG_LEVEL_INFO;
+
+static __thread app_log_buf_t *app_log_tls;
+static pthread_key_t app_log_key;
+static pthread_once_t app_log_once = PTHREAD_ONCE_INIT;
+
+/* buffers are only ever freed by the drainer */
+static app_log_buf_t *app_log_bufs;
+static pthread_mutex_t app_log_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t app_log_cond = PTHREAD_COND_INITIALIZER;
+static pthread_t app_log_thread;
+static bool app_log_should_run;
+static _Atomic bool app_log_kicked;
+
+/* drainer only */
+static char app_log_path[MAX_NAME_SIZE];
+static int app_log_fd = -1;
+static uint64_t app_log_file_bytes;
+static uint8_t app_log_out[64 * 1024];
+static uint32_t app_log_out_len;
+static uint64_t *app_log_sites;
+static uint32_t app_log_sites_cap;
+static uint32_t app_log_sites_count;
+
+
+/** static functions */
+
+/**
+ *  @fn app_log_now_ns()
+ *  @brief monotonic time in nanoseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t app_log_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ *  @fn app_log_align()
+ *  @brief rounds a size up to the record alignment
+ *  @param
+ *  @return
+ */
+static inline uint32_t app_log_align(uint32_t n)
+{
+    return((n + 7) & ~7u);
+}
+
+/**
+ *  @fn app_log_thread_exit()
+ *  @brief hands the buffer of an exiting thread to the drainer
+ *  @param
+ *  @return
+ */
+static void app_log_thread_exit(void *arg)
+{
+    app_log_buf_t *b = arg;
+
+    app_log_tls = NULL;
+    atomic_store_explicit(&b->orphan, true, memory_order_release);
+}
+
+/**
+ *  @fn app_log_key_create()
+ *  @brief creates the key whose destructor releases thread buffers
+ *  @param
+ *  @return
+ */
+static void app_log_key_create(void)
+{
+    pthread_key_create(&app_log_key, app_log_thread_exit);
+}
+
+/**
+ *  @fn app_log_register()
+ *  @brief creates the buffer of the calling thread, once per thread
+ *  @param
+ *  @return the buffer, NULL if out of memory
+ */
+static app_log_buf_t *app_log_register(void)
+{
+    app_log_buf_t *b = NULL;
+
+    if(posix_memalign((void **)&b, BLE_CACHE_LINE_SIZE, sizeof(*b)) || b == NULL) {
+        return(NULL);
+    }
+    memset(b, 0, offsetof(app_log_buf_t, data));
+    b->tid = (uint32_t)syscall(SYS_gettid);
+
+    pthread_once(&app_log_once, app_log_key_create);
+    pthread_setspecific(app_log_key, b);
+
+    pthread_mutex_lock(&app_log_mutex);
+    b->next = app_log_bufs;
+    app_log_bufs = b;
+    pthread_mutex_unlock(&app_log_mutex);
+
+    app_log_tls = b;
+    return(b);
+}
+
+/**
+ *  @fn app_log_peek()
+ *  @brief gets the next record of a buffer skipping the wrap padding,
+ *         drainer only
+ *  @param cur - read offset, advanced past the padding
+ *  @param end - producer offset seen at the start of the pass
+ *  @return the record, NULL if there is none
+ */
+static app_log_rec_t *app_log_peek(app_log_buf_t *b, uint64_t *cur, uint64_t end)
+{
+    app_log_rec_t *r;
+
+    while(*cur < end) {
+        r = (app_log_rec_t *)&b->data[*cur & LOG_BUF_MASK];
+        if(r->kind != LOG_REC_PAD) {
+            return(r);
+        }
+        *cur += r->size;
+    }
+    return(NULL);
+}
+
+/**
+ *  @fn app_log_flush()
+ *  @brief writes the pending output, drainer only
+ *  @param
+ *  @return
+ */
+static void app_log_flush(void)
+{
+    uint32_t off = 0;
+    ssize_t n;
+
+    while(app_log_fd >= 0 && off < app_log_out_len) {
+        n = write(app_log_fd, app_log_out + off, app_log_out_len - off);
+        if(n < 0 && errno == EINTR) {
+            continue;
+        }
+        if(n <= 0) {
+            /* a full disk loses log lines, never the gateway */
+            break;
+        }
+        off += (uint32_t)n;
+    }
+    app_log_file_bytes += app_log_out_len;
+    app_log_out_len = 0;
+}
+
+/**
+ *  @fn app_log_emit()
+ *  @brief appends bytes to the output, drainer only
+ *  @param
+ *  @return
+ */
+static void app_log_emit(const void *data, uint32_t len)
+{
+    if(app_log_out_len + len > sizeof(app_log_out)) {
+        app_log_flush();
+    }
+    memcpy(app_log_out + app_log_out_len, data, len);
+    app_log_out_len += len;
+}
+
+/**
+ *  @fn app_log_emit_header()
+ *  @brief starts a file with its magic and the clock pairing, drainer only
+ *  @param
+ *  @return
+ */
+static void app_log_emit_header(void)
+{
+    app_log_rec_t r = {0};
+    struct timespec ts;
+
+    app_log_emit(LOG_FILE_MAGIC, 8);
+
+    r.size = sizeof(r);
+    r.kind = LOG_REC_CLOCK;
+    r.ts_ns = app_log_now_ns();
+    clock_gettime(CLOCK_REALTIME, &ts);
+    r.id = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    app_log_emit(&r, sizeof(r));
+}
+
+/**
+ *  @fn app_log_site_known()
+ *  @brief tells if a site was described on this file, adding it if not,
+ *         drainer only
+ *  @param
+ *  @return
+ */
+static bool app_log_site_known(uint64_t id)
+{
+    uint32_t i;
+
+    if(app_log_sites_count * 2 >= app_log_sites_cap) {
+        uint32_t cap = (app_log_sites_cap) ? app_log_sites_cap * 2 : 256;
+        uint64_t *sites = calloc(cap, sizeof(*sites));
+        uint64_t *old = app_log_sites;
+
+        if(sites == NULL) {
+            /* describing a site twice is harmless */
+            return(false);
+        }
+        app_log_sites = sites;
+        app_log_sites_cap = cap;
+        app_log_sites_count = 0;
+        for(i = 0; old != NULL && i < cap / 2; i++) {
+            if(old[i]) {
+                app_log_site_known(old[i]);
+            }
+        }
+        free(old);
+    }
+
+    /* site addresses are 8 byte aligned, drop the bits that never change */
+    for(i = (uint32_t)((id >> 3) * 0x9E3779B97F4A7C15ULL >> 32) & (app_log_sites_cap - 1);
+        app_log_sites[i]; i = (i + 1) & (app_log_sites_cap - 1)) {
+        if(app_log_sites[i] == id) {
+            return(true);
+        }
+    }
+    app_log_sites[i] = id;
+    app_log_sites_count++;
+    return(false);
+}
+
+/**
+ *  @fn app_log_emit_site()
+ *  @brief describes a call site before its first event, drainer only
+ *  @param
+ *  @return
+ */
+static void app_log_emit_site(uint64_t id)
+{
+    const app_log_site_t *site = (const app_log_site_t *)(uintptr_t)id;
+    uint8_t rec[sizeof(app_log_rec_t) + 1 + 2 * MAX_NAME_SIZE + 1024] = {0};
+    app_log_rec_t *r = (app_log_rec_t *)rec;
+    size_t flen = strnlen(site->func, MAX_NAME_SIZE * 2 - 1) + 1;
+    size_t mlen = strnlen(site->fmt, 1023) + 1;
+
+    if(app_log_site_known(id)) {
+        return;
+    }
+
+    r->kind = LOG_REC_SITE;
+    r->id = id;
+    rec[sizeof(*r)] = site->level;
+    memcpy(&rec[sizeof(*r) + 1], site->func, flen - 1);
+    memcpy(&rec[sizeof(*r) + 1 + flen], site->fmt, mlen - 1);
+    r->size = (uint16_t)app_log_align(sizeof(*r) + 1 + flen + mlen);
+    app_log_emit(rec, r->size);
+}
+
+/**
+ *  @fn app_log_open()
+ *  @brief opens a fresh log file, the previous one is kept as <path>.1,
+ *         drainer only or before it runs
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+static int app_log_open(void)
+{
+    char old_path[MAX_NAME_SIZE + 2];
+
+    if(app_log_fd >= 0) {
+        close(app_log_fd);
+    }
+    snprintf(old_path, sizeof(old_path), "%s.1", app_log_path);
+    rename(app_log_path, old_path);
+
+    app_log_fd = open(app_log_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    app_log_file_bytes = 0;
+
+    /* a new file describes every site again */
+    if(app_log_sites != NULL) {
+        memset(app_log_sites, 0, app_log_sites_cap * sizeof(*app_log_sites));
+    }
+    app_log_sites_count = 0;
+
+    if(app_log_fd < 0) {
+        return(-1);
+    }
+    app_log_emit_header();
+    return(0);
+}
+
+/**
+ *  @fn app_log_drain()
+ *  @brief moves every buffered record to the file, merging the buffers in
+ *         time order, drainer only
+ *  @param
+ *  @return
+ */
+static void app_log_drain(void)
+{
+    app_log_buf_t *bufs[256];
+    uint64_t cur[256];
+    uint64_t end[256];
+    app_log_rec_t *r;
+    app_log_buf_t **pp;
+    uint32_t n = 0;
+
+    pthread_mutex_lock(&app_log_mutex);
+    for(app_log_buf_t *b = app_log_bufs; b != NULL && n < 256; b = b->next) {
+        bufs[n++] = b;
+    }
+    pthread_mutex_unlock(&app_log_mutex);
+
+    for(uint32_t i = 0; i < n; i++) {
+        uint64_t dropped = atomic_load_explicit(&bufs[i]->dropped, memory_order_relaxed);
+
+        cur[i] = atomic_load_explicit(&bufs[i]->tail, memory_order_relaxed);
+        end[i] = atomic_load_explicit(&bufs[i]->head, memory_order_acquire);
+
+        if(dropped != bufs[i]->dropped_seen) {
+            app_log_rec_t d = { .size = sizeof(d), .kind = LOG_REC_DROP, .tid = bufs[i]->tid,
+                .ts_ns = app_log_now_ns(), .id = dropped - bufs[i]->dropped_seen };
+
+            bufs[i]->dropped_seen = dropped;
+            app_log_emit(&d, sizeof(d));
+        }
+    }
+
+    /* every buffer is in order already, the oldest head goes out first */
+    for(;;) {
+        uint32_t best = n;
+        uint64_t best_ts = UINT64_MAX;
+
+        for(uint32_t i = 0; i < n; i++) {
+            r = app_log_peek(bufs[i], &cur[i], end[i]);
+            if(r != NULL && r->ts_ns < best_ts) {
+                best_ts = r->ts_ns;
+                best = i;
+            }
+        }
+        if(best == n) {
+            break;
+        }
+
+        r = (app_log_rec_t *)&bufs[best]->data[cur[best] & LOG_BUF_MASK];
+        r->tid = bufs[best]->tid;
+        app_log_emit_site(r->id);
+        app_log_emit(r, r->size);
+        cur[best] += r->size;
+    }
+
+    for(uint32_t i = 0; i < n; i++) {
+        atomic_store_explicit(&bufs[i]->tail, end[i], memory_order_release);
+    }
+
+    /* buffers of threads that are gone are freed once empty */
+    pthread_mutex_lock(&app_log_mutex);
+    for(pp = &app_log_bufs; *pp != NULL;) {
+        app_log_buf_t *b = *pp;
+
+        if(atomic_load_explicit(&b->orphan, memory_order_acquire) &&
+            atomic_load_explicit(&b->head, memory_order_relaxed) == atomic_load(&b->tail) &&
+            atomic_load_explicit(&b->dropped, memory_order_relaxed) == b->dropped_seen) {
+            *pp = b->next;
+            free(b);
+        } else {
+            pp = &b->next;
+        }
+    }
+    pthread_mutex_unlock(&app_log_mutex);
+
+    app_log_flush();
+    if(app_log_file_bytes >= LOG_FILE_MAX_BYTES) {
+        app_log_open();
+    }
+}
+
+/**
+ *  @fn app_log_drainer_thread()
+ *  @brief drains the buffers every LOG_DRAIN_PERIOD_MS
+ *  @param
+ *  @return
+ */
+static void *app_log_drainer_thread(void *args)
+{
+    struct timespec ts;
+
+    (void)args;
+
+    pthread_mutex_lock(&app_log_mutex);
+    while(app_log_should_run) {
+        clock_gettime(CLOCK_REALTIME, &ts);
+        ts.tv_nsec += LOG_DRAIN_PERIOD_MS * 1000000L;
+        if(ts.tv_nsec >= 1000000000L) {
+            ts.tv_sec++;
+            ts.tv_nsec -= 1000000000L;
+        }
+        if(!atomic_load_explicit(&app_log_kicked, memory_order_relaxed)) {
+            pthread_cond_timedwait(&app_log_cond, &app_log_mutex, &ts);
+        }
+        atomic_store_explicit(&app_log_kicked, false, memory_order_relaxed);
+
+        pthread_mutex_unlock(&app_log_mutex);
+        app_log_drain();
+        pthread_mutex_lock(&app_log_mutex);
+    }
+    pthread_mutex_unlock(&app_log_mutex);
+
+    return(NULL);
+}
+
+
+/** public functions */
+void app_log_write(const app_log_site_t *site, const app_log_arg_t *args, uint32_t nargs)
+{
+    app_log_buf_t *b = app_log_tls;
+    uint32_t slen[LOG_MAX_ARGS];
+    uint32_t size;
+    uint32_t off;
+    uint32_t room;
+    uint64_t head;
+    uint64_t tail;
+    app_log_rec_t *r;
+    uint8_t *p;
+
+    if(b == NULL && (b = app_log_register()) == NULL) {
+        return;
+    }
+    if(nargs > LOG_MAX_ARGS) {
+        nargs = LOG_MAX_ARGS;
+    }
+
+    size = sizeof(*r) + app_log_align(nargs) + nargs * sizeof(uint64_t);
+    for(uint32_t i = 0; i < nargs; i++) {
+        if(args[i].type == LOG_ARG_STR) {
+            slen[i] = (args[i].s != NULL) ? (uint32_t)strnlen(args[i].s, LOG_MAX_STR) : 0;
+            size += app_log_align(slen[i]);
+        }
+    }
+
+    /* records never wrap, the end of the buffer is padded instead */
+    head = atomic_load_explicit(&b->head, memory_order_relaxed);
+    tail = atomic_load_explicit(&b->tail, memory_order_acquire);
+    off = (uint32_t)(head & LOG_BUF_MASK);
+    room = LOG_BUF_SIZE - off;
+    if(head + size + ((room < size) ? room : 0) - tail > LOG_BUF_SIZE) {
+        atomic_store_explicit(&b->dropped, atomic_load_explicit(&b->dropped, memory_order_relaxed) + 1,
+            memory_order_relaxed);
+        return;
+    }
+    if(room < size) {
+        r = (app_log_rec_t *)&b->data[off];
+        r->size = (uint16_t)room;
+        r->kind = LOG_REC_PAD;
+        head += room;
+        off = 0;
+    }
+
+    r = (app_log_rec_t *)&b->data[off];
+    r->size = (uint16_t)size;
+    r->kind = LOG_REC_EVENT;
+    r->nargs = (uint8_t)nargs;
+    r->ts_ns = app_log_now_ns();
+    r->id = (uintptr_t)site;
+
+    p = (uint8_t *)(r + 1);
+    for(uint32_t i = 0; i < nargs; i++) {
+        p[i] = args[i].type;
+    }
+    p += app_log_align(nargs);
+
+    for(uint32_t i = 0; i < nargs; i++) {
+        if(args[i].type == LOG_ARG_STR) {
+            uint64_t len = slen[i];
+
+            memcpy(p, &len, sizeof(len));
+            memcpy(p + sizeof(len), args[i].s, slen[i]);
+            p += sizeof(len) + app_log_align(slen[i]);
+        } else {
+            memcpy(p, &args[i].u, sizeof(uint64_t));
+            p += sizeof(uint64_t);
+        }
+    }
+
+    atomic_store_explicit(&b->head, head + size, memory_order_release);
+
+    /* a burst filling the buffer does not wait for the next period, once
+     * per pass at most */
+    if(head + size - tail > LOG_BUF_SIZE / 2 &&
+        !atomic_exchange_explicit(&app_log_kicked, true, memory_order_relaxed)) {
+        pthread_cond_signal(&app_log_cond);
+    }
+}
+
+int app_log_start(const char *path)
+{
+    snprintf(app_log_path, sizeof(app_log_path), "%s", path);
+    if(app_log_open() < 0) {
+        fprintf(stderr, "ERROR: Failed to open the log file %s.\n", path);
+        return(-1);
+    }
+
+    app_log_should_run = true;
+    if(pthread_create(&app_log_thread, NULL, app_log_drainer_thread, NULL)) {
+        app_log_should_run = false;
+        fprintf(stderr, "ERROR: Failed to start the log drainer thread.\n");
+        close(app_log_fd);
+        app_log_fd = -1;
+        return(-1);
+    }
+    return(0);
+}
+
+void app_log_finish(void)
+{
+    pthread_mutex_lock(&app_log_mutex);
+    if(!app_log_should_run) {
+        pthread_mutex_unlock(&app_log_mutex);
+        return;
+    }
+    app_log_should_run = false;
+    pthread_cond_signal(&app_log_cond);
+    pthread_mutex_unlock(&app_log_mutex);
+
+    pthread_join(app_log_thread, NULL);
+
+    /* whatever was logged while it stopped */
+    app_log_drain();
+    close(app_log_fd);
+    app_log_fd = -1;
+}
+
+void app_log_set_level(int level)
+{
+    if(level < LOG_LEVEL_ERR) {
+        level = LOG_LEVEL_ERR;
+    } else if(level > LOG_LEVEL_DEBUG) {
+        level = LOG_LEVEL_DEBUG;
+    }
+    atomic_store_explicit(&app_log_level, level, memory_order_relaxed);
+}
+
+int app_log_level_parse(const char *name)
+{
+    static const char *names[] = { "err", "warn", "info", "debug" };
+
+    for(int i = 0; i <= LOG_LEVEL_DEBUG; i++) {
+        if(!strcasecmp(name, names[i]) || (name[0] == '0' + i && name[1] == '\0')) {
+            return(i);
+        }
+    }
+    return(-1);
+}
+
+uint64_t app_log_dropped(void)
+{
+    uint64_t n = 0;
+
+    pthread_mutex_lock(&app_log_mutex);
+    for(app_log_buf_t *b = app_log_bufs; b != NULL; b = b->next) {
+        n += atomic_load_explicit(&b->dropped, memory_order_relaxed);
+    }
+    pthread_mutex_unlock(&app_log_mutex);
+    return(n);
+}
@@ -0,0 +1,425 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_ota.c
+ *  @brief edge node firmware update engine, the window is selective repeat:
+ *         the node acknowledges what it holds in order plus a bitmap of the
+ *         window, so only the holes are sent again
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** static variables */
+static pthread_mutex_t ota_mutex = PTHREAD_MUTEX_INITIALIZER;
+static _Atomic bool ota_active;
+static ota_image_t *ota_image;
+static char (*ota_done)[REGISTRY_ADDR_SIZE];
+static uint32_t ota_done_count;
+static uint32_t ota_done_cap;
+
+
+/** static functions */
+
+/**
+ *  @fn ota_image_load()
+ *  @brief reads a firmware image, it has to stay put while nodes take it
+ *  @param
+ *  @return the image with a single reference, NULL on failure
+ */
+static ota_image_t *ota_image_load(const char *path)
+{
+    ota_image_t *img = NULL;
+    struct stat st;
+    uint32_t got = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0) {
+        return(NULL);
+    }
+
+    if(fstat(fd, &st) < 0 || st.st_size <= 0 || st.st_size > (off_t)OTA_MAX_FRAGS * OTA_FRAG_SIZE) {
+        fprintf(stderr, "ERROR: Firmware image %s has an unusable size.\n", path);
+        goto cleanup;
+    }
+
+    img = calloc(1, sizeof(*img));
+    if(img == NULL) {
+        goto cleanup;
+    }
+    img->size = (uint32_t)st.st_size;
+    img->data = malloc(img->size);
+    if(img->data == NULL) {
+        free(img);
+        img = NULL;
+        goto cleanup;
+    }
+
+    while(got < img->size) {
+        ssize_t n = read(fd, img->data + got, img->size - got);
+
+        if(n <= 0) {
+            fprintf(stderr, "ERROR: Failed to read the firmware image %s.\n", path);
+            free(img->data);
+            free(img);
+            img = NULL;
+            goto cleanup;
+        }
+        got += (uint32_t)n;
+    }
+
+    atomic_init(&img->refs, 1);
+    img->frags = (img->size + OTA_FRAG_SIZE - 1) / OTA_FRAG_SIZE;
+    img->crc = crc32c(0, img->data, img->size);
+
+cleanup:
+    close(fd);
+    return(img);
+}
+
+/**
+ *  @fn ota_rtt_sample()
+ *  @brief feeds a round trip to the retransmission timeout, rfc 6298
+ *  @param
+ *  @return
+ */
+static void ota_rtt_sample(ota_session_t *s, int64_t rtt)
+{
+    int64_t rto;
+
+    if(!s->srtt_us) {
+        s->srtt_us = rtt;
+        s->rttvar_us = rtt / 2;
+    } else {
+        int64_t err = (s->srtt_us > rtt) ? s->srtt_us - rtt : rtt - s->srtt_us;
+
+        s->rttvar_us += (err - s->rttvar_us) / 4;
+        s->srtt_us += (rtt - s->srtt_us) / 8;
+    }
+
+    rto = s->srtt_us + 4 * s->rttvar_us;
+    s->rto_us = (rto < OTA_RTO_MIN_US) ? OTA_RTO_MIN_US : (rto > OTA_RTO_MAX_US) ? OTA_RTO_MAX_US : rto;
+}
+
+/**
+ *  @fn ota_session_sync()
+ *  @brief restarts the window where the node says it stands
+ *  @param
+ *  @return
+ */
+static void ota_session_sync(ota_session_t *s, uint32_t cum, uint64_t now_us)
+{
+    memset(s->slot_state, OTA_SLOT_FREE, sizeof(s->slot_state));
+    s->synced = true;
+    s->cum = cum;
+    s->next = cum;
+    s->lost = 0;
+    s->progress_us = now_us;
+    s->ack_us = now_us;
+}
+
+
+/** public functions */
+int beeinformed_app_ota_start(const char *path)
+{
+    ota_image_t *img = ota_image_load(path);
+    ota_image_t *old;
+
+    if(img == NULL) {
+        printf("%s: no firmware image at %s, hives keep their firmware \n\r", __func__, path);
+        return(-1);
+    }
+
+    pthread_mutex_lock(&ota_mutex);
+    old = ota_image;
+    ota_image = img;
+
+    /* a different image has to go to everyone again */
+    if(old == NULL || old->crc != img->crc || old->size != img->size) {
+        ota_done_count = 0;
+    }
+    atomic_store(&ota_active, true);
+    pthread_mutex_unlock(&ota_mutex);
+
+    ota_image_put(old);
+    printf("%s: firmware image %s, %u bytes in %u fragments, crc %08x \n\r", __func__,
+        path, img->size, img->frags, img->crc);
+    return(0);
+}
+
+void beeinformed_app_ota_finish(void)
+{
+    ota_image_t *old;
+
+    pthread_mutex_lock(&ota_mutex);
+    atomic_store(&ota_active, false);
+    old = ota_image;
+    ota_image = NULL;
+    free(ota_done);
+    ota_done = NULL;
+    ota_done_count = 0;
+    ota_done_cap = 0;
+    pthread_mutex_unlock(&ota_mutex);
+
+    ota_image_put(old);
+}
+
+ota_image_t *ota_job_get(const char *bd_addr)
+{
+    ota_image_t *img = NULL;
+
+    /* asked on every poll, most of the time there is no job at all */
+    if(!atomic_load_explicit(&ota_active, memory_order_relaxed)) {
+        return(NULL);
+    }
+
+    pthread_mutex_lock(&ota_mutex);
+    if(ota_image != NULL) {
+        img = ota_image;
+        for(uint32_t i = 0; i < ota_done_count; i++) {
+            if(!strcmp(ota_done[i], bd_addr)) {
+                img = NULL;
+                break;
+            }
+        }
+    }
+    if(img != NULL) {
+        atomic_fetch_add(&img->refs, 1);
+    }
+    pthread_mutex_unlock(&ota_mutex);
+
+    return(img);
+}
+
+void ota_job_done(const char *bd_addr, const ota_image_t *img)
+{
+    pthread_mutex_lock(&ota_mutex);
+    if(img != ota_image) {
+        goto cleanup;
+    }
+
+    if(ota_done_count == ota_done_cap) {
+        uint32_t cap = (ota_done_cap) ? 2 * ota_done_cap : 16;
+        char (*done)[REGISTRY_ADDR_SIZE] = realloc(ota_done, cap * sizeof(*done));
+
+        if(done == NULL) {
+            goto cleanup;
+        }
+        ota_done = done;
+        ota_done_cap = cap;
+    }
+    strncpy(ota_done[ota_done_count], bd_addr, REGISTRY_ADDR_SIZE - 1);
+    ota_done[ota_done_count][REGISTRY_ADDR_SIZE - 1] = '\0';
+    ota_done_count++;
+
+cleanup:
+    pthread_mutex_unlock(&ota_mutex);
+}
+
+void ota_image_put(ota_image_t *img)
+{
+    if(img != NULL && atomic_fetch_sub_explicit(&img->refs, 1, memory_order_acq_rel) == 1) {
+        free(img->data);
+        free(img);
+    }
+}
+
+void ota_session_begin(ota_session_t *s, ota_image_t *img, uint64_t now_us)
+{
+    memset(s, 0, sizeof(*s));
+    s->img = img;
+    s->rto_us = OTA_RTO_INIT_US;
+    s->progress_us = now_us;
+    s->stats.start_us = now_us;
+}
+
+void ota_session_end(ota_session_t *s)
+{
+    ota_image_put(s->img);
+    s->img = NULL;
+}
+
+int ota_session_ack(ota_session_t *s, const uint8_t *ack, size_t len, uint64_t now_us)
+{
+    uint32_t cum;
+    uint64_t sack;
+    uint32_t top = 0;
+    int64_t rtt = -1;
+
+    if(len < OTA_ACK_SIZE) {
+        return(-1);
+    }
+    memcpy(&cum, ack, sizeof(cum));
+    memcpy(&sack, ack + sizeof(cum), sizeof(sack));
+    if(cum > s->img->frags) {
+        return(-1);
+    }
+    s->stats.acks++;
+
+    if(!s->synced) {
+        ota_session_sync(s, cum, now_us);
+        s->stats.resumed_at = cum;
+    } else if(cum < s->cum) {
+        /* the node threw the image away, its checksum did not match */
+        if(++s->restarts > OTA_MAX_RESTARTS) {
+            return(-1);
+        }
+        ota_session_sync(s, cum, now_us);
+    }
+
+    /* everything below the cumulative point leaves the window */
+    for(uint32_t f = s->cum; f < cum; f++) {
+        uint32_t i = f % OTA_WINDOW;
+
+        if(f < s->next && s->slot_state[i] != OTA_SLOT_SACKED) {
+            if(s->slot_state[i] == OTA_SLOT_LOST) {
+                s->lost--;
+            } else if(!s->slot_retx[i]) {
+                rtt = (int64_t)(now_us - s->slot_sent[i]);
+            }
+            top = (s->slot_order[i] > top) ? s->slot_order[i] : top;
+        }
+        s->slot_state[i] = OTA_SLOT_FREE;
+    }
+    if(cum > s->cum) {
+        s->cum = cum;
+        s->progress_us = now_us;
+    }
+    if(s->next < cum) {
+        s->next = cum;
+    }
+
+    /* bit 0 is the hole the node is waiting for */
+    for(uint32_t b = 1; b < OTA_WINDOW && cum + b < s->img->frags; b++) {
+        uint32_t f = cum + b;
+        uint32_t i = f % OTA_WINDOW;
+
+        if(!((sack >> b) & 1) || s->slot_state[i] == OTA_SLOT_SACKED) {
+            continue;
+        }
+        if(f < s->next) {
+            if(s->slot_state[i] == OTA_SLOT_LOST) {
+                s->lost--;
+            } else if(!s->slot_retx[i]) {
+                rtt = (int64_t)(now_us - s->slot_sent[i]);
+            }
+            top = (s->slot_order[i] > top) ? s->slot_order[i] : top;
+        }
+        /* held from an earlier session, never sent in this one */
+        s->slot_state[i] = OTA_SLOT_SACKED;
+    }
+
+    /* anything new got through, the timeout starts over */
+    if(top) {
+        s->ack_us = now_us;
+    }
+    if(rtt >= 0) {
+        ota_rtt_sample(s, rtt);
+    }
+
+    /* whatever went out well before something that arrived is lost */
+    for(uint32_t f = s->cum; f < s->next; f++) {
+        uint32_t i = f % OTA_WINDOW;
+
+        if(s->slot_state[i] == OTA_SLOT_IN_FLIGHT && s->slot_order[i] + OTA_REORDER_THRESH <= top) {
+            s->slot_state[i] = OTA_SLOT_LOST;
+            s->lost++;
+        }
+    }
+
+    return(0);
+}
+
+size_t ota_session_next(ota_session_t *s, ble_data_t *p, uint64_t now_us)
+{
+    uint32_t f = s->next;
+    uint32_t i;
+    uint32_t len;
+
+    if(!s->synced) {
+        return(0);
+    }
+
+    if(s->lost) {
+        for(f = s->cum; f < s->next; f++) {
+            if(s->slot_state[f % OTA_WINDOW] == OTA_SLOT_LOST) {
+                break;
+            }
+        }
+        s->lost--;
+    }
+
+    if(f < s->next) {
+        s->slot_retx[f % OTA_WINDOW] = true;
+        s->stats.retransmits++;
+    } else {
+        while(s->next < s->img->frags && s->next - s->cum < OTA_WINDOW &&
+            s->slot_state[s->next % OTA_WINDOW] == OTA_SLOT_SACKED) {
+            s->next++;
+        }
+        if(s->next >= s->img->frags || s->next - s->cum >= OTA_WINDOW) {
+            return(0);
+        }
+        f = s->next++;
+        s->slot_retx[f % OTA_WINDOW] = false;
+    }
+
+    i = f % OTA_WINDOW;
+    s->slot_state[i] = OTA_SLOT_IN_FLIGHT;
+    s->slot_order[i] = ++s->order;
+    s->slot_sent[i] = now_us;
+    s->stats.sent++;
+
+    len = s->img->size - f * OTA_FRAG_SIZE;
+    len = (len > OTA_FRAG_SIZE) ? OTA_FRAG_SIZE : len;
+    p->type = k_sequence_packet;
+    p->id = (uint8_t)f;
+    p->pack_amount = (uint8_t)(f >> 8);
+    p->payload_size = (uint8_t)len;
+    memcpy(p->pack_data, s->img->data + f * OTA_FRAG_SIZE, len);
+    return(BLE_PACKET_HDR_SIZE + len);
+}
+
+void ota_session_expire(ota_session_t *s, uint64_t now_us)
+{
+    uint64_t deadline = ota_session_deadline(s);
+
+    if(!deadline || deadline > now_us) {
+        return;
+    }
+
+    /* only the oldest is sent again, the bitmap tells about the others */
+    for(uint32_t f = s->cum; f < s->next; f++) {
+        uint32_t i = f % OTA_WINDOW;
+
+        if(s->slot_state[i] == OTA_SLOT_IN_FLIGHT) {
+            s->slot_state[i] = OTA_SLOT_LOST;
+            s->lost++;
+            break;
+        }
+    }
+
+    /* the link got worse, back off until acks come again */
+    s->stats.timeouts++;
+    s->rto_us = (2 * s->rto_us > OTA_RTO_MAX_US) ? OTA_RTO_MAX_US : 2 * s->rto_us;
+    s->ack_us = now_us;
+}
+
+uint64_t ota_session_deadline(const ota_session_t *s)
+{
+    uint64_t first = 0;
+
+    for(uint32_t f = s->cum; f < s->next; f++) {
+        uint32_t i = f % OTA_WINDOW;
+
+        if(s->slot_state[i] == OTA_SLOT_IN_FLIGHT && (!first || s->slot_sent[i] < first)) {
+            first = s->slot_sent[i];
+        }
+    }
+
+    /* runs from the last acknowledgement that brought news, rfc 6298 */
+    if(first && first < s->ack_us) {
+        first = s->ack_us;
+    }
+    return((first) ? first + s->rto_us : 0);
+}
@@ -0,0 +1,432 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_registry.c
+ *  @brief beeinformed known devices registry, indexed in memory and
+ *         persisted as an append only file of compact records
+ */
+
+#include "beeinformed_gateway.h"
+
+/** initial number of index buckets, must be a power of two */
+#define REGISTRY_INITIAL_BUCKETS    256
+
+/** marks a free index bucket */
+#define REGISTRY_EMPTY              UINT32_MAX
+
+/** device handle older gateways appended whole to the config file, laid
+ *  out by the same compiler and libc as this one, only the address and
+ *  the name are read back */
+typedef struct {
+    pthread_t ble_device_thread;
+    pthread_attr_t ble_dev_att;
+    void *conn_handle;
+    void *services;
+    void *characteristics;
+    acqui_st_t data_env;
+    mqd_t mq;
+    struct mq_attr attr;
+    struct timespec mq_rcv_tout;
+    struct {
+        timer_t timerid;
+        struct sigevent sev;
+        struct itimerspec trigger;
+    } timer;
+    int timestamp;
+    bool should_run;
+    int services_count;
+    int characteristics_count;
+    char device_name[MAX_NAME_SIZE];
+    char bd_addr[MAX_NAME_SIZE];
+    char uuid_str[2 * MAX_NAME_SIZE];
+    bool new_device;
+    k_list_t link;
+}registry_legacy_t;
+
+/** static variables */
+static pthread_rwlock_t registry_lock = PTHREAD_RWLOCK_INITIALIZER;
+static registry_record_t *registry_entries = NULL;
+static uint32_t registry_entries_count = 0;
+static uint32_t registry_entries_size = 0;
+static uint32_t *registry_buckets = NULL;
+static uint32_t registry_buckets_count = 0;
+static int registry_fd = -1;
+
+
+/** static functions */
+
+/**
+ *  @fn registry_find()
+ *  @brief finds the bucket holding an address or the free one ending its probe
+ *  @param
+ *  @return
+ */
+static uint32_t registry_find(const char *bd_addr)
+{
+    uint32_t mask = registry_buckets_count - 1;
+    uint32_t b = fnv1a_str(bd_addr) & mask;
+
+    while(registry_buckets[b] != REGISTRY_EMPTY) {
+        if(!strcmp(registry_entries[registry_buckets[b]].bd_addr, bd_addr)) {
+            break;
+        }
+        b = (b + 1) & mask;
+    }
+    return(b);
+}
+
+/**
+ *  @fn registry_grow()
+ *  @brief doubles the index when it goes above 70% load
+ *  @param
+ *  @return
+ */
+static int registry_grow(void)
+{
+    uint32_t count = (registry_buckets_count) ? registry_buckets_count * 2 : REGISTRY_INITIAL_BUCKETS;
+    uint32_t *buckets = malloc(count * sizeof(uint32_t));
+
+    if(buckets == NULL) {
+        return(-1);
+    }
+
+    free(registry_buckets);
+    registry_buckets = buckets;
+    registry_buckets_count = count;
+    memset(registry_buckets, 0xFF, count * sizeof(uint32_t));
+
+    for(uint32_t i = 0; i < registry_entries_count; i++) {
+        registry_buckets[registry_find(registry_entries[i].bd_addr)] = i;
+    }
+    return(0);
+}
+
+/**
+ *  @fn registry_insert()
+ *  @brief inserts or replaces a record on the index, with registry locked
+ *  @param
+ *  @return
+ */
+static int registry_insert(const registry_record_t *rec)
+{
+    uint32_t b;
+
+    if((registry_entries_count + 1) * 10 > registry_buckets_count * 7) {
+        if(registry_grow() < 0) {
+            return(-1);
+        }
+    }
+
+    b = registry_find(rec->bd_addr);
+    if(registry_buckets[b] != REGISTRY_EMPTY) {
+        /* later records supersede the older ones */
+        registry_entries[registry_buckets[b]] = *rec;
+        return(0);
+    }
+
+    if(registry_entries_count == registry_entries_size) {
+        uint32_t size = (registry_entries_size) ? registry_entries_size * 2 : REGISTRY_INITIAL_BUCKETS;
+        registry_record_t *e = realloc(registry_entries, size * sizeof(registry_record_t));
+
+        if(e == NULL) {
+            return(-1);
+        }
+        registry_entries = e;
+        registry_entries_size = size;
+    }
+
+    registry_entries[registry_entries_count] = *rec;
+    registry_buckets[b] = registry_entries_count++;
+    return(0);
+}
+
+/**
+ *  @fn registry_append()
+ *  @brief persists a record and indexes it, with registry locked, the
+ *         caller syncs the file
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+static int registry_append(const registry_record_t *rec)
+{
+    if(registry_fd < 0 || write(registry_fd, rec, sizeof(*rec)) != sizeof(*rec)) {
+        fprintf(stderr, "ERROR: Failed to persist device on registry.\n");
+        return(-1);
+    }
+    return(registry_insert(rec));
+}
+
+/**
+ *  @fn registry_record_fill()
+ *  @brief builds the record of a device
+ *  @param
+ *  @return
+ */
+static void registry_record_fill(registry_record_t *rec, const char *bd_addr, const char *name, uint8_t addr_type)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->magic = REGISTRY_MAGIC;
+    rec->version = REGISTRY_VERSION;
+    rec->size = sizeof(*rec);
+    rec->addr_type = addr_type;
+    strncpy(rec->bd_addr, bd_addr, REGISTRY_ADDR_SIZE - 1);
+    strncpy(rec->name, name, REGISTRY_NAME_SIZE - 1);
+    rec->crc = crc32c(0, rec, offsetof(registry_record_t, crc));
+}
+
+/**
+ *  @fn registry_import_legacy()
+ *  @brief brings the devices of an older gateway config file into the
+ *         registry, with registry locked
+ *  @param path - config file of fixed size device handles
+ *  @return number of devices imported, -1 if the file cannot be read
+ */
+static int registry_import_legacy(const char *path)
+{
+    registry_legacy_t dev;
+    registry_record_t rec;
+    int imported = 0;
+    FILE *fp;
+
+    fp = fopen(path, "rb");
+    if(fp == NULL) {
+        return(-1);
+    }
+
+    while(fread(&dev, 1, sizeof(dev), fp) == sizeof(dev)) {
+        size_t len = strnlen(dev.bd_addr, sizeof(dev.bd_addr));
+
+        /* anything but a terminated address is not a handle of ours */
+        if(!len || len >= REGISTRY_ADDR_SIZE) {
+            continue;
+        }
+        dev.device_name[sizeof(dev.device_name) - 1] = 0;
+        registry_record_fill(&rec, dev.bd_addr, dev.device_name, BDADDR_LE_PUBLIC);
+        if(registry_append(&rec) < 0) {
+            break;
+        }
+        imported++;
+    }
+    fclose(fp);
+
+    fdatasync(registry_fd);
+    return(imported);
+}
+
+/**
+ *  @fn registry_record_parse()
+ *  @brief checks a record read from the file
+ *  @param left - bytes left in the file
+ *  @return size of the record in the file, 0 if it is not valid
+ */
+static size_t registry_record_parse(const uint8_t *p, size_t left, registry_record_t *rec)
+{
+    memset(rec, 0, sizeof(*rec));
+    memcpy(rec, p, (left < sizeof(*rec)) ? left : sizeof(*rec));
+
+    if(left < offsetof(registry_record_t, crc) || rec->magic != REGISTRY_MAGIC ||
+        memchr(rec->bd_addr, 0, REGISTRY_ADDR_SIZE) == NULL ||
+        memchr(rec->name, 0, REGISTRY_NAME_SIZE) == NULL) {
+        return(0);
+    }
+
+    if(rec->version == 1 && rec->size == offsetof(registry_record_t, crc)) {
+        /* kept without a crc in memory, so the next update rewrites it */
+        rec->crc = 0;
+        rec->version = REGISTRY_VERSION;
+        rec->size = sizeof(*rec);
+        return(offsetof(registry_record_t, crc));
+    }
+
+    if(rec->version != REGISTRY_VERSION || rec->size != sizeof(*rec) || left < sizeof(*rec) ||
+        crc32c(0, rec, offsetof(registry_record_t, crc)) != rec->crc) {
+        return(0);
+    }
+    return(sizeof(*rec));
+}
+
+/**
+ *  @fn registry_load()
+ *  @brief reads the whole file in one go and indexes it
+ *  @param
+ *  @return number of valid bytes in the file, -1 if it is not a registry
+ */
+static off_t registry_load(int fd)
+{
+    struct stat st;
+    uint8_t *buf;
+    off_t off = 0;
+
+    if(fstat(fd, &st) < 0) {
+        return(-1);
+    }
+    if(!st.st_size) {
+        return(0);
+    }
+
+    buf = malloc(st.st_size);
+    if(buf == NULL || pread(fd, buf, st.st_size, 0) != st.st_size) {
+        free(buf);
+        return(-1);
+    }
+
+    while(off < st.st_size) {
+        registry_record_t rec;
+        size_t size = registry_record_parse(buf + off, st.st_size - off, &rec);
+
+        if(!size) {
+            break;
+        }
+        registry_insert(&rec);
+        off += size;
+    }
+
+    free(buf);
+
+    /* garbage right at the start means this is not our format at all */
+    return((!off && st.st_size) ? -1 : off);
+}
+
+
+/** public functions */
+int registry_open(const char *path)
+{
+    char legacy[MAX_PATH_SIZE + sizeof(".legacy")];
+    struct stat st;
+    int imported;
+    off_t valid;
+    int ret = 0;
+
+    pthread_rwlock_wrlock(&registry_lock);
+
+    registry_entries_count = 0;
+    if(registry_grow() < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    registry_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if(registry_fd < 0) {
+        fprintf(stderr, "ERROR: Failed to open the devices registry.\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    valid = registry_load(registry_fd);
+    if(valid < 0) {
+        /* config written by older gateways, its devices are brought over
+         * and the file is kept aside */
+        snprintf(legacy, sizeof(legacy), "%s.legacy", path);
+        printf("%s: %s is not a registry, moving it to %s \n\r", __func__, path, legacy);
+        close(registry_fd);
+        registry_fd = -1;
+        if(rename(path, legacy) < 0) {
+            fprintf(stderr, "ERROR: Failed to move the old devices config aside.\n");
+            ret = -1;
+            goto cleanup;
+        }
+        registry_entries_count = 0;
+        memset(registry_buckets, 0xFF, registry_buckets_count * sizeof(uint32_t));
+        registry_fd = open(path, O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if(registry_fd < 0) {
+            ret = -1;
+            goto cleanup;
+        }
+        imported = registry_import_legacy(legacy);
+        if(imported < 0) {
+            fprintf(stderr, "ERROR: Failed to import the old devices config.\n");
+        } else {
+            printf("%s: %d devices imported from %s \n\r", __func__, imported, legacy);
+        }
+    } else if(fstat(registry_fd, &st) == 0 && st.st_size != valid) {
+        /* torn record from a power loss, drop it */
+        printf("%s: dropping %ld trailing bytes of registry \n\r", __func__, (long)(st.st_size - valid));
+        if(ftruncate(registry_fd, valid) < 0) {
+            fprintf(stderr, "ERROR: Failed to truncate the devices registry.\n");
+        }
+    }
+
+    printf("%s: %u known devices \n\r", __func__, registry_entries_count);
+
+cleanup:
+    pthread_rwlock_unlock(&registry_lock);
+    return(ret);
+}
+
+void registry_close(void)
+{
+    pthread_rwlock_wrlock(&registry_lock);
+    if(registry_fd >= 0) {
+        close(registry_fd);
+        registry_fd = -1;
+    }
+    free(registry_buckets);
+    free(registry_entries);
+    registry_buckets = NULL;
+    registry_entries = NULL;
+    registry_buckets_count = 0;
+    registry_entries_count = 0;
+    registry_entries_size = 0;
+    pthread_rwlock_unlock(&registry_lock);
+}
+
+bool registry_lookup(const char *bd_addr, registry_record_t *rec)
+{
+    bool found = false;
+    uint32_t b;
+
+    assert(bd_addr != NULL);
+
+    pthread_rwlock_rdlock(&registry_lock);
+    if(registry_buckets_count) {
+        b = registry_find(bd_addr);
+        if(registry_buckets[b] != REGISTRY_EMPTY) {
+            found = true;
+            if(rec != NULL) {
+                *rec = registry_entries[registry_buckets[b]];
+            }
+        }
+    }
+    pthread_rwlock_unlock(&registry_lock);
+
+    return(found);
+}
+
+int registry_add(const char *bd_addr, const char *name, uint8_t addr_type, bool *is_new)
+{
+    registry_record_t rec;
+    registry_record_t old;
+    bool found;
+    int ret = 0;
+
+    assert(bd_addr != NULL && name != NULL);
+
+    registry_record_fill(&rec, bd_addr, name, addr_type);
+
+    /* steady state is a known device, which only needs the read lock */
+    found = registry_lookup(rec.bd_addr, &old);
+    if(is_new != NULL) {
+        *is_new = !found;
+    }
+    if(found && !memcmp(&old, &rec, sizeof(rec))) {
+        return(0);
+    }
+
+    pthread_rwlock_wrlock(&registry_lock);
+    ret = registry_append(&rec);
+    if(!ret) {
+        fdatasync(registry_fd);
+    }
+    pthread_rwlock_unlock(&registry_lock);
+
+    return(ret);
+}
+
+uint32_t registry_count(void)
+{
+    uint32_t count;
+
+    pthread_rwlock_rdlock(&registry_lock);
+    count = registry_entries_count;
+    pthread_rwlock_unlock(&registry_lock);
+    return(count);
+}
@@ -0,0 +1,150 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_sched.c
+ *  @brief beeinformed event loop, a fixed pool of workers sharing one epoll
+ */
+
+#include "beeinformed_gateway.h"
+
+/** upper bound of workers, a 410c has four cores */
+#define SCHED_MAX_WORKERS       32
+
+/** static variables */
+static int sched_epfd = -1;
+static int sched_stopfd = -1;
+static int sched_workers_count = 0;
+static pthread_t sched_workers[SCHED_MAX_WORKERS];
+
+
+/** static functions */
+
+/**
+ *  @fn sched_worker_thread()
+ *  @brief takes ready sources from epoll and runs their handlers
+ *  @param
+ *  @return
+ */
+static void *sched_worker_thread(void *args)
+{
+    struct epoll_event events[SCHED_MAX_EVENTS];
+    (void)args;
+
+    for(;;) {
+        int n = epoll_wait(sched_epfd, events, SCHED_MAX_EVENTS, -1);
+
+        if(n < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "ERROR: epoll_wait failed, worker exiting.\n");
+            break;
+        }
+
+        for(int i = 0; i < n; i++) {
+            sched_source_t *src = events[i].data.ptr;
+
+            /* stop source is level triggered, so every worker sees it */
+            if(src == NULL) {
+                goto cleanup;
+            }
+
+            src->handler(src->arg);
+        }
+    }
+
+cleanup:
+    return(NULL);
+}
+
+
+/** public functions */
+int sched_start(int workers)
+{
+    struct epoll_event ev;
+    int ret = 0;
+
+    if(workers <= 0) {
+        workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if(workers <= 0) {
+        workers = 1;
+    }
+    if(workers > SCHED_MAX_WORKERS) {
+        workers = SCHED_MAX_WORKERS;
+    }
+
+    sched_epfd = epoll_create1(EPOLL_CLOEXEC);
+    sched_stopfd = eventfd(0, EFD_CLOEXEC);
+    if(sched_epfd < 0 || sched_stopfd < 0) {
+        fprintf(stderr, "ERROR: Failed to create the event loop.\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if(epoll_ctl(sched_epfd, EPOLL_CTL_ADD, sched_stopfd, &ev) < 0) {
+        ret = -1;
+        goto cleanup;
+    }
+
+    for(sched_workers_count = 0; sched_workers_count < workers; sched_workers_count++) {
+        if(pthread_create(&sched_workers[sched_workers_count], NULL, sched_worker_thread, NULL)) {
+            fprintf(stderr, "ERROR: Failed to start event loop worker.\n");
+            break;
+        }
+    }
+
+    printf("%s: event loop running with %d workers \n\r", __func__, sched_workers_count);
+    ret = (sched_workers_count) ? 0 : -1;
+
+cleanup:
+    return(ret);
+}
+
+void sched_finish(void)
+{
+    if(sched_stopfd < 0) {
+        return;
+    }
+
+    eventfd_write(sched_stopfd, 1);
+    for(int i = 0; i < sched_workers_count; i++) {
+        pthread_join(sched_workers[i], NULL);
+    }
+    sched_workers_count = 0;
+
+    close(sched_stopfd);
+    close(sched_epfd);
+    sched_stopfd = -1;
+    sched_epfd = -1;
+}
+
+int sched_add(sched_source_t *src)
+{
+    struct epoll_event ev;
+
+    assert(src != NULL);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = src;
+    return(epoll_ctl(sched_epfd, EPOLL_CTL_ADD, src->fd, &ev) < 0 ? -1 : 0);
+}
+
+int sched_rearm(sched_source_t *src)
+{
+    struct epoll_event ev;
+
+    assert(src != NULL);
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLONESHOT;
+    ev.data.ptr = src;
+    return(epoll_ctl(sched_epfd, EPOLL_CTL_MOD, src->fd, &ev) < 0 ? -1 : 0);
+}
+
+int sched_remove(sched_source_t *src)
+{
+    assert(src != NULL);
+    return(epoll_ctl(sched_epfd, EPOLL_CTL_DEL, src->fd, NULL) < 0 ? -1 : 0);
+}
@@ -0,0 +1,174 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_session.c
+ *  @brief beeinformed active sessions index, keyed by device address
+ */
+
+#include "beeinformed_gateway.h"
+
+/** session entry, kept for the lifetime of the gateway to remember backoff */
+typedef struct session_entry_s {
+    k_list_t link;
+    char bd_addr[REGISTRY_ADDR_SIZE];
+    session_state_t state;
+    uint32_t failures;
+    uint64_t retry_at;
+}session_entry_t;
+
+/** static variables */
+static k_list_t session_buckets[SESSION_BUCKETS];
+static pthread_mutex_t session_locks[SESSION_LOCKS] = {
+    [0 ... SESSION_LOCKS - 1] = PTHREAD_MUTEX_INITIALIZER
+};
+
+static _Atomic uint64_t session_started;
+static _Atomic uint64_t session_suppressed[k_session_backoff + 1];
+
+
+/** static functions */
+
+/**
+ *  @fn session_now_ms()
+ *  @brief monotonic time in milliseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t session_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000);
+}
+
+/**
+ *  @fn session_lookup()
+ *  @brief finds the entry of a device, with its bucket locked
+ *  @param create - allocates the entry when it does not exist
+ *  @return
+ */
+static session_entry_t *session_lookup(k_list_t *bucket, const char *bd_addr, bool create)
+{
+    session_entry_t *e;
+
+    /* buckets start zeroed and are initialized on first use */
+    if(bucket->head == NULL) {
+        sys_dlist_init(bucket);
+    }
+
+    SYS_DLIST_FOR_EACH_CONTAINER(bucket, e, link) {
+        if(!strcmp(e->bd_addr, bd_addr)) {
+            return(e);
+        }
+    }
+
+    if(!create) {
+        return(NULL);
+    }
+
+    e = calloc(1, sizeof(session_entry_t));
+    if(e != NULL) {
+        strncpy(e->bd_addr, bd_addr, REGISTRY_ADDR_SIZE - 1);
+        e->state = k_session_none;
+        sys_dlist_append(bucket, &e->link);
+    }
+    return(e);
+}
+
+
+/** public functions */
+bool session_try_begin(const char *bd_addr)
+{
+    uint32_t h = fnv1a_str(bd_addr);
+    pthread_mutex_t *lock = &session_locks[h % SESSION_LOCKS];
+    session_entry_t *e;
+    bool ret = false;
+
+    pthread_mutex_lock(lock);
+    e = session_lookup(&session_buckets[h % SESSION_BUCKETS], bd_addr, true);
+    if(e == NULL) {
+        goto cleanup;
+    }
+
+    if(e->state == k_session_backoff && session_now_ms() >= e->retry_at) {
+        e->state = k_session_none;
+    }
+
+    if(e->state == k_session_none) {
+        e->state = k_session_connecting;
+        atomic_fetch_add_explicit(&session_started, 1, memory_order_relaxed);
+        ret = true;
+    } else {
+        atomic_fetch_add_explicit(&session_suppressed[e->state], 1, memory_order_relaxed);
+    }
+
+cleanup:
+    pthread_mutex_unlock(lock);
+    return(ret);
+}
+
+void session_set_connected(const char *bd_addr)
+{
+    uint32_t h = fnv1a_str(bd_addr);
+    pthread_mutex_t *lock = &session_locks[h % SESSION_LOCKS];
+    session_entry_t *e;
+
+    pthread_mutex_lock(lock);
+    e = session_lookup(&session_buckets[h % SESSION_BUCKETS], bd_addr, false);
+    if(e != NULL) {
+        e->state = k_session_connected;
+        e->failures = 0;
+    }
+    pthread_mutex_unlock(lock);
+}
+
+void session_end(const char *bd_addr, bool failed)
+{
+    uint32_t h = fnv1a_str(bd_addr);
+    pthread_mutex_t *lock = &session_locks[h % SESSION_LOCKS];
+    session_entry_t *e;
+    uint64_t backoff;
+
+    pthread_mutex_lock(lock);
+    e = session_lookup(&session_buckets[h % SESSION_BUCKETS], bd_addr, false);
+    if(e != NULL) {
+        if(failed) {
+            backoff = (uint64_t)SESSION_BACKOFF_MIN_MS << (e->failures < 6 ? e->failures : 6);
+            if(backoff > SESSION_BACKOFF_MAX_MS) {
+                backoff = SESSION_BACKOFF_MAX_MS;
+            }
+            e->failures++;
+            e->retry_at = session_now_ms() + backoff;
+            e->state = k_session_backoff;
+        } else {
+            e->state = k_session_none;
+        }
+    }
+    pthread_mutex_unlock(lock);
+}
+
+session_state_t session_get_state(const char *bd_addr)
+{
+    uint32_t h = fnv1a_str(bd_addr);
+    pthread_mutex_t *lock = &session_locks[h % SESSION_LOCKS];
+    session_entry_t *e;
+    session_state_t st = k_session_none;
+
+    pthread_mutex_lock(lock);
+    e = session_lookup(&session_buckets[h % SESSION_BUCKETS], bd_addr, false);
+    if(e != NULL) {
+        st = e->state;
+    }
+    pthread_mutex_unlock(lock);
+    return(st);
+}
+
+void session_get_stats(session_stats_t *s)
+{
+    assert(s != NULL);
+
+    s->started = atomic_load_explicit(&session_started, memory_order_relaxed);
+    s->suppressed_connecting = atomic_load_explicit(&session_suppressed[k_session_connecting], memory_order_relaxed);
+    s->suppressed_connected = atomic_load_explicit(&session_suppressed[k_session_connected], memory_order_relaxed);
+    s->suppressed_backoff = atomic_load_explicit(&session_suppressed[k_session_backoff], memory_order_relaxed);
+}
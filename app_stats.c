@@ -0,0 +1,136 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_stats.c
+ *  @brief per device counters published in a posix shared memory segment
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** static variables */
+static stats_shm_t *stats_shm = NULL;
+static bool stats_shared = false;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* in use until the segment exists, no caller ever gets a NULL slot */
+static stats_shm_t stats_private;
+
+
+/** static functions */
+
+/**
+ *  @fn stats_now_us()
+ *  @brief monotonic time in microseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t stats_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+/**
+ *  @fn stats_segment()
+ *  @brief gets the counters, shared or private
+ *  @param
+ *  @return
+ */
+static inline stats_shm_t *stats_segment(void)
+{
+    return((stats_shm != NULL) ? stats_shm : &stats_private);
+}
+
+
+/** public functions */
+int app_stats_start(void)
+{
+    stats_shm_t *s = MAP_FAILED;
+    int fd;
+
+    /* a segment left by a crashed run is stale, start from zero */
+    shm_unlink(STATS_SHM_NAME);
+    fd = shm_open(STATS_SHM_NAME, O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create the stats segment, counters are not published.\n");
+        goto cleanup;
+    }
+
+    if(ftruncate(fd, sizeof(*s)) == 0) {
+        s = mmap(NULL, sizeof(*s), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if(s == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to map the stats segment, counters are not published.\n");
+        shm_unlink(STATS_SHM_NAME);
+        goto cleanup;
+    }
+
+    /* ftruncate zeroed it, only the header needs filling */
+    s->version = STATS_VERSION;
+    s->max_devices = STATS_MAX_DEVICES;
+    s->dev_size = sizeof(stats_dev_t);
+    s->pid = (int32_t)getpid();
+    s->start_us = stats_now_us();
+    atomic_store_explicit(&s->magic, STATS_MAGIC, memory_order_release);
+
+    pthread_mutex_lock(&stats_mutex);
+    stats_shm = s;
+    stats_shared = true;
+    pthread_mutex_unlock(&stats_mutex);
+
+    printf("%s: counters published at %s, %zu bytes \n\r", __func__, STATS_SHM_NAME, sizeof(*s));
+    return(0);
+
+cleanup:
+    stats_private.start_us = stats_now_us();
+    return(-1);
+}
+
+void app_stats_finish(void)
+{
+    /* devices may still hold slots, the mapping stays until exit */
+    if(stats_shared) {
+        shm_unlink(STATS_SHM_NAME);
+        stats_shared = false;
+    }
+}
+
+stats_dev_t *app_stats_device(const char *bd_addr)
+{
+    stats_shm_t *s;
+    stats_dev_t *d = NULL;
+    uint32_t n;
+
+    pthread_mutex_lock(&stats_mutex);
+    s = stats_segment();
+    n = atomic_load_explicit(&s->devices, memory_order_relaxed);
+    for(uint32_t i = 0; i < n; i++) {
+        if(!strncmp(s->dev[i].bd_addr, bd_addr, STATS_ADDR_SIZE - 1)) {
+            d = &s->dev[i];
+            goto cleanup;
+        }
+    }
+
+    if(n == STATS_MAX_DEVICES) {
+        d = &s->dev[STATS_MAX_DEVICES - 1];
+        goto cleanup;
+    }
+
+    /* the address is visible before the slot is */
+    d = &s->dev[n];
+    strncpy(d->bd_addr, bd_addr, STATS_ADDR_SIZE - 1);
+    atomic_store_explicit(&d->in_use, 1, memory_order_release);
+    atomic_store_explicit(&s->devices, n + 1, memory_order_release);
+
+cleanup:
+    pthread_mutex_unlock(&stats_mutex);
+    return(d);
+}
+
+stats_shm_t *app_stats_gateway(void)
+{
+    return(stats_segment());
+}
@@ -0,0 +1,310 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_timer.c
+ *  @brief beeinformed gateway wide hierarchical timer wheel
+ */
+
+#include "beeinformed_gateway.h"
+
+/** static variables */
+static k_list_t wheel[APP_TIMER_LEVELS][APP_TIMER_SLOTS];
+static pthread_mutex_t wheel_mutex = PTHREAD_MUTEX_INITIALIZER;
+static sched_source_t wheel_src = { .fd = -1 };
+static uint64_t wheel_cur;
+static uint64_t wheel_deadline;
+static uint32_t wheel_pending;
+static bool wheel_ticking;
+
+
+/** static functions */
+
+/**
+ *  @fn app_timer_now()
+ *  @brief gets the current monotonic time in wheel ticks
+ *  @param
+ *  @return
+ */
+static inline uint64_t app_timer_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return(((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000) / APP_TIMER_TICK_US);
+}
+
+/**
+ *  @fn app_timer_tick_source()
+ *  @brief programs the tick source to fire once at a tick, with wheel locked
+ *  @param tick - wheel tick to wake up at, 0 stops the tick source
+ *  @return
+ */
+static void app_timer_tick_source(uint64_t tick)
+{
+    struct itimerspec its;
+    uint64_t ns = tick * APP_TIMER_TICK_US * 1000ULL;
+
+    /* ticks are whole units of the monotonic clock, so the absolute time
+     * of a tick is exact and a tick already gone fires right away */
+    memset(&its, 0, sizeof(its));
+    its.it_value.tv_sec = ns / 1000000000ULL;
+    its.it_value.tv_nsec = ns % 1000000000ULL;
+    timerfd_settime(wheel_src.fd, TFD_TIMER_ABSTIME, &its, NULL);
+    wheel_deadline = (tick) ? tick : UINT64_MAX;
+}
+
+/**
+ *  @fn app_timer_next()
+ *  @brief first tick from the current one with work to do, with wheel locked
+ *
+ *  That is the first non empty slot of the lowest level, or the first
+ *  cascade of a non empty slot of an upper level, whichever comes first.
+ *  Nothing happens on the ticks in between, so the wheel can jump them.
+ *
+ *  @param
+ *  @return the tick, UINT64_MAX if the wheel is empty
+ */
+static uint64_t app_timer_next(void)
+{
+    uint64_t next = UINT64_MAX;
+
+    for(int level = 0; level < APP_TIMER_LEVELS; level++) {
+        uint32_t shift = level * APP_TIMER_SLOT_BITS;
+        uint64_t period = 1ULL << shift;
+
+        /* the slots of a level go by once every period ticks, on the
+         * ticks where every lower level index is zero */
+        uint64_t tick = (wheel_cur + period - 1) & ~(period - 1);
+
+        for(uint32_t i = 0; i < APP_TIMER_SLOTS && tick < next; i++, tick += period) {
+            if(!sys_dlist_is_empty(&wheel[level][(tick >> shift) & APP_TIMER_SLOT_MASK])) {
+                next = tick;
+                break;
+            }
+        }
+    }
+
+    return(next);
+}
+
+/**
+ *  @fn app_timer_insert()
+ *  @brief places a timer on the slot matching its expiration, with wheel locked
+ *  @param
+ *  @return
+ */
+static void app_timer_insert(app_timer_t *t)
+{
+    uint64_t expires = t->expires;
+    uint64_t delta = expires - wheel_cur;
+    k_list_t *slot;
+
+    if((int64_t)delta < 0) {
+        /* already late, runs on the next processed tick */
+        slot = &wheel[0][wheel_cur & APP_TIMER_SLOT_MASK];
+    } else if(delta < (1ULL << APP_TIMER_SLOT_BITS)) {
+        slot = &wheel[0][expires & APP_TIMER_SLOT_MASK];
+    } else if(delta < (1ULL << (2 * APP_TIMER_SLOT_BITS))) {
+        slot = &wheel[1][(expires >> APP_TIMER_SLOT_BITS) & APP_TIMER_SLOT_MASK];
+    } else if(delta < (1ULL << (3 * APP_TIMER_SLOT_BITS))) {
+        slot = &wheel[2][(expires >> (2 * APP_TIMER_SLOT_BITS)) & APP_TIMER_SLOT_MASK];
+    } else {
+        /* beyond the wheel range, clamp to its last slot */
+        if(delta >= (1ULL << (4 * APP_TIMER_SLOT_BITS))) {
+            expires = wheel_cur + (1ULL << (4 * APP_TIMER_SLOT_BITS)) - 1;
+            t->expires = expires;
+        }
+        slot = &wheel[3][(expires >> (3 * APP_TIMER_SLOT_BITS)) & APP_TIMER_SLOT_MASK];
+    }
+
+    sys_dlist_append(slot, &t->link);
+}
+
+/**
+ *  @fn app_timer_cascade()
+ *  @brief moves timers of an upper level slot down the wheel
+ *  @param
+ *  @return the slot index, zero means the next level must cascade too
+ */
+static uint32_t app_timer_cascade(int level, uint32_t index)
+{
+    k_list_t *slot = &wheel[level][index];
+    k_list_t *node;
+
+    while((node = sys_dlist_get(slot)) != NULL) {
+        app_timer_insert(CONTAINER_OF(node, app_timer_t, link));
+    }
+
+    return(index);
+}
+
+/**
+ *  @fn app_timer_run_tick()
+ *  @brief processes the current tick and advances the wheel, with wheel locked
+ *  @param
+ *  @return
+ */
+static void app_timer_run_tick(void)
+{
+    uint32_t index = wheel_cur & APP_TIMER_SLOT_MASK;
+    k_list_t expired;
+    k_list_t *node;
+
+    if(!index &&
+        !app_timer_cascade(1, (wheel_cur >> APP_TIMER_SLOT_BITS) & APP_TIMER_SLOT_MASK) &&
+        !app_timer_cascade(2, (wheel_cur >> (2 * APP_TIMER_SLOT_BITS)) & APP_TIMER_SLOT_MASK)) {
+        app_timer_cascade(3, (wheel_cur >> (3 * APP_TIMER_SLOT_BITS)) & APP_TIMER_SLOT_MASK);
+    }
+    wheel_cur++;
+
+    /* detach the slot first, so a handler never sees a half walked list */
+    sys_dlist_init(&expired);
+    while((node = sys_dlist_get(&wheel[0][index])) != NULL) {
+        sys_dlist_append(&expired, node);
+    }
+
+    while((node = sys_dlist_get(&expired)) != NULL) {
+        app_timer_t *t = CONTAINER_OF(node, app_timer_t, link);
+
+        t->pending = false;
+        wheel_pending--;
+        t->handler(t->arg);
+    }
+}
+
+/**
+ *  @fn app_timer_handler()
+ *  @brief event loop handler of the tick source
+ *  @param
+ *  @return
+ */
+static void app_timer_handler(void *args)
+{
+    uint64_t expirations;
+    uint64_t now;
+    (void)args;
+
+    if(read(wheel_src.fd, &expirations, sizeof(expirations)) < 0) {
+        /* spurious wakeup, the wheel is caught up against the clock anyway */
+    }
+
+    now = app_timer_now();
+
+    pthread_mutex_lock(&wheel_mutex);
+    while(wheel_pending) {
+        uint64_t next = app_timer_next();
+
+        if(next > now) {
+            break;
+        }
+        wheel_cur = next;
+        app_timer_run_tick();
+    }
+
+    /* sleep until the next slot with work, or for good if there is none */
+    if(wheel_pending) {
+        app_timer_tick_source(app_timer_next());
+    } else {
+        app_timer_tick_source(0);
+        wheel_ticking = false;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+
+    sched_rearm(&wheel_src);
+}
+
+
+/** public functions */
+int app_timer_start(void)
+{
+    int ret = 0;
+
+    for(int i = 0; i < APP_TIMER_LEVELS; i++) {
+        for(int j = 0; j < APP_TIMER_SLOTS; j++) {
+            sys_dlist_init(&wheel[i][j]);
+        }
+    }
+    wheel_cur = app_timer_now();
+    wheel_deadline = UINT64_MAX;
+    wheel_pending = 0;
+    wheel_ticking = false;
+
+    wheel_src.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    wheel_src.handler = app_timer_handler;
+    wheel_src.arg = NULL;
+    if(wheel_src.fd < 0) {
+        fprintf(stderr, "ERROR: Failed to create the timer wheel tick source.\n");
+        ret = -1;
+        goto cleanup;
+    }
+
+    ret = sched_add(&wheel_src);
+
+cleanup:
+    return(ret);
+}
+
+void app_timer_finish(void)
+{
+    if(wheel_src.fd < 0) {
+        return;
+    }
+
+    sched_remove(&wheel_src);
+    close(wheel_src.fd);
+    wheel_src.fd = -1;
+}
+
+void app_timer_init(app_timer_t *t, app_timer_handler_t handler, void *arg)
+{
+    assert(t != NULL);
+
+    sys_dlist_init(&t->link);
+    t->expires = 0;
+    t->handler = handler;
+    t->arg = arg;
+    t->pending = false;
+}
+
+void app_timer_arm(app_timer_t *t, uint32_t usec)
+{
+    uint64_t now = app_timer_now();
+
+    assert(t != NULL);
+
+    pthread_mutex_lock(&wheel_mutex);
+    if(t->pending) {
+        sys_dlist_remove(&t->link);
+        wheel_pending--;
+    }
+
+    if(!wheel_ticking) {
+        /* the wheel sleeps while empty, so skip the ticks it missed */
+        wheel_cur = now;
+        wheel_ticking = true;
+    }
+
+    t->expires = now + (usec + APP_TIMER_TICK_US - 1) / APP_TIMER_TICK_US;
+    t->pending = true;
+    wheel_pending++;
+    app_timer_insert(t);
+
+    /* only a timer due before the programmed wakeup costs a syscall, one
+     * in an upper level is due when its slot cascades */
+    if(t->expires < wheel_deadline) {
+        app_timer_tick_source(app_timer_next());
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
+
+void app_timer_cancel(app_timer_t *t)
+{
+    assert(t != NULL);
+
+    pthread_mutex_lock(&wheel_mutex);
+    if(t->pending) {
+        sys_dlist_remove(&t->link);
+        t->pending = false;
+        wheel_pending--;
+    }
+    pthread_mutex_unlock(&wheel_mutex);
+}
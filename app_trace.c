@@ -0,0 +1,123 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_trace.c
+ *  @brief chrome trace json export of the sensor command cycles
+ */
+
+#include "beeinformed_gateway.h"
+
+/** static variables */
+static pthread_mutex_t trace_mutex = PTHREAD_MUTEX_INITIALIZER;
+static FILE *trace_file = NULL;
+static _Atomic bool trace_enabled = false;
+static uint64_t trace_base_ns;
+static uint32_t trace_cycles;
+static uint8_t trace_named[TRACE_MAX_TRACKS / 8];
+
+
+/** static functions */
+
+/**
+ *  @fn trace_now_ns()
+ *  @brief monotonic time in nanoseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t trace_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ *  @fn trace_us()
+ *  @brief trace time of a monotonic instant, microseconds since the start
+ *  @param
+ *  @return
+ */
+static inline double trace_us(uint64_t ns)
+{
+    return((ns > trace_base_ns) ? (ns - trace_base_ns) / 1000.0 : 0.0);
+}
+
+
+/** public functions */
+int app_trace_start(const char *path)
+{
+    FILE *f;
+
+    f = fopen(path, "w");
+    if(f == NULL) {
+        fprintf(stderr, "ERROR: Failed to create the trace file %s.\n", path);
+        return(-1);
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+        "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":0,\"args\":{\"name\":\"beeinformed gateway\"}}");
+
+    pthread_mutex_lock(&trace_mutex);
+    trace_file = f;
+    trace_base_ns = trace_now_ns();
+    trace_cycles = 0;
+    memset(trace_named, 0, sizeof(trace_named));
+    pthread_mutex_unlock(&trace_mutex);
+    atomic_store(&trace_enabled, true);
+
+    printf("%s: sensor command cycles traced to %s \n\r", __func__, path);
+    return(0);
+}
+
+void app_trace_finish(void)
+{
+    atomic_store(&trace_enabled, false);
+
+    pthread_mutex_lock(&trace_mutex);
+    if(trace_file != NULL) {
+        fprintf(trace_file, "\n]}\n");
+        fclose(trace_file);
+        trace_file = NULL;
+        printf("%s: %u cycles traced \n\r", __func__, trace_cycles);
+    }
+    pthread_mutex_unlock(&trace_mutex);
+}
+
+bool app_trace_enabled(void)
+{
+    return(atomic_load_explicit(&trace_enabled, memory_order_relaxed));
+}
+
+void app_trace_cycle(uint32_t track, const char *bd_addr, const uint64_t *t)
+{
+    uint32_t tid;
+
+    if(!app_trace_enabled()) {
+        return;
+    }
+
+    tid = ((track < TRACE_MAX_TRACKS) ? track : TRACE_MAX_TRACKS - 1) + 1;
+
+    pthread_mutex_lock(&trace_mutex);
+    if(trace_file == NULL || trace_cycles >= TRACE_MAX_CYCLES) {
+        goto cleanup;
+    }
+
+    if(!(trace_named[(tid - 1) / 8] & (1 << ((tid - 1) % 8)))) {
+        trace_named[(tid - 1) / 8] |= 1 << ((tid - 1) % 8);
+        fprintf(trace_file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            tid, bd_addr);
+    }
+
+    /* the enclosing span first, viewers nest by start and duration */
+    fprintf(trace_file, ",\n{\"name\":\"%s\",\"cat\":\"sensors\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+        stats_lat_name(k_lat_cycle), tid, trace_us(t[0]), (t[k_lat_cycle] - t[0]) / 1000.0);
+    for(uint32_t i = 0; i < k_lat_cycle; i++) {
+        fprintf(trace_file, ",\n{\"name\":\"%s\",\"cat\":\"sensors\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+            stats_lat_name(i), tid, trace_us(t[i]), (t[i + 1] - t[i]) / 1000.0);
+    }
+    trace_cycles++;
+
+cleanup:
+    pthread_mutex_unlock(&trace_mutex);
+}
@@ -0,0 +1,51 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_acq_col.h
+ *  @brief beeinformed columnar block codec for acquisition records
+ */
+
+#ifndef __APP_ACQ_COL_H
+#define __APP_ACQ_COL_H
+
+/** columns of a block, timestamp first then every acqui_st_t field */
+#define ACQ_COL_FIELDS          4
+#define ACQ_COL_COLUMNS         (ACQ_COL_FIELDS + 1)
+
+/** temperature is the only signed field */
+#define ACQ_COL_SIGNED_FIELD    0
+
+/** worst case varint length of a 32 bit value */
+#define ACQ_COL_VARINT_MAX      5
+
+/** follows the block header when it is columnar */
+typedef struct __attribute__((packed)) {
+    acqui_st_t min;
+    acqui_st_t max;
+}acq_col_hdr_t;
+
+/** worst case on disk size of a columnar block holding n records */
+#define ACQ_COL_MAX_SIZE(n)     (sizeof(acq_block_hdr_t) + sizeof(acq_col_hdr_t) + \
+                                    (size_t)(n) * ACQ_COL_COLUMNS * ACQ_COL_VARINT_MAX)
+
+
+/**
+ *  @fn acq_col_encode()
+ *  @brief encodes records as a columnar block
+ *  @param rec - records in time order
+ *  @param count - number of records, up to ACQ_BLOCK_RECORDS
+ *  @param out - receives the block, at least ACQ_COL_MAX_SIZE(count) bytes
+ *  @return size of the encoded block, the header crc is left to the caller
+ */
+size_t acq_col_encode(const acq_record_t *rec, uint16_t count, uint8_t *out);
+
+/**
+ *  @fn acq_col_decode()
+ *  @brief decodes a columnar block
+ *  @param blk - block, starting at its block header
+ *  @param size - bytes available at blk
+ *  @param rec - receives the records, room for ACQ_BLOCK_RECORDS
+ *  @return number of records, -1 if the block is malformed
+ */
+int acq_col_decode(const uint8_t *blk, size_t size, acq_record_t *rec);
+
+#endif
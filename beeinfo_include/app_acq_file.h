@@ -1,7 +1,7 @@
 /**
  *          THE BeeInformed Team
  *  @file app_acq_file.h
- *  @brief beeinformed acquisition file definitions 
+ *  @brief beeinformed acquisition file definitions
  */
 
 #ifndef __APP_ACQ_FILE_H
@@ -17,21 +17,304 @@ typedef struct {
 	uint32_t humidity;
 }acqui_st_t;
 
+/** block identification */
+#define ACQ_BLOCK_MAGIC             0x4B4C4242
+#define ACQ_BLOCK_VERSION           1
+#define ACQ_BLOCK_VERSION_COLUMNAR  2
+
+/** records per block, a full raw block fits in 4 KiB on disk */
+#define ACQ_BLOCK_RECORDS           203
+
+/** blocks buffered per file before appends have to wait for the disk */
+#define ACQ_FILE_BLOCKS             4
+
+/** index entries held back until the data they describe is synced, a
+ *  writer that fills them syncs right away */
+#define ACQ_FILE_PENDING            64
+
+/** acquisition file name inside each device directory */
+#define ACQ_FILE_NAME               "beedata.dat"
+
+/** the live file becomes a segment once its data spans a new period or
+ *  it grows past the size limit, segments are named after their range */
+#define ACQ_SEGMENT_PERIOD          (24 * 60 * 60)
+#define ACQ_SEGMENT_MAX_SIZE        (16 * 1024 * 1024)
+#define ACQ_SEGMENT_FMT             "seg-%010u-%010u"
+#define ACQ_SEGMENT_SCAN            "seg-%10u-%10u.dat%n"
+
+/** default group commit interval in milliseconds */
+#define ACQ_FILE_DEF_COMMIT_MS      1000
+
+/** block formats a writer can produce, readers take any mix of them */
+typedef enum {
+    k_acq_format_raw = 0,
+    k_acq_format_columnar,
+}acq_file_format_t;
+
+/** timestamped record, fixed size */
+typedef struct __attribute__((packed)) {
+    uint32_t timestamp;
+    acqui_st_t val;
+}acq_record_t;
+
+/** every group commit writes whole blocks, each one led by this header,
+ *  crc is the CRC32C of the header up to it followed by the block payload */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t first_ts;
+    uint32_t last_ts;
+    uint32_t size;
+    uint32_t crc;
+}acq_block_hdr_t;
+
+/** sidecar index entry, one per block in file order */
+typedef struct __attribute__((packed)) {
+    uint64_t offset;
+    uint32_t first_ts;
+    uint32_t last_ts;
+    uint32_t count;
+    uint32_t size;
+}acq_index_entry_t;
+
+/** on disk size of a raw block holding n records */
+#define ACQ_BLOCK_SIZE(n)   (sizeof(acq_block_hdr_t) + (size_t)(n) * sizeof(acq_record_t))
+
+/** in memory block, header and records laid out as on disk */
+typedef struct acq_block_s {
+    k_list_t link;
+    acq_block_hdr_t hdr;
+    acq_record_t rec[ACQ_BLOCK_RECORDS];
+}acq_block_t;
+
+/** rollup tiers kept next to the data file */
+typedef enum {
+    k_acq_rollup_minute = 0,
+    k_acq_rollup_hour,
+    k_acq_rollup_day,
+    k_acq_rollup_tiers,
+}acq_rollup_tier_t;
+
+/** closed buckets waiting for the next commit, per tier */
+#define ACQ_ROLLUP_PENDING          4
+
+/** one bucket of a tier, fixed size, files hold them in time order */
+typedef struct __attribute__((packed)) {
+    uint32_t start;
+    uint32_t count;
+    acqui_st_t min;
+    acqui_st_t max;
+    int64_t sum[4];
+}acq_rollup_t;
+
+/** writer side of a tier, the open bucket is rewritten on every commit */
+typedef struct {
+    int fd;
+    acq_rollup_t cur;
+    uint32_t cur_slot;
+    acq_rollup_t done[ACQ_ROLLUP_PENDING];
+    uint32_t done_slot[ACQ_ROLLUP_PENDING];
+    int done_count;
+}acq_rollup_file_t;
+
+/** writer statistics */
+typedef struct {
+    uint64_t records;
+    uint64_t blocks;
+    uint64_t bytes;
+    uint64_t syncs;
+    uint64_t stalls;
+    uint64_t segments;
+}acq_file_stats_t;
+
+/** acquisition file writer, refs counts the commits working on it
+ *  outside of the files list lock, the pending index entries belong to
+ *  whoever holds the io lock */
+typedef struct acq_file_s {
+    k_list_t link;
+    uint32_t refs;
+    pthread_mutex_t lock;
+    pthread_mutex_t io_lock;
+    char path[MAX_NAME_SIZE];
+    int fd;
+    int idx_fd;
+    uint64_t offset;
+    uint32_t seg_first;
+    uint32_t seg_last;
+    uint32_t last_ts;
+    acq_file_format_t format;
+    uint8_t *enc;
+    acq_block_t *filling;
+    k_list_t sealed;
+    k_list_t free;
+    acq_block_t blocks[ACQ_FILE_BLOCKS];
+    acq_rollup_file_t rollup[k_acq_rollup_tiers];
+    acq_index_entry_t pending[ACQ_FILE_PENDING];
+    int pending_count;
+    acq_file_stats_t stats;
+}acq_file_t;
+
+/** acquisition file reader, a snapshot of the file when it was opened,
+ *  the identity of the data follows it across a rotation */
+typedef struct {
+    dev_t dev;
+    ino_t ino;
+    const uint8_t *base;
+    size_t size;
+    acq_index_entry_t *idx;
+    size_t blocks;
+    const acq_rollup_t *rollup[k_acq_rollup_tiers];
+    size_t rollups[k_acq_rollup_tiers];
+}acq_reader_t;
+
+/** range scan callback, records of raw blocks point straight into the
+ *  mapped file, those of columnar blocks into a decoded copy
+ *  return false to stop the scan */
+typedef bool (*acq_scan_cb_t)(const acq_record_t *rec, size_t count, void *arg);
+
+/** rollup scan callback, buckets point straight into the mapped tier */
+typedef bool (*acq_rollup_cb_t)(const acq_rollup_t *bucket, size_t count, void *arg);
+
+
 /**
- *  @fn acq_file_append_val()
- *  @brief append a new line to acquisition file 
+ *  @fn acq_file_start()
+ *  @brief starts the group commit thread shared by all acquisition files
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+int acq_file_start(void);
+
+/**
+ *  @fn acq_file_finish()
+ *  @brief flushes every open file and stops the group commit thread
  *  @param
  *  @return
  */
-int acq_file_append_val(acqui_st_t *aq, FILE *f, uint32_t timestamp);
+void acq_file_finish(void);
 
+/**
+ *  @fn acq_file_set_commit_interval()
+ *  @brief sets how often buffered records are written and synced
+ *  @param ms - interval in milliseconds
+ *  @return
+ */
+void acq_file_set_commit_interval(uint32_t ms);
 
 /**
- *  @fn acq_file_get_data()
- *  @brief get a specific data field from acquisition file
- *  @param
+ *  @fn acq_file_open()
+ *  @brief opens an acquisition file for appending
+ *  @param path - file path, created if it does not exist
+ *  @param format - format of the blocks written from now on
+ *  @return the writer, NULL on failure
+ */
+acq_file_t *acq_file_open(const char *path, acq_file_format_t format);
+
+/**
+ *  @fn acq_file_close()
+ *  @brief writes and syncs whatever is buffered and closes the file
+ *  @param f - writer to close
+ *  @param s - optional, filled with the final statistics
  *  @return
  */
-int acq_file_get_data(void *data, size_t size, uint32_t timestamp);
- 
-#endif
\ No newline at end of file
+void acq_file_close(acq_file_t *f, acq_file_stats_t *s);
+
+/**
+ *  @fn acq_file_get_stats()
+ *  @brief gets the writer statistics
+ *  @param f - writer
+ *  @param s - filled with the current counters
+ *  @return
+ */
+void acq_file_get_stats(acq_file_t *f, acq_file_stats_t *s);
+
+/**
+ *  @fn acq_file_append_val()
+ *  @brief append a new line to acquisition file
+ *  @param aq - values to append
+ *  @param f - writer of the device acquisition file
+ *  @param timestamp - time of the reading, never before the previous one
+ *  @return 0 on success, -1 on failure
+ */
+int acq_file_append_val(acqui_st_t *aq, acq_file_t *f, uint32_t timestamp);
+
+
+/**
+ *  @fn acq_block_crc()
+ *  @brief CRC32C of a whole block, header crc field excluded
+ *  @param blk - block, starting at its header with the size filled
+ *  @return
+ */
+uint32_t acq_block_crc(const uint8_t *blk);
+
+/**
+ *  @fn acq_file_recover()
+ *  @brief cuts every device acquisition file back to its last intact block
+ *         and rebuilds its rollups of that day, meant to run once at startup
+ *  @param root - directory holding one directory per device
+ *  @return number of files checked, -1 on failure
+ */
+int acq_file_recover(const char *root);
+
+/**
+ *  @fn acq_reader_open()
+ *  @brief maps an acquisition file and loads its block index
+ *  @param path - acquisition file path
+ *  @return the reader, NULL on failure
+ */
+acq_reader_t *acq_reader_open(const char *path);
+
+/**
+ *  @fn acq_reader_close()
+ *  @brief unmaps the file and releases the reader
+ *  @param r - reader to close
+ *  @return
+ */
+void acq_reader_close(acq_reader_t *r);
+
+/**
+ *  @fn acq_file_scan()
+ *  @brief walks the records of a time range
+ *  @param r - reader
+ *  @param t0 - first timestamp of the range
+ *  @param t1 - last timestamp of the range, inclusive
+ *  @param cb - called with each run of contiguous matching records
+ *  @param arg - passed to the callback
+ *  @return number of records passed to the callback
+ */
+size_t acq_file_scan(acq_reader_t *r, uint32_t t0, uint32_t t1, acq_scan_cb_t cb, void *arg);
+
+/**
+ *  @fn acq_file_scan_rollup()
+ *  @brief walks the buckets of a tier overlapping a time range
+ *  @param r - reader
+ *  @param tier - minute, hour or day buckets
+ *  @param t0 - first timestamp of the range
+ *  @param t1 - last timestamp of the range, inclusive
+ *  @param cb - called with each run of contiguous matching buckets
+ *  @param arg - passed to the callback
+ *  @return number of buckets passed to the callback
+ */
+size_t acq_file_scan_rollup(acq_reader_t *r, acq_rollup_tier_t tier, uint32_t t0, uint32_t t1,
+            acq_rollup_cb_t cb, void *arg);
+
+/**
+ *  @fn acq_rollup_merge()
+ *  @brief folds a bucket into another, to build coarser resolutions
+ *  @param dst - accumulated bucket, count 0 starts a new one
+ *  @param src - bucket to fold
+ *  @return
+ */
+void acq_rollup_merge(acq_rollup_t *dst, const acq_rollup_t *src);
+
+/**
+ *  @fn acq_file_get_data()
+ *  @brief gets the first record at or after a timestamp
+ *  @param r - reader
+ *  @param timestamp - requested time
+ *  @param rec - filled with the record found
+ *  @return 0 on success, -1 if there is no such record
+ */
+int acq_file_get_data(acq_reader_t *r, uint32_t timestamp, acq_record_t *rec);
+
+#endif
@@ -0,0 +1,84 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_acq_store.h
+ *  @brief beeinformed acquisition segments store, background compaction
+ *         and disk budget retention
+ */
+
+#ifndef __APP_ACQ_STORE_H
+#define __APP_ACQ_STORE_H
+
+/** compactor pass interval */
+#define ACQ_STORE_PERIOD_MS         (60 * 1000)
+
+/** segments are merged up to this size, bigger ones are left alone */
+#define ACQ_STORE_COMPACT_TARGET    (4 * 1024 * 1024)
+
+/** files of an in flight compaction, inside the device directory */
+#define ACQ_STORE_LOG               "compact.log"
+#define ACQ_STORE_TMP               "compact.tmp"
+#define ACQ_STORE_TMP_IDX           "compact.itmp"
+#define ACQ_STORE_LOG_END           "end"
+
+/** a closed segment of a device */
+typedef struct {
+    uint32_t first;
+    uint32_t last;
+    uint64_t size;
+    char name[32];
+}acq_segment_t;
+
+/** store statistics */
+typedef struct {
+    uint64_t passes;
+    uint64_t merged;
+    uint64_t bytes_in;
+    uint64_t bytes_out;
+    uint64_t dropped;
+    uint64_t dropped_bytes;
+    uint64_t throttled_ms;
+    uint64_t disk_bytes;
+}acq_store_stats_t;
+
+
+/**
+ *  @fn acq_store_start()
+ *  @brief starts the compactor thread
+ *  @param root - directory holding one directory per device
+ *  @param budget - bytes the device directories may take, the oldest sensor
+ *                  and audio segments go first
+ *  @param rate - compactor io limit in bytes per second
+ *  @return 0 on success, -1 on failure
+ */
+int acq_store_start(const char *root, uint64_t budget, uint32_t rate);
+
+/**
+ *  @fn acq_store_finish()
+ *  @brief stops the compactor, an interrupted merge is simply dropped
+ *  @param
+ *  @return
+ */
+void acq_store_finish(void);
+
+/**
+ *  @fn acq_store_get_stats()
+ *  @brief gets the store statistics
+ *  @param s - filled with the current counters
+ *  @return
+ */
+void acq_store_get_stats(acq_store_stats_t *s);
+
+/**
+ *  @fn acq_store_scan()
+ *  @brief walks the records of a time range across the segments and the
+ *         live file of a device
+ *  @param dir - device directory
+ *  @param t0 - first timestamp of the range
+ *  @param t1 - last timestamp of the range, inclusive
+ *  @param cb - called with each run of contiguous matching records
+ *  @param arg - passed to the callback
+ *  @return number of records passed to the callback
+ */
+size_t acq_store_scan(const char *dir, uint32_t t0, uint32_t t1, acq_scan_cb_t cb, void *arg);
+
+#endif
@@ -0,0 +1,54 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_audio_adpcm.h
+ *  @brief beeinformed IMA-ADPCM codec for hive audio captures
+ */
+
+#ifndef __APP_AUDIO_ADPCM_H
+#define __APP_AUDIO_ADPCM_H
+
+/** frames follow the WAV IMA-ADPCM mono block layout, a 4 byte header
+ *  holding the first sample and the step index, then 4 bit codes */
+#define AUDIO_ADPCM_FRAME_SIZE      256
+#define AUDIO_ADPCM_FRAME_SAMPLES   ((AUDIO_ADPCM_FRAME_SIZE - sizeof(audio_adpcm_hdr_t)) * 2 + 1)
+
+/** frames needed by a number of samples */
+#define AUDIO_ADPCM_FRAMES(n)       (((n) + AUDIO_ADPCM_FRAME_SAMPLES - 1) / AUDIO_ADPCM_FRAME_SAMPLES)
+
+/** highest step index */
+#define AUDIO_ADPCM_INDEX_MAX       88
+
+/** frame header */
+typedef struct __attribute__((packed)) {
+    int16_t sample;
+    uint8_t index;
+    uint8_t reserved;
+}audio_adpcm_hdr_t;
+
+/** encoder state carried from one frame to the next */
+typedef struct {
+    int32_t index;
+}audio_adpcm_state_t;
+
+
+/**
+ *  @fn audio_adpcm_encode()
+ *  @brief encodes samples as whole frames, the last one padded with silence
+ *  @param st - encoder state, zeroed at the start of a capture
+ *  @param pcm - samples
+ *  @param count - number of samples
+ *  @param out - receives AUDIO_ADPCM_FRAMES(count) frames
+ *  @return bytes written to out
+ */
+size_t audio_adpcm_encode(audio_adpcm_state_t *st, const int16_t *pcm, size_t count, uint8_t *out);
+
+/**
+ *  @fn audio_adpcm_decode()
+ *  @brief decodes a single frame, every frame decodes on its own
+ *  @param frame - AUDIO_ADPCM_FRAME_SIZE bytes
+ *  @param pcm - receives AUDIO_ADPCM_FRAME_SAMPLES samples
+ *  @return number of samples, -1 if the frame is malformed
+ */
+int audio_adpcm_decode(const uint8_t *frame, int16_t *pcm);
+
+#endif
@@ -0,0 +1,140 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_audio_feat.h
+ *  @brief beeinformed hive audio spectral features
+ */
+
+#ifndef __APP_AUDIO_FEAT_H
+#define __APP_AUDIO_FEAT_H
+
+/** feature file name inside each device directory */
+#define AUDIO_FEAT_FILE_NAME        "beefeat.dat"
+
+/** analysis frames, a real fft of 512 samples every 250 samples, so a
+ *  second of audio is exactly 32 frames */
+#define AUDIO_FEAT_FFT_SIZE         512
+#define AUDIO_FEAT_HOP              250
+#define AUDIO_FEAT_BINS             (AUDIO_FEAT_FFT_SIZE / 2 + 1)
+#define AUDIO_FEAT_RECORD_FRAMES    (AUDIO_SAMPLE_RATE / AUDIO_FEAT_HOP)
+
+/** bands in Hz, hum, warble, piping and quacking live below 600 Hz */
+#define AUDIO_FEAT_BANDS            8
+#define AUDIO_FEAT_BAND_EDGES       { 0, 100, 200, 300, 400, 500, 600, 1000, AUDIO_SAMPLE_RATE / 2 }
+
+/** feature record identification */
+#define AUDIO_FEAT_MAGIC            0x54414546
+
+/** one second of hive audio, crc covers everything before it */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t timestamp;
+    uint16_t frames;
+    uint16_t dominant_hz;
+    uint16_t centroid_hz;
+    uint16_t flatness;
+    int16_t band_cdb[AUDIO_FEAT_BANDS];
+    uint32_t crc;
+}audio_feat_record_t;
+
+/** records of a capture written together once it ends */
+#define AUDIO_FEAT_PENDING          16
+
+/** streaming analyzer of a device, the fft works in place on split real
+ *  and imaginary halves, one spare slot wraps the spectrum around */
+typedef struct {
+    float re[AUDIO_FEAT_FFT_SIZE / 2 + 8] __attribute__((aligned(32)));
+    float im[AUDIO_FEAT_FFT_SIZE / 2 + 8] __attribute__((aligned(32)));
+    float acc[AUDIO_FEAT_BINS + 7] __attribute__((aligned(32)));
+    int16_t pcm[AUDIO_FEAT_FFT_SIZE];
+    uint32_t fill;
+    uint32_t frames;
+    uint32_t timestamp;
+    uint32_t seconds;
+    int fd;
+    char path[MAX_PATH_SIZE];
+    uint32_t pending_count;
+    audio_feat_record_t pending[AUDIO_FEAT_PENDING];
+    uint64_t total_frames;
+    uint64_t cpu_ns;
+}audio_feat_t;
+
+
+/**
+ *  @fn audio_feat_open()
+ *  @brief opens or creates a feature file, cutting a torn last record
+ *  @param path - feature file path
+ *  @return the analyzer, NULL on failure
+ */
+audio_feat_t *audio_feat_open(const char *path);
+
+/**
+ *  @fn audio_feat_rotate()
+ *  @brief moves the records written so far to another file and starts a
+ *         new one, between captures
+ *  @param a - analyzer
+ *  @param path - where the records written so far go
+ *  @return 0 on success, -1 on failure
+ */
+int audio_feat_rotate(audio_feat_t *a, const char *path);
+
+/**
+ *  @fn audio_feat_close()
+ *  @brief writes pending records and releases the analyzer
+ *  @param a - analyzer
+ *  @return
+ */
+void audio_feat_close(audio_feat_t *a);
+
+/**
+ *  @fn audio_feat_begin()
+ *  @brief starts the analysis of a capture
+ *  @param a - analyzer
+ *  @param timestamp - capture time, each record is a second after the last
+ *  @return
+ */
+void audio_feat_begin(audio_feat_t *a, uint32_t timestamp);
+
+/**
+ *  @fn audio_feat_push()
+ *  @brief feeds capture samples, frames are analyzed as soon as complete
+ *  @param a - analyzer
+ *  @param pcm - samples
+ *  @param count - number of samples
+ *  @return
+ */
+void audio_feat_push(audio_feat_t *a, const int16_t *pcm, size_t count);
+
+/**
+ *  @fn audio_feat_end()
+ *  @brief ends a capture, its records reach the disk with a single write
+ *  @param a - analyzer
+ *  @return
+ */
+void audio_feat_end(audio_feat_t *a);
+
+/**
+ *  @fn audio_feat_frame()
+ *  @brief windows a frame, runs the real fft and accumulates its power
+ *  @param a - analyzer
+ *  @param pcm - AUDIO_FEAT_FFT_SIZE samples
+ *  @return
+ */
+void audio_feat_frame(audio_feat_t *a, const int16_t *pcm);
+
+/**
+ *  @fn audio_feat_select()
+ *  @brief forces a kernel implementation, the fastest one is the default
+ *  @param name - "scalar", "sse", "avx" or "neon"
+ *  @return 0 on success, -1 if the cpu cannot run it
+ */
+int audio_feat_select(const char *name);
+
+/**
+ *  @fn audio_feat_impl_name()
+ *  @brief name of the kernel implementation in use
+ *  @param
+ *  @return
+ */
+const char *audio_feat_impl_name(void);
+
+#endif
@@ -0,0 +1,258 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_audio_file.h
+ *  @brief beeinformed hive audio capture file
+ */
+
+#ifndef __APP_AUDIO_FILE_H
+#define __APP_AUDIO_FILE_H
+
+/** capture format, mono 16 bit pcm as sent by the edge node */
+#define AUDIO_SAMPLE_RATE           8000
+#define AUDIO_SAMPLE_BYTES          2
+
+/** bytes of a capture fragment, all but the last one are full, and the
+ *  sequence distance past which a fragment is taken as a late duplicate
+ *  rather than a run of lost ones */
+#define AUDIO_FRAGMENT_SIZE         PACKET_MAX_PAYLOAD
+#define AUDIO_FRAGMENT_LATE         128
+
+/** audio file name inside each device directory */
+#define AUDIO_FILE_NAME             "beeaudio.dat"
+
+/** capture buffers of a file, each one reaches the disk with a single
+ *  aligned write, captures start on an aligned offset */
+#define AUDIO_FILE_BUFFER_SIZE      (64 * 1024)
+#define AUDIO_FILE_BUFFERS          4
+#define AUDIO_FILE_ALIGN            4096
+
+/** compressed frames made out of a full capture buffer */
+#define AUDIO_FILE_BUFFER_FRAMES    (AUDIO_FILE_BUFFER_SIZE / (AUDIO_ADPCM_FRAME_SAMPLES * AUDIO_SAMPLE_BYTES))
+
+/** index entry identification */
+#define AUDIO_INDEX_MAGIC           0x58445541
+
+/** the audio file becomes a segment once its captures span a new period
+ *  or it grows past the size limit, a segment is named after its range
+ *  and takes the feature records of its captures along */
+#define AUDIO_SEGMENT_PERIOD        (24 * 60 * 60)
+#define AUDIO_SEGMENT_MAX_SIZE      (16 * 1024 * 1024)
+#define AUDIO_SEGMENT_FMT           "aseg-%010u-%010u"
+#define AUDIO_SEGMENT_SCAN          "aseg-%10u-%10u.dat%n"
+
+/** writer wakeup period in milliseconds */
+#define AUDIO_FILE_WRITER_MS        200
+
+/** how captures are laid out on disk */
+typedef enum {
+    k_audio_format_pcm = 0,
+    k_audio_format_adpcm,
+}audio_file_format_t;
+
+/** a capture as kept in the index file, size counts pcm bytes whatever
+ *  the format, crc covers everything before it */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t format;
+    uint16_t frame_size;
+    uint64_t offset;
+    uint32_t timestamp;
+    uint32_t size;
+    uint32_t gaps;
+    uint32_t crc;
+}audio_index_entry_t;
+
+/** capture buffer, the entry is filled on the last one of a capture, the
+ *  first one only carries its timestamp */
+typedef struct {
+    k_list_t link;
+    uint32_t len;
+    bool first;
+    bool last;
+    audio_index_entry_t entry;
+    uint8_t *data;
+}audio_buf_t;
+
+/** audio file statistics */
+typedef struct {
+    uint64_t captures;
+    uint64_t bytes;
+    uint64_t gaps;
+    uint64_t overruns;
+    uint64_t writes;
+    uint64_t disk_bytes;
+    uint64_t stream_us;
+    uint64_t write_cpu_ns;
+    uint64_t feat_frames;
+    uint64_t feat_cpu_ns;
+    uint64_t segments;
+}audio_file_stats_t;
+
+/** audio file of a device, refs counts the writer passes draining it
+ *  outside of the files list lock */
+typedef struct {
+    k_list_t link;
+    uint32_t refs;
+    pthread_mutex_t lock;
+    char path[MAX_PATH_SIZE];
+    int fd;
+    int idx_fd;
+    bool direct;
+    audio_file_format_t format;
+    uint32_t capacity;
+    audio_buf_t *fill;
+    k_list_t sealed;
+    k_list_t free;
+    audio_buf_t bufs[AUDIO_FILE_BUFFERS];
+    uint8_t *mem;
+    bool capturing;
+    bool fresh;
+    uint8_t seq;
+    uint64_t begin_us;
+    audio_index_entry_t cur;
+    uint64_t tail;
+    uint64_t capture_offset;
+    uint32_t seg_first;
+    uint32_t seg_last;
+    uint32_t seg_captures;
+    audio_adpcm_state_t enc_state;
+    uint8_t *enc;
+    audio_feat_t *feat;
+    audio_file_stats_t stats;
+}audio_file_t;
+
+/** maps an audio file and its captures index for analysis */
+typedef struct {
+    const uint8_t *base;
+    size_t size;
+    audio_index_entry_t *idx;
+    size_t captures;
+}audio_reader_t;
+
+
+/**
+ *  @fn audio_file_start()
+ *  @brief starts the audio writer thread
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+int audio_file_start(void);
+
+/**
+ *  @fn audio_file_finish()
+ *  @brief stops the audio writer thread, files still open keep their
+ *         buffers until closed
+ *  @param
+ *  @return
+ */
+void audio_file_finish(void);
+
+/**
+ *  @fn audio_file_open()
+ *  @brief opens or creates an audio file, dropping index entries whose
+ *         data never reached the disk and finishing a rotation cut short
+ *  @param path - audio file path, the index lives next to it
+ *  @param format - how new captures are stored
+ *  @return the file, NULL on failure
+ */
+audio_file_t *audio_file_open(const char *path, audio_file_format_t format);
+
+/**
+ *  @fn audio_file_analyze()
+ *  @brief makes the writer extract spectral features of the captures from
+ *         now on, before they are compressed
+ *  @param f - audio file
+ *  @param path - feature file path
+ *  @return 0 on success, -1 on failure
+ */
+int audio_file_analyze(audio_file_t *f, const char *path);
+
+/**
+ *  @fn audio_file_close()
+ *  @brief ends any open capture, writes and syncs everything buffered
+ *  @param f - file to close
+ *  @param s - if not NULL, receives the final statistics
+ *  @return
+ */
+void audio_file_close(audio_file_t *f, audio_file_stats_t *s);
+
+/**
+ *  @fn audio_file_begin()
+ *  @brief starts a new capture
+ *  @param f - audio file
+ *  @param timestamp - capture time
+ *  @return
+ */
+void audio_file_begin(audio_file_t *f, uint32_t timestamp);
+
+/**
+ *  @fn audio_file_put()
+ *  @brief copies a capture fragment into the write buffers, fragments lost
+ *         on the way are replaced by full fragments of silence and late
+ *         duplicates are dropped
+ *  @param f - audio file
+ *  @param seq - fragment sequence number
+ *  @param data - fragment samples
+ *  @param size - fragment size in bytes
+ *  @return 0 on success, -1 if the writer fell behind and data was dropped
+ */
+int audio_file_put(audio_file_t *f, uint8_t seq, const uint8_t *data, size_t size);
+
+/**
+ *  @fn audio_file_end()
+ *  @brief ends the current capture, its index entry is written once its
+ *         data is on the disk
+ *  @param f - audio file
+ *  @param entry - if not NULL, receives the capture entry, its offset is
+ *                 only known once written
+ *  @return
+ */
+void audio_file_end(audio_file_t *f, audio_index_entry_t *entry);
+
+/**
+ *  @fn audio_file_get_stats()
+ *  @brief gets the statistics of an open file
+ *  @param f - audio file
+ *  @param s - filled with the current counters
+ *  @return
+ */
+void audio_file_get_stats(audio_file_t *f, audio_file_stats_t *s);
+
+/**
+ *  @fn audio_index_disk_size()
+ *  @brief bytes a capture takes on disk, alignment padding excluded
+ *  @param e - capture entry
+ *  @return
+ */
+uint64_t audio_index_disk_size(const audio_index_entry_t *e);
+
+/**
+ *  @fn audio_reader_open()
+ *  @brief maps an audio file and loads its intact index entries
+ *  @param path - audio file path
+ *  @return the reader, NULL on failure
+ */
+audio_reader_t *audio_reader_open(const char *path);
+
+/**
+ *  @fn audio_reader_close()
+ *  @brief unmaps the file and releases the reader
+ *  @param r - reader to close
+ *  @return
+ */
+void audio_reader_close(audio_reader_t *r);
+
+/**
+ *  @fn audio_reader_read()
+ *  @brief decodes samples of a capture, seeking straight to the frame
+ *         holding the first one
+ *  @param r - reader
+ *  @param capture - capture number, in index order
+ *  @param sample - first sample to read
+ *  @param pcm - receives the samples
+ *  @param count - number of samples wanted
+ *  @return number of samples read, -1 if the capture is not readable
+ */
+ssize_t audio_reader_read(audio_reader_t *r, size_t capture, size_t sample, int16_t *pcm, size_t count);
+
+#endif
@@ -36,9 +36,22 @@ typedef enum {
 	k_get_audio,
 	k_get_status,
 	k_reboot,
+	k_fw_update,
 }edge_cmds_t;
 
 
+/** k_get_audio carries the requested capture size as a little endian
+ *  uint32_t, the node answers with a stream of k_sequence_packet fragments
+ *  numbered by id, modulo 256, and a non zero pack_amount on the last one */
+#define BLE_AUDIO_REQ_SIZE      sizeof(uint32_t)
+
+/** k_fw_update carries the image size and crc32c as little endian
+ *  uint32_t, the image follows as k_sequence_packet writes without response
+ *  numbered by id and pack_amount, low byte first. The node answers the
+ *  command and every few fragments with a k_fw_update notification of
+ *  OTA_ACK_SIZE bytes, and runs the image once it gets k_reboot */
+#define BLE_OTA_REQ_SIZE        (2 * sizeof(uint32_t))
+
 /** packet structure */
 typedef struct {
 	uint8_t type;
@@ -48,39 +61,162 @@ typedef struct {
 	uint8_t pack_data[PACKET_MAX_PAYLOAD];
 }ble_data_t;
 
+/* per device packet ring, downstream queues and firmware transfer, need
+ * ble_data_t */
+#include "ble_rx_ring.h"
+#include "app_ble_tx.h"
+#include "app_ota.h"
 
-typedef struct device_timer_spec_s {
-    timer_t timerid;
-    struct sigevent sev;
-    struct itimerspec trigger;
-}device_timer_spec_t;
+/** device session states, each one is a non blocking step on the event loop */
+typedef enum {
+    k_dev_connect = 0,
+    k_dev_idle,
+    k_dev_wait_response,
+    k_dev_wait_audio,
+    k_dev_ota,
+    k_dev_disconnect,
+}ble_dev_state_t;
+
+/** blocking gatt operation a device hands to the link threads */
+typedef enum {
+    k_link_none = 0,
+    k_link_connect,
+    k_link_write,
+}ble_link_op_t;
 
+/** outcome of a reassembly pass over the ring */
+typedef enum {
+    k_rx_asm_idle = 0,
+    k_rx_asm_progress,
+    k_rx_asm_done,
+    k_rx_asm_bad,
+}ble_rx_asm_t;
 
 /* device context structure */
 typedef struct  ble_device_handle_s{
-    pthread_t ble_device_thread;
-    pthread_attr_t ble_dev_att;
+    sched_source_t src;
+    ble_dev_state_t state;
     gatt_connection_t *conn_handle;
     gattlib_primary_service_t* services;
     gattlib_characteristic_t* characteristics;
     acqui_st_t data_env;
-	mqd_t mq;
-    struct mq_attr attr;
-    struct timespec mq_rcv_tout;
-    device_timer_spec_t timer;
-	int timestamp;
-    bool should_run;
+    ble_rx_ring_t rx;
+    ble_tx_t tx;
+    uint32_t tx_credit;
+    _Atomic bool timer_fired;
+    app_timer_t timer;
+    stats_dev_t *stats;
+    uint64_t cycle[k_lat_cycle + 1];
+    _Atomic bool rx_stamp;
+    _Atomic uint64_t rx_first;
+    uint32_t rx_offset;
+    uint32_t rx_pending;
+    bool rx_started;
+    acq_file_t *acq;
+    audio_file_t *audio;
+    uint64_t audio_due;
+    uint64_t audio_cpu_ns;
+    ota_session_t ota;
+    bool ota_rebooted;
+	uint32_t timestamp;
+    _Atomic bool should_run;
     int services_count; 
     int characteristics_count;
     char device_name[MAX_NAME_SIZE];
     char bd_addr[MAX_NAME_SIZE];
     char uuid_str[2*MAX_NAME_SIZE];
     bool new_device;
+    uint8_t addr_type;
+    uint16_t tx_handle;
+    bool gatt_cached;
+    bool first_reading_done;
+    uint64_t connect_start;
+    int slot;
+    epoch_node_t retire;
+
+    /* off the event loop while a link thread runs link_op */
     k_list_t link;
+    ble_link_op_t link_op;
+    void (*link_done)(struct ble_device_handle_s *h, int ret);
+    int link_ret;
+    uint64_t link_ns;
+    size_t link_len;
+    ble_data_t link_packet;
 } ble_device_handle_t;
 
 
 
+/**
+ *  @fn ble_device_ingest()
+ *  @brief what the notification callback does with a packet, lives here
+ *         so bench/ measures the very same code
+ *  @param dev - device the notification came from
+ *  @param data - raw ble_data_t bytes
+ *  @param len - number of bytes
+ *  @return
+ */
+static inline void ble_device_ingest(ble_device_handle_t *dev, const uint8_t *data, size_t len)
+{
+    struct timespec ts;
+
+    /* the first notification of a sensor cycle is stamped on arrival,
+     * before the ring and the event loop add their own delay */
+    if(atomic_load_explicit(&dev->rx_stamp, memory_order_relaxed)) {
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        atomic_store_explicit(&dev->rx_stamp, false, memory_order_relaxed);
+        atomic_store_explicit(&dev->rx_first, (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec,
+            memory_order_relaxed);
+    }
+
+    /* data received, store on ring for further processing, a full ring
+     * is only counted, printing here would slow the producer down more */
+    if(ble_rx_ring_push(&dev->rx, data, len)) {
+        stats_add(&dev->stats->rx_packets, 1);
+        stats_add(&dev->stats->rx_bytes, len);
+    } else {
+        stats_add(&dev->stats->rx_drops, 1);
+    }
+}
+
+/**
+ *  @fn ble_device_reassemble()
+ *  @brief copies the queued fragments of a sensors answer into data_env,
+ *         straight from the ring slots, event loop step only
+ *  @param h - device waiting for the answer
+ *  @param bad - filled with the header of a packet that does not belong
+ *               to the answer, a command packet means a faulty link
+ *  @return k_rx_asm_done once the last fragment is in
+ */
+static inline ble_rx_asm_t ble_device_reassemble(ble_device_handle_t *h, ble_data_t *bad)
+{
+    const ble_data_t *rx_packet;
+    ble_rx_asm_t ret = k_rx_asm_idle;
+
+    while((rx_packet = ble_rx_ring_peek(&h->rx)) != NULL) {
+        if(rx_packet->type == k_command_packet ||
+            rx_packet->payload_size > sizeof(h->data_env) - h->rx_offset) {
+            memcpy(bad, rx_packet, BLE_PACKET_HDR_SIZE);
+            ble_rx_ring_release(&h->rx);
+            return(k_rx_asm_bad);
+        }
+
+        if(!h->rx_started) {
+            h->rx_pending = (rx_packet->pack_amount) ? rx_packet->pack_amount : 1;
+            h->rx_started = true;
+        }
+
+        memcpy((uint8_t *)&h->data_env + h->rx_offset, rx_packet->pack_data, rx_packet->payload_size);
+        h->rx_offset += rx_packet->payload_size;
+        ble_rx_ring_release(&h->rx);
+
+        if(--h->rx_pending == 0) {
+            return(k_rx_asm_done);
+        }
+        ret = k_rx_asm_progress;
+    }
+    return(ret);
+}
+
 /**
  *  @fn beeinformed_app_ble_start()
  *  @brief starts the beeinformed devices connection manager 
@@ -99,9 +235,12 @@ void beeinformed_app_ble_finish(void);
 
 /**
  *  @fn beeinformed_app_ble_send_data()
- *  @brief custom personalized data channel to ble connection manager
- *  @param
- *  @return
+ *  @brief custom personalized data channel to ble connection manager, the
+ *         message is encoded once and queued on every connected hive
+ *  @param data - payload
+ *  @param size - payload length, at most BLE_TX_MSG_MAX bytes
+ *  @param tag - kind of payload, sets its priority
+ *  @return number of hives the message was queued on, -1 if invalid
  */
 int  beeinformed_app_ble_send_data(void *data, size_t size, app_ble_data_tag_t tag);
 
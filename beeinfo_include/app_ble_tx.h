@@ -0,0 +1,135 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_ble_tx.h
+ *  @brief downstream channel from the gateway to the edge nodes
+ *
+ *  Messages are encoded once as a record, a tag byte, a length byte and
+ *  the payload, and shared by reference between every hive they go to.
+ *  Each device keeps one queue per tag and frames the records of the most
+ *  urgent one back to back into k_data_packet writes, so small messages
+ *  share frames and large ones straddle them. The frame id counts frames
+ *  modulo 256 and pack_amount tells how many records end in the frame.
+ */
+
+#ifndef __APP_BLE_TX_H
+#define __APP_BLE_TX_H
+
+/** record header, tag and payload length */
+#define BLE_TX_REC_HDR_SIZE         2
+#define BLE_TX_MSG_MAX              255
+
+/** queued messages per tag and device, must be a power of two */
+#define BLE_TX_QUEUE_SLOTS          32
+#define BLE_TX_QUEUE_MASK           (BLE_TX_QUEUE_SLOTS - 1)
+
+/** one queue per tag, node requisitions first, then gps, then user data */
+#define BLE_TX_PRIOS                3
+
+/** frames a device may write between two sensor polls, writes block
+ *  and the link is shared with the acquisition, so a backlog is paced by
+ *  it and takes at most this share of the air time */
+#define BLE_TX_FRAMES_PER_POLL      1
+
+/** encoded message, freed by whoever drops the last reference */
+typedef struct {
+    _Atomic uint32_t refs;
+    uint8_t prio;
+    uint16_t len;
+    uint8_t data[];
+}ble_tx_msg_t;
+
+/** queue of one tag */
+typedef struct {
+    ble_tx_msg_t *slot[BLE_TX_QUEUE_SLOTS];
+    uint32_t head;
+    uint32_t tail;
+}ble_tx_queue_t;
+
+/** downstream statistics of a device */
+typedef struct {
+    uint64_t queued;
+    uint64_t delivered;
+    uint64_t replaced;
+    uint64_t dropped;
+    uint64_t frames;
+    uint64_t bytes;
+}ble_tx_stats_t;
+
+/** per device downstream state, any thread queues, the device step is
+ *  the only one framing */
+typedef struct {
+    pthread_mutex_t lock;
+    ble_tx_queue_t q[BLE_TX_PRIOS];
+    _Atomic uint32_t pending;
+    ble_tx_msg_t *cur;
+    uint32_t cur_off;
+    uint8_t seq;
+    ble_tx_stats_t stats;
+}ble_tx_t;
+
+
+/**
+ *  @fn ble_tx_msg_new()
+ *  @brief encodes a message, the caller owns the only reference
+ *  @param tag - app_ble_data_tag_t of the payload
+ *  @param data - payload
+ *  @param size - payload length, at most BLE_TX_MSG_MAX
+ *  @return the message, NULL if the tag or size is invalid
+ */
+ble_tx_msg_t *ble_tx_msg_new(uint8_t tag, const void *data, size_t size);
+
+/**
+ *  @fn ble_tx_msg_put()
+ *  @brief drops a reference to a message
+ *  @param m - message
+ *  @return
+ */
+void ble_tx_msg_put(ble_tx_msg_t *m);
+
+/**
+ *  @fn ble_tx_init()
+ *  @brief resets the downstream state of a device
+ *  @param t - state to initialize
+ *  @return
+ */
+void ble_tx_init(ble_tx_t *t);
+
+/**
+ *  @fn ble_tx_deinit()
+ *  @brief drops every message still queued on a device
+ *  @param t - state to release
+ *  @return
+ */
+void ble_tx_deinit(ble_tx_t *t);
+
+/**
+ *  @fn ble_tx_enqueue()
+ *  @brief queues a message on a device taking a new reference, a gps fix
+ *         replaces the one still waiting instead of queueing behind it
+ *  @param t - device downstream state
+ *  @param m - message
+ *  @return 0 on success, -1 if the queue of the tag is full
+ */
+int ble_tx_enqueue(ble_tx_t *t, ble_tx_msg_t *m);
+
+/**
+ *  @fn ble_tx_pending()
+ *  @brief tells if the device has anything left to frame
+ *  @param t - device downstream state
+ *  @return
+ */
+static inline bool ble_tx_pending(ble_tx_t *t)
+{
+    return(t->cur != NULL || atomic_load(&t->pending) != 0);
+}
+
+/**
+ *  @fn ble_tx_next_frame()
+ *  @brief fills the next downstream frame, device step only
+ *  @param t - device downstream state
+ *  @param f - receives the frame
+ *  @return bytes of the frame to write, 0 if there is nothing to send
+ */
+size_t ble_tx_next_frame(ble_tx_t *t, ble_data_t *f);
+
+#endif
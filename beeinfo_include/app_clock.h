@@ -0,0 +1,96 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_clock.h
+ *  @brief beeinformed gateway time service, monotonic time mapped to utc
+ *         and disciplined by gps
+ */
+
+#ifndef __APP_CLOCK_H
+#define __APP_CLOCK_H
+
+/** NMEA time marks the start of the second, the first sentence of an
+ *  epoch reaches us about this much later */
+#define APP_CLOCK_NMEA_DELAY_NS     (50 * 1000000LL)
+
+/** epochs the offset estimate looks back on, serial delays only ever make
+ *  us late so the largest offset of the window is the truest one */
+#define APP_CLOCK_WINDOW            8
+
+/** once synced, forward errors above this are stepped, anything else is
+ *  slewed so the clock never runs backwards */
+#define APP_CLOCK_STEP_NS           (1000 * 1000000LL)
+
+/** offsets are absorbed over this horizon, at most this much faster or
+ *  slower than the monotonic clock */
+#define APP_CLOCK_SLEW_NS           (16 * 1000000000LL)
+#define APP_CLOCK_SLEW_MAX_PPB      500000000LL
+
+/** mapping from monotonic time, the slew only lasts until its correction
+ *  is complete, so a lost receiver can not drag the clock along */
+typedef struct {
+    int64_t base_mono;
+    int64_t base_utc;
+    int64_t slew_ns;
+    int64_t rate_ppb;
+}app_clock_map_t;
+
+/** time service statistics */
+typedef struct {
+    bool synced;
+    uint64_t updates;
+    uint64_t steps;
+    int64_t offset_ns;
+    int64_t rate_ppb;
+}app_clock_stats_t;
+
+
+/**
+ *  @fn app_clock_now()
+ *  @brief current utc time, no lock and no syscall
+ *  @param
+ *  @return seconds since the epoch
+ */
+uint32_t app_clock_now(void);
+
+/**
+ *  @fn app_clock_now_ns()
+ *  @brief current utc time, no lock and no syscall
+ *  @param
+ *  @return nanoseconds since the epoch
+ */
+int64_t app_clock_now_ns(void);
+
+/**
+ *  @fn app_clock_from_mono()
+ *  @brief utc time of a CLOCK_MONOTONIC instant
+ *  @param mono_ns - monotonic time in nanoseconds
+ *  @return nanoseconds since the epoch
+ */
+int64_t app_clock_from_mono(int64_t mono_ns);
+
+/**
+ *  @fn app_clock_mono_ns()
+ *  @brief CLOCK_MONOTONIC in nanoseconds
+ *  @param
+ *  @return
+ */
+int64_t app_clock_mono_ns(void);
+
+/**
+ *  @fn app_clock_discipline()
+ *  @brief feeds a gps epoch, single caller
+ *  @param utc - second the receiver reported
+ *  @param mono_ns - monotonic time the report arrived
+ *  @return
+ */
+void app_clock_discipline(uint32_t utc, int64_t mono_ns);
+
+/**
+ *  @fn app_clock_get_stats()
+ *  @brief gets the time service statistics
+ *  @param s - filled with the current values
+ *  @return
+ */
+void app_clock_get_stats(app_clock_stats_t *s);
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_devtab.h
+ *  @brief table of live devices, walked without locks inside an epoch
+ *         section while devices come and go
+ *
+ *  Writers, the scan callback adding a device and its session removing
+ *  it, take the table mutex, a few stores each. Readers walk the slots
+ *  below the high water mark and skip the empty ones, a device seen in a
+ *  walk stays allocated until the section ends as long as its owner
+ *  retires it through epoch_retire() after devtab_remove().
+ */
+
+#ifndef __APP_DEVTAB_H
+#define __APP_DEVTAB_H
+
+/** devices at once, past it a new device is refused */
+#define DEVTAB_SLOTS                256
+
+/** device table */
+typedef struct {
+    _Atomic(void *) slot[DEVTAB_SLOTS];
+    _Atomic uint32_t hwm;
+    uint32_t count;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+}devtab_t;
+
+#define DEVTAB_STATIC_INIT { .mutex = PTHREAD_MUTEX_INITIALIZER, .cond = PTHREAD_COND_INITIALIZER }
+
+/**
+ *  @fn DEVTAB_FOR_EACH()
+ *  @brief walks the devices of a table, inside an epoch section only
+ *  @param t - table
+ *  @param i - uint32_t cursor
+ *  @param dev - set to each device in turn
+ */
+#define DEVTAB_FOR_EACH(t, i, dev)                                                      \
+    for(uint32_t devtab_hwm_ = ((i) = 0,                                                \
+            atomic_load_explicit(&(t)->hwm, memory_order_acquire));                      \
+        (i) < devtab_hwm_; (i)++)                                                       \
+        if(((dev) = atomic_load_explicit(&(t)->slot[(i)], memory_order_acquire)) != NULL)
+
+
+/**
+ *  @fn devtab_insert()
+ *  @brief publishes a device, readers may see it as soon as this returns
+ *  @param t - table
+ *  @param dev - device, fully initialized
+ *  @return its slot, -1 if the table is full
+ */
+int devtab_insert(devtab_t *t, void *dev);
+
+/**
+ *  @fn devtab_remove()
+ *  @brief unlinks a device, readers already holding it keep it until
+ *         their section ends, retire it after this
+ *  @param t - table
+ *  @param slot - returned by devtab_insert()
+ *  @return
+ */
+void devtab_remove(devtab_t *t, int slot);
+
+/**
+ *  @fn devtab_count()
+ *  @brief number of devices in the table
+ *  @param t - table
+ *  @return
+ */
+uint32_t devtab_count(devtab_t *t);
+
+/**
+ *  @fn devtab_wait_empty()
+ *  @brief waits until every device left the table
+ *  @param t - table
+ *  @return
+ */
+void devtab_wait_empty(devtab_t *t);
+
+#endif
@@ -0,0 +1,141 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_epoch.h
+ *  @brief epoch based reclamation, readers of shared objects never lock
+ *         and writers free what they unlinked once no reader can see it
+ *
+ *  A reader brackets its accesses with epoch_enter() and epoch_exit(),
+ *  announcing the global epoch it started in. A writer unlinks an object,
+ *  then hands it to epoch_retire(), which bumps the global epoch and tags
+ *  the object with the epoch before the bump. A reader that announced a
+ *  later epoch started after the unlink and can not hold the object, so
+ *  the reclaimer thread frees it once every reader still inside a section
+ *  announced a later epoch. Readers must not block inside a section, a
+ *  stuck reader holds every later reclamation back.
+ */
+
+#ifndef __APP_EPOCH_H
+#define __APP_EPOCH_H
+
+/** reader threads tracked at once, a thread takes a slot on its first
+ *  section and gives it back when it exits */
+#define EPOCH_MAX_THREADS           256
+
+/** reclaimer period, retiring a batch kicks it earlier */
+#define EPOCH_RECLAIM_PERIOD_MS     10
+#define EPOCH_RECLAIM_BATCH         32
+
+/** keeps the readers off each other cache lines */
+#define EPOCH_CACHE_LINE_SIZE       64
+
+/** retired object, embedded in it and passed back to its release */
+typedef struct epoch_node_s {
+    struct epoch_node_s *next;
+    uint64_t epoch;
+    void (*release)(struct epoch_node_s *node);
+}epoch_node_t;
+
+/** reader slot, epoch is 0 outside of a section */
+typedef struct {
+    _Atomic uint64_t epoch __attribute__((aligned(EPOCH_CACHE_LINE_SIZE)));
+    uint32_t nest;
+    _Atomic bool used;
+}epoch_reader_t;
+
+/** global epoch, starts at 1 so 0 means quiescent */
+extern _Atomic uint64_t epoch_global;
+
+/** slot of the calling thread, NULL until its first section */
+extern __thread epoch_reader_t *epoch_self;
+
+
+/**
+ *  @fn epoch_register()
+ *  @brief gives the calling thread a reader slot, use epoch_enter()
+ *  @param
+ *  @return the slot
+ */
+epoch_reader_t *epoch_register(void);
+
+/**
+ *  @fn epoch_enter()
+ *  @brief starts a read side section, sections nest
+ *  @param
+ *  @return
+ */
+static inline void epoch_enter(void)
+{
+    epoch_reader_t *r = epoch_self;
+
+    if(r == NULL) {
+        r = epoch_register();
+    }
+    if(r->nest++ == 0) {
+        atomic_store_explicit(&r->epoch, atomic_load_explicit(&epoch_global, memory_order_acquire),
+            memory_order_relaxed);
+        /* the announcement is visible before anything read in the
+         * section, pairs with the fence of the reclaimer */
+        atomic_thread_fence(memory_order_seq_cst);
+    }
+}
+
+/**
+ *  @fn epoch_exit()
+ *  @brief ends a read side section, nothing read in it may be used after
+ *  @param
+ *  @return
+ */
+static inline void epoch_exit(void)
+{
+    epoch_reader_t *r = epoch_self;
+
+    if(--r->nest == 0) {
+        atomic_store_explicit(&r->epoch, 0, memory_order_release);
+    }
+}
+
+/**
+ *  @fn epoch_retire()
+ *  @brief frees an unlinked object once no reader can hold it anymore,
+ *         any thread may call it, inside a section or not
+ *  @param node - embedded in the object
+ *  @param release - frees the object, runs on the reclaimer thread
+ *  @return
+ */
+void epoch_retire(epoch_node_t *node, void (*release)(epoch_node_t *node));
+
+/**
+ *  @fn epoch_reclaim()
+ *  @brief releases what no reader can hold anymore, the reclaimer thread
+ *         calls it, others may too outside of a section
+ *  @param
+ *  @return number of objects still waiting
+ */
+uint32_t epoch_reclaim(void);
+
+/**
+ *  @fn epoch_barrier()
+ *  @brief waits until everything retired so far is released, never from
+ *         inside a section
+ *  @param
+ *  @return
+ */
+void epoch_barrier(void);
+
+/**
+ *  @fn epoch_start()
+ *  @brief starts the reclaimer thread, retired objects wait until then
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+int epoch_start(void);
+
+/**
+ *  @fn epoch_finish()
+ *  @brief releases everything retired and stops the reclaimer thread
+ *  @param
+ *  @return
+ */
+void epoch_finish(void);
+
+#endif
@@ -0,0 +1,98 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_gatt_cache.h
+ *  @brief beeinformed per device gatt attribute cache, saves a full
+ *         service discovery on every reconnection
+ */
+
+#ifndef __APP_GATT_CACHE_H
+#define __APP_GATT_CACHE_H
+
+/** record identification */
+#define GATT_CACHE_MAGIC        0x43544147
+#define GATT_CACHE_VERSION      3
+
+/** index buckets, must be a power of two */
+#define GATT_CACHE_BUCKETS      256
+
+/** size of the database hash characteristic of the node */
+#define GATT_CACHE_NODE_HASH_SIZE   16
+
+/** on disk record, the latest one of an address wins, crc is the CRC32C
+ *  of everything before it, records of older versions are dropped on load
+ *  and the file is rewritten with the live entries only */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    char bd_addr[REGISTRY_ADDR_SIZE];
+    uint8_t valid;
+    uint8_t services_count;
+    uint32_t db_hash;
+    uint32_t services_hash;
+    uint16_t tx_handle;
+    uint16_t tx_cccd_handle;
+    uint16_t noti_handle;
+    uint16_t characteristics_count;
+    uint8_t has_node_hash;
+    uint8_t reserved[3];
+    uint8_t node_hash[GATT_CACHE_NODE_HASH_SIZE];
+    uint32_t crc;
+}gatt_cache_record_t;
+
+
+/**
+ *  @fn gatt_cache_open()
+ *  @brief loads the attribute cache file
+ *  @param path - cache file, created if it does not exist
+ *  @return 0 on success, -1 on failure
+ */
+int gatt_cache_open(const char *path);
+
+/**
+ *  @fn gatt_cache_close()
+ *  @brief closes the cache file and releases its entries
+ *  @param
+ *  @return
+ */
+void gatt_cache_close(void);
+
+/**
+ *  @fn gatt_cache_lookup()
+ *  @brief gets the cached attributes of a device
+ *  @param bd_addr - device address
+ *  @param rec - filled with the cached attributes when found
+ *  @return true if a valid entry exists
+ */
+bool gatt_cache_lookup(const char *bd_addr, gatt_cache_record_t *rec);
+
+/**
+ *  @fn gatt_cache_store()
+ *  @brief stores the attributes found by a full discovery
+ *  @param rec - attributes to store, magic, version and size are filled here
+ *  @return 0 on success, -1 on failure
+ */
+int gatt_cache_store(gatt_cache_record_t *rec);
+
+/**
+ *  @fn gatt_cache_invalidate()
+ *  @brief drops the entry of a device so next connection rediscovers it
+ *  @param bd_addr - device address
+ *  @return
+ */
+void gatt_cache_invalidate(const char *bd_addr);
+
+/**
+ *  @fn gatt_cache_hash()
+ *  @brief hash of a discovered attribute database
+ *  @param services - discovered primary services
+ *  @param services_count - number of services
+ *  @param characteristics - discovered characteristics, NULL hashes the
+ *         services only
+ *  @param characteristics_count - number of characteristics
+ *  @return
+ */
+uint32_t gatt_cache_hash(const gattlib_primary_service_t *services, int services_count,
+            const gattlib_characteristic_t *characteristics, int characteristics_count);
+
+#endif
@@ -7,23 +7,48 @@
  #ifndef __APP_GPS_H
  #define __APP_GPS_H
 
-/** app gps acquisition data type*/
+/** serial line of the receiver, replay files are read paced instead */
+#define GPS_BAUDRATE            B9600
+
+/** reader wakeup period and how often a missing receiver is retried */
+#define GPS_POLL_MS             200
+#define GPS_RETRY_MS            5000
+
+/** replay files deliver one epoch per period, like a receiver would */
+#define GPS_REPLAY_EPOCH_MS     1000
+
+/** NMEA limits, sentences are at most 82 characters long */
+#define GPS_NMEA_MAX_FIELDS     20
+#define GPS_NMEA_BUFFER_SIZE    4096
+
+/** app gps acquisition data type, positions in 1e-7 degrees, north and
+ *  east positive, dops in hundredths, utc in seconds since the epoch */
 typedef struct {
-    uint32_t lati;
-    uint32_t longi;
+    int32_t lati;
+    int32_t longi;
     uint32_t pdop;
     uint32_t hdop;
     uint32_t utc_timestamp;
+    uint32_t fix;
 }gps_data_t;
 
+/** NMEA parser state, the fix is assembled across sentences */
+typedef struct {
+    gps_data_t data;
+    uint32_t days;
+    uint64_t sentences;
+    uint64_t accepted;
+    uint64_t bad;
+}gps_nmea_t;
+
 
 /**
  *  @fn beeinformed_app_gps_start()
- *  @brief starts the beeinformed gps manager 
- *  @param
+ *  @brief starts the beeinformed gps manager
+ *  @param path - receiver tty or NMEA replay file
  *  @return
  */
-void beeinformed_app_gps_start(void);
+void beeinformed_app_gps_start(const char *path);
 
 /**
  *  @fn beeinformed_app_gps_finish()
@@ -35,10 +60,22 @@ void beeinformed_app_gps_finish(void);
 
 /**
  *  @fn beeinformed_app_gps_get_data()
- *  @brief gets asynchronously the current gps data
- *  @param
- *  @return
+ *  @brief gets asynchronously the current gps data, never blocks and
+ *         never sees a fix half written
+ *  @param g - receives the latest data
+ *  @return 0 if the receiver has a fix, -1 otherwise
  */
 int beeinformed_app_gps_get_data(gps_data_t *g);
 
- #endif
\ No newline at end of file
+/**
+ *  @fn gps_nmea_parse()
+ *  @brief parses a single sentence in place, GGA, RMC and GSA update the
+ *         fix, anything else is ignored
+ *  @param n - parser state
+ *  @param s - sentence, starting at '$', line ending optional
+ *  @param len - sentence length
+ *  @return 1 if the fix changed, 0 if ignored, -1 if malformed
+ */
+int gps_nmea_parse(gps_nmea_t *n, const char *s, size_t len);
+
+ #endif
@@ -0,0 +1,158 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_hist.h
+ *  @brief fixed size log linear latency histograms
+ *
+ *  Values are nanoseconds. Below HIST_SUB_COUNT each value has its own
+ *  bucket, above it every power of two is split in HIST_SUB_COUNT equal
+ *  buckets, so a bucket is never wider than 1/HIST_SUB_COUNT of what it
+ *  holds. Recording is a count leading zeros and three stores, nothing is
+ *  allocated and the histogram lives wherever its owner puts it, shared
+ *  memory included. Like the counters, a histogram has a single writer;
+ *  readers take snapshots and merge them.
+ */
+
+#ifndef __APP_HIST_H
+#define __APP_HIST_H
+
+/** resolution, 32 buckets per power of two keep a bucket within 3.2% */
+#define HIST_SUB_BITS               5
+#define HIST_SUB_COUNT              (1 << HIST_SUB_BITS)
+
+/** range, values from 2^36 ns (68.7 s) up land in the last bucket */
+#define HIST_MAX_BITS               36
+#define HIST_BUCKETS                ((HIST_MAX_BITS - HIST_SUB_BITS + 1) * HIST_SUB_COUNT)
+
+/** histogram as its writer updates it */
+typedef struct {
+    _Atomic uint64_t count;
+    _Atomic uint64_t sum_ns;
+    _Atomic uint64_t max_ns;
+    _Atomic uint32_t bucket[HIST_BUCKETS];
+}app_hist_t;
+
+/** plain copy of one or more histograms, what percentiles are taken on */
+typedef struct {
+    uint64_t count;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+    uint64_t bucket[HIST_BUCKETS];
+}app_hist_snap_t;
+
+
+/**
+ *  @fn app_hist_index()
+ *  @brief bucket of a value
+ *  @param ns - value
+ *  @return
+ */
+static inline uint32_t app_hist_index(uint64_t ns)
+{
+    uint32_t e;
+
+    if(ns < HIST_SUB_COUNT) {
+        return((uint32_t)ns);
+    }
+
+    e = 63 - __builtin_clzll(ns);
+    if(e >= HIST_MAX_BITS) {
+        return(HIST_BUCKETS - 1);
+    }
+    return(((e - HIST_SUB_BITS + 1) << HIST_SUB_BITS) | ((ns >> (e - HIST_SUB_BITS)) & (HIST_SUB_COUNT - 1)));
+}
+
+/**
+ *  @fn app_hist_upper()
+ *  @brief highest value a bucket holds
+ *  @param idx - bucket
+ *  @return
+ */
+static inline uint64_t app_hist_upper(uint32_t idx)
+{
+    uint32_t group = idx >> HIST_SUB_BITS;
+
+    if(!group) {
+        return(idx);
+    }
+    return((((uint64_t)(HIST_SUB_COUNT | (idx & (HIST_SUB_COUNT - 1))) + 1) << (group - 1)) - 1);
+}
+
+/**
+ *  @fn app_hist_record()
+ *  @brief records a value, only the owning thread may call it
+ *  @param h - histogram
+ *  @param ns - value
+ *  @return
+ */
+static inline void app_hist_record(app_hist_t *h, uint64_t ns)
+{
+    _Atomic uint32_t *b = &h->bucket[app_hist_index(ns)];
+
+    atomic_store_explicit(b, atomic_load_explicit(b, memory_order_relaxed) + 1, memory_order_relaxed);
+    atomic_store_explicit(&h->sum_ns, atomic_load_explicit(&h->sum_ns, memory_order_relaxed) + ns,
+        memory_order_relaxed);
+    if(ns > atomic_load_explicit(&h->max_ns, memory_order_relaxed)) {
+        atomic_store_explicit(&h->max_ns, ns, memory_order_relaxed);
+    }
+    atomic_store_explicit(&h->count, atomic_load_explicit(&h->count, memory_order_relaxed) + 1,
+        memory_order_relaxed);
+}
+
+/**
+ *  @fn app_hist_merge()
+ *  @brief adds a histogram to a snapshot, any thread may call it
+ *  @param s - snapshot, zeroed before the first merge
+ *  @param h - histogram
+ *  @return
+ */
+static inline void app_hist_merge(app_hist_snap_t *s, const app_hist_t *h)
+{
+    uint64_t max = atomic_load_explicit((_Atomic uint64_t *)&h->max_ns, memory_order_relaxed);
+
+    /* the count is taken from the buckets, the writer may be between the
+     * stores of a record */
+    for(uint32_t i = 0; i < HIST_BUCKETS; i++) {
+        uint32_t n = atomic_load_explicit((_Atomic uint32_t *)&h->bucket[i], memory_order_relaxed);
+
+        s->bucket[i] += n;
+        s->count += n;
+    }
+    s->sum_ns += atomic_load_explicit((_Atomic uint64_t *)&h->sum_ns, memory_order_relaxed);
+    if(max > s->max_ns) {
+        s->max_ns = max;
+    }
+}
+
+/**
+ *  @fn app_hist_percentile()
+ *  @brief value below which a fraction of the snapshot falls
+ *  @param s - snapshot
+ *  @param q - fraction, 0.5 for the median, 0.999 for p999
+ *  @return the upper bound of its bucket, 0 if the snapshot is empty
+ */
+static inline uint64_t app_hist_percentile(const app_hist_snap_t *s, double q)
+{
+    uint64_t rank;
+    uint64_t seen = 0;
+    uint64_t v;
+
+    if(!s->count) {
+        return(0);
+    }
+
+    rank = (uint64_t)(q * s->count + 0.5);
+    if(rank < 1) {
+        rank = 1;
+    }
+
+    for(uint32_t i = 0; i < HIST_BUCKETS; i++) {
+        seen += s->bucket[i];
+        if(seen >= rank) {
+            v = app_hist_upper(i);
+            return((v < s->max_ns || !s->max_ns) ? v : s->max_ns);
+        }
+    }
+    return(s->max_ns);
+}
+
+#endif
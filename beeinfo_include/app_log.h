@@ -0,0 +1,216 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_log.h
+ *  @brief asynchronous binary logger
+ *
+ *  A log call never formats text nor takes a lock: it copies a timestamp,
+ *  the address of its call site and the raw arguments into a lock-free
+ *  buffer owned by the calling thread. A drainer thread merges the buffers
+ *  in time order into a binary file, describing each call site the first
+ *  time one shows up, so tools/beelog turns the file back into text with
+ *  nothing but the file. A call whose buffer is full is dropped and
+ *  counted, the caller never waits for the disk.
+ */
+
+#ifndef __APP_LOG_H
+#define __APP_LOG_H
+
+/** log levels, a call above the runtime level costs one relaxed load */
+#define LOG_LEVEL_ERR               0
+#define LOG_LEVEL_WARN              1
+#define LOG_LEVEL_INFO              2
+#define LOG_LEVEL_DEBUG             3
+
+/** per thread buffer, must be a power of two */
+#define LOG_BUF_SIZE                (64 * 1024)
+#define LOG_BUF_MASK                (LOG_BUF_SIZE - 1)
+
+/** drainer period, the buffers absorb the bursts in between */
+#define LOG_DRAIN_PERIOD_MS         20
+
+/** the file is moved to <path>.1 once it grows past this */
+#define LOG_FILE_MAX_BYTES          (64 * 1024 * 1024)
+
+/** disk the live file and the previous one may take, the log is kept
+ *  out of the acquisition data budget */
+#define LOG_FILE_BUDGET             ((uint64_t)2 * LOG_FILE_MAX_BYTES)
+
+/** arguments per call and bytes kept of a string argument */
+#define LOG_MAX_ARGS                12
+#define LOG_MAX_STR                 255
+
+/** the file starts with this and then holds records back to back */
+#define LOG_FILE_MAGIC              "BEELOG01"
+
+/** record kinds */
+#define LOG_REC_PAD                 0
+#define LOG_REC_EVENT               1
+#define LOG_REC_SITE                2
+#define LOG_REC_DROP                3
+#define LOG_REC_CLOCK               4
+
+/** argument types */
+#define LOG_ARG_I32                 0
+#define LOG_ARG_U32                 1
+#define LOG_ARG_I64                 2
+#define LOG_ARG_U64                 3
+#define LOG_ARG_DBL                 4
+#define LOG_ARG_STR                 5
+#define LOG_ARG_PTR                 6
+
+/** record header, sizes are multiples of 8
+ *  event: types[nargs] padded to 8, then 8 bytes per argument, a string
+ *         being its length followed by its bytes padded to 8
+ *  site:  id is the site, level byte, function and format zero terminated
+ *  drop:  id is the number of calls the thread lost since the last one
+ *  clock: ts_ns is the monotonic time and id the realtime of one instant */
+typedef struct {
+    uint16_t size;
+    uint8_t kind;
+    uint8_t nargs;
+    uint32_t tid;
+    uint64_t ts_ns;
+    uint64_t id;
+}app_log_rec_t;
+
+/** call site, one static instance per log call */
+typedef struct {
+    uint8_t level;
+    const char *func;
+    const char *fmt;
+}app_log_site_t;
+
+/** argument as captured by the call */
+typedef struct {
+    uint8_t type;
+    union {
+        uint64_t u;
+        double d;
+        const char *s;
+    };
+}app_log_arg_t;
+
+/** runtime level, calls above it are skipped */
+extern _Atomic int app_log_level;
+
+
+/**
+ *  @fn app_log_arg_*()
+ *  @brief tag an argument with its type, picked by LOG_ARG()
+ *  @param
+ *  @return
+ */
+static inline app_log_arg_t app_log_arg_i32(int32_t v) { return((app_log_arg_t){ .type = LOG_ARG_I32, .u = (uint64_t)(int64_t)v }); }
+static inline app_log_arg_t app_log_arg_u32(uint32_t v) { return((app_log_arg_t){ .type = LOG_ARG_U32, .u = v }); }
+static inline app_log_arg_t app_log_arg_i64(int64_t v) { return((app_log_arg_t){ .type = LOG_ARG_I64, .u = (uint64_t)v }); }
+static inline app_log_arg_t app_log_arg_u64(uint64_t v) { return((app_log_arg_t){ .type = LOG_ARG_U64, .u = v }); }
+static inline app_log_arg_t app_log_arg_dbl(double v) { return((app_log_arg_t){ .type = LOG_ARG_DBL, .d = v }); }
+static inline app_log_arg_t app_log_arg_str(const char *v) { return((app_log_arg_t){ .type = LOG_ARG_STR, .s = v }); }
+static inline app_log_arg_t app_log_arg_ptr(const void *v) { return((app_log_arg_t){ .type = LOG_ARG_PTR, .u = (uintptr_t)v }); }
+
+#define LOG_ARG(x) _Generic((x),                                        \
+    _Bool: app_log_arg_u32, char: app_log_arg_i32,                      \
+    signed char: app_log_arg_i32, unsigned char: app_log_arg_u32,       \
+    short: app_log_arg_i32, unsigned short: app_log_arg_u32,            \
+    int: app_log_arg_i32, unsigned int: app_log_arg_u32,                \
+    long: app_log_arg_i64, unsigned long: app_log_arg_u64,              \
+    long long: app_log_arg_i64, unsigned long long: app_log_arg_u64,    \
+    float: app_log_arg_dbl, double: app_log_arg_dbl,                    \
+    char *: app_log_arg_str, const char *: app_log_arg_str,             \
+    default: app_log_arg_ptr)(x)
+
+/* applies LOG_ARG() to every argument of a call */
+#define LOG_NARGS(...) LOG_NARGS_(0, ##__VA_ARGS__, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0)
+#define LOG_NARGS_(_0, _1, _2, _3, _4, _5, _6, _7, _8, _9, _10, _11, _12, n, ...) n
+#define LOG_CAT(a, b) LOG_CAT_(a, b)
+#define LOG_CAT_(a, b) a##b
+#define LOG_ARGS(...) LOG_CAT(LOG_ARGS_, LOG_NARGS(__VA_ARGS__))(__VA_ARGS__)
+#define LOG_ARGS_0()
+#define LOG_ARGS_1(a) LOG_ARG(a)
+#define LOG_ARGS_2(a, ...) LOG_ARG(a), LOG_ARGS_1(__VA_ARGS__)
+#define LOG_ARGS_3(a, ...) LOG_ARG(a), LOG_ARGS_2(__VA_ARGS__)
+#define LOG_ARGS_4(a, ...) LOG_ARG(a), LOG_ARGS_3(__VA_ARGS__)
+#define LOG_ARGS_5(a, ...) LOG_ARG(a), LOG_ARGS_4(__VA_ARGS__)
+#define LOG_ARGS_6(a, ...) LOG_ARG(a), LOG_ARGS_5(__VA_ARGS__)
+#define LOG_ARGS_7(a, ...) LOG_ARG(a), LOG_ARGS_6(__VA_ARGS__)
+#define LOG_ARGS_8(a, ...) LOG_ARG(a), LOG_ARGS_7(__VA_ARGS__)
+#define LOG_ARGS_9(a, ...) LOG_ARG(a), LOG_ARGS_8(__VA_ARGS__)
+#define LOG_ARGS_10(a, ...) LOG_ARG(a), LOG_ARGS_9(__VA_ARGS__)
+#define LOG_ARGS_11(a, ...) LOG_ARG(a), LOG_ARGS_10(__VA_ARGS__)
+#define LOG_ARGS_12(a, ...) LOG_ARG(a), LOG_ARGS_11(__VA_ARGS__)
+
+/**
+ *  @fn APP_LOG()
+ *  @brief logs a printf style message of the calling function, the format
+ *         must be a literal and the line break is added by the decoder
+ *  @param lvl - LOG_LEVEL_*
+ *  @param fmt - format, up to LOG_MAX_ARGS conversions
+ *  @return
+ */
+#define APP_LOG(lvl, fmt, ...) do {                                                 \
+    static const app_log_site_t log_site_ = { (lvl), __func__, fmt };               \
+    if((lvl) <= atomic_load_explicit(&app_log_level, memory_order_relaxed)) {       \
+        const app_log_arg_t log_args_[LOG_NARGS(__VA_ARGS__) + 1] = {               \
+            LOG_ARGS(__VA_ARGS__) };                                                \
+        app_log_write(&log_site_, log_args_, LOG_NARGS(__VA_ARGS__));               \
+    }                                                                               \
+} while(0)
+
+#define LOG_ERR(fmt, ...)       APP_LOG(LOG_LEVEL_ERR, fmt, ##__VA_ARGS__)
+#define LOG_WARN(fmt, ...)      APP_LOG(LOG_LEVEL_WARN, fmt, ##__VA_ARGS__)
+#define LOG_INFO(fmt, ...)      APP_LOG(LOG_LEVEL_INFO, fmt, ##__VA_ARGS__)
+#define LOG_DEBUG(fmt, ...)     APP_LOG(LOG_LEVEL_DEBUG, fmt, ##__VA_ARGS__)
+
+/**
+ *  @fn app_log_write()
+ *  @brief copies a call into the buffer of the calling thread, use the
+ *         LOG_*() macros instead
+ *  @param site - call site
+ *  @param args - arguments
+ *  @param nargs - number of arguments
+ *  @return
+ */
+void app_log_write(const app_log_site_t *site, const app_log_arg_t *args, uint32_t nargs);
+
+/**
+ *  @fn app_log_start()
+ *  @brief opens the log file and starts the drainer, calls made before it
+ *         wait in their buffers
+ *  @param path - binary log file
+ *  @return 0 on success, -1 on failure
+ */
+int app_log_start(const char *path);
+
+/**
+ *  @fn app_log_finish()
+ *  @brief drains whatever is left and stops the drainer
+ *  @param
+ *  @return
+ */
+void app_log_finish(void);
+
+/**
+ *  @fn app_log_set_level()
+ *  @brief changes the runtime level
+ *  @param level - LOG_LEVEL_*, calls above it are skipped
+ *  @return
+ */
+void app_log_set_level(int level);
+
+/**
+ *  @fn app_log_level_parse()
+ *  @brief parses a level name or number
+ *  @param name - "err", "warn", "info", "debug" or 0 to 3
+ *  @return the level, -1 if unknown
+ */
+int app_log_level_parse(const char *name);
+
+/**
+ *  @fn app_log_dropped()
+ *  @brief calls lost to full buffers so far
+ *  @param
+ *  @return
+ */
+uint64_t app_log_dropped(void);
+
+#endif
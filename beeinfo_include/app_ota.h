@@ -0,0 +1,192 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_ota.h
+ *  @brief edge node firmware update engine, one image streamed to every
+ *         hive through a selective repeat sliding window
+ */
+
+#ifndef __APP_OTA_H
+#define __APP_OTA_H
+
+/** image bytes per fragment, a fragment is one k_sequence_packet */
+#define OTA_FRAG_SIZE               PACKET_MAX_PAYLOAD
+
+/** the fragment number is 16 bit, id low and pack_amount high */
+#define OTA_MAX_FRAGS               65536
+
+/** fragments in flight, also the bits the node acknowledges selectively */
+#define OTA_WINDOW                  64
+
+/** acknowledgement payload, fragments held in order and a bitmap of the
+ *  window after them, bit 0 being the first missing fragment */
+#define OTA_ACK_SIZE                (sizeof(uint32_t) + OTA_WINDOW / 8)
+
+/** a fragment is taken as lost once this many sent after it got through */
+#define OTA_REORDER_THRESH          3
+
+/** retransmission timeout bounds, in microseconds */
+#define OTA_RTO_INIT_US             200000
+#define OTA_RTO_MIN_US              20000
+#define OTA_RTO_MAX_US              2000000
+
+/** times a node may throw the image away before it is given up on */
+#define OTA_MAX_RESTARTS            2
+
+/** fragment slot states */
+#define OTA_SLOT_FREE               0
+#define OTA_SLOT_IN_FLIGHT          1
+#define OTA_SLOT_SACKED             2
+#define OTA_SLOT_LOST               3
+
+/** firmware image, read once and shared by every transfer */
+typedef struct {
+    _Atomic uint32_t refs;
+    uint32_t size;
+    uint32_t frags;
+    uint32_t crc;
+    uint8_t *data;
+}ota_image_t;
+
+/** transfer statistics */
+typedef struct {
+    uint64_t start_us;
+    uint64_t sent;
+    uint64_t retransmits;
+    uint64_t timeouts;
+    uint64_t acks;
+    uint32_t resumed_at;
+}ota_stats_t;
+
+/** transfer state of one node, driven by its event loop step only */
+typedef struct {
+    ota_image_t *img;
+    bool synced;
+    uint32_t cum;
+    uint32_t next;
+    uint32_t order;
+    uint32_t lost;
+    uint32_t restarts;
+    uint8_t slot_state[OTA_WINDOW];
+    uint32_t slot_order[OTA_WINDOW];
+    uint64_t slot_sent[OTA_WINDOW];
+    bool slot_retx[OTA_WINDOW];
+    int64_t srtt_us;
+    int64_t rttvar_us;
+    int64_t rto_us;
+    uint64_t ack_us;
+    uint64_t progress_us;
+    ota_stats_t stats;
+}ota_session_t;
+
+
+/**
+ *  @fn beeinformed_app_ota_start()
+ *  @brief loads a firmware image, every hive connected from now on gets it
+ *  @param path - image file
+ *  @return 0 on success, -1 if there is no usable image
+ */
+int beeinformed_app_ota_start(const char *path);
+
+/**
+ *  @fn beeinformed_app_ota_finish()
+ *  @brief drops the image, transfers in progress keep their reference
+ *  @param
+ *  @return
+ */
+void beeinformed_app_ota_finish(void);
+
+/**
+ *  @fn ota_job_get()
+ *  @brief gets the image a node still has to receive
+ *  @param bd_addr - node address
+ *  @return image with a new reference, NULL if there is nothing to send
+ */
+ota_image_t *ota_job_get(const char *bd_addr);
+
+/**
+ *  @fn ota_job_done()
+ *  @brief records that a node runs the current image
+ *  @param bd_addr - node address
+ *  @param img - image it received
+ *  @return
+ */
+void ota_job_done(const char *bd_addr, const ota_image_t *img);
+
+/**
+ *  @fn ota_image_put()
+ *  @brief drops a reference to an image
+ *  @param img - image
+ *  @return
+ */
+void ota_image_put(ota_image_t *img);
+
+/**
+ *  @fn ota_session_begin()
+ *  @brief starts a transfer, nothing is sent before the node tells where
+ *         it stands
+ *  @param s - transfer state
+ *  @param img - image, the transfer takes over the reference
+ *  @param now_us - monotonic time
+ *  @return
+ */
+void ota_session_begin(ota_session_t *s, ota_image_t *img, uint64_t now_us);
+
+/**
+ *  @fn ota_session_end()
+ *  @brief releases the transfer image
+ *  @param s - transfer state
+ *  @return
+ */
+void ota_session_end(ota_session_t *s);
+
+/**
+ *  @fn ota_session_ack()
+ *  @brief takes an acknowledgement, slides the window and flags the holes
+ *  @param s - transfer state
+ *  @param ack - acknowledgement payload
+ *  @param len - payload length
+ *  @param now_us - monotonic time
+ *  @return 0 on success, -1 if malformed or the node keeps discarding
+ */
+int ota_session_ack(ota_session_t *s, const uint8_t *ack, size_t len, uint64_t now_us);
+
+/**
+ *  @fn ota_session_next()
+ *  @brief builds the next fragment to write, lost ones first
+ *  @param s - transfer state
+ *  @param p - receives the fragment
+ *  @param now_us - monotonic time, taken as the send time
+ *  @return bytes to write, 0 if the window is closed or nothing is left
+ */
+size_t ota_session_next(ota_session_t *s, ble_data_t *p, uint64_t now_us);
+
+/**
+ *  @fn ota_session_expire()
+ *  @brief runs the retransmission timeout, the oldest fragment in flight
+ *         is taken as lost once it goes off
+ *  @param s - transfer state
+ *  @param now_us - monotonic time
+ *  @return
+ */
+void ota_session_expire(ota_session_t *s, uint64_t now_us);
+
+/**
+ *  @fn ota_session_deadline()
+ *  @brief when the retransmission timeout goes off
+ *  @param s - transfer state
+ *  @return monotonic time in microseconds, 0 if nothing is in flight
+ */
+uint64_t ota_session_deadline(const ota_session_t *s);
+
+/**
+ *  @fn ota_session_complete()
+ *  @brief tells if the node holds the whole image
+ *  @param s - transfer state
+ *  @return
+ */
+static inline bool ota_session_complete(const ota_session_t *s)
+{
+    return(s->synced && s->cum == s->img->frags);
+}
+
+#endif
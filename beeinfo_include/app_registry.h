@@ -0,0 +1,77 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_registry.h
+ *  @brief beeinformed known devices registry, indexed in memory and
+ *         persisted as an append only file of compact records
+ */
+
+#ifndef __APP_REGISTRY_H
+#define __APP_REGISTRY_H
+
+/** record identification, a file not starting with it is not a registry */
+#define REGISTRY_MAGIC          0x47455242
+#define REGISTRY_VERSION        2
+
+/** sizes of persistent fields */
+#define REGISTRY_ADDR_SIZE      18
+#define REGISTRY_NAME_SIZE      32
+
+/** on disk record, only what survives a reboot lives here, crc is the
+ *  CRC32C of everything before it, version 1 records had no crc */
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    char bd_addr[REGISTRY_ADDR_SIZE];
+    uint8_t addr_type;
+    uint8_t flags;
+    char name[REGISTRY_NAME_SIZE];
+    uint32_t crc;
+}registry_record_t;
+
+
+/**
+ *  @fn registry_open()
+ *  @brief loads the registry file into the in memory index
+ *  @param path - registry file, created if it does not exist
+ *  @return 0 on success, -1 on failure
+ */
+int registry_open(const char *path);
+
+/**
+ *  @fn registry_close()
+ *  @brief closes the registry file and releases the index
+ *  @param
+ *  @return
+ */
+void registry_close(void);
+
+/**
+ *  @fn registry_lookup()
+ *  @brief finds a device by its address, O(1)
+ *  @param bd_addr - device address
+ *  @param rec - filled with the device record when found, may be NULL
+ *  @return true if the device is known
+ */
+bool registry_lookup(const char *bd_addr, registry_record_t *rec);
+
+/**
+ *  @fn registry_add()
+ *  @brief adds or updates a device, a record is appended only on changes
+ *  @param bd_addr - device address
+ *  @param name - device name
+ *  @param addr_type - BDADDR_LE_PUBLIC or BDADDR_LE_RANDOM
+ *  @param is_new - set to true if the device was not known, may be NULL
+ *  @return 0 on success, -1 on failure
+ */
+int registry_add(const char *bd_addr, const char *name, uint8_t addr_type, bool *is_new);
+
+/**
+ *  @fn registry_count()
+ *  @brief number of known devices
+ *  @param
+ *  @return
+ */
+uint32_t registry_count(void);
+
+#endif
@@ -0,0 +1,68 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_sched.h
+ *  @brief beeinformed event loop, a fixed pool of workers sharing one epoll
+ */
+
+#ifndef __APP_SCHED_H
+#define __APP_SCHED_H
+
+/** maximum number of events a worker takes from epoll at once */
+#define SCHED_MAX_EVENTS        16
+
+/** handler executed by a worker when the source becomes readable */
+typedef void (*sched_handler_t)(void *arg);
+
+/** event source, one per device or service that wants to be scheduled */
+typedef struct sched_source_s {
+    int fd;
+    sched_handler_t handler;
+    void *arg;
+} sched_source_t;
+
+
+/**
+ *  @fn sched_start()
+ *  @brief creates the event loop and starts its workers
+ *  @param workers - number of worker threads, 0 uses one per online core
+ *  @return 0 on success, -1 on failure
+ */
+int sched_start(int workers);
+
+/**
+ *  @fn sched_finish()
+ *  @brief stops and joins all the workers
+ *  @param
+ *  @return
+ */
+void sched_finish(void);
+
+/**
+ *  @fn sched_add()
+ *  @brief adds a source to the event loop, it is armed for a single shot
+ *  @param src - source to add, must stay valid until sched_remove()
+ *  @return 0 on success, -1 on failure
+ */
+int sched_add(sched_source_t *src);
+
+/**
+ *  @fn sched_rearm()
+ *  @brief arms again a source after its handler has run
+ *
+ *  A source is never handed to two workers at once, so a handler owns its
+ *  source until it calls this function.
+ *
+ *  @param src - source to rearm
+ *  @return 0 on success, -1 on failure
+ */
+int sched_rearm(sched_source_t *src);
+
+/**
+ *  @fn sched_remove()
+ *  @brief removes a source from the event loop
+ *  @param src - source to remove
+ *  @return 0 on success, -1 on failure
+ */
+int sched_remove(sched_source_t *src);
+
+#endif
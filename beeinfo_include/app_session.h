@@ -0,0 +1,76 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_session.h
+ *  @brief beeinformed active sessions index, keyed by device address
+ */
+
+#ifndef __APP_SESSION_H
+#define __APP_SESSION_H
+
+/** index geometry, buckets share a smaller set of locks */
+#define SESSION_BUCKETS         1024
+#define SESSION_LOCKS           64
+
+/** backoff applied after a failed session, doubled on each failure */
+#define SESSION_BACKOFF_MIN_MS  1000
+#define SESSION_BACKOFF_MAX_MS  (60 * 1000)
+
+/** session states */
+typedef enum {
+    k_session_none = 0,
+    k_session_connecting,
+    k_session_connected,
+    k_session_backoff,
+}session_state_t;
+
+/** discovery suppression metrics */
+typedef struct {
+    uint64_t started;
+    uint64_t suppressed_connecting;
+    uint64_t suppressed_connected;
+    uint64_t suppressed_backoff;
+}session_stats_t;
+
+
+/**
+ *  @fn session_try_begin()
+ *  @brief claims a device for a new session, called on every discovery
+ *  @param bd_addr - device address
+ *  @return true if the caller owns the new session, false if it is suppressed
+ */
+bool session_try_begin(const char *bd_addr);
+
+/**
+ *  @fn session_set_connected()
+ *  @brief marks the session of a device as connected
+ *  @param bd_addr - device address
+ *  @return
+ */
+void session_set_connected(const char *bd_addr);
+
+/**
+ *  @fn session_end()
+ *  @brief releases the session of a device
+ *  @param bd_addr - device address
+ *  @param failed - true puts the device on backoff before it is retried
+ *  @return
+ */
+void session_end(const char *bd_addr, bool failed);
+
+/**
+ *  @fn session_get_state()
+ *  @brief gets the current session state of a device
+ *  @param bd_addr - device address
+ *  @return
+ */
+session_state_t session_get_state(const char *bd_addr);
+
+/**
+ *  @fn session_get_stats()
+ *  @brief gets the discovery suppression metrics
+ *  @param s - filled with the current counters
+ *  @return
+ */
+void session_get_stats(session_stats_t *s);
+
+#endif
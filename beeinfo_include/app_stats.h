@@ -0,0 +1,207 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_stats.h
+ *  @brief per device counters and gauges published in a posix shared
+ *         memory segment, read by tools/beestat without any locking
+ *
+ *  Every counter has a single writer, the notification callback or the
+ *  event loop step of the device, and each writer owns its cache lines,
+ *  so an update is a relaxed load and store with no bus lock. Readers see
+ *  every counter torn free but not a consistent snapshot of the slot.
+ *  A slot belongs to a device address for the whole gateway run, so the
+ *  counters survive reconnections. The sensor command cycle of every device
+ *  is also kept as one latency histogram per phase, gateway wide figures
+ *  are the merge of all of them.
+ */
+
+#ifndef __APP_STATS_H
+#define __APP_STATS_H
+
+/** segment name and layout version, bumped on any layout change */
+#define STATS_SHM_NAME              "/beeinformed_stats"
+#define STATS_MAGIC                 0x54534542
+#define STATS_VERSION               2
+
+/** device slots, devices past it share the last one and its counters
+ *  turn approximate */
+#define STATS_MAX_DEVICES           256
+#define STATS_ADDR_SIZE             18
+
+/** keeps writers of different threads off each other cache lines */
+#define STATS_CACHE_LINE_SIZE       64
+
+/** instrumentation cost allowed on the path of a received packet, in
+ *  nanoseconds, the stats_rx_packet bench fails past it */
+#define STATS_BUDGET_NS             10
+
+/** phases of a sensor command cycle, back to back, the cycle spans them */
+typedef enum {
+    k_lat_write = 0,
+    k_lat_first,
+    k_lat_reassembly,
+    k_lat_persist,
+    k_lat_cycle,
+    k_lat_phases,
+}stats_lat_t;
+
+/** counters of one device */
+typedef struct {
+    /* notification callback */
+    _Atomic uint64_t rx_packets __attribute__((aligned(STATS_CACHE_LINE_SIZE)));
+    _Atomic uint64_t rx_bytes;
+    _Atomic uint64_t rx_drops;
+
+    /* event loop step */
+    _Atomic uint64_t tx_writes __attribute__((aligned(STATS_CACHE_LINE_SIZE)));
+    _Atomic uint64_t tx_bytes;
+    _Atomic uint64_t readings;
+    _Atomic uint64_t timeouts;
+    _Atomic uint64_t connects;
+    _Atomic uint64_t rtt_last_us;
+    _Atomic uint64_t rtt_min_us;
+    _Atomic uint64_t rtt_max_us;
+    _Atomic uint64_t rtt_sum_us;
+    _Atomic uint64_t connected;
+    _Atomic uint64_t state;
+
+    /* event loop step, command write acked, first notification arrived,
+     * last fragment copied and reading stored */
+    app_hist_t lat[k_lat_phases] __attribute__((aligned(STATS_CACHE_LINE_SIZE)));
+
+    /* set once when the slot is claimed */
+    _Atomic uint32_t in_use __attribute__((aligned(STATS_CACHE_LINE_SIZE)));
+    char bd_addr[STATS_ADDR_SIZE];
+}stats_dev_t;
+
+/** segment layout, the magic is stored last so a reader never sees a
+ *  half initialized header */
+typedef struct {
+    _Atomic uint32_t magic;
+    uint32_t version;
+    uint32_t max_devices;
+    uint32_t dev_size;
+    int32_t pid;
+    uint64_t start_us;
+    _Atomic uint32_t devices;
+    _Atomic uint64_t scans;
+    _Atomic uint64_t discoveries;
+    stats_dev_t dev[STATS_MAX_DEVICES] __attribute__((aligned(STATS_CACHE_LINE_SIZE)));
+}stats_shm_t;
+
+
+/**
+ *  @fn stats_add()
+ *  @brief adds to a counter, only its owning thread may call it
+ *  @param c - counter
+ *  @param n - amount
+ *  @return
+ */
+static inline void stats_add(_Atomic uint64_t *c, uint64_t n)
+{
+    atomic_store_explicit(c, atomic_load_explicit(c, memory_order_relaxed) + n, memory_order_relaxed);
+}
+
+/**
+ *  @fn stats_set()
+ *  @brief sets a gauge, only its owning thread may call it
+ *  @param c - gauge
+ *  @param v - value
+ *  @return
+ */
+static inline void stats_set(_Atomic uint64_t *c, uint64_t v)
+{
+    atomic_store_explicit(c, v, memory_order_relaxed);
+}
+
+/**
+ *  @fn app_stats_start()
+ *  @brief creates the shared segment, counters are kept in private memory
+ *         if it can not be created so the gateway runs regardless
+ *  @param
+ *  @return 0 on success, -1 if nothing will be published
+ */
+int app_stats_start(void);
+
+/**
+ *  @fn app_stats_finish()
+ *  @brief removes the shared segment
+ *  @param
+ *  @return
+ */
+void app_stats_finish(void);
+
+/**
+ *  @fn app_stats_device()
+ *  @brief gets the slot of a device, claiming one on its first session
+ *  @param bd_addr - device address
+ *  @return the slot, never NULL
+ */
+stats_dev_t *app_stats_device(const char *bd_addr);
+
+/**
+ *  @fn app_stats_gateway()
+ *  @brief gets the segment header for the gateway wide counters
+ *  @param
+ *  @return the header, never NULL
+ */
+stats_shm_t *app_stats_gateway(void);
+
+/**
+ *  @fn app_stats_rtt()
+ *  @brief records a command round trip, event loop step only
+ *  @param d - device slot
+ *  @param us - round trip time
+ *  @return
+ */
+static inline void app_stats_rtt(stats_dev_t *d, uint64_t us)
+{
+    uint64_t min = atomic_load_explicit(&d->rtt_min_us, memory_order_relaxed);
+
+    stats_set(&d->rtt_last_us, us);
+    stats_add(&d->rtt_sum_us, us);
+    stats_add(&d->readings, 1);
+    if(!min || us < min) {
+        stats_set(&d->rtt_min_us, us);
+    }
+    if(us > atomic_load_explicit(&d->rtt_max_us, memory_order_relaxed)) {
+        stats_set(&d->rtt_max_us, us);
+    }
+}
+
+/**
+ *  @fn stats_lat_name()
+ *  @brief name of a cycle phase
+ *  @param phase - stats_lat_t
+ *  @return
+ */
+static inline const char *stats_lat_name(uint32_t phase)
+{
+    static const char *names[] = { "write", "first", "reassembly", "persist", "cycle" };
+
+    return((phase < k_lat_phases) ? names[phase] : "?");
+}
+
+/**
+ *  @fn stats_latency()
+ *  @brief merges the histograms of a phase, any thread or process may
+ *         call it on a mapped segment
+ *  @param s - segment
+ *  @param phase - stats_lat_t
+ *  @param bd_addr - device, NULL for the whole gateway
+ *  @param snap - result, zeroed here
+ *  @return
+ */
+static inline void stats_latency(const stats_shm_t *s, uint32_t phase, const char *bd_addr,
+    app_hist_snap_t *snap)
+{
+    uint32_t n = atomic_load_explicit((_Atomic uint32_t *)&s->devices, memory_order_acquire);
+
+    memset(snap, 0, sizeof(*snap));
+    for(uint32_t i = 0; i < n && i < STATS_MAX_DEVICES; i++) {
+        if(bd_addr == NULL || !strncmp(s->dev[i].bd_addr, bd_addr, STATS_ADDR_SIZE - 1)) {
+            app_hist_merge(snap, &s->dev[i].lat[phase]);
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,80 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_timer.h
+ *  @brief beeinformed gateway wide hierarchical timer wheel
+ */
+
+#ifndef __APP_TIMER_H
+#define __APP_TIMER_H
+
+/** wheel resolution in microseconds */
+#define APP_TIMER_TICK_US       1000
+
+/** wheel geometry, 4 levels of 64 slots cover about 4.6 hours of ticks */
+#define APP_TIMER_LEVELS        4
+#define APP_TIMER_SLOT_BITS     6
+#define APP_TIMER_SLOTS         (1 << APP_TIMER_SLOT_BITS)
+#define APP_TIMER_SLOT_MASK     (APP_TIMER_SLOTS - 1)
+
+/** handler executed when a timer expires, runs with the wheel locked */
+typedef void (*app_timer_handler_t)(void *arg);
+
+/** timer structure, meant to be embedded on its owner */
+typedef struct app_timer_s {
+    k_list_t link;
+    uint64_t expires;
+    app_timer_handler_t handler;
+    void *arg;
+    bool pending;
+} app_timer_t;
+
+
+/**
+ *  @fn app_timer_start()
+ *  @brief creates the timer wheel and hooks it on the event loop
+ *  @param
+ *  @return 0 on success, -1 on failure
+ */
+int app_timer_start(void);
+
+/**
+ *  @fn app_timer_finish()
+ *  @brief detaches the timer wheel from the event loop
+ *  @param
+ *  @return
+ */
+void app_timer_finish(void);
+
+/**
+ *  @fn app_timer_init()
+ *  @brief initializes a timer, it starts disarmed
+ *  @param t - timer to initialize
+ *  @param handler - function called on expiration
+ *  @param arg - argument passed to handler
+ *  @return
+ */
+void app_timer_init(app_timer_t *t, app_timer_handler_t handler, void *arg);
+
+/**
+ *  @fn app_timer_arm()
+ *  @brief arms or rearms a timer, O(1)
+ *
+ *  Handlers run with the wheel locked, so they must not arm or cancel
+ *  timers themselves; in exchange, once app_timer_cancel() returns the
+ *  handler is guaranteed not to be running nor to run later.
+ *
+ *  @param t - timer to arm
+ *  @param usec - time from now to expiration in microseconds
+ *  @return
+ */
+void app_timer_arm(app_timer_t *t, uint32_t usec);
+
+/**
+ *  @fn app_timer_cancel()
+ *  @brief disarms a timer, O(1), does nothing if it is not pending
+ *  @param t - timer to cancel
+ *  @return
+ */
+void app_timer_cancel(app_timer_t *t);
+
+#endif
@@ -0,0 +1,57 @@
+/**
+ *          THE BeeInformed Team
+ *  @file app_trace.h
+ *  @brief optional export of every sensor command cycle as a chrome trace
+ *         json file, to be opened in chrome://tracing or ui.perfetto.dev
+ *
+ *  Each device is a track and each cycle a span holding one span per
+ *  phase. Nothing is written unless app_trace_start() succeeded, the cost
+ *  for the event loop is then one formatted write per phase.
+ */
+
+#ifndef __APP_TRACE_H
+#define __APP_TRACE_H
+
+/** cycles past it are not written, keeps a forgotten trace bounded */
+#define TRACE_MAX_CYCLES            (256 * 1024)
+
+/** tracks with a name, device slots past it share the last track */
+#define TRACE_MAX_TRACKS            256
+
+
+/**
+ *  @fn app_trace_start()
+ *  @brief creates the trace file, cycles are written from then on
+ *  @param path - json file
+ *  @return 0 on success, -1 on failure
+ */
+int app_trace_start(const char *path);
+
+/**
+ *  @fn app_trace_finish()
+ *  @brief terminates the json and closes the file
+ *  @param
+ *  @return
+ */
+void app_trace_finish(void);
+
+/**
+ *  @fn app_trace_enabled()
+ *  @brief tells whether cycles are being traced
+ *  @param
+ *  @return
+ */
+bool app_trace_enabled(void);
+
+/**
+ *  @fn app_trace_cycle()
+ *  @brief writes one sensor command cycle
+ *  @param track - track of the device, its stats slot
+ *  @param bd_addr - device address, names the track
+ *  @param t - monotonic ns the cycle started and each of its phases
+ *             ended, k_lat_cycle + 1 of them
+ *  @return
+ */
+void app_trace_cycle(uint32_t track, const char *bd_addr, const uint64_t *t);
+
+#endif
@@ -16,10 +16,14 @@
 
  #define MAX_NAME_SIZE 		128
 
+/* paths made of a root and up to two directory entries below it */
+ #define MAX_PATH_SIZE 		(MAX_NAME_SIZE + 2 * (NAME_MAX + 1))
+
 /* include standard libc needed files here */
 #include <assert.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <limits.h>
 #include <signal.h>
 #include <stdbool.h>
 #include <unistd.h>
@@ -31,16 +35,46 @@
 #include <sys/socket.h>
 #include <fcntl.h>
 #include <sys/stat.h>
-#include <mqueue.h>
+#include <stdatomic.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <termios.h>
+#include <errno.h>
 #include <k_list.h>
 #include <time.h> 
+#include <sys/syscall.h>
+#include <mqueue.h>
 
 
 /* gattlib to use Bluetooth low energy */
 #include "gattlib.h"
 
 /* include subapps here */
+#include "app_log.h"
+#include "app_epoch.h"
+#include "app_devtab.h"
+#include "crc32c.h"
+#include "fnv1a.h"
+#include "app_clock.h"
+#include "app_sched.h"
+#include "app_timer.h"
+#include "app_hist.h"
+#include "app_stats.h"
+#include "app_trace.h"
+#include "app_registry.h"
+#include "app_session.h"
+#include "app_gatt_cache.h"
 #include "app_acq_file.h"
+#include "app_acq_col.h"
+#include "app_acq_store.h"
+#include "app_audio_adpcm.h"
+#include "app_audio_feat.h"
+#include "app_audio_file.h"
 #include "app_ble.h"
 #include "app_gps.h"
 
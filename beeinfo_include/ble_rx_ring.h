@@ -0,0 +1,182 @@
+/**
+ *          THE BeeInformed Team
+ *  @file ble_rx_ring.h
+ *  @brief lock-free single producer / single consumer ring of ble packets
+ *
+ *  The producer is the gattlib notification callback of a device and the
+ *  consumer is whoever runs the acquisition of that same device, so a ring
+ *  must never be shared between two producers or two consumers.
+ */
+
+#ifndef __BLE_RX_RING_H
+#define __BLE_RX_RING_H
+
+/** number of packet slots per device, must be a power of two */
+#define BLE_RX_RING_SLOTS           128
+#define BLE_RX_RING_MASK            (BLE_RX_RING_SLOTS - 1)
+
+/** cache line size used to keep producer and consumer indexes apart */
+#define BLE_CACHE_LINE_SIZE         64
+
+/** bytes of a ble_data_t that come before its payload */
+#define BLE_PACKET_HDR_SIZE         offsetof(ble_data_t, pack_data)
+
+/** ring control structure */
+typedef struct ble_rx_ring_s {
+    /* producer side */
+    _Atomic uint32_t head __attribute__((aligned(BLE_CACHE_LINE_SIZE)));
+    _Atomic uint32_t overflows;
+
+    /* consumer side */
+    _Atomic uint32_t tail __attribute__((aligned(BLE_CACHE_LINE_SIZE)));
+    _Atomic bool waiting;
+    int efd;
+
+    ble_data_t slot[BLE_RX_RING_SLOTS] __attribute__((aligned(BLE_CACHE_LINE_SIZE)));
+} ble_rx_ring_t;
+
+
+/**
+ *  @fn ble_rx_ring_init()
+ *  @brief resets the ring and creates its consumer wakeup eventfd
+ *  @param r - ring to initialize
+ *  @return 0 on success, -1 if the eventfd could not be created
+ */
+static inline int ble_rx_ring_init(ble_rx_ring_t *r)
+{
+    atomic_init(&r->head, 0);
+    atomic_init(&r->tail, 0);
+    atomic_init(&r->overflows, 0);
+    atomic_init(&r->waiting, false);
+    r->efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    return((r->efd < 0) ? -1 : 0);
+}
+
+/**
+ *  @fn ble_rx_ring_deinit()
+ *  @brief releases the ring wakeup eventfd
+ *  @param r - ring to release
+ *  @return N/A
+ */
+static inline void ble_rx_ring_deinit(ble_rx_ring_t *r)
+{
+    if(r->efd >= 0) {
+        close(r->efd);
+        r->efd = -1;
+    }
+}
+
+/**
+ *  @fn ble_rx_ring_wakeup()
+ *  @brief wakes the consumer if it is parked on the eventfd, safe to call
+ *         from any thread
+ *  @param r - ring to signal
+ *  @return N/A
+ */
+static inline void ble_rx_ring_wakeup(ble_rx_ring_t *r)
+{
+    uint64_t one = 1;
+
+    if(atomic_exchange(&r->waiting, false)) {
+        if(write(r->efd, &one, sizeof(one)) < 0) {
+            /* counter saturated means a wakeup is already pending */
+        }
+    }
+}
+
+/**
+ *  @fn ble_rx_ring_push()
+ *  @brief copies a raw notification into the next free slot, producer only
+ *  @param r - ring to push into
+ *  @param data - raw ble_data_t bytes as received
+ *  @param len - number of valid bytes in data
+ *  @return true if stored, false if the ring is full or data is too short
+ */
+static inline bool ble_rx_ring_push(ble_rx_ring_t *r, const uint8_t *data, size_t len)
+{
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_acquire);
+    ble_data_t *slot;
+    size_t payload;
+
+    if(len < BLE_PACKET_HDR_SIZE) {
+        return false;
+    }
+
+    if((head - tail) >= BLE_RX_RING_SLOTS) {
+        atomic_fetch_add_explicit(&r->overflows, 1, memory_order_relaxed);
+        return false;
+    }
+
+    /* copy the header, then only the payload the sender claims to have */
+    slot = &r->slot[head & BLE_RX_RING_MASK];
+    memcpy(slot, data, BLE_PACKET_HDR_SIZE);
+
+    payload = len - BLE_PACKET_HDR_SIZE;
+    if(payload > slot->payload_size) {
+        payload = slot->payload_size;
+    }
+    if(payload > PACKET_MAX_PAYLOAD) {
+        payload = PACKET_MAX_PAYLOAD;
+    }
+    slot->payload_size = (uint8_t)payload;
+    memcpy(slot->pack_data, data + BLE_PACKET_HDR_SIZE, payload);
+
+    atomic_store_explicit(&r->head, head + 1, memory_order_seq_cst);
+    ble_rx_ring_wakeup(r);
+    return true;
+}
+
+/**
+ *  @fn ble_rx_ring_peek()
+ *  @brief gets the oldest packet without copying it, consumer only
+ *  @param r - ring to peek
+ *  @return pointer to the slot, valid until ble_rx_ring_release(), or NULL
+ */
+static inline const ble_data_t *ble_rx_ring_peek(ble_rx_ring_t *r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    uint32_t head = atomic_load_explicit(&r->head, memory_order_acquire);
+
+    return((head == tail) ? NULL : &r->slot[tail & BLE_RX_RING_MASK]);
+}
+
+/**
+ *  @fn ble_rx_ring_release()
+ *  @brief gives the slot returned by ble_rx_ring_peek() back to the producer
+ *  @param r - ring to release the slot into
+ *  @return N/A
+ */
+static inline void ble_rx_ring_release(ble_rx_ring_t *r)
+{
+    uint32_t tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+    atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+}
+
+/**
+ *  @fn ble_rx_ring_arm()
+ *  @brief announces the consumer is about to sleep on the eventfd
+ *  @param r - ring to arm
+ *  @return true if it is safe to sleep, false if a packet raced in
+ */
+static inline bool ble_rx_ring_arm(ble_rx_ring_t *r)
+{
+    uint64_t cnt;
+
+    /* drop stale wakeups so the next poll really blocks */
+    if(read(r->efd, &cnt, sizeof(cnt)) < 0) {
+        /* nothing pending */
+    }
+
+    /* store then load, only a full fence keeps the head load from going
+     * ahead of the store and missing a push that saw waiting still false */
+    atomic_store_explicit(&r->waiting, true, memory_order_seq_cst);
+    atomic_thread_fence(memory_order_seq_cst);
+    if(ble_rx_ring_peek(r) != NULL) {
+        atomic_store_explicit(&r->waiting, false, memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+#endif
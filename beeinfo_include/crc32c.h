@@ -0,0 +1,29 @@
+/**
+ *          THE BeeInformed Team
+ *  @file crc32c.h
+ *  @brief CRC32C (Castagnoli) used to frame everything the gateway persists
+ */
+
+#ifndef __CRC32C_H
+#define __CRC32C_H
+
+/**
+ *  @fn crc32c()
+ *  @brief computes or extends a CRC32C, using the cpu crc instructions
+ *         when present (SSE4.2 on x86, CRC extension on ARMv8)
+ *  @param crc - 0 to start, or the result of a previous call to extend it
+ *  @param buf - data
+ *  @param size - data size in bytes
+ *  @return
+ */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t size);
+
+/**
+ *  @fn crc32c_impl_name()
+ *  @brief name of the implementation in use
+ *  @param
+ *  @return
+ */
+const char *crc32c_impl_name(void);
+
+#endif
@@ -0,0 +1,50 @@
+/**
+ *          THE BeeInformed Team
+ *  @file fnv1a.h
+ *  @brief FNV-1a, the hash of the in memory indexes keyed by device address
+ */
+
+#ifndef __FNV1A_H
+#define __FNV1A_H
+
+/** offset basis, the hash of nothing */
+#define FNV1A_INIT              2166136261u
+#define FNV1A_PRIME             16777619u
+
+/**
+ *  @fn fnv1a()
+ *  @brief computes or extends a FNV-1a over a buffer
+ *  @param h - FNV1A_INIT to start, or the result of a previous call to extend it
+ *  @param data - data
+ *  @param size - data size in bytes
+ *  @return
+ */
+static inline uint32_t fnv1a(uint32_t h, const void *data, size_t size)
+{
+    const uint8_t *p = data;
+
+    while(size--) {
+        h ^= *p++;
+        h *= FNV1A_PRIME;
+    }
+    return(h);
+}
+
+/**
+ *  @fn fnv1a_str()
+ *  @brief FNV-1a of a string, a device address mostly
+ *  @param s - string
+ *  @return
+ */
+static inline uint32_t fnv1a_str(const char *s)
+{
+    uint32_t h = FNV1A_INIT;
+
+    while(*s) {
+        h ^= (uint8_t)*s++;
+        h *= FNV1A_PRIME;
+    }
+    return(h);
+}
+
+#endif
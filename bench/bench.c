@@ -0,0 +1,1611 @@
+/**
+ *          THE BeeInformed Team
+ *  @file bench.c
+ *  @brief microbenchmarks of the gateway hot paths, built against the
+ *         gateway sources but the ble and gps managers, which need a radio
+ *
+ *  usage: bench.out [-w warmup ms] [-t batch ms] [-r repeats] [-n iterations]
+ *                   [-c cpu] [-g nmea log] [-a acq file] [-j] [-l] [name ...]
+ *
+ *  Each benchmark is warmed up, its batch size calibrated so a batch lasts
+ *  about the batch time, then timed over a number of batches. The median
+ *  of the batches is the figure to track, min and max tell how noisy the
+ *  box was. -j prints one json object per line, meant to be stored per
+ *  build and compared by a script, names filter by prefix. -g replays a
+ *  recorded NMEA log through the gps parser instead of the epoch below,
+ *  -a the readings of a recorded beedata.dat through the columnar codec
+ *  instead of synthetic ones.
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include "beeinformed_gateway.h"
+#include <sys/utsname.h>
+#include <sys/resource.h>
+#include <math.h>
+
+
+/** defaults of the command line */
+#define BENCH_WARMUP_MS             200
+#define BENCH_BATCH_MS              50
+#define BENCH_REPEATS               9
+#define BENCH_MAX_REPEATS           101
+
+/** sizes the benchmarks work on, close to a busy apiary */
+#define BENCH_DEVICES               64
+#define BENCH_FRAG_SIZE             4
+#define BENCH_ACQ_RECORDS           (64 * 1024)
+#define BENCH_ACQ_SCAN              3600
+#define BENCH_REGISTRY              (BENCH_DEVICES * 4)
+
+/** appends per batch, keeps the scratch files in the tens of MB */
+#define BENCH_ACQ_BATCH             (128 * 1024)
+
+/** raw blocks of the file recovered at startup, the most a live file
+ *  holds before it rotates, 16 readings a second keep them in one day */
+#define BENCH_RECOVER_BLOCKS        (ACQ_SEGMENT_MAX_SIZE / ACQ_BLOCK_SIZE(ACQ_BLOCK_RECORDS))
+#define BENCH_RECOVER_RATE          16
+#define BENCH_RECOVER_DIR           "hive"
+
+/** raw bytes a reading takes on disk, what the columnar codec is held to */
+#define BENCH_ACQ_RAW_RECORD        ((double)ACQ_BLOCK_SIZE(ACQ_BLOCK_RECORDS) / ACQ_BLOCK_RECORDS)
+
+/** synthetic hive audio the codec and analysis benchmarks cycle through,
+ *  about a second of it in whole compressed frames */
+#define BENCH_AUDIO_FRAMES          16
+#define BENCH_AUDIO_SAMPLES         (BENCH_AUDIO_FRAMES * AUDIO_ADPCM_FRAME_SAMPLES)
+
+/** an epoch as a u-blox receiver sends it once a second, the parser
+ *  takes GGA, RMC and GSA and skips the rest */
+#define BENCH_NMEA_EPOCH                                                            \
+    "$GPRMC,083559.00,A,2332.44281,S,04638.36120,W,0.004,,170826,,,A*77\r\n"       \
+    "$GPVTG,,T,,M,0.004,N,0.007,K,A*20\r\n"                                         \
+    "$GPGGA,083559.00,2332.44281,S,04638.36120,W,1,08,1.01,762.3,M,-5.8,M,,*4D\r\n" \
+    "$GPGSA,A,3,10,32,24,12,25,15,18,14,,,,,1.86,1.01,1.56*05\r\n"                  \
+    "$GPGSV,3,1,11,10,63,137,17,12,42,286,25,14,13,121,23,15,22,321,27*77\r\n"      \
+    "$GPGSV,3,2,11,18,48,030,31,24,53,237,32,25,19,186,29,29,01,052,*7D\r\n"        \
+    "$GPGSV,3,3,11,31,05,344,,32,31,098,26,46,37,305,*4B\r\n"                       \
+    "$GPGLL,2332.44281,S,04638.36120,W,083559.00,A,A*60\r\n"
+
+/** log calls per batch, they fit half of the thread buffer so none is
+ *  dropped nor wakes the drainer while timed */
+#define BENCH_LOG_BURST             256
+
+/** pending timers of the timer wheel benchmarks */
+#define BENCH_TIMERS_1K             1000
+#define BENCH_TIMERS_10K            10000
+
+/** devices of the bigger event loop and thread per device rounds */
+#define BENCH_SCHED_DEVICES         1024
+#define BENCH_SCHED_STACK_SIZE      (64 * 1024)
+
+/** one benchmark, run() performs iters operations, max_iters caps a batch
+ *  of those that grow a file, a median past budget_ns fails the run and
+ *  settle(), untimed, runs before every batch */
+typedef struct {
+    const char *name;
+    const char *op;
+    uint64_t max_iters;
+    void *(*setup)(void);
+    void (*run)(void *ctx, uint64_t iters);
+    void (*teardown)(void *ctx);
+    uint32_t budget_ns;
+    void (*settle)(void *ctx);
+}bench_t;
+
+/** result of one benchmark, nanoseconds and context switches per operation */
+typedef struct {
+    double median;
+    double min;
+    double max;
+    double csw;
+    uint64_t iters;
+    uint32_t repeats;
+    double bytes;
+}bench_result_t;
+
+/** startup recovery of a file, its index torn or lost before each one */
+typedef struct {
+    char dir[MAX_NAME_SIZE];
+    char idx_path[MAX_PATH_SIZE];
+    bool lost;
+}bench_recover_t;
+
+/** readings as columnar blocks, encoded once for the decoder */
+typedef struct {
+    acq_record_t *rec;
+    size_t count;
+    uint8_t *enc;
+    size_t *off;
+    size_t blocks;
+    acq_record_t dec[ACQ_BLOCK_RECORDS];
+}bench_col_t;
+
+/** hive audio and its compressed frames */
+typedef struct {
+    int16_t pcm[BENCH_AUDIO_SAMPLES];
+    uint8_t enc[BENCH_AUDIO_FRAMES * AUDIO_ADPCM_FRAME_SIZE];
+    audio_adpcm_state_t st;
+}bench_audio_t;
+
+/** spectral analysis of hive audio, with the kernel in use before */
+typedef struct {
+    audio_feat_t *feat;
+    const char *impl;
+    int16_t pcm[BENCH_AUDIO_SAMPLES];
+}bench_feat_t;
+
+/** NMEA sentences of a log, pointing into it */
+typedef struct {
+    char *log;
+    const char **s;
+    size_t *len;
+    size_t count;
+    gps_nmea_t nmea;
+}bench_nmea_t;
+
+/** dlist benchmark node */
+typedef struct {
+    uint32_t value;
+    k_list_t link;
+}bench_node_t;
+
+/** device of the sched benchmarks, woken through its eventfd either by
+ *  the event loop or by its own thread blocked on it */
+typedef struct {
+    sched_source_t src;
+    pthread_t thread;
+    struct bench_sched_s *sched;
+}bench_sched_dev_t;
+
+/** timer wheel benchmark, the timers stay pending during the batches */
+typedef struct {
+    app_timer_t *timers;
+    uint32_t count;
+    uint32_t seed;
+}bench_timer_t;
+
+/** sched benchmark, an operation wakes batch devices and waits until the
+ *  last of them signals done */
+typedef struct bench_sched_s {
+    bench_sched_dev_t *devs;
+    uint32_t count;
+    uint32_t batch;
+    uint32_t next;
+    bool threads;
+    _Atomic bool stop;
+    _Atomic uint32_t left;
+    int done;
+}bench_sched_t;
+
+
+/** static variables */
+static uint32_t bench_warmup_ms = BENCH_WARMUP_MS;
+static uint32_t bench_batch_ms = BENCH_BATCH_MS;
+static uint32_t bench_repeats = BENCH_REPEATS;
+static uint64_t bench_iters = 0;
+static bool bench_json = false;
+static const char *bench_nmea_log = NULL;
+static const char *bench_acq_log = NULL;
+
+/* bytes an operation leaves on disk, set by the setup of codec benchmarks */
+static double bench_bytes;
+static char bench_dir[] = "/tmp/beebench.XXXXXX";
+
+/* results are folded here so the compiler keeps the work */
+static volatile uint64_t bench_sink;
+
+
+/** static functions */
+
+/**
+ *  @fn bench_now_ns()
+ *  @brief monotonic time in nanoseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ *  @fn bench_rand()
+ *  @brief xorshift, cheap and the same sequence on every run
+ *  @param
+ *  @return
+ */
+static inline uint32_t bench_rand(uint32_t *state)
+{
+    uint32_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return(x);
+}
+
+/**
+ *  @fn bench_path()
+ *  @brief path of a file in the scratch directory
+ *  @param
+ *  @return
+ */
+static const char *bench_path(char *buf, size_t size, const char *name)
+{
+    snprintf(buf, size, "%s/%s", bench_dir, name);
+    return(buf);
+}
+
+/**
+ *  @fn bench_quiet()
+ *  @brief keeps what the modules print while opening and closing files
+ *         out of the results
+ *  @param quiet - true to silence stdout, false to restore it
+ *  @return
+ */
+static void bench_quiet(bool quiet)
+{
+    static int saved = -1;
+    int fd;
+
+    fflush(stdout);
+    if(quiet && saved < 0) {
+        saved = dup(STDOUT_FILENO);
+        fd = open("/dev/null", O_WRONLY);
+        if(fd >= 0) {
+            dup2(fd, STDOUT_FILENO);
+            close(fd);
+        }
+    } else if(!quiet && saved >= 0) {
+        dup2(saved, STDOUT_FILENO);
+        close(saved);
+        saved = -1;
+    }
+}
+
+/**
+ *  @fn bench_device_new()
+ *  @brief a device handle with its ring and a private stats slot, as the
+ *         connection manager would leave it
+ *  @param
+ *  @return
+ */
+static ble_device_handle_t *bench_device_new(void)
+{
+    static stats_dev_t stats;
+    ble_device_handle_t *h;
+
+    h = aligned_alloc(BLE_CACHE_LINE_SIZE, (sizeof(*h) + BLE_CACHE_LINE_SIZE - 1) & ~(BLE_CACHE_LINE_SIZE - 1));
+    assert(h != NULL);
+    memset(h, 0, sizeof(*h));
+    if(ble_rx_ring_init(&h->rx) < 0) {
+        abort();
+    }
+    strcpy(h->bd_addr, "B0:EE:00:00:00:00");
+    h->stats = &stats;
+    return(h);
+}
+
+/**
+ *  @fn bench_device_free()
+ *  @brief
+ *  @param
+ *  @return
+ */
+static void bench_device_free(void *ctx)
+{
+    ble_device_handle_t *h = ctx;
+
+    ble_rx_ring_deinit(&h->rx);
+    free(h);
+}
+
+
+/* notification ingest, one packet through the gattlib callback body */
+static void bench_rx_ingest(void *ctx, uint64_t iters)
+{
+    ble_device_handle_t *h = ctx;
+    ble_data_t pkt = { .type = k_data_packet, .pack_amount = 1, .payload_size = PACKET_MAX_PAYLOAD };
+
+    for(uint64_t i = 0; i < iters; i++) {
+        /* the consumer keeps up, as the event loop does */
+        if((i & (BLE_RX_RING_SLOTS / 2 - 1)) == 0) {
+            atomic_store_explicit(&h->rx.tail, atomic_load_explicit(&h->rx.head, memory_order_relaxed),
+                memory_order_release);
+        }
+        pkt.id = (uint8_t)i;
+        ble_device_ingest(h, (const uint8_t *)&pkt, sizeof(pkt));
+    }
+    bench_sink += atomic_load(&h->stats->rx_packets);
+}
+
+/* counters of a received packet, what the stats add to the ingest above,
+ * held to STATS_BUDGET_NS */
+static void bench_stats_packet(void *ctx, uint64_t iters)
+{
+    ble_device_handle_t *h = ctx;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        stats_add(&h->stats->rx_packets, 1);
+        stats_add(&h->stats->rx_bytes, sizeof(ble_data_t));
+    }
+    bench_sink += atomic_load(&h->stats->rx_bytes);
+}
+
+/* fragment reassembly, one sensors answer out of the ring into data_env,
+ * the fragments are pushed once and replayed by rewinding the tail */
+static void *bench_reassembly_setup(void)
+{
+    ble_device_handle_t *h = bench_device_new();
+    uint32_t frags = sizeof(h->data_env) / BENCH_FRAG_SIZE;
+    ble_data_t pkt = { .type = k_data_packet, .pack_amount = (uint8_t)frags, .payload_size = BENCH_FRAG_SIZE };
+
+    for(uint32_t i = 0; i < frags; i++) {
+        pkt.id = (uint8_t)i;
+        memset(pkt.pack_data, i, BENCH_FRAG_SIZE);
+        ble_rx_ring_push(&h->rx, (const uint8_t *)&pkt, BLE_PACKET_HDR_SIZE + BENCH_FRAG_SIZE);
+    }
+    return(h);
+}
+
+static void bench_reassembly(void *ctx, uint64_t iters)
+{
+    ble_device_handle_t *h = ctx;
+    ble_data_t bad;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        atomic_store_explicit(&h->rx.tail, 0, memory_order_relaxed);
+        h->rx_offset = 0;
+        h->rx_pending = 0;
+        h->rx_started = false;
+        if(ble_device_reassemble(h, &bad) != k_rx_asm_done) {
+            abort();
+        }
+    }
+    bench_sink += h->data_env.humidity;
+}
+
+/* device wakeups, the event loop against the thread per device it
+ * replaced, one device at a time for the latency and all of them at once
+ * for a busy apiary */
+static void bench_sched_complete(bench_sched_t *s)
+{
+    if(atomic_fetch_sub_explicit(&s->left, 1, memory_order_acq_rel) == 1) {
+        eventfd_write(s->done, 1);
+    }
+}
+
+static void bench_sched_handler(void *arg)
+{
+    bench_sched_dev_t *d = arg;
+    eventfd_t v;
+
+    eventfd_read(d->src.fd, &v);
+    bench_sched_complete(d->sched);
+    sched_rearm(&d->src);
+}
+
+static void *bench_sched_thread(void *arg)
+{
+    bench_sched_dev_t *d = arg;
+    eventfd_t v;
+
+    while(!eventfd_read(d->src.fd, &v) && !atomic_load(&d->sched->stop)) {
+        bench_sched_complete(d->sched);
+    }
+    return(NULL);
+}
+
+static void *bench_sched_setup(uint32_t count, uint32_t batch, bool threads)
+{
+    bench_sched_t *s = calloc(1, sizeof(*s));
+    pthread_attr_t attr;
+
+    assert(s != NULL);
+    s->devs = calloc(count, sizeof(*s->devs));
+    assert(s->devs != NULL);
+    s->count = count;
+    s->batch = batch;
+    s->threads = threads;
+    s->done = eventfd(0, EFD_CLOEXEC);
+    assert(s->done >= 0);
+
+    /* the event loop gets its default, one worker per core */
+    if(!threads && sched_start(0) < 0) {
+        abort();
+    }
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, BENCH_SCHED_STACK_SIZE);
+
+    for(uint32_t i = 0; i < count; i++) {
+        bench_sched_dev_t *d = &s->devs[i];
+
+        d->sched = s;
+        d->src.fd = eventfd(0, EFD_CLOEXEC | ((threads) ? 0 : EFD_NONBLOCK));
+        d->src.handler = bench_sched_handler;
+        d->src.arg = d;
+        assert(d->src.fd >= 0);
+        if((threads) ? pthread_create(&d->thread, &attr, bench_sched_thread, d) : sched_add(&d->src)) {
+            abort();
+        }
+    }
+    pthread_attr_destroy(&attr);
+    return(s);
+}
+
+static void *bench_sched_loop_wake_setup(void)
+{
+    return(bench_sched_setup(BENCH_DEVICES, 1, false));
+}
+
+static void *bench_sched_thread_wake_setup(void)
+{
+    return(bench_sched_setup(BENCH_DEVICES, 1, true));
+}
+
+static void *bench_sched_loop_round_setup(void)
+{
+    return(bench_sched_setup(BENCH_DEVICES, BENCH_DEVICES, false));
+}
+
+static void *bench_sched_thread_round_setup(void)
+{
+    return(bench_sched_setup(BENCH_DEVICES, BENCH_DEVICES, true));
+}
+
+static void *bench_sched_loop_round1k_setup(void)
+{
+    return(bench_sched_setup(BENCH_SCHED_DEVICES, BENCH_SCHED_DEVICES, false));
+}
+
+static void *bench_sched_thread_round1k_setup(void)
+{
+    return(bench_sched_setup(BENCH_SCHED_DEVICES, BENCH_SCHED_DEVICES, true));
+}
+
+static void bench_sched(void *ctx, uint64_t iters)
+{
+    bench_sched_t *s = ctx;
+    eventfd_t v;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        atomic_store_explicit(&s->left, s->batch, memory_order_relaxed);
+        for(uint32_t j = 0; j < s->batch; j++) {
+            eventfd_write(s->devs[s->next].src.fd, 1);
+            s->next = (s->next + 1) % s->count;
+        }
+        eventfd_read(s->done, &v);
+    }
+}
+
+static void bench_sched_teardown(void *ctx)
+{
+    bench_sched_t *s = ctx;
+
+    if(s->threads) {
+        atomic_store(&s->stop, true);
+        for(uint32_t i = 0; i < s->count; i++) {
+            eventfd_write(s->devs[i].src.fd, 1);
+            pthread_join(s->devs[i].thread, NULL);
+        }
+    } else {
+        for(uint32_t i = 0; i < s->count; i++) {
+            sched_remove(&s->devs[i].src);
+        }
+        sched_finish();
+    }
+
+    for(uint32_t i = 0; i < s->count; i++) {
+        close(s->devs[i].src.fd);
+    }
+    close(s->done);
+    free(s->devs);
+    free(s);
+}
+
+/* timer wheel, a device rearming its timeout on a fragment and another
+ * one cancelling it, among 1k and 10k pending timeouts */
+static void bench_timer_expired(void *arg)
+{
+    (void)arg;
+    bench_sink++;
+}
+
+static uint32_t bench_timer_usec(uint32_t *seed)
+{
+    /* from the acquisition period to a slow communication timeout */
+    return(100000 + bench_rand(seed) % 10000000);
+}
+
+static void *bench_timer_setup(uint32_t count)
+{
+    bench_timer_t *t = calloc(1, sizeof(*t));
+
+    assert(t != NULL);
+    t->timers = calloc(count, sizeof(*t->timers));
+    assert(t->timers != NULL);
+    t->count = count;
+    t->seed = 2463534242u;
+
+    if(sched_start(1) < 0 || app_timer_start() < 0) {
+        abort();
+    }
+    for(uint32_t i = 0; i < count; i++) {
+        app_timer_init(&t->timers[i], bench_timer_expired, NULL);
+        app_timer_arm(&t->timers[i], bench_timer_usec(&t->seed));
+    }
+    return(t);
+}
+
+static void *bench_timer_1k_setup(void)
+{
+    return(bench_timer_setup(BENCH_TIMERS_1K));
+}
+
+static void *bench_timer_10k_setup(void)
+{
+    return(bench_timer_setup(BENCH_TIMERS_10K));
+}
+
+static void bench_timer_arm_cancel(void *ctx, uint64_t iters)
+{
+    bench_timer_t *t = ctx;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        app_timer_cancel(&t->timers[bench_rand(&t->seed) % t->count]);
+        app_timer_arm(&t->timers[bench_rand(&t->seed) % t->count], bench_timer_usec(&t->seed));
+    }
+}
+
+static void bench_timer_teardown(void *ctx)
+{
+    bench_timer_t *t = ctx;
+
+    for(uint32_t i = 0; i < t->count; i++) {
+        app_timer_cancel(&t->timers[i]);
+    }
+    app_timer_finish();
+    sched_finish();
+    free(t->timers);
+    free(t);
+}
+
+/* dlist, the device list of the connection manager */
+static void *bench_dlist_setup(void)
+{
+    k_list_t *list = malloc(sizeof(*list) + BENCH_DEVICES * sizeof(bench_node_t));
+    bench_node_t *nodes = (bench_node_t *)(list + 1);
+
+    assert(list != NULL);
+    sys_dlist_init(list);
+    for(uint32_t i = 0; i < BENCH_DEVICES; i++) {
+        nodes[i].value = i;
+        sys_dlist_append(list, &nodes[i].link);
+    }
+    return(list);
+}
+
+static void bench_dlist_rotate(void *ctx, uint64_t iters)
+{
+    k_list_t *list = ctx;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        sys_dlist_append(list, sys_dlist_get(list));
+    }
+    bench_sink += CONTAINER_OF(sys_dlist_peek_head(list), bench_node_t, link)->value;
+}
+
+static void bench_dlist_remove_insert(void *ctx, uint64_t iters)
+{
+    k_list_t *list = ctx;
+    bench_node_t *nodes = (bench_node_t *)(list + 1);
+    uint32_t seed = 2463534242u;
+
+    /* a device leaving and another one joining mid list */
+    for(uint64_t i = 0; i < iters; i++) {
+        bench_node_t *n = &nodes[bench_rand(&seed) % BENCH_DEVICES];
+        bench_node_t *at = &nodes[bench_rand(&seed) % BENCH_DEVICES];
+
+        if(n == at) {
+            continue;
+        }
+        sys_dlist_remove(&n->link);
+        sys_dlist_insert_before(list, &at->link, &n->link);
+    }
+    bench_sink += CONTAINER_OF(sys_dlist_peek_tail(list), bench_node_t, link)->value;
+}
+
+static void bench_dlist_walk(void *ctx, uint64_t iters)
+{
+    k_list_t *list = ctx;
+    bench_node_t *n;
+    uint64_t sum = 0;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        SYS_DLIST_FOR_EACH_CONTAINER(list, n, link) {
+            sum += n->value;
+        }
+    }
+    bench_sink += sum;
+}
+
+/* device table, the walk of the downstream fan out, inside an epoch
+ * section and under the mutex it replaced */
+static void *bench_devtab_setup(void)
+{
+    devtab_t *t = malloc(sizeof(*t) + BENCH_DEVICES * sizeof(bench_node_t));
+    bench_node_t *nodes = (bench_node_t *)(t + 1);
+
+    assert(t != NULL);
+    *t = (devtab_t)DEVTAB_STATIC_INIT;
+    for(uint32_t i = 0; i < BENCH_DEVICES; i++) {
+        nodes[i].value = i;
+        devtab_insert(t, &nodes[i]);
+    }
+    return(t);
+}
+
+static void bench_epoch_section(void *ctx, uint64_t iters)
+{
+    (void)ctx;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        epoch_enter();
+        epoch_exit();
+    }
+}
+
+static void bench_devtab_walk(void *ctx, uint64_t iters)
+{
+    devtab_t *t = ctx;
+    bench_node_t *n;
+    uint64_t sum = 0;
+    uint32_t j;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        epoch_enter();
+        DEVTAB_FOR_EACH(t, j, n) {
+            sum += n->value;
+        }
+        epoch_exit();
+    }
+    bench_sink += sum;
+}
+
+static void bench_devtab_walk_mutex(void *ctx, uint64_t iters)
+{
+    devtab_t *t = ctx;
+    bench_node_t *n;
+    uint64_t sum = 0;
+    uint32_t j;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        pthread_mutex_lock(&t->mutex);
+        DEVTAB_FOR_EACH(t, j, n) {
+            sum += n->value;
+        }
+        pthread_mutex_unlock(&t->mutex);
+    }
+    bench_sink += sum;
+}
+
+/* acquisition file append, the cost the event loop pays per reading */
+static void *bench_acq_append_setup(acq_file_format_t format)
+{
+    char path[MAX_NAME_SIZE];
+    acq_file_t *f;
+
+    f = acq_file_open(bench_path(path, sizeof(path), (format == k_acq_format_raw) ? "raw.acq" : "col.acq"),
+        format);
+    assert(f != NULL);
+    return(f);
+}
+
+static void *bench_acq_append_raw_setup(void)
+{
+    return(bench_acq_append_setup(k_acq_format_raw));
+}
+
+static void *bench_acq_append_col_setup(void)
+{
+    return(bench_acq_append_setup(k_acq_format_columnar));
+}
+
+static void bench_acq_append(void *ctx, uint64_t iters)
+{
+    static uint32_t timestamp = 1;
+    acq_file_t *f = ctx;
+    acqui_st_t v;
+
+    for(uint64_t i = 0; i < iters; i++, timestamp++) {
+        v.temperature = 25000 + (int32_t)(timestamp % 64);
+        v.pressure = 101325 + (timestamp % 16);
+        v.luminosity = 1000 + (timestamp % 256);
+        v.humidity = 60;
+        if(acq_file_append_val(&v, f, timestamp) < 0) {
+            abort();
+        }
+    }
+}
+
+static void bench_acq_append_teardown(void *ctx)
+{
+    acq_file_close(ctx, NULL);
+}
+
+/* acquisition file queries, on a file written once in the columnar format
+ * the gateway uses */
+static void *bench_acq_query_setup(void)
+{
+    char path[MAX_NAME_SIZE];
+    acq_reader_t *r;
+    acq_file_t *f;
+    acqui_st_t v = { .temperature = 25000, .pressure = 101325, .luminosity = 1000, .humidity = 60 };
+
+    bench_path(path, sizeof(path), "query.acq");
+    unlink(path);
+    f = acq_file_open(path, k_acq_format_columnar);
+    assert(f != NULL);
+    for(uint32_t t = 1; t <= BENCH_ACQ_RECORDS; t++) {
+        v.temperature += (t & 1) ? 3 : -2;
+        acq_file_append_val(&v, f, t);
+    }
+    acq_file_close(f, NULL);
+
+    r = acq_reader_open(path);
+    assert(r != NULL);
+    return(r);
+}
+
+static void bench_acq_get(void *ctx, uint64_t iters)
+{
+    acq_reader_t *r = ctx;
+    acq_record_t rec;
+    uint32_t seed = 88675123u;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        if(acq_file_get_data(r, 1 + bench_rand(&seed) % BENCH_ACQ_RECORDS, &rec) < 0) {
+            abort();
+        }
+        bench_sink += rec.val.temperature;
+    }
+}
+
+static bool bench_acq_scan_cb(const acq_record_t *rec, size_t count, void *arg)
+{
+    int64_t *sum = arg;
+
+    for(size_t i = 0; i < count; i++) {
+        *sum += rec[i].val.temperature;
+    }
+    return(true);
+}
+
+static void bench_acq_scan(void *ctx, uint64_t iters)
+{
+    acq_reader_t *r = ctx;
+    uint32_t seed = 521288629u;
+    int64_t sum = 0;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        uint32_t t0 = 1 + bench_rand(&seed) % (BENCH_ACQ_RECORDS - BENCH_ACQ_SCAN);
+
+        acq_file_scan(r, t0, t0 + BENCH_ACQ_SCAN - 1, bench_acq_scan_cb, &sum);
+    }
+    bench_sink += sum;
+}
+
+static void bench_acq_query_teardown(void *ctx)
+{
+    acq_reader_close(ctx);
+}
+
+/* startup recovery of a device directory after a power loss, the normal
+ * case only finds the index tail torn */
+static void *bench_acq_recover_setup(bool lost)
+{
+    char path[MAX_PATH_SIZE];
+    bench_recover_t *r = calloc(1, sizeof(bench_recover_t));
+    acqui_st_t v = { .temperature = 25000, .pressure = 101325, .luminosity = 1000, .humidity = 60 };
+    acq_file_t *f;
+
+    assert(r != NULL);
+    r->lost = lost;
+    bench_path(r->dir, sizeof(r->dir), BENCH_RECOVER_DIR);
+    mkdir(r->dir, 0755);
+    snprintf(path, sizeof(path), "%s/%s", r->dir, ACQ_FILE_NAME);
+    snprintf(r->idx_path, sizeof(r->idx_path), "%s/%.*s.idx", r->dir,
+        (int)(strlen(ACQ_FILE_NAME) - strlen(".dat")), ACQ_FILE_NAME);
+
+    f = acq_file_open(path, k_acq_format_raw);
+    assert(f != NULL);
+    for(uint32_t t = 1; t <= BENCH_RECOVER_BLOCKS * ACQ_BLOCK_RECORDS; t++) {
+        v.temperature += (t & 1) ? 3 : -2;
+        acq_file_append_val(&v, f, t / BENCH_RECOVER_RATE);
+    }
+    acq_file_close(f, NULL);
+    return(r);
+}
+
+static void *bench_acq_recover_torn_setup(void)
+{
+    return(bench_acq_recover_setup(false));
+}
+
+static void *bench_acq_recover_lost_setup(void)
+{
+    return(bench_acq_recover_setup(true));
+}
+
+static void bench_acq_recover(void *ctx, uint64_t iters)
+{
+    bench_recover_t *r = ctx;
+    struct stat st;
+
+    /* the summary recovery prints goes nowhere */
+    bench_quiet(true);
+    for(uint64_t i = 0; i < iters; i++) {
+        if(r->lost) {
+            unlink(r->idx_path);
+        } else if(stat(r->idx_path, &st) < 0 ||
+            truncate(r->idx_path, st.st_size - sizeof(acq_index_entry_t) - sizeof(acq_index_entry_t) / 2) < 0) {
+            abort();
+        }
+        if(acq_file_recover(bench_dir) != 1) {
+            abort();
+        }
+    }
+    bench_quiet(false);
+}
+
+static void bench_acq_recover_teardown(void *ctx)
+{
+    bench_recover_t *r = ctx;
+    char path[MAX_PATH_SIZE];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(r->dir);
+    while(d != NULL && (e = readdir(d)) != NULL) {
+        if(e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", r->dir, e->d_name);
+            unlink(path);
+        }
+    }
+    if(d != NULL) {
+        closedir(d);
+    }
+    rmdir(r->dir);
+    free(r);
+}
+
+/* columnar codec alone, a reading at a time in whole blocks, the bytes
+ * it takes against the raw ones tell the ratio */
+static bool bench_col_collect(const acq_record_t *rec, size_t count, void *arg)
+{
+    bench_col_t *b = arg;
+    acq_record_t *r = realloc(b->rec, (b->count + count) * sizeof(acq_record_t));
+
+    if(r == NULL) {
+        return(false);
+    }
+    b->rec = r;
+    memcpy(&b->rec[b->count], rec, count * sizeof(acq_record_t));
+    b->count += count;
+    return(true);
+}
+
+static void *bench_col_setup(void)
+{
+    bench_col_t *b = calloc(1, sizeof(bench_col_t));
+    acqui_st_t v = { .temperature = 25000, .pressure = 101325, .luminosity = 0, .humidity = 60 };
+    uint32_t seed = 1597334677u;
+    acq_reader_t *r;
+    size_t size = 0;
+
+    assert(b != NULL);
+    if(bench_acq_log != NULL) {
+        r = acq_reader_open(bench_acq_log);
+        if(r == NULL || !acq_file_scan(r, 0, UINT32_MAX, bench_col_collect, b)) {
+            fprintf(stderr, "ERROR: No readings to replay in %s.\n", bench_acq_log);
+            abort();
+        }
+        acq_reader_close(r);
+    } else {
+        /* a reading a second, slow drifts with a little sensor noise and
+         * the light of a day */
+        b->rec = malloc(BENCH_ACQ_RECORDS * sizeof(acq_record_t));
+        assert(b->rec != NULL);
+        for(uint32_t t = 0; t < BENCH_ACQ_RECORDS; t++) {
+            v.temperature += (int32_t)(bench_rand(&seed) % 7) - 3;
+            v.pressure += (bench_rand(&seed) % 5) - 2;
+            v.luminosity = (uint32_t)(50000.0 * fmax(0.0, sin(M_PI * t / (12 * 60 * 60)))) + bench_rand(&seed) % 16;
+            v.humidity = 60 + (t / 3600) % 10;
+            b->rec[t].timestamp = 1 + t;
+            b->rec[t].val = v;
+        }
+        b->count = BENCH_ACQ_RECORDS;
+    }
+
+    b->blocks = (b->count + ACQ_BLOCK_RECORDS - 1) / ACQ_BLOCK_RECORDS;
+    b->enc = malloc(b->blocks * ACQ_COL_MAX_SIZE(ACQ_BLOCK_RECORDS));
+    b->off = malloc((b->blocks + 1) * sizeof(size_t));
+    assert(b->enc != NULL && b->off != NULL);
+    b->off[0] = 0;
+    for(size_t i = 0; i < b->blocks; i++) {
+        size_t n = b->count - i * ACQ_BLOCK_RECORDS;
+
+        n = (n < ACQ_BLOCK_RECORDS) ? n : ACQ_BLOCK_RECORDS;
+        size = acq_col_encode(&b->rec[i * ACQ_BLOCK_RECORDS], (uint16_t)n, b->enc + b->off[i]);
+        b->off[i + 1] = b->off[i] + size;
+    }
+    bench_bytes = (double)b->off[b->blocks] / b->count;
+    return(b);
+}
+
+static void bench_col_encode(void *ctx, uint64_t iters)
+{
+    bench_col_t *b = ctx;
+    size_t size = 0;
+    size_t k = 0;
+
+    for(uint64_t i = 0; i < iters; ) {
+        size_t n = b->count - k * ACQ_BLOCK_RECORDS;
+
+        n = (n < ACQ_BLOCK_RECORDS) ? n : ACQ_BLOCK_RECORDS;
+        size += acq_col_encode(&b->rec[k * ACQ_BLOCK_RECORDS], (uint16_t)n, b->enc + b->off[k]);
+        k = (k + 1) % b->blocks;
+        i += n;
+    }
+    bench_sink += size;
+}
+
+static void bench_col_decode(void *ctx, uint64_t iters)
+{
+    bench_col_t *b = ctx;
+    size_t k = 0;
+    int64_t sum = 0;
+
+    for(uint64_t i = 0; i < iters; ) {
+        int n = acq_col_decode(b->enc + b->off[k], b->off[k + 1] - b->off[k], b->dec);
+
+        if(n <= 0) {
+            abort();
+        }
+        sum += b->dec[n - 1].val.temperature;
+        k = (k + 1) % b->blocks;
+        i += n;
+    }
+    bench_sink += sum;
+}
+
+static void bench_col_teardown(void *ctx)
+{
+    bench_col_t *b = ctx;
+
+    free(b->rec);
+    free(b->enc);
+    free(b->off);
+    free(b);
+}
+
+/**
+ *  @fn bench_hive_audio()
+ *  @brief synthetic hive audio, hum and harmonics over noise
+ *  @param
+ *  @return
+ */
+static void bench_hive_audio(int16_t *pcm, size_t count)
+{
+    uint32_t seed = 1013904223u;
+
+    for(size_t i = 0; i < count; i++) {
+        double t = (double)i / AUDIO_SAMPLE_RATE;
+
+        pcm[i] = (int16_t)(6000.0 * sin(2 * M_PI * 250.0 * t) + 2500.0 * sin(2 * M_PI * 500.0 * t) +
+            1200.0 * sin(2 * M_PI * 410.0 * t) + (int32_t)(bench_rand(&seed) % 1024) - 512);
+    }
+}
+
+/* hive audio codec, a frame is what the audio writer encodes at a time
+ * and what a reader decodes to seek */
+static void *bench_audio_setup(void)
+{
+    bench_audio_t *a = calloc(1, sizeof(bench_audio_t));
+
+    assert(a != NULL);
+    bench_hive_audio(a->pcm, BENCH_AUDIO_SAMPLES);
+    audio_adpcm_encode(&a->st, a->pcm, BENCH_AUDIO_SAMPLES, a->enc);
+    return(a);
+}
+
+static void bench_audio_encode(void *ctx, uint64_t iters)
+{
+    bench_audio_t *a = ctx;
+    size_t bytes = 0;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        uint32_t f = i % BENCH_AUDIO_FRAMES;
+
+        bytes += audio_adpcm_encode(&a->st, a->pcm + f * AUDIO_ADPCM_FRAME_SAMPLES, AUDIO_ADPCM_FRAME_SAMPLES,
+            a->enc + f * AUDIO_ADPCM_FRAME_SIZE);
+    }
+    bench_sink += bytes;
+}
+
+static void bench_audio_decode(void *ctx, uint64_t iters)
+{
+    int16_t pcm[AUDIO_ADPCM_FRAME_SAMPLES];
+    bench_audio_t *a = ctx;
+    int64_t sum = 0;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        if(audio_adpcm_decode(a->enc + (i % BENCH_AUDIO_FRAMES) * AUDIO_ADPCM_FRAME_SIZE, pcm) < 0) {
+            abort();
+        }
+        sum += pcm[i % AUDIO_ADPCM_FRAME_SAMPLES];
+    }
+    bench_sink += sum;
+}
+
+/* spectral features of hive audio, fed a hop at a time as the audio
+ * writer does, so an operation is one fft frame */
+static void *bench_feat_setup(const char *impl)
+{
+    char path[MAX_NAME_SIZE];
+    bench_feat_t *b = calloc(1, sizeof(bench_feat_t));
+
+    assert(b != NULL);
+    b->impl = audio_feat_impl_name();
+    if(impl != NULL && audio_feat_select(impl) < 0) {
+        abort();
+    }
+    b->feat = audio_feat_open(bench_path(path, sizeof(path), "feat.dat"));
+    assert(b->feat != NULL);
+    bench_hive_audio(b->pcm, BENCH_AUDIO_SAMPLES);
+    audio_feat_begin(b->feat, 1);
+    return(b);
+}
+
+static void *bench_feat_fastest_setup(void)
+{
+    return(bench_feat_setup(NULL));
+}
+
+static void *bench_feat_scalar_setup(void)
+{
+    return(bench_feat_setup("scalar"));
+}
+
+static void bench_feat(void *ctx, uint64_t iters)
+{
+    bench_feat_t *b = ctx;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        audio_feat_push(b->feat, b->pcm + (i % (BENCH_AUDIO_SAMPLES / AUDIO_FEAT_HOP)) * AUDIO_FEAT_HOP,
+            AUDIO_FEAT_HOP);
+    }
+    bench_sink += b->feat->total_frames;
+}
+
+static void bench_feat_teardown(void *ctx)
+{
+    bench_feat_t *b = ctx;
+
+    audio_feat_close(b->feat);
+    audio_feat_select(b->impl);
+    free(b);
+}
+
+/* gps parser, a sentence at a time as the reader thread hands them over */
+static void *bench_nmea_setup(void)
+{
+    bench_nmea_t *b = calloc(1, sizeof(bench_nmea_t));
+    size_t size = 0;
+    char *p, *nl;
+    FILE *fp;
+
+    assert(b != NULL);
+    if(bench_nmea_log != NULL) {
+        fp = fopen(bench_nmea_log, "r");
+        if(fp == NULL || fseek(fp, 0, SEEK_END) < 0 || (long)(size = ftell(fp)) < 0) {
+            fprintf(stderr, "ERROR: Failed to read NMEA log %s.\n", bench_nmea_log);
+            abort();
+        }
+        rewind(fp);
+        b->log = malloc(size + 1);
+        assert(b->log != NULL);
+        size = fread(b->log, 1, size, fp);
+        b->log[size] = 0;
+        fclose(fp);
+    } else {
+        b->log = strdup(BENCH_NMEA_EPOCH);
+        assert(b->log != NULL);
+        size = strlen(b->log);
+    }
+
+    /* a sentence per line, it keeps its line ending as it comes in */
+    b->s = malloc((size / 2 + 1) * sizeof(*b->s));
+    b->len = malloc((size / 2 + 1) * sizeof(*b->len));
+    assert(b->s != NULL && b->len != NULL);
+    for(p = b->log; *p; p = nl) {
+        nl = strchr(p, '\n');
+        nl = (nl != NULL) ? nl + 1 : p + strlen(p);
+        if(*p == '$') {
+            b->s[b->count] = p;
+            b->len[b->count] = nl - p;
+            b->count++;
+        }
+    }
+    if(!b->count) {
+        fprintf(stderr, "ERROR: No NMEA sentence to parse.\n");
+        abort();
+    }
+    return(b);
+}
+
+static void bench_nmea(void *ctx, uint64_t iters)
+{
+    bench_nmea_t *b = ctx;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        size_t k = i % b->count;
+
+        gps_nmea_parse(&b->nmea, b->s[k], b->len[k]);
+    }
+    bench_sink += b->nmea.accepted + b->nmea.data.lati;
+}
+
+static void bench_nmea_teardown(void *ctx)
+{
+    bench_nmea_t *b = ctx;
+
+    free(b->s);
+    free(b->len);
+    free(b->log);
+    free(b);
+}
+
+/* log call as the modules make them, the drainer runs and empties the
+ * buffer in between batches */
+static void *bench_log_setup(void)
+{
+    char path[MAX_PATH_SIZE];
+
+    if(app_log_start(bench_path(path, sizeof(path), "bench.log")) < 0) {
+        abort();
+    }
+    app_log_set_level(LOG_LEVEL_INFO);
+    return(NULL);
+}
+
+static void bench_log_settle(void *ctx)
+{
+    uint64_t end = bench_now_ns() + 2ULL * LOG_DRAIN_PERIOD_MS * 1000000ULL;
+
+    /* spins rather than sleeps, an idle core would time a cold call */
+    (void)ctx;
+    while(bench_now_ns() < end) {
+        bench_sink++;
+    }
+}
+
+static void bench_log(void *ctx, uint64_t iters)
+{
+    const char *addr = "B0:EE:00:00:00:00";
+
+    (void)ctx;
+    for(uint64_t i = 0; i < iters; i++) {
+        LOG_INFO("%s already holds %u of %u fragments, resuming", addr, (uint32_t)i, 64u);
+    }
+}
+
+static void bench_log_teardown(void *ctx)
+{
+    (void)ctx;
+    app_log_set_level(LOG_LEVEL_ERR);
+    app_log_finish();
+    if(app_log_dropped()) {
+        fprintf(stderr, "ERROR: %llu log calls dropped, the figure is off.\n",
+            (unsigned long long)app_log_dropped());
+    }
+}
+
+/* the same message formatted by stdio, what the log replaced */
+static void *bench_printf_setup(void)
+{
+    FILE *f = fopen("/dev/null", "w");
+
+    assert(f != NULL);
+    return(f);
+}
+
+static void bench_printf(void *ctx, uint64_t iters)
+{
+    const char *addr = "B0:EE:00:00:00:00";
+    FILE *f = ctx;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        fprintf(f, "%s already holds %u of %u fragments, resuming\n", addr, (uint32_t)i, 64u);
+    }
+}
+
+static void bench_printf_teardown(void *ctx)
+{
+    fclose(ctx);
+}
+
+/* registry lookup, done on every discovery, half of the addresses asked
+ * for are known */
+static void *bench_registry_setup(void)
+{
+    char path[MAX_NAME_SIZE];
+    char (*addr)[REGISTRY_ADDR_SIZE] = malloc(BENCH_REGISTRY * 2 * REGISTRY_ADDR_SIZE);
+
+    assert(addr != NULL);
+    bench_path(path, sizeof(path), "registry.bin");
+    unlink(path);
+    if(registry_open(path) < 0) {
+        abort();
+    }
+    for(uint32_t i = 0; i < BENCH_REGISTRY * 2; i++) {
+        snprintf(addr[i], REGISTRY_ADDR_SIZE, "%02X:EE:00:00:%02X:%02X",
+            (i < BENCH_REGISTRY) ? 0xB0 : 0xC0, (i % BENCH_REGISTRY) >> 8, i & 0xff);
+        if(i < BENCH_REGISTRY) {
+            registry_add(addr[i], "BeeInformed", BDADDR_LE_PUBLIC, NULL);
+        }
+    }
+    return(addr);
+}
+
+static void bench_registry_lookup(void *ctx, uint64_t iters, uint32_t base)
+{
+    char (*addr)[REGISTRY_ADDR_SIZE] = ctx;
+    uint32_t seed = 3141592653u;
+    uint64_t found = 0;
+
+    for(uint64_t i = 0; i < iters; i++) {
+        found += registry_lookup(addr[base + bench_rand(&seed) % BENCH_REGISTRY], NULL);
+    }
+    bench_sink += found;
+}
+
+static void bench_registry_hit(void *ctx, uint64_t iters)
+{
+    bench_registry_lookup(ctx, iters, 0);
+}
+
+static void bench_registry_miss(void *ctx, uint64_t iters)
+{
+    bench_registry_lookup(ctx, iters, BENCH_REGISTRY);
+}
+
+static void bench_registry_teardown(void *ctx)
+{
+    registry_close();
+    free(ctx);
+}
+
+
+/** every benchmark, in the order they run */
+static const bench_t bench_list[] = {
+    { "rx_ingest",          "packet",   0, (void *(*)(void))bench_device_new, bench_rx_ingest, bench_device_free, 0, NULL },
+    { "stats_rx_packet",    "packet",   0, (void *(*)(void))bench_device_new, bench_stats_packet, bench_device_free, STATS_BUDGET_NS, NULL },
+    { "rx_reassembly",      "answer",   0, bench_reassembly_setup, bench_reassembly, bench_device_free, 0, NULL },
+    { "sched_loop_wake64",  "wakeup",   0, bench_sched_loop_wake_setup, bench_sched, bench_sched_teardown, 0, NULL },
+    { "sched_thread_wake64","wakeup",   0, bench_sched_thread_wake_setup, bench_sched, bench_sched_teardown, 0, NULL },
+    { "sched_loop_round64", "round",    0, bench_sched_loop_round_setup, bench_sched, bench_sched_teardown, 0, NULL },
+    { "sched_thread_round64","round",   0, bench_sched_thread_round_setup, bench_sched, bench_sched_teardown, 0, NULL },
+    { "sched_loop_round1k", "round",    0, bench_sched_loop_round1k_setup, bench_sched, bench_sched_teardown, 0, NULL },
+    { "sched_thread_round1k","round",   0, bench_sched_thread_round1k_setup, bench_sched, bench_sched_teardown, 0, NULL },
+    { "timer_arm_cancel_1k","pair",     0, bench_timer_1k_setup, bench_timer_arm_cancel, bench_timer_teardown, 0, NULL },
+    { "timer_arm_cancel_10k","pair",    0, bench_timer_10k_setup, bench_timer_arm_cancel, bench_timer_teardown, 0, NULL },
+    { "dlist_rotate",       "op",       0, bench_dlist_setup, bench_dlist_rotate, free, 0, NULL },
+    { "dlist_remove_insert","op",       0, bench_dlist_setup, bench_dlist_remove_insert, free, 0, NULL },
+    { "dlist_walk64",       "walk",     0, bench_dlist_setup, bench_dlist_walk, free, 0, NULL },
+    { "epoch_section",      "section",  0, NULL, bench_epoch_section, NULL, 0, NULL },
+    { "devtab_walk64",      "walk",     0, bench_devtab_setup, bench_devtab_walk, free, 0, NULL },
+    { "devtab_walk64_mutex","walk",     0, bench_devtab_setup, bench_devtab_walk_mutex, free, 0, NULL },
+    { "acq_append_raw",     "record",   BENCH_ACQ_BATCH, bench_acq_append_raw_setup, bench_acq_append, bench_acq_append_teardown, 0, NULL },
+    { "acq_append_col",     "record",   BENCH_ACQ_BATCH, bench_acq_append_col_setup, bench_acq_append, bench_acq_append_teardown, 0, NULL },
+    { "acq_get",            "query",    0, bench_acq_query_setup, bench_acq_get, bench_acq_query_teardown, 0, NULL },
+    { "acq_scan3600",       "query",    0, bench_acq_query_setup, bench_acq_scan, bench_acq_query_teardown, 0, NULL },
+    { "acq_recover16m_torn","recovery", 0, bench_acq_recover_torn_setup, bench_acq_recover, bench_acq_recover_teardown, 0, NULL },
+    { "acq_recover16m_lost","recovery", 0, bench_acq_recover_lost_setup, bench_acq_recover, bench_acq_recover_teardown, 0, NULL },
+    { "acq_col_encode",     "record",   0, bench_col_setup, bench_col_encode, bench_col_teardown, 0, NULL },
+    { "acq_col_decode",     "record",   0, bench_col_setup, bench_col_decode, bench_col_teardown, 0, NULL },
+    { "audio_adpcm_encode", "frame",    0, bench_audio_setup, bench_audio_encode, free, 0, NULL },
+    { "audio_adpcm_decode", "frame",    0, bench_audio_setup, bench_audio_decode, free, 0, NULL },
+    { "audio_feat_frame",   "frame",    0, bench_feat_fastest_setup, bench_feat, bench_feat_teardown, 0, NULL },
+    { "audio_feat_scalar",  "frame",    0, bench_feat_scalar_setup, bench_feat, bench_feat_teardown, 0, NULL },
+    { "gps_nmea_parse",     "sentence", 0, bench_nmea_setup, bench_nmea, bench_nmea_teardown, 0, NULL },
+    { "log_info",           "call",     BENCH_LOG_BURST, bench_log_setup, bench_log, bench_log_teardown, 0, bench_log_settle },
+    { "log_printf",         "call",     0, bench_printf_setup, bench_printf, bench_printf_teardown, 0, NULL },
+    { "registry_hit",       "lookup",   0, bench_registry_setup, bench_registry_hit, bench_registry_teardown, 0, NULL },
+    { "registry_miss",      "lookup",   0, bench_registry_setup, bench_registry_miss, bench_registry_teardown, 0, NULL },
+};
+
+/**
+ *  @fn bench_cmp()
+ *  @brief qsort order of doubles
+ *  @param
+ *  @return
+ */
+static int bench_cmp(const void *a, const void *b)
+{
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+
+    return((x > y) - (x < y));
+}
+
+/**
+ *  @fn bench_batch()
+ *  @brief times one batch
+ *  @param
+ *  @return nanoseconds the batch took
+ */
+static uint64_t bench_batch(const bench_t *b, void *ctx, uint64_t iters)
+{
+    uint64_t t0;
+
+    if(b->settle != NULL) {
+        b->settle(ctx);
+    }
+    t0 = bench_now_ns();
+
+    b->run(ctx, iters);
+    return(bench_now_ns() - t0);
+}
+
+/**
+ *  @fn bench_run()
+ *  @brief warms a benchmark up, sizes its batches and times them
+ *  @param b - benchmark
+ *  @param res - filled with the figures
+ *  @return
+ */
+static void bench_run(const bench_t *b, bench_result_t *res)
+{
+    double per_op[BENCH_MAX_REPEATS];
+    uint64_t target = (uint64_t)bench_batch_ms * 1000000ULL;
+    uint64_t iters = 1;
+    uint64_t start;
+    uint64_t ns = 0;
+    struct rusage ru0;
+    struct rusage ru1;
+    void *ctx;
+
+    bench_bytes = 0;
+    bench_quiet(true);
+    ctx = (b->setup != NULL) ? b->setup() : NULL;
+    bench_quiet(false);
+    res->bytes = bench_bytes;
+
+    /* the warmup doubles the batch until it lasts long enough, which
+     * also settles caches, branch predictors and the cpu clock */
+    start = bench_now_ns();
+    do {
+        ns = bench_batch(b, ctx, iters);
+        if(ns < target / 2 && (!b->max_iters || iters < b->max_iters)) {
+            iters *= 2;
+        }
+    } while(bench_now_ns() - start < (uint64_t)bench_warmup_ms * 1000000ULL);
+
+    if(bench_iters) {
+        iters = bench_iters;
+    } else if(ns) {
+        iters = (uint64_t)((double)iters * target / ns) + 1;
+    }
+    if(b->max_iters && iters > b->max_iters) {
+        iters = b->max_iters;
+    }
+
+    /* the whole process counts, workers and device threads included */
+    getrusage(RUSAGE_SELF, &ru0);
+    for(uint32_t i = 0; i < bench_repeats; i++) {
+        per_op[i] = (double)bench_batch(b, ctx, iters) / iters;
+    }
+    getrusage(RUSAGE_SELF, &ru1);
+
+    bench_quiet(true);
+    if(b->teardown != NULL) {
+        b->teardown(ctx);
+    }
+    bench_quiet(false);
+
+    qsort(per_op, bench_repeats, sizeof(per_op[0]), bench_cmp);
+    res->median = per_op[bench_repeats / 2];
+    res->min = per_op[0];
+    res->max = per_op[bench_repeats - 1];
+    res->csw = (double)((ru1.ru_nvcsw + ru1.ru_nivcsw) - (ru0.ru_nvcsw + ru0.ru_nivcsw)) /
+        ((double)iters * bench_repeats);
+    res->iters = iters;
+    res->repeats = bench_repeats;
+}
+
+/**
+ *  @fn bench_selected()
+ *  @brief tells whether a benchmark was asked for
+ *  @param
+ *  @return
+ */
+static bool bench_selected(const char *name, int argc, char **argv)
+{
+    if(optind >= argc) {
+        return(true);
+    }
+    for(int i = optind; i < argc; i++) {
+        if(!strncmp(name, argv[i], strlen(argv[i]))) {
+            return(true);
+        }
+    }
+    return(false);
+}
+
+/**
+ *  @fn bench_cleanup()
+ *  @brief removes the scratch directory
+ *  @param
+ *  @return
+ */
+static void bench_cleanup(void)
+{
+    char path[MAX_PATH_SIZE];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(bench_dir);
+    if(d == NULL) {
+        return;
+    }
+    while((e = readdir(d)) != NULL) {
+        if(e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", bench_dir, e->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+    rmdir(bench_dir);
+}
+
+
+/**
+ *  @fn main()
+ *  @brief bench entry point
+ *  @param
+ *  @return
+ */
+int main(int argc, char **argv)
+{
+    struct utsname un;
+    bench_result_t res;
+    int cpu = -1;
+    int ret = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "w:t:r:n:c:g:a:jlh")) != -1) {
+        switch(opt) {
+        case 'w':
+            bench_warmup_ms = (uint32_t)atoi(optarg);
+            break;
+        case 't':
+            bench_batch_ms = (uint32_t)atoi(optarg);
+            break;
+        case 'r':
+            bench_repeats = (uint32_t)atoi(optarg);
+            break;
+        case 'n':
+            bench_iters = strtoull(optarg, NULL, 0);
+            break;
+        case 'c':
+            cpu = atoi(optarg);
+            break;
+        case 'g':
+            bench_nmea_log = optarg;
+            break;
+        case 'a':
+            bench_acq_log = optarg;
+            break;
+        case 'j':
+            bench_json = true;
+            break;
+        case 'l':
+            for(size_t i = 0; i < sizeof(bench_list) / sizeof(bench_list[0]); i++) {
+                printf("%s\n", bench_list[i].name);
+            }
+            return(0);
+        default:
+            fprintf(stderr, "usage: %s [-w warmup ms] [-t batch ms] [-r repeats] [-n iterations] "
+                "[-c cpu] [-g nmea log] [-a acq file] [-j] [-l] [name ...]\n", argv[0]);
+            return((opt == 'h') ? 0 : -1);
+        }
+    }
+    if(bench_repeats < 1 || bench_repeats > BENCH_MAX_REPEATS) {
+        bench_repeats = BENCH_REPEATS;
+    }
+    if(!bench_batch_ms) {
+        bench_batch_ms = BENCH_BATCH_MS;
+    }
+
+    /* one cpu keeps the figures from migrating with the scheduler */
+    if(cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+        if(sched_setaffinity(0, sizeof(set), &set) < 0) {
+            fprintf(stderr, "ERROR: Failed to pin to cpu %d.\n", cpu);
+            return(-1);
+        }
+    }
+
+    if(mkdtemp(bench_dir) == NULL) {
+        fprintf(stderr, "ERROR: Failed to create the scratch directory.\n");
+        return(-1);
+    }
+    atexit(bench_cleanup);
+
+    /* the acquisition files need their commit thread, the benchmarks
+     * themselves only log errors */
+    app_log_set_level(LOG_LEVEL_ERR);
+    bench_quiet(true);
+    if(acq_file_start() < 0) {
+        return(-1);
+    }
+    bench_quiet(false);
+
+    uname(&un);
+    if(!bench_json) {
+        printf("# beeinformed bench on %s %s %s, batches of %u ms, %u repeats\n",
+            un.nodename, un.machine, un.release, bench_batch_ms, bench_repeats);
+        printf("%-20s %-8s %12s %12s %12s %12s %8s %12s\n",
+            "name", "op", "ns/op", "min", "max", "ops/s", "csw/op", "iters");
+    }
+
+    for(size_t i = 0; i < sizeof(bench_list) / sizeof(bench_list[0]); i++) {
+        const bench_t *b = &bench_list[i];
+
+        if(!bench_selected(b->name, argc, argv)) {
+            continue;
+        }
+
+        bench_run(b, &res);
+        if(bench_json) {
+            printf("{\"bench\":\"%s\",\"op\":\"%s\",\"ns_per_op\":%.3f,\"min\":%.3f,\"max\":%.3f,"
+                "\"csw_per_op\":%.3f,\"iters\":%llu,\"repeats\":%u,\"host\":\"%s\",\"arch\":\"%s\","
+                "\"kernel\":\"%s\"",
+                b->name, b->op, res.median, res.min, res.max, res.csw, (unsigned long long)res.iters,
+                res.repeats, un.nodename, un.machine, un.release);
+            if(res.bytes) {
+                printf(",\"bytes_per_op\":%.3f,\"raw_bytes_per_op\":%.3f", res.bytes, BENCH_ACQ_RAW_RECORD);
+            }
+            printf("}\n");
+        } else {
+            printf("%-20s %-8s %12.2f %12.2f %12.2f %12.0f %8.2f %12llu",
+                b->name, b->op, res.median, res.min, res.max, 1e9 / res.median, res.csw,
+                (unsigned long long)res.iters);
+            if(res.bytes) {
+                printf("  %.2f B/%s, %.1fx under the %.2f raw", res.bytes, b->op,
+                    BENCH_ACQ_RAW_RECORD / res.bytes, BENCH_ACQ_RAW_RECORD);
+            }
+            printf("\n");
+        }
+        if(b->budget_ns && res.median > b->budget_ns) {
+            fprintf(stderr, "ERROR: %s takes %.2f ns per %s, over its %u ns budget.\n",
+                b->name, res.median, b->op, b->budget_ns);
+            ret = -1;
+        }
+        fflush(stdout);
+    }
+
+    bench_quiet(true);
+    acq_file_finish();
+    bench_quiet(false);
+    return(ret);
+}
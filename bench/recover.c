@@ -0,0 +1,554 @@
+/**
+ *          THE BeeInformed Team
+ *  @file recover.c
+ *  @brief startup recovery of acquisition files against torn writes,
+ *         checks every intact block survives and nothing torn does
+ *
+ *  usage: recover.out [-n blocks]
+ *
+ *  Each case writes a file of full blocks through the writer, tears it
+ *  the way a power loss would, runs acq_file_recover() over the directory
+ *  and checks what is left: the blocks expected to survive, an index
+ *  chaining over all of them and matching their headers, and every record
+ *  of them readable. Both block formats go through every case.
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** defaults of the command line */
+#define RECOVER_BLOCKS              16
+
+/** rollup tiers next to the data, with their bucket period */
+static const char *recover_tier_ext[k_acq_rollup_tiers] = { ".r1m", ".r1h", ".r1d" };
+static const uint32_t recover_tier_period[k_acq_rollup_tiers] = { 60, 60 * 60, 24 * 60 * 60 };
+
+/** rollup check of one tier against the records of the directory */
+typedef struct {
+    uint32_t period;
+    uint64_t records;
+    bool bad;
+}recover_tier_t;
+
+/** one way of tearing a file, returns the blocks expected to survive */
+typedef struct {
+    const char *name;
+    uint32_t (*tear)(const char *path, const char *idx_path, uint32_t blocks);
+}recover_case_t;
+
+
+/** static variables */
+static char recover_dir[] = "/tmp/beerecover.XXXXXX";
+static char recover_dev[MAX_NAME_SIZE];
+static acq_file_format_t recover_format;
+
+
+/** static functions */
+
+/**
+ *  @fn recover_must()
+ *  @brief gives up on a step the check itself could not do
+ *  @param
+ *  @return
+ */
+static void recover_must(bool ok, const char *what)
+{
+    if(!ok) {
+        fprintf(stderr, "ERROR: Failed to %s: %s.\n", what, strerror(errno));
+        exit(-1);
+    }
+}
+
+/**
+ *  @fn recover_entry()
+ *  @brief reads an index entry
+ *  @param
+ *  @return
+ */
+static void recover_entry(const char *idx_path, uint32_t n, acq_index_entry_t *e)
+{
+    int fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+
+    recover_must(fd >= 0 && pread(fd, e, sizeof(*e), (off_t)n * sizeof(*e)) == sizeof(*e), "read the index");
+    close(fd);
+}
+
+/**
+ *  @fn recover_flip()
+ *  @brief flips a byte in the middle of a block, a sector that never
+ *         made it to disk
+ *  @param
+ *  @return
+ */
+static void recover_flip(const char *path, const char *idx_path, uint32_t n)
+{
+    acq_index_entry_t e;
+    uint8_t c;
+    int fd;
+
+    recover_entry(idx_path, n, &e);
+    fd = open(path, O_RDWR | O_CLOEXEC);
+    recover_must(fd >= 0 && pread(fd, &c, 1, e.offset + e.size / 2) == 1, "read a block");
+    c ^= 0x5A;
+    recover_must(pwrite(fd, &c, 1, e.offset + e.size / 2) == 1, "tear a block");
+    close(fd);
+}
+
+/**
+ *  @fn recover_tear_index_tail()
+ *  @brief a normal restart, the last index entry written halfway
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_index_tail(const char *path, const char *idx_path, uint32_t blocks)
+{
+    (void)path;
+    recover_must(truncate(idx_path, sizeof(acq_index_entry_t) + 10) == 0, "tear the index");
+    return(blocks);
+}
+
+/**
+ *  @fn recover_tear_index_zeros()
+ *  @brief index extended by the filesystem but never written
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_index_zeros(const char *path, const char *idx_path, uint32_t blocks)
+{
+    struct stat st;
+
+    (void)path;
+    recover_must(stat(idx_path, &st) == 0 &&
+        truncate(idx_path, st.st_size + 3 * sizeof(acq_index_entry_t)) == 0, "extend the index");
+    return(blocks);
+}
+
+/**
+ *  @fn recover_tear_index_lost()
+ *  @brief index gone, every block is found by its header
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_index_lost(const char *path, const char *idx_path, uint32_t blocks)
+{
+    (void)path;
+    recover_must(unlink(idx_path) == 0, "remove the index");
+    return(blocks);
+}
+
+/**
+ *  @fn recover_tear_data_tail()
+ *  @brief last block written halfway
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_data_tail(const char *path, const char *idx_path, uint32_t blocks)
+{
+    acq_index_entry_t e;
+
+    recover_entry(idx_path, blocks - 1, &e);
+    recover_must(truncate(path, e.offset + e.size / 2) == 0, "tear the data");
+    return(blocks - 1);
+}
+
+/**
+ *  @fn recover_tear_unindexed()
+ *  @brief a block past the index torn, the intact ones after it go too
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_unindexed(const char *path, const char *idx_path, uint32_t blocks)
+{
+    uint32_t torn = blocks / 2 + 1;
+
+    recover_flip(path, idx_path, torn);
+    recover_must(truncate(idx_path, (blocks / 2) * sizeof(acq_index_entry_t)) == 0, "tear the index");
+    return(torn);
+}
+
+/**
+ *  @fn recover_tear_indexed()
+ *  @brief last indexed block torn
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_indexed(const char *path, const char *idx_path, uint32_t blocks)
+{
+    recover_flip(path, idx_path, blocks - 1);
+    return(blocks - 1);
+}
+
+/**
+ *  @fn recover_sidecar()
+ *  @brief path of a file next to the data, as the writer names it
+ *  @param
+ *  @return
+ */
+static const char *recover_sidecar(char *out, size_t size, const char *ext)
+{
+    snprintf(out, size, "%s/%.*s%s", recover_dev, (int)(strlen(ACQ_FILE_NAME) - strlen(".dat")), ACQ_FILE_NAME, ext);
+    return(out);
+}
+
+/**
+ *  @fn recover_tear_rollups()
+ *  @brief tiers never synced, the minute one cut mid bucket and the last
+ *         hour bucket a stale page
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_rollups(const char *path, const char *idx_path, uint32_t blocks)
+{
+    char tier[MAX_PATH_SIZE];
+    struct stat st;
+    uint8_t stale[sizeof(acq_rollup_t)];
+    int fd;
+
+    (void)path;
+    (void)idx_path;
+    recover_sidecar(tier, sizeof(tier), recover_tier_ext[k_acq_rollup_minute]);
+    recover_must(stat(tier, &st) == 0 && truncate(tier, st.st_size / 2 + 7) == 0, "tear the minute tier");
+
+    memset(stale, 0xA5, sizeof(stale));
+    recover_sidecar(tier, sizeof(tier), recover_tier_ext[k_acq_rollup_hour]);
+    fd = open(tier, O_RDWR | O_CLOEXEC);
+    recover_must(fd >= 0 && fstat(fd, &st) == 0 &&
+        pwrite(fd, stale, sizeof(stale), st.st_size - sizeof(stale)) == sizeof(stale), "tear the hour tier");
+    close(fd);
+    return(blocks);
+}
+
+/**
+ *  @fn recover_write()
+ *  @brief writes full blocks of readings, one a second from first on
+ *  @param
+ *  @return
+ */
+static void recover_write(const char *path, uint32_t first, uint32_t blocks)
+{
+    acqui_st_t v = { .temperature = 25000, .pressure = 101325, .luminosity = 1000, .humidity = 60 };
+    acq_file_t *f;
+
+    f = acq_file_open(path, recover_format);
+    recover_must(f != NULL, "open the file");
+    for(uint32_t t = first; t < first + blocks * ACQ_BLOCK_RECORDS; t++) {
+        v.temperature += (t & 1) ? 3 : -2;
+        v.luminosity = t % 4096;
+        recover_must(acq_file_append_val(&v, f, t) == 0, "append");
+    }
+    acq_file_close(f, NULL);
+}
+
+/**
+ *  @fn recover_tear_rotated()
+ *  @brief file rotated by size into a segment of the same day, a new live
+ *         file written after it and every tier lost
+ *  @param
+ *  @return
+ */
+static uint32_t recover_tear_rotated(const char *path, const char *idx_path, uint32_t blocks)
+{
+    char seg[MAX_PATH_SIZE];
+    char tier[MAX_PATH_SIZE];
+    uint32_t last = blocks * ACQ_BLOCK_RECORDS;
+
+    snprintf(seg, sizeof(seg), "%s/" ACQ_SEGMENT_FMT ".dat", recover_dev, 1, last);
+    recover_must(rename(path, seg) == 0, "rotate the data");
+    snprintf(seg, sizeof(seg), "%s/" ACQ_SEGMENT_FMT ".idx", recover_dev, 1, last);
+    recover_must(rename(idx_path, seg) == 0, "rotate the index");
+    recover_write(path, last + 1, blocks);
+
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        recover_sidecar(tier, sizeof(tier), recover_tier_ext[t]);
+        recover_must(truncate(tier, 0) == 0, "drop a tier");
+    }
+    return(blocks);
+}
+
+/**
+ *  @fn recover_count()
+ *  @brief scan callback counting records and checking they follow each other
+ *  @param
+ *  @return
+ */
+static bool recover_count(const acq_record_t *rec, size_t count, void *arg)
+{
+    uint32_t *n = arg;
+
+    for(size_t i = 0; i < count; i++) {
+        if(rec[i].timestamp != *n + 1 || rec[i].val.luminosity != rec[i].timestamp % 4096) {
+            return(false);
+        }
+        (*n)++;
+    }
+    return(true);
+}
+
+/**
+ *  @fn recover_sum()
+ *  @brief scan callback summing the temperatures
+ *  @param
+ *  @return
+ */
+static bool recover_sum(const acq_record_t *rec, size_t count, void *arg)
+{
+    int64_t *sum = arg;
+
+    for(size_t i = 0; i < count; i++) {
+        *sum += rec[i].val.temperature;
+    }
+    return(true);
+}
+
+/**
+ *  @fn recover_tier_cb()
+ *  @brief rollup scan callback checking each bucket against the records
+ *         it covers
+ *  @param
+ *  @return
+ */
+static bool recover_tier_cb(const acq_rollup_t *bucket, size_t count, void *arg)
+{
+    recover_tier_t *c = arg;
+    int64_t sum;
+    size_t n;
+
+    for(size_t i = 0; i < count; i++) {
+        sum = 0;
+        n = acq_store_scan(recover_dev, bucket[i].start, bucket[i].start + c->period - 1, recover_sum, &sum);
+        if(bucket[i].start % c->period || n != bucket[i].count || sum != bucket[i].sum[0]) {
+            c->bad = true;
+        }
+        c->records += bucket[i].count;
+    }
+    return(!c->bad);
+}
+
+/**
+ *  @fn recover_check_tiers()
+ *  @brief checks every tier accounts for exactly the records left
+ *  @param
+ *  @return NULL when they do, what is wrong otherwise
+ */
+static const char *recover_check_tiers(const char *path)
+{
+    recover_tier_t c;
+    acq_reader_t *r;
+    uint64_t records;
+    int64_t sum = 0;
+
+    records = acq_store_scan(recover_dev, 0, UINT32_MAX, recover_sum, &sum);
+    r = acq_reader_open(path);
+    if(r == NULL) {
+        return("reader failed");
+    }
+    for(int t = 0; t < k_acq_rollup_tiers; t++) {
+        c.period = recover_tier_period[t];
+        c.records = 0;
+        c.bad = false;
+        acq_file_scan_rollup(r, t, 0, UINT32_MAX, recover_tier_cb, &c);
+        if(c.bad || c.records != records) {
+            acq_reader_close(r);
+            return("rollups do not match the records");
+        }
+    }
+    acq_reader_close(r);
+    return(NULL);
+}
+
+/**
+ *  @fn recover_check()
+ *  @brief checks data and index hold exactly the expected blocks
+ *  @param
+ *  @return NULL when they do, what is wrong otherwise
+ */
+static const char *recover_check(const char *path, const char *idx_path, uint32_t expect)
+{
+    acq_block_hdr_t hdr;
+    acq_index_entry_t e;
+    acq_reader_t *r;
+    struct stat st;
+    uint64_t off = 0;
+    uint32_t first = 1;
+    uint32_t records;
+    const char *err = NULL;
+    int fd;
+    int idx_fd;
+
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    idx_fd = open(idx_path, O_RDONLY | O_CLOEXEC);
+    if(fd < 0 || idx_fd < 0 || fstat(idx_fd, &st) < 0) {
+        err = "files missing";
+        goto cleanup;
+    }
+    if(st.st_size != (off_t)(expect * sizeof(e))) {
+        err = "wrong index size";
+        goto cleanup;
+    }
+
+    for(uint32_t i = 0; i < expect; i++) {
+        if(pread(idx_fd, &e, sizeof(e), (off_t)i * sizeof(e)) != sizeof(e) ||
+            pread(fd, &hdr, sizeof(hdr), e.offset) != sizeof(hdr)) {
+            err = "index unreadable";
+            goto cleanup;
+        }
+        if(e.offset != off || e.size != hdr.size || e.count != hdr.count ||
+            e.first_ts != hdr.first_ts || e.last_ts != hdr.last_ts) {
+            err = "index does not match the blocks";
+            goto cleanup;
+        }
+        first = (i == 0) ? e.first_ts : first;
+        off += e.size;
+    }
+    if(fstat(fd, &st) < 0 || (uint64_t)st.st_size != off) {
+        err = "data not cut after the last block";
+        goto cleanup;
+    }
+
+    r = acq_reader_open(path);
+    if(r == NULL) {
+        err = "reader failed";
+        goto cleanup;
+    }
+    records = first - 1;
+    acq_file_scan(r, 0, UINT32_MAX, recover_count, &records);
+    acq_reader_close(r);
+    if(records - (first - 1) != expect * ACQ_BLOCK_RECORDS) {
+        err = "records lost";
+        goto cleanup;
+    }
+    err = recover_check_tiers(path);
+
+cleanup:
+    if(fd >= 0) {
+        close(fd);
+    }
+    if(idx_fd >= 0) {
+        close(idx_fd);
+    }
+    return(err);
+}
+
+/**
+ *  @fn recover_clear()
+ *  @brief removes every file of the device directory
+ *  @param
+ *  @return
+ */
+static void recover_clear(void)
+{
+    char path[MAX_PATH_SIZE];
+    struct dirent *e;
+    DIR *d;
+
+    d = opendir(recover_dev);
+    if(d == NULL) {
+        return;
+    }
+    while((e = readdir(d)) != NULL) {
+        if(e->d_name[0] != '.') {
+            snprintf(path, sizeof(path), "%s/%s", recover_dev, e->d_name);
+            unlink(path);
+        }
+    }
+    closedir(d);
+}
+
+/**
+ *  @fn recover_cleanup()
+ *  @brief removes the scratch directories
+ *  @param
+ *  @return
+ */
+static void recover_cleanup(void)
+{
+    recover_clear();
+    rmdir(recover_dev);
+    rmdir(recover_dir);
+}
+
+
+/** cases, in the order they run */
+static const recover_case_t recover_list[] = {
+    { "index_tail_torn",        recover_tear_index_tail },
+    { "index_tail_zeros",       recover_tear_index_zeros },
+    { "index_lost",             recover_tear_index_lost },
+    { "data_tail_torn",         recover_tear_data_tail },
+    { "unindexed_block_torn",   recover_tear_unindexed },
+    { "indexed_block_torn",     recover_tear_indexed },
+    { "rollups_torn",           recover_tear_rollups },
+    { "rotated_same_day",       recover_tear_rotated },
+};
+
+
+/**
+ *  @fn main()
+ *  @brief recovery check entry point
+ *  @param
+ *  @return
+ */
+int main(int argc, char **argv)
+{
+    static const acq_file_format_t formats[] = { k_acq_format_raw, k_acq_format_columnar };
+    char path[MAX_PATH_SIZE];
+    char idx_path[MAX_PATH_SIZE];
+    uint32_t blocks = RECOVER_BLOCKS;
+    uint32_t expect;
+    const char *err;
+    int failed = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "n:h")) != -1) {
+        switch(opt) {
+        case 'n':
+            blocks = (uint32_t)atoi(optarg);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n blocks]\n", argv[0]);
+            return((opt == 'h') ? 0 : -1);
+        }
+    }
+    if(blocks < 4) {
+        fprintf(stderr, "ERROR: At least 4 blocks are needed to tear one in the middle.\n");
+        return(-1);
+    }
+
+    if(mkdtemp(recover_dir) == NULL) {
+        fprintf(stderr, "ERROR: Failed to create the scratch directory.\n");
+        return(-1);
+    }
+    snprintf(recover_dev, sizeof(recover_dev), "%s/dev", recover_dir);
+    if(mkdir(recover_dev, 0755) < 0) {
+        rmdir(recover_dir);
+        return(-1);
+    }
+    atexit(recover_cleanup);
+
+    snprintf(path, sizeof(path), "%s/%s", recover_dev, ACQ_FILE_NAME);
+    snprintf(idx_path, sizeof(idx_path), "%s/%.*s.idx", recover_dev,
+        (int)(strlen(ACQ_FILE_NAME) - strlen(".dat")), ACQ_FILE_NAME);
+
+    for(size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+        for(size_t i = 0; i < sizeof(recover_list) / sizeof(recover_list[0]); i++) {
+            recover_clear();
+            recover_format = formats[f];
+            recover_write(path, 1, blocks);
+            err = recover_check(path, idx_path, blocks);
+            if(err == NULL) {
+                expect = recover_list[i].tear(path, idx_path, blocks);
+                fflush(stdout);
+                if(acq_file_recover(recover_dir) != 1) {
+                    err = "recovery failed";
+                } else {
+                    err = recover_check(path, idx_path, expect);
+                }
+            }
+
+            printf("%-8s %-24s %s%s\n", (formats[f] == k_acq_format_raw) ? "raw" : "columnar",
+                recover_list[i].name, (err == NULL) ? "ok" : "FAIL: ", (err == NULL) ? "" : err);
+            failed += (err != NULL);
+        }
+    }
+
+    return(failed ? -1 : 0);
+}
@@ -0,0 +1,310 @@
+/**
+ *          THE BeeInformed Team
+ *  @file stress.c
+ *  @brief device table under connect and disconnect churn with concurrent
+ *         readers, checks no reader ever touches a released device
+ *
+ *  usage: stress.out [-d seconds] [-r readers] [-w writers] [-n devices]
+ *                    [-m] [-j]
+ *
+ *  Writers keep inserting and removing devices, retiring them through the
+ *  epoch reclaimer. Readers walk the table as the downstream fan out does
+ *  and check every device they meet is alive. Released devices are
+ *  poisoned and held in quarantine for a while before going back to
+ *  malloc, so a late reader finds the poison rather than a new device.
+ *  -m walks under the table mutex and frees right away instead, the
+ *  locking the table replaced, for comparison.
+ */
+
+#include "beeinformed_gateway.h"
+
+
+/** defaults of the command line */
+#define STRESS_SECONDS              3
+#define STRESS_READERS              4
+#define STRESS_WRITERS              2
+#define STRESS_DEVICES              64
+
+/** released devices kept poisoned before they are freed, per thread */
+#define STRESS_QUARANTINE           4096
+
+#define STRESS_ALIVE                0xA11FEB0A11FEB0AULL
+#define STRESS_DEAD                 0xDEADB0DEDEADB0DEULL
+
+/** fake device, the size of a handle is not what is measured */
+typedef struct {
+    _Atomic uint64_t magic;
+    _Atomic uint64_t queued;
+    int slot;
+    epoch_node_t retire;
+}stress_dev_t;
+
+/** per thread figures, each on its own line */
+typedef struct {
+    uint64_t walks __attribute__((aligned(EPOCH_CACHE_LINE_SIZE)));
+    uint64_t visits;
+    uint64_t inserts;
+    uint64_t removes;
+    uint64_t full;
+    uint64_t violations;
+    pthread_t thread;
+    uint32_t id;
+}stress_worker_t;
+
+
+/** static variables */
+static devtab_t stress_table = DEVTAB_STATIC_INIT;
+static _Atomic bool stress_run = true;
+static bool stress_mutex = false;
+static uint32_t stress_devices = STRESS_DEVICES;
+
+static __thread stress_dev_t *stress_quarantine[STRESS_QUARANTINE];
+static __thread uint32_t stress_quarantine_next;
+
+
+/** static functions */
+
+/**
+ *  @fn stress_now_ns()
+ *  @brief monotonic time in nanoseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t stress_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+
+/**
+ *  @fn stress_free()
+ *  @brief poisons a device and frees the one it evicts from quarantine
+ *  @param
+ *  @return
+ */
+static void stress_free(stress_dev_t *d)
+{
+    uint32_t i = stress_quarantine_next++ % STRESS_QUARANTINE;
+
+    atomic_store_explicit(&d->magic, STRESS_DEAD, memory_order_relaxed);
+    free(stress_quarantine[i]);
+    stress_quarantine[i] = d;
+}
+
+/**
+ *  @fn stress_release()
+ *  @brief epoch release of a device
+ *  @param
+ *  @return
+ */
+static void stress_release(epoch_node_t *node)
+{
+    stress_free(CONTAINER_OF(node, stress_dev_t, retire));
+}
+
+/**
+ *  @fn stress_reader_thread()
+ *  @brief walks the table like the downstream fan out
+ *  @param
+ *  @return
+ */
+static void *stress_reader_thread(void *args)
+{
+    stress_worker_t *w = args;
+    stress_dev_t *d;
+    uint32_t i;
+
+    while(atomic_load_explicit(&stress_run, memory_order_relaxed)) {
+        if(stress_mutex) {
+            pthread_mutex_lock(&stress_table.mutex);
+        } else {
+            epoch_enter();
+        }
+
+        DEVTAB_FOR_EACH(&stress_table, i, d) {
+            if(atomic_load_explicit(&d->magic, memory_order_relaxed) != STRESS_ALIVE) {
+                w->violations++;
+                continue;
+            }
+            atomic_fetch_add_explicit(&d->queued, 1, memory_order_relaxed);
+            w->visits++;
+        }
+
+        if(stress_mutex) {
+            pthread_mutex_unlock(&stress_table.mutex);
+        } else {
+            epoch_exit();
+        }
+        w->walks++;
+    }
+    return(NULL);
+}
+
+/**
+ *  @fn stress_writer_thread()
+ *  @brief connects and disconnects its share of the devices at random
+ *  @param
+ *  @return
+ */
+static void *stress_writer_thread(void *args)
+{
+    stress_worker_t *w = args;
+    stress_dev_t **own = calloc(stress_devices, sizeof(*own));
+    uint32_t seed = 2463534242u + w->id;
+    uint32_t n;
+
+    assert(own != NULL);
+    while(atomic_load_explicit(&stress_run, memory_order_relaxed)) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        n = seed % stress_devices;
+
+        if(own[n] == NULL) {
+            stress_dev_t *d = calloc(1, sizeof(*d));
+
+            assert(d != NULL);
+            atomic_store_explicit(&d->magic, STRESS_ALIVE, memory_order_relaxed);
+            d->slot = devtab_insert(&stress_table, d);
+            if(d->slot < 0) {
+                free(d);
+                w->full++;
+                continue;
+            }
+            own[n] = d;
+            w->inserts++;
+        } else {
+            devtab_remove(&stress_table, own[n]->slot);
+            if(stress_mutex) {
+                stress_free(own[n]);
+            } else {
+                epoch_retire(&own[n]->retire, stress_release);
+            }
+            own[n] = NULL;
+            w->removes++;
+        }
+    }
+
+    for(n = 0; n < stress_devices; n++) {
+        if(own[n] != NULL) {
+            devtab_remove(&stress_table, own[n]->slot);
+            if(stress_mutex) {
+                stress_free(own[n]);
+            } else {
+                epoch_retire(&own[n]->retire, stress_release);
+            }
+        }
+    }
+    free(own);
+    return(NULL);
+}
+
+
+/**
+ *  @fn main()
+ *  @brief stress entry point
+ *  @param
+ *  @return
+ */
+int main(int argc, char **argv)
+{
+    stress_worker_t *readers;
+    stress_worker_t *writers;
+    stress_worker_t sum = {0};
+    uint32_t n_readers = STRESS_READERS;
+    uint32_t n_writers = STRESS_WRITERS;
+    double seconds = STRESS_SECONDS;
+    bool json = false;
+    uint64_t t0;
+    double secs;
+    int opt;
+
+    while((opt = getopt(argc, argv, "d:r:w:n:mjh")) != -1) {
+        switch(opt) {
+        case 'd':
+            seconds = atof(optarg);
+            break;
+        case 'r':
+            n_readers = (uint32_t)atoi(optarg);
+            break;
+        case 'w':
+            n_writers = (uint32_t)atoi(optarg);
+            break;
+        case 'n':
+            stress_devices = (uint32_t)atoi(optarg);
+            break;
+        case 'm':
+            stress_mutex = true;
+            break;
+        case 'j':
+            json = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-d seconds] [-r readers] [-w writers] [-n devices] [-m] [-j]\n", argv[0]);
+            return((opt == 'h') ? 0 : -1);
+        }
+    }
+    if(!n_writers || !stress_devices || seconds <= 0) {
+        fprintf(stderr, "ERROR: At least one writer, one device and some time are needed.\n");
+        return(-1);
+    }
+
+    readers = calloc(n_readers + 1, sizeof(*readers));
+    writers = calloc(n_writers, sizeof(*writers));
+    assert(readers != NULL && writers != NULL);
+
+    if(!stress_mutex && epoch_start() < 0) {
+        return(-1);
+    }
+
+    t0 = stress_now_ns();
+    for(uint32_t i = 0; i < n_writers; i++) {
+        writers[i].id = i;
+        pthread_create(&writers[i].thread, NULL, stress_writer_thread, &writers[i]);
+    }
+    for(uint32_t i = 0; i < n_readers; i++) {
+        readers[i].id = i;
+        pthread_create(&readers[i].thread, NULL, stress_reader_thread, &readers[i]);
+    }
+
+    usleep((useconds_t)(seconds * 1e6));
+    atomic_store(&stress_run, false);
+
+    for(uint32_t i = 0; i < n_readers; i++) {
+        pthread_join(readers[i].thread, NULL);
+        sum.walks += readers[i].walks;
+        sum.visits += readers[i].visits;
+        sum.violations += readers[i].violations;
+    }
+    for(uint32_t i = 0; i < n_writers; i++) {
+        pthread_join(writers[i].thread, NULL);
+        sum.inserts += writers[i].inserts;
+        sum.removes += writers[i].removes;
+        sum.full += writers[i].full;
+    }
+    secs = (stress_now_ns() - t0) / 1e9;
+
+    if(!stress_mutex) {
+        epoch_finish();
+    }
+
+    if(json) {
+        printf("{\"stress\":\"devtab\",\"mode\":\"%s\",\"readers\":%u,\"writers\":%u,\"devices\":%u,"
+            "\"seconds\":%.2f,\"walks_per_s\":%.0f,\"visits_per_s\":%.0f,\"churn_per_s\":%.0f,"
+            "\"full\":%llu,\"violations\":%llu,\"left\":%u}\n",
+            (stress_mutex) ? "mutex" : "epoch", n_readers, n_writers, stress_devices, secs,
+            sum.walks / secs, sum.visits / secs, (sum.inserts + sum.removes) / secs,
+            (unsigned long long)sum.full, (unsigned long long)sum.violations, devtab_count(&stress_table));
+    } else {
+        printf("%s walks, %u readers, %u writers of %u devices each, %.2f s\n",
+            (stress_mutex) ? "mutex" : "epoch", n_readers, n_writers, stress_devices, secs);
+        printf("  %.0f walks/s, %.0f devices visited/s, %.0f connects and disconnects/s, %llu refused\n",
+            sum.walks / secs, sum.visits / secs, (sum.inserts + sum.removes) / secs, (unsigned long long)sum.full);
+        printf("  %llu released devices seen, %u devices left in the table\n",
+            (unsigned long long)sum.violations, devtab_count(&stress_table));
+    }
+
+    return((sum.violations || devtab_count(&stress_table)) ? -1 : 0);
+}
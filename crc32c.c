@@ -0,0 +1,173 @@
+/**
+ *          THE BeeInformed Team
+ *  @file crc32c.c
+ *  @brief CRC32C (Castagnoli) used to frame everything the gateway persists
+ */
+
+#include "beeinformed_gateway.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#elif defined(__aarch64__)
+#include <arm_acle.h>
+#include <sys/auxv.h>
+#include <asm/hwcap.h>
+#endif
+
+/** reflected Castagnoli polynomial */
+#define CRC32C_POLY     0x82F63B78
+
+typedef uint32_t (*crc32c_fn_t)(uint32_t crc, const uint8_t *p, size_t size);
+
+/** static variables */
+static uint32_t crc32c_table[8][256];
+static pthread_once_t crc32c_once = PTHREAD_ONCE_INIT;
+static crc32c_fn_t crc32c_fn = NULL;
+static const char *crc32c_name = "none";
+
+
+/** static functions */
+
+/**
+ *  @fn crc32c_sw()
+ *  @brief portable slicing by 8 implementation
+ *  @param
+ *  @return
+ */
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t size)
+{
+    while(size && ((uintptr_t)p & 7)) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+        size--;
+    }
+
+    while(size >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        v ^= crc;
+        crc = crc32c_table[7][v & 0xFF] ^ crc32c_table[6][(v >> 8) & 0xFF] ^
+              crc32c_table[5][(v >> 16) & 0xFF] ^ crc32c_table[4][(v >> 24) & 0xFF] ^
+              crc32c_table[3][(v >> 32) & 0xFF] ^ crc32c_table[2][(v >> 40) & 0xFF] ^
+              crc32c_table[1][(v >> 48) & 0xFF] ^ crc32c_table[0][v >> 56];
+        p += 8;
+        size -= 8;
+    }
+
+    while(size--) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return(crc);
+}
+
+#if defined(__x86_64__)
+/**
+ *  @fn crc32c_sse42()
+ *  @brief SSE4.2 crc32 instruction, 8 bytes per step
+ *  @param
+ *  @return
+ */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const uint8_t *p, size_t size)
+{
+    uint64_t c = crc;
+
+    while(size && ((uintptr_t)p & 7)) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+        size--;
+    }
+    while(size >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        size -= 8;
+    }
+    while(size--) {
+        c = _mm_crc32_u8((uint32_t)c, *p++);
+    }
+    return((uint32_t)c);
+}
+#elif defined(__aarch64__)
+/**
+ *  @fn crc32c_armv8()
+ *  @brief ARMv8 crc32c instructions, 8 bytes per step
+ *  @param
+ *  @return
+ */
+__attribute__((target("+crc")))
+static uint32_t crc32c_armv8(uint32_t crc, const uint8_t *p, size_t size)
+{
+    while(size && ((uintptr_t)p & 7)) {
+        crc = __crc32cb(crc, *p++);
+        size--;
+    }
+    while(size >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+        p += 8;
+        size -= 8;
+    }
+    while(size--) {
+        crc = __crc32cb(crc, *p++);
+    }
+    return(crc);
+}
+#endif
+
+/**
+ *  @fn crc32c_select()
+ *  @brief picks the fastest implementation the cpu runs
+ *  @param
+ *  @return
+ */
+static void crc32c_select(void)
+{
+    crc32c_fn_t fn = crc32c_sw;
+
+    for(uint32_t i = 0; i < 256; i++) {
+        uint32_t c = i;
+
+        for(int k = 0; k < 8; k++) {
+            c = (c & 1) ? (c >> 1) ^ CRC32C_POLY : c >> 1;
+        }
+        crc32c_table[0][i] = c;
+    }
+    for(uint32_t i = 0; i < 256; i++) {
+        for(int t = 1; t < 8; t++) {
+            crc32c_table[t][i] = crc32c_table[0][crc32c_table[t - 1][i] & 0xFF] ^ (crc32c_table[t - 1][i] >> 8);
+        }
+    }
+    crc32c_name = "table";
+
+#if defined(__x86_64__)
+    if(__builtin_cpu_supports("sse4.2")) {
+        fn = crc32c_sse42;
+        crc32c_name = "sse4.2";
+    }
+#elif defined(__aarch64__)
+    if(getauxval(AT_HWCAP) & HWCAP_CRC32) {
+        fn = crc32c_armv8;
+        crc32c_name = "armv8";
+    }
+#endif
+
+    crc32c_fn = fn;
+}
+
+
+/** public functions */
+uint32_t crc32c(uint32_t crc, const void *buf, size_t size)
+{
+    pthread_once(&crc32c_once, crc32c_select);
+    return(~crc32c_fn(~crc, buf, size));
+}
+
+const char *crc32c_impl_name(void)
+{
+    pthread_once(&crc32c_once, crc32c_select);
+    return(crc32c_name);
+}
@@ -9,6 +9,20 @@
 
 #define  MAIN_LOOP_SLEEP_PERIOD     (useconds_t)(1000 * 1000 * 60)
 
+/** disk the gateway may take and the compactor io limit, the log keeps
+ *  to its own share and the device data gets the rest */
+#define  BEEINFO_DISK_BUDGET        ((uint64_t)2 * 1024 * 1024 * 1024)
+#define  BEEINFO_COMPACT_RATE       (1024 * 1024)
+
+/** NMEA source, the receiver tty or a recorded log to replay */
+#define  BEEINFO_GPS_DEVICE         "/dev/ttyUSB0"
+
+/** binary log, read it with tools/beelog */
+#define  BEEINFO_LOG_PATH           "beeinformed/gateway.blog"
+
+/** edge node firmware, hives are updated while it is there */
+#define  BEEINFO_OTA_IMAGE          "beeinformed/edge_fw.bin"
+
 /** static variables */
 static FILE *cfg_fp = NULL;
 char cfg_path[] = "beeinformed/beeinformed.cfg";
@@ -21,14 +35,38 @@ char cfg_path[] = "beeinformed/beeinformed.cfg";
  */
 static void app_exit(int arg)
 {
+    (void)arg;
+
     printf("--------------------%s: BeeInformed application was interrupted, exiting! --------------------------- \n\r", __func__);
     beeinformed_app_ble_finish();
+    epoch_finish();
+    app_stats_finish();
+    app_trace_finish();
+    beeinformed_app_ota_finish();
     beeinformed_app_gps_finish();
+    acq_store_finish();
+    audio_file_finish();
+    acq_file_finish();
+    app_timer_finish();
+    sched_finish();
+    app_log_finish();
     printf("-----------------------------%s: BeeInformed is safe to exit! --------------------------------------- \n\r", __func__);
     exit(0);
 }
 
 
+/**
+ *  @fn app_log_verbosity()
+ *  @brief SIGUSR1 makes the log more verbose, SIGUSR2 quieter
+ *  @param
+ *  @return
+ */
+static void app_log_verbosity(int arg)
+{
+    app_log_set_level(atomic_load(&app_log_level) + ((arg == SIGUSR1) ? 1 : -1));
+}
+
+
 /**
  *  @fn main()
  *  @brief BeeInformed Main application entry point 
@@ -37,14 +75,37 @@ static void app_exit(int arg)
  */
 int main(int argc, char **argv)
 {
+    (void)argc;
+    (void)argv;
+
     /* the first task is to create the directory which will store the acquisition files */
     int err = mkdir("beeinformed",0644);
-    if(err < 0 ) {
+    if(err < 0 && errno != EEXIST) {
+        fprintf(stderr, "ERROR: Failed to create the beeinformed directory.\n");
+        return(-1);
+    } else if(err < 0) {
+        /* power may have been cut mid write, drop whatever did not make it */
         printf("-----------------Restoring the BeeInformedApplication!------------------------------ \n\r");
+        acq_file_recover("beeinformed");
     }else {
         printf("-----------------Creating the BeeHives monitoring environment!-----------------------\n\r");        
     }
 
+    /* every later step logs through it, BEEINFO_LOG_LEVEL sets how much */
+    char *level = getenv("BEEINFO_LOG_LEVEL");
+    if(level != NULL) {
+        int lvl = app_log_level_parse(level);
+
+        if(lvl < 0) {
+            fprintf(stderr, "ERROR: Unknown BEEINFO_LOG_LEVEL %s, use err, warn, info or debug.\n", level);
+        } else {
+            app_log_set_level(lvl);
+        }
+    }
+    app_log_start(BEEINFO_LOG_PATH);
+    signal(SIGUSR1, app_log_verbosity);
+    signal(SIGUSR2, app_log_verbosity);
+
     /* creates the configuration file */
     cfg_fp = fopen(cfg_path, "ab");
     fclose(cfg_fp);
@@ -54,8 +115,25 @@ int main(int argc, char **argv)
 
     /* with config file, passes the control to ble manager */
     printf("----------------------------Starting the beeinformed subtasks!-----------------------\n\r");
+    if(sched_start(0) < 0 || app_timer_start() < 0) {
+        fprintf(stderr, "ERROR: Failed to start the event loop.\n");
+        return(-1);
+    }
+    if(acq_file_start() < 0 || audio_file_start() < 0 ||
+        acq_store_start("beeinformed", BEEINFO_DISK_BUDGET - LOG_FILE_BUDGET, BEEINFO_COMPACT_RATE) < 0) {
+        return(-1);
+    }
+    beeinformed_app_ota_start(BEEINFO_OTA_IMAGE);
+    epoch_start();
+    app_stats_start();
+
+    /* BEEINFO_TRACE names a chrome trace file of the sensor cycles */
+    char *trace = getenv("BEEINFO_TRACE");
+    if(trace != NULL && *trace) {
+        app_trace_start(trace);
+    }
     beeinformed_app_ble_start(cfg_path);
-    beeinformed_app_gps_start();
+    beeinformed_app_gps_start(BEEINFO_GPS_DEVICE);
 
     for(;;) {
         usleep(MAIN_LOOP_SLEEP_PERIOD);
@@ -0,0 +1,87 @@
+/**
+ *          THE BeeInformed Team
+ *  @file gattlib.h
+ *  @brief simulated stand-in of the gattlib API subset used by the gateway
+ *
+ *  Only built by the sim target, the declarations mirror the real gattlib
+ *  so the gateway sources compile unchanged against both.
+ */
+
+#ifndef __SIM_GATTLIB_H
+#define __SIM_GATTLIB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/** bluez address types */
+#define BDADDR_BREDR            0x00
+#define BDADDR_LE_PUBLIC        0x01
+#define BDADDR_LE_RANDOM        0x02
+
+/** bluez sdp uuid representation, the one gattlib hands out */
+#define SDP_UUID16              0x19
+#define SDP_UUID32              0x1A
+#define SDP_UUID128             0x1C
+
+typedef struct {
+    uint8_t data[16];
+} uint128_t;
+
+typedef struct {
+    uint8_t type;
+    union {
+        uint16_t uuid16;
+        uint32_t uuid32;
+        uint128_t uuid128;
+    } value;
+} uuid_t;
+
+#define CREATE_UUID16(value16)  { .type = SDP_UUID16, .value.uuid16 = (value16) }
+
+typedef enum {
+    BT_SEC_SDP = 0,
+    BT_SEC_LOW,
+    BT_SEC_MEDIUM,
+    BT_SEC_HIGH,
+} gattlib_bt_sec_level_t;
+
+/** opaque connection, one per simulated node */
+typedef struct _gatt_connection_t gatt_connection_t;
+
+typedef struct {
+    uint16_t attr_handle_start;
+    uint16_t attr_handle_end;
+    uuid_t uuid;
+} gattlib_primary_service_t;
+
+typedef struct {
+    uint16_t handle;
+    uint8_t properties;
+    uint16_t value_handle;
+    uuid_t uuid;
+} gattlib_characteristic_t;
+
+typedef void (*gattlib_discovered_device_t)(const char* addr, const char* name);
+typedef void (*gatt_event_cb_t)(const uuid_t* uuid, const uint8_t* data, size_t data_length, void* user_data);
+
+
+gatt_connection_t *gattlib_connect(const char *src, const char *dst,
+                uint8_t dest_type, gattlib_bt_sec_level_t sec_level, int psm, int mtu);
+int gattlib_disconnect(gatt_connection_t* connection);
+
+int gattlib_adapter_open(const char* adapter_name, void** adapter);
+int gattlib_adapter_scan_enable(void* adapter, gattlib_discovered_device_t discovered_device_cb, int timeout);
+int gattlib_adapter_scan_disable(void* adapter);
+int gattlib_adapter_close(void* adapter);
+
+int gattlib_discover_primary(gatt_connection_t* connection, gattlib_primary_service_t** services, int* services_count);
+int gattlib_discover_char(gatt_connection_t* connection, gattlib_characteristic_t** characteristics, int* characteristic_count);
+
+int gattlib_read_char_by_uuid(gatt_connection_t* connection, uuid_t* uuid, void* buffer, size_t* buffer_len);
+int gattlib_write_char_by_handle(gatt_connection_t* connection, uint16_t handle, const void* buffer, size_t buffer_len);
+int gattlib_write_without_response_char_by_handle(gatt_connection_t* connection, uint16_t handle, const void* buffer, size_t buffer_len);
+void gattlib_register_notification(gatt_connection_t* connection, gatt_event_cb_t notification_handler, void* user_data);
+
+int gattlib_uuid_to_string(const uuid_t *uuid, char *str, size_t size);
+
+#endif
@@ -0,0 +1,1135 @@
+/**
+ *          THE BeeInformed Team
+ *  @file sim_gattlib.c
+ *  @brief simulated gattlib backend and beeinformed edge node load generator
+ *
+ *  Every node answers k_get_sensors with a multi packet ble_data_t response
+ *  delivered from a single notification thread, after a configurable
+ *  latency, jitter and loss. k_get_audio is answered with a stream of full
+ *  k_sequence_packet fragments of a synthetic hive hum, each one scheduled
+ *  as the previous is delivered. Downstream k_data_packet frames are
+ *  decoded back into records and checked, fed by a generator that sends
+ *  user data and node requisitions through beeinformed_app_ble_send_data().
+ *  Firmware fragments written without response queue on a per node link of
+ *  fixed air time, lose like notifications do and are acknowledged every
+ *  few fragments, or right away on a hole, with what the node holds. What
+ *  a node stored survives a dropped link. The knobs come from the
+ *  environment:
+ *
+ *  BEEINFO_SIM_NODES        number of simulated hives (16)
+ *  BEEINFO_SIM_LATENCY_US   command to first fragment latency (2000)
+ *  BEEINFO_SIM_JITTER_US    uniform jitter added to every fragment (1000)
+ *  BEEINFO_SIM_GAP_US       gap between fragments of a response (100)
+ *  BEEINFO_SIM_LOSS         fragment loss, per thousand (0)
+ *  BEEINFO_SIM_FRAG         payload bytes per fragment (4)
+ *  BEEINFO_SIM_CONNECT_US   connection establishment time (20000)
+ *  BEEINFO_SIM_DISCOVER_US  gatt database discovery time (50000)
+ *  BEEINFO_SIM_DB_REV       revision of the node attribute database, its hash (1)
+ *  BEEINFO_SIM_WRITE_US     write with response round trip (0)
+ *  BEEINFO_SIM_AUDIO_GAP_US gap between audio fragments (200)
+ *  BEEINFO_SIM_DOWN_RATE    downstream messages offered per second (200)
+ *  BEEINFO_SIM_DOWN_SIZE    downstream user data payload bytes (8)
+ *  BEEINFO_SIM_LINK_US      air time of a write without response (1250)
+ *  BEEINFO_SIM_OTA_DROP     firmware fragments dropping the link, per thousand (0)
+ *  BEEINFO_SIM_DURATION     seconds before the run is stopped, 0 runs forever (10)
+ *  BEEINFO_SIM_SEED         random seed (1)
+ */
+
+#include "beeinformed_gateway.h"
+#include <math.h>
+
+/** simulated handles, must match the edge node firmware */
+#define SIM_TX_HANDLE           0x0010
+#define SIM_NOTI_HANDLE         0x0013
+#define SIM_DB_HASH_HANDLE      0x000C
+#define SIM_DB_HASH_UUID        0x2B2A
+
+/** latency histogram geometry, log2 buckets split in linear sub buckets */
+#define SIM_HIST_SUB_BITS       4
+#define SIM_HIST_SUB            (1 << SIM_HIST_SUB_BITS)
+#define SIM_HIST_BUCKETS        (40 * SIM_HIST_SUB)
+
+/** firmware acknowledgement policy of the nodes */
+#define SIM_OTA_ACK_EVERY       8
+#define SIM_OTA_ACK_DELAY_US    5000
+
+/** pending notifications heap size */
+#define SIM_MAX_PENDING         (64 * 1024)
+
+/** one in flight notification */
+typedef struct {
+    uint64_t due;
+    struct _gatt_connection_t *node;
+    uint32_t generation;
+    bool last;
+    bool audio;
+    bool to_node;
+    bool ota_ack;
+    ble_data_t packet;
+} sim_event_t;
+
+/** simulated node, it is also the connection handle */
+struct _gatt_connection_t {
+    char addr[18];
+    pthread_mutex_t lock;
+    gatt_event_cb_t cb;
+    void *user_data;
+    uint32_t generation;
+    bool connected;
+    uint32_t seq;
+    uint64_t last_cmd;
+    bool last_complete;
+    bool lost;
+    uint32_t audio_left;
+    uint32_t audio_sample;
+    uint8_t audio_seq;
+    bool down_started;
+    uint8_t down_seq;
+    uint32_t down_hdr;
+    uint32_t down_left;
+    uint64_t link_free;
+    uint32_t ota_size;
+    uint32_t ota_crc;
+    uint32_t ota_frags;
+    uint32_t ota_cum;
+    uint32_t ota_since_ack;
+    bool ota_ack_pending;
+    uint8_t *ota_image;
+    uint8_t *ota_have;
+};
+
+/** configuration */
+static uint32_t sim_nodes = 16;
+static uint32_t sim_latency_us = 2000;
+static uint32_t sim_jitter_us = 1000;
+static uint32_t sim_gap_us = 100;
+static uint32_t sim_loss = 0;
+static uint32_t sim_frag = 4;
+static uint32_t sim_connect_us = 20000;
+static uint32_t sim_discover_us = 50000;
+static uint32_t sim_db_rev = 1;
+static uint32_t sim_write_us = 0;
+static uint32_t sim_audio_gap_us = 200;
+static uint32_t sim_down_rate = 200;
+static uint32_t sim_down_size = 8;
+static uint32_t sim_link_us = 1250;
+static uint32_t sim_ota_drop = 0;
+static uint32_t sim_duration = 10;
+
+/** static variables */
+static struct _gatt_connection_t *sim_node;
+static sim_event_t *sim_heap;
+static uint32_t sim_heap_len;
+static pthread_mutex_t sim_heap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_heap_cond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t sim_rand_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t sim_deliver_thread;
+static pthread_t sim_report_thread;
+static pthread_t sim_down_thread;
+static uint64_t sim_rand_state = 1;
+static uint64_t sim_start;
+
+static _Atomic uint64_t sim_cmds;
+static _Atomic uint64_t sim_readings;
+static _Atomic uint64_t sim_fragments;
+static _Atomic uint64_t sim_lost;
+static _Atomic uint64_t sim_dropped;
+static _Atomic uint64_t sim_connects;
+static _Atomic uint64_t sim_audio_bytes;
+static _Atomic uint64_t sim_down_msgs;
+static _Atomic uint64_t sim_down_frames;
+static _Atomic uint64_t sim_down_bad;
+static _Atomic uint64_t sim_ota_bytes;
+static _Atomic uint64_t sim_ota_frags;
+static _Atomic uint64_t sim_ota_dups;
+static _Atomic uint64_t sim_ota_updates;
+static _Atomic uint64_t sim_ota_bad;
+static _Atomic uint64_t sim_hist[SIM_HIST_BUCKETS];
+
+
+/** static functions */
+
+/**
+ *  @fn sim_now_us()
+ *  @brief monotonic time in microseconds
+ *  @param
+ *  @return
+ */
+static inline uint64_t sim_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+/**
+ *  @fn sim_rand()
+ *  @brief xorshift generator, seeded so runs are repeatable
+ *  @param
+ *  @return
+ */
+static uint32_t sim_rand(void)
+{
+    uint64_t x;
+
+    pthread_mutex_lock(&sim_rand_mutex);
+    x = sim_rand_state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    sim_rand_state = x;
+    pthread_mutex_unlock(&sim_rand_mutex);
+    return((uint32_t)(x >> 16));
+}
+
+/**
+ *  @fn sim_env()
+ *  @brief reads a numeric knob from the environment
+ *  @param
+ *  @return
+ */
+static uint32_t sim_env(const char *name, uint32_t def)
+{
+    const char *v = getenv(name);
+
+    return((v != NULL && *v) ? (uint32_t)strtoul(v, NULL, 0) : def);
+}
+
+/**
+ *  @fn sim_hist_record()
+ *  @brief records a latency sample in microseconds
+ *  @param
+ *  @return
+ */
+static void sim_hist_record(uint64_t us)
+{
+    uint32_t idx;
+
+    if(us < SIM_HIST_SUB) {
+        idx = (uint32_t)us;
+    } else {
+        uint32_t msb = 63 - __builtin_clzll(us);
+        uint32_t sub = (uint32_t)(us >> (msb - SIM_HIST_SUB_BITS)) & (SIM_HIST_SUB - 1);
+        idx = (msb - SIM_HIST_SUB_BITS + 1) * SIM_HIST_SUB + sub;
+    }
+    if(idx >= SIM_HIST_BUCKETS) {
+        idx = SIM_HIST_BUCKETS - 1;
+    }
+    atomic_fetch_add_explicit(&sim_hist[idx], 1, memory_order_relaxed);
+}
+
+/**
+ *  @fn sim_hist_value()
+ *  @brief lowest latency represented by a histogram bucket
+ *  @param
+ *  @return
+ */
+static uint64_t sim_hist_value(uint32_t idx)
+{
+    uint32_t major = idx / SIM_HIST_SUB;
+    uint32_t sub = idx % SIM_HIST_SUB;
+
+    if(!major) {
+        return(sub);
+    }
+    return((uint64_t)(SIM_HIST_SUB + sub) << (major - 1));
+}
+
+/**
+ *  @fn sim_hist_percentile()
+ *  @brief estimates a percentile of the recorded latencies
+ *  @param
+ *  @return
+ */
+static uint64_t sim_hist_percentile(const uint64_t *snap, uint64_t total, double p)
+{
+    uint64_t target = (uint64_t)(p * total / 100.0);
+    uint64_t acc = 0;
+
+    for(uint32_t i = 0; i < SIM_HIST_BUCKETS; i++) {
+        acc += snap[i];
+        if(acc > target) {
+            return(sim_hist_value(i));
+        }
+    }
+    return(0);
+}
+
+/**
+ *  @fn sim_report()
+ *  @brief prints the readings rate, cycle latency percentiles, the
+ *         downstream messages the nodes got and the firmware they stored
+ *  @param
+ *  @return
+ */
+static void sim_report(const char *tag, uint64_t readings, uint64_t audio, uint64_t down, uint64_t ota, double secs)
+{
+    uint64_t snap[SIM_HIST_BUCKETS];
+    uint64_t total = 0;
+
+    for(uint32_t i = 0; i < SIM_HIST_BUCKETS; i++) {
+        snap[i] = atomic_load_explicit(&sim_hist[i], memory_order_relaxed);
+        total += snap[i];
+    }
+
+    fprintf(stderr, "[SIM] %s: nodes=%u connects=%lu readings/s=%.1f cmds=%lu frags=%lu lost=%lu dropped=%lu "
+            "cycle_us p50=%lu p99=%lu p999=%lu audio_kB/s=%.1f down_msgs/s=%.1f down_frames=%lu down_bad=%lu "
+            "ota_kB/s=%.1f ota_frags=%lu ota_dups=%lu ota_done=%lu ota_bad=%lu\n", tag, sim_nodes,
+            (unsigned long)atomic_load(&sim_connects), readings / secs,
+            (unsigned long)atomic_load(&sim_cmds), (unsigned long)atomic_load(&sim_fragments),
+            (unsigned long)atomic_load(&sim_lost), (unsigned long)atomic_load(&sim_dropped),
+            (unsigned long)sim_hist_percentile(snap, total, 50.0),
+            (unsigned long)sim_hist_percentile(snap, total, 99.0),
+            (unsigned long)sim_hist_percentile(snap, total, 99.9), audio / secs / 1000.0, down / secs,
+            (unsigned long)atomic_load(&sim_down_frames), (unsigned long)atomic_load(&sim_down_bad),
+            ota / secs / 1000.0, (unsigned long)atomic_load(&sim_ota_frags), (unsigned long)atomic_load(&sim_ota_dups),
+            (unsigned long)atomic_load(&sim_ota_updates), (unsigned long)atomic_load(&sim_ota_bad));
+}
+
+/**
+ *  @fn sim_heap_push()
+ *  @brief queues a notification for delivery, with heap locked
+ *  @param
+ *  @return
+ */
+static void sim_heap_push(const sim_event_t *ev)
+{
+    uint32_t i;
+
+    if(sim_heap_len >= SIM_MAX_PENDING) {
+        atomic_fetch_add(&sim_dropped, 1);
+        return;
+    }
+
+    i = sim_heap_len++;
+    while(i && sim_heap[(i - 1) / 2].due > ev->due) {
+        sim_heap[i] = sim_heap[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sim_heap[i] = *ev;
+}
+
+/**
+ *  @fn sim_heap_pop()
+ *  @brief takes the earliest notification, with heap locked
+ *  @param
+ *  @return
+ */
+static void sim_heap_pop(sim_event_t *ev)
+{
+    sim_event_t last;
+    uint32_t i = 0;
+
+    *ev = sim_heap[0];
+    last = sim_heap[--sim_heap_len];
+
+    for(;;) {
+        uint32_t c = 2 * i + 1;
+
+        if(c >= sim_heap_len) {
+            break;
+        }
+        if(c + 1 < sim_heap_len && sim_heap[c + 1].due < sim_heap[c].due) {
+            c++;
+        }
+        if(sim_heap[c].due >= last.due) {
+            break;
+        }
+        sim_heap[i] = sim_heap[c];
+        i = c;
+    }
+    sim_heap[i] = last;
+}
+
+/**
+ *  @fn sim_audio_next()
+ *  @brief schedules the next fragment of an audio capture, with node locked
+ *  @param
+ *  @return
+ */
+static void sim_audio_next(struct _gatt_connection_t *node, uint64_t due)
+{
+    sim_event_t ev;
+    int16_t pcm[PACKET_MAX_PAYLOAD / sizeof(int16_t)];
+    uint32_t len = (node->audio_left < sizeof(pcm)) ? node->audio_left : sizeof(pcm);
+
+    /* worker bees hum around 250 Hz with a harmonic and some noise */
+    for(uint32_t i = 0; i < len / sizeof(int16_t); i++) {
+        double t = (double)node->audio_sample++ / AUDIO_SAMPLE_RATE;
+
+        pcm[i] = (int16_t)(8000.0 * sin(2.0 * M_PI * 250.0 * t) + 2000.0 * sin(2.0 * M_PI * 500.0 * t) +
+                (int32_t)(sim_rand() % 1024) - 512);
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.node = node;
+    ev.generation = node->generation;
+    ev.audio = true;
+    ev.due = due;
+    ev.packet.type = k_sequence_packet;
+    ev.packet.id = node->audio_seq++;
+    ev.packet.payload_size = (uint8_t)len;
+    memcpy(ev.packet.pack_data, pcm, len);
+    node->audio_left -= len;
+    ev.last = (node->audio_left == 0);
+    ev.packet.pack_amount = ev.last;
+
+    pthread_mutex_lock(&sim_heap_mutex);
+    sim_heap_push(&ev);
+    pthread_cond_signal(&sim_heap_cond);
+    pthread_mutex_unlock(&sim_heap_mutex);
+}
+
+/**
+ *  @fn sim_ota_ack_schedule()
+ *  @brief queues a firmware acknowledgement, with node locked
+ *  @param
+ *  @return
+ */
+static void sim_ota_ack_schedule(struct _gatt_connection_t *node, uint64_t due)
+{
+    sim_event_t ev;
+
+    if(sim_loss && (sim_rand() % 1000) < sim_loss) {
+        atomic_fetch_add(&sim_lost, 1);
+        return;
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.node = node;
+    ev.generation = node->generation;
+    ev.ota_ack = true;
+    ev.due = due;
+
+    pthread_mutex_lock(&sim_heap_mutex);
+    sim_heap_push(&ev);
+    pthread_cond_signal(&sim_heap_cond);
+    pthread_mutex_unlock(&sim_heap_mutex);
+}
+
+/**
+ *  @fn sim_ota_ack_send()
+ *  @brief notifies what the node holds, with node locked
+ *  @param
+ *  @return
+ */
+static void sim_ota_ack_send(struct _gatt_connection_t *node)
+{
+    ble_data_t ack = {0};
+    uint64_t sack = 0;
+
+    for(uint32_t b = 1; b < OTA_WINDOW && node->ota_cum + b < node->ota_frags; b++) {
+        sack |= (uint64_t)node->ota_have[node->ota_cum + b] << b;
+    }
+
+    ack.type = k_command_packet;
+    ack.id = k_fw_update;
+    ack.payload_size = OTA_ACK_SIZE;
+    memcpy(ack.pack_data, &node->ota_cum, sizeof(node->ota_cum));
+    memcpy(ack.pack_data + sizeof(node->ota_cum), &sack, sizeof(sack));
+    node->cb(NULL, (const uint8_t *)&ack, BLE_PACKET_HDR_SIZE + OTA_ACK_SIZE, node->user_data);
+}
+
+/**
+ *  @fn sim_ota_take()
+ *  @brief stores a firmware fragment that made it through, with node locked
+ *  @param
+ *  @return
+ */
+static void sim_ota_take(struct _gatt_connection_t *node, const sim_event_t *ev)
+{
+    uint32_t f = ev->packet.id | ((uint32_t)ev->packet.pack_amount << 8);
+
+    if(!node->ota_size || f >= node->ota_frags) {
+        return;
+    }
+    atomic_fetch_add_explicit(&sim_ota_frags, 1, memory_order_relaxed);
+
+    /* the node goes out of range, what it stored stays */
+    if(sim_ota_drop && (sim_rand() % 1000) < sim_ota_drop) {
+        node->connected = false;
+        node->cb = NULL;
+        node->user_data = NULL;
+        node->generation++;
+        return;
+    }
+
+    if(node->ota_have[f]) {
+        atomic_fetch_add_explicit(&sim_ota_dups, 1, memory_order_relaxed);
+    } else {
+        memcpy(node->ota_image + f * OTA_FRAG_SIZE, ev->packet.pack_data, ev->packet.payload_size);
+        node->ota_have[f] = 1;
+        atomic_fetch_add_explicit(&sim_ota_bytes, ev->packet.payload_size, memory_order_relaxed);
+        while(node->ota_cum < node->ota_frags && node->ota_have[node->ota_cum]) {
+            node->ota_cum++;
+        }
+    }
+
+    /* holes and the end are told right away, the rest every few fragments */
+    if(++node->ota_since_ack >= SIM_OTA_ACK_EVERY || f > node->ota_cum ||
+        node->ota_cum == node->ota_frags) {
+        node->ota_since_ack = 0;
+        sim_ota_ack_schedule(node, ev->due + sim_latency_us);
+    } else if(!node->ota_ack_pending) {
+        node->ota_ack_pending = true;
+        sim_ota_ack_schedule(node, ev->due + SIM_OTA_ACK_DELAY_US + sim_latency_us);
+    }
+}
+
+/**
+ *  @fn sim_ota_offer()
+ *  @brief answers k_fw_update, a new image wipes whatever was stored
+ *  @param
+ *  @return
+ */
+static void sim_ota_offer(struct _gatt_connection_t *node, const ble_data_t *cmd)
+{
+    uint32_t size;
+    uint32_t crc;
+
+    if(cmd->payload_size < BLE_OTA_REQ_SIZE) {
+        return;
+    }
+    memcpy(&size, cmd->pack_data, sizeof(size));
+    memcpy(&crc, cmd->pack_data + sizeof(size), sizeof(crc));
+    if(!size || size > OTA_MAX_FRAGS * OTA_FRAG_SIZE) {
+        return;
+    }
+
+    pthread_mutex_lock(&node->lock);
+    if(size != node->ota_size || crc != node->ota_crc) {
+        free(node->ota_image);
+        free(node->ota_have);
+        node->ota_size = size;
+        node->ota_crc = crc;
+        node->ota_frags = (size + OTA_FRAG_SIZE - 1) / OTA_FRAG_SIZE;
+        node->ota_cum = 0;
+        node->ota_image = calloc(node->ota_frags, OTA_FRAG_SIZE);
+        node->ota_have = calloc(node->ota_frags, 1);
+        assert(node->ota_image != NULL && node->ota_have != NULL);
+    }
+    node->ota_since_ack = 0;
+    node->ota_ack_pending = false;
+    sim_ota_ack_schedule(node, sim_now_us() + sim_latency_us);
+    pthread_mutex_unlock(&node->lock);
+}
+
+/**
+ *  @fn sim_ota_reboot()
+ *  @brief runs the stored image if it is whole and checks out
+ *  @param
+ *  @return
+ */
+static void sim_ota_reboot(struct _gatt_connection_t *node)
+{
+    pthread_mutex_lock(&node->lock);
+    if(node->ota_size) {
+        if(node->ota_cum == node->ota_frags &&
+            crc32c(0, node->ota_image, node->ota_size) == node->ota_crc) {
+            atomic_fetch_add(&sim_ota_updates, 1);
+        } else {
+            atomic_fetch_add(&sim_ota_bad, 1);
+        }
+        free(node->ota_image);
+        free(node->ota_have);
+        node->ota_image = NULL;
+        node->ota_have = NULL;
+        node->ota_size = 0;
+        node->ota_crc = 0;
+    }
+    pthread_mutex_unlock(&node->lock);
+}
+
+/**
+ *  @fn sim_deliver_thread_fn()
+ *  @brief the single notification producer of every simulated node
+ *  @param
+ *  @return
+ */
+static void *sim_deliver_thread_fn(void *args)
+{
+    sim_event_t ev;
+    (void)args;
+
+    for(;;) {
+        pthread_mutex_lock(&sim_heap_mutex);
+        for(;;) {
+            uint64_t now = sim_now_us();
+
+            if(sim_heap_len && sim_heap[0].due <= now) {
+                sim_heap_pop(&ev);
+                break;
+            }
+
+            if(!sim_heap_len) {
+                pthread_cond_wait(&sim_heap_cond, &sim_heap_mutex);
+            } else {
+                struct timespec ts;
+                uint64_t due = sim_heap[0].due;
+
+                /* condvar uses realtime clock, convert the monotonic due */
+                clock_gettime(CLOCK_REALTIME, &ts);
+                uint64_t abs_us = (uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000 + (due - now);
+                ts.tv_sec = abs_us / 1000000ULL;
+                ts.tv_nsec = (abs_us % 1000000ULL) * 1000;
+                pthread_cond_timedwait(&sim_heap_cond, &sim_heap_mutex, &ts);
+            }
+        }
+        pthread_mutex_unlock(&sim_heap_mutex);
+
+        struct _gatt_connection_t *node = ev.node;
+
+        /* node lock keeps disconnect from freeing the receiver meanwhile */
+        pthread_mutex_lock(&node->lock);
+        if(node->connected && node->generation == ev.generation && ev.to_node) {
+            sim_ota_take(node, &ev);
+        } else if(node->connected && node->generation == ev.generation && ev.ota_ack && node->cb != NULL) {
+            node->ota_ack_pending = false;
+            sim_ota_ack_send(node);
+        } else if(node->connected && node->generation == ev.generation && node->cb != NULL) {
+            node->cb(NULL, (const uint8_t *)&ev.packet, BLE_PACKET_HDR_SIZE + ev.packet.payload_size,
+                    node->user_data);
+            atomic_fetch_add_explicit(&sim_fragments, 1, memory_order_relaxed);
+            if(ev.audio) {
+                atomic_fetch_add_explicit(&sim_audio_bytes, ev.packet.payload_size, memory_order_relaxed);
+                if(!ev.last) {
+                    sim_audio_next(node, ev.due + sim_audio_gap_us);
+                }
+            } else if(ev.last && !node->lost) {
+                node->last_complete = true;
+                atomic_fetch_add_explicit(&sim_readings, 1, memory_order_relaxed);
+            }
+        }
+        pthread_mutex_unlock(&node->lock);
+    }
+
+    return(NULL);
+}
+
+/**
+ *  @fn sim_report_thread_fn()
+ *  @brief prints statistics every second and ends the run
+ *  @param
+ *  @return
+ */
+static void *sim_report_thread_fn(void *args)
+{
+    uint64_t prev = 0;
+    uint64_t prev_audio = 0;
+    uint64_t prev_down = 0;
+    uint64_t prev_ota = 0;
+    (void)args;
+
+    for(uint32_t t = 1; !sim_duration || t <= sim_duration; t++) {
+        sleep(1);
+        uint64_t cur = atomic_load(&sim_readings);
+        uint64_t cur_audio = atomic_load(&sim_audio_bytes);
+        uint64_t cur_down = atomic_load(&sim_down_msgs);
+        uint64_t cur_ota = atomic_load(&sim_ota_bytes);
+        sim_report("1s", cur - prev, cur_audio - prev_audio, cur_down - prev_down, cur_ota - prev_ota, 1.0);
+        prev = cur;
+        prev_audio = cur_audio;
+        prev_down = cur_down;
+        prev_ota = cur_ota;
+    }
+
+    sim_report("total", atomic_load(&sim_readings), atomic_load(&sim_audio_bytes),
+            atomic_load(&sim_down_msgs), atomic_load(&sim_ota_bytes), (sim_now_us() - sim_start) / 1e6);
+    kill(getpid(), SIGINT);
+    return(NULL);
+}
+
+/**
+ *  @fn sim_down_thread_fn()
+ *  @brief offers downstream messages to the gateway at a steady rate,
+ *         one node requisition for every seven user data
+ *  @param
+ *  @return
+ */
+static void *sim_down_thread_fn(void *args)
+{
+    uint8_t payload[BLE_TX_MSG_MAX];
+    uint64_t due = sim_now_us();
+    (void)args;
+
+    for(uint32_t n = 0; ; n++) {
+        uint64_t now = sim_now_us();
+
+        due += 1000000ULL / sim_down_rate;
+        if(due > now) {
+            usleep(due - now);
+        }
+
+        memset(payload, (uint8_t)n, sizeof(payload));
+        if((n & 7) == 7) {
+            beeinformed_app_ble_send_data(payload, 2, k_ble_node_requisition_tag);
+        } else {
+            beeinformed_app_ble_send_data(payload, sim_down_size, k_ble_user_data_tag);
+        }
+    }
+
+    return(NULL);
+}
+
+/**
+ *  @fn sim_take_downstream()
+ *  @brief decodes a downstream frame into records, like the node would
+ *  @param
+ *  @return
+ */
+static void sim_take_downstream(struct _gatt_connection_t *node, const ble_data_t *f, size_t len)
+{
+    uint32_t n = (uint32_t)(len - BLE_PACKET_HDR_SIZE);
+    uint32_t ended = 0;
+
+    if(n > f->payload_size) {
+        n = f->payload_size;
+    }
+
+    /* writes are acknowledged, a missing frame is a gateway bug */
+    if(node->down_started && f->id != node->down_seq) {
+        atomic_fetch_add(&sim_down_bad, 1);
+    }
+    node->down_started = true;
+    node->down_seq = f->id + 1;
+    atomic_fetch_add_explicit(&sim_down_frames, 1, memory_order_relaxed);
+
+    for(uint32_t i = 0; i < n; i++) {
+        if(node->down_hdr < BLE_TX_REC_HDR_SIZE) {
+            if(node->down_hdr++ == 0) {
+                if(f->pack_data[i] < k_ble_gps_tag || f->pack_data[i] > k_ble_node_requisition_tag) {
+                    atomic_fetch_add(&sim_down_bad, 1);
+                }
+                continue;
+            }
+            node->down_left = f->pack_data[i];
+        } else {
+            node->down_left--;
+        }
+
+        if(!node->down_left) {
+            node->down_hdr = 0;
+            ended++;
+        }
+    }
+
+    if(ended != f->pack_amount) {
+        atomic_fetch_add(&sim_down_bad, 1);
+    }
+    atomic_fetch_add_explicit(&sim_down_msgs, ended, memory_order_relaxed);
+}
+
+/**
+ *  @fn sim_answer_sensors()
+ *  @brief schedules a multi packet response to k_get_sensors
+ *  @param
+ *  @return
+ */
+static void sim_answer_sensors(struct _gatt_connection_t *node)
+{
+    acqui_st_t env;
+    sim_event_t ev;
+    uint32_t frags = (sizeof(env) + sim_frag - 1) / sim_frag;
+    uint64_t due = sim_now_us() + sim_latency_us;
+    uint64_t prev_due = 0;
+    double phase = node->seq++ / 60.0;
+
+    env.temperature = 25000 + (int32_t)(3000.0 * sin(phase));
+    env.pressure = 101325 + (uint32_t)(sim_rand() % 200);
+    env.luminosity = 50000 + (uint32_t)(20000.0 * (1.0 + sin(phase / 10.0)));
+    env.humidity = 55 + (sim_rand() % 10);
+
+    node->lost = false;
+    memset(&ev, 0, sizeof(ev));
+    ev.node = node;
+    ev.generation = node->generation;
+
+    pthread_mutex_lock(&sim_heap_mutex);
+    for(uint32_t i = 0; i < frags; i++) {
+        uint32_t off = i * sim_frag;
+        uint32_t len = (sizeof(env) - off < sim_frag) ? sizeof(env) - off : sim_frag;
+
+        ev.packet.type = k_data_packet;
+        ev.packet.id = (uint8_t)i;
+        ev.packet.pack_amount = (uint8_t)frags;
+        ev.packet.payload_size = (uint8_t)len;
+        memcpy(ev.packet.pack_data, (uint8_t *)&env + off, len);
+        ev.last = (i == frags - 1);
+        ev.due = due + i * sim_gap_us + (sim_jitter_us ? sim_rand() % sim_jitter_us : 0);
+
+        /* jitter must not reorder fragments of the same response, the
+         * heap does not keep ties in order either */
+        if(i && ev.due <= prev_due) {
+            ev.due = prev_due + 1;
+        }
+        prev_due = ev.due;
+
+        if(sim_loss && (sim_rand() % 1000) < sim_loss) {
+            node->lost = true;
+            atomic_fetch_add(&sim_lost, 1);
+            continue;
+        }
+        sim_heap_push(&ev);
+    }
+    pthread_cond_signal(&sim_heap_cond);
+    pthread_mutex_unlock(&sim_heap_mutex);
+}
+
+/**
+ *  @fn sim_init()
+ *  @brief builds the node population before main() runs
+ *  @param
+ *  @return
+ */
+__attribute__((constructor)) static void sim_init(void)
+{
+    sim_nodes = sim_env("BEEINFO_SIM_NODES", sim_nodes);
+    sim_latency_us = sim_env("BEEINFO_SIM_LATENCY_US", sim_latency_us);
+    sim_jitter_us = sim_env("BEEINFO_SIM_JITTER_US", sim_jitter_us);
+    sim_gap_us = sim_env("BEEINFO_SIM_GAP_US", sim_gap_us);
+    sim_loss = sim_env("BEEINFO_SIM_LOSS", sim_loss);
+    sim_frag = sim_env("BEEINFO_SIM_FRAG", sim_frag);
+    sim_connect_us = sim_env("BEEINFO_SIM_CONNECT_US", sim_connect_us);
+    sim_discover_us = sim_env("BEEINFO_SIM_DISCOVER_US", sim_discover_us);
+    sim_db_rev = sim_env("BEEINFO_SIM_DB_REV", sim_db_rev);
+    sim_write_us = sim_env("BEEINFO_SIM_WRITE_US", sim_write_us);
+    sim_audio_gap_us = sim_env("BEEINFO_SIM_AUDIO_GAP_US", sim_audio_gap_us);
+    sim_down_rate = sim_env("BEEINFO_SIM_DOWN_RATE", sim_down_rate);
+    sim_down_size = sim_env("BEEINFO_SIM_DOWN_SIZE", sim_down_size);
+    sim_link_us = sim_env("BEEINFO_SIM_LINK_US", sim_link_us);
+    sim_ota_drop = sim_env("BEEINFO_SIM_OTA_DROP", sim_ota_drop);
+    sim_duration = sim_env("BEEINFO_SIM_DURATION", sim_duration);
+    sim_rand_state = sim_env("BEEINFO_SIM_SEED", 1) | 1;
+
+    if(sim_frag == 0 || sim_frag > PACKET_MAX_PAYLOAD) {
+        sim_frag = PACKET_MAX_PAYLOAD;
+    }
+    if(sim_down_size > BLE_TX_MSG_MAX) {
+        sim_down_size = BLE_TX_MSG_MAX;
+    }
+
+    sim_node = calloc(sim_nodes, sizeof(*sim_node));
+    sim_heap = calloc(SIM_MAX_PENDING, sizeof(*sim_heap));
+    assert(sim_node != NULL && sim_heap != NULL);
+
+    for(uint32_t i = 0; i < sim_nodes; i++) {
+        snprintf(sim_node[i].addr, sizeof(sim_node[i].addr), "B0:EE:00:00:%02X:%02X",
+                (i >> 8) & 0xFF, i & 0xFF);
+        pthread_mutex_init(&sim_node[i].lock, NULL);
+    }
+
+    sim_start = sim_now_us();
+    pthread_create(&sim_deliver_thread, NULL, sim_deliver_thread_fn, NULL);
+    pthread_create(&sim_report_thread, NULL, sim_report_thread_fn, NULL);
+    if(sim_down_rate) {
+        pthread_create(&sim_down_thread, NULL, sim_down_thread_fn, NULL);
+    }
+    fprintf(stderr, "[SIM] %u nodes, latency %uus, jitter %uus, loss %u/1000, %u bytes per fragment\n",
+            sim_nodes, sim_latency_us, sim_jitter_us, sim_loss, sim_frag);
+}
+
+
+/** public functions */
+gatt_connection_t *gattlib_connect(const char *src, const char *dst,
+                uint8_t dest_type, gattlib_bt_sec_level_t sec_level, int psm, int mtu)
+{
+    (void)src;
+    (void)sec_level;
+    (void)psm;
+    (void)mtu;
+
+    if(dest_type != BDADDR_LE_PUBLIC) {
+        return(NULL);
+    }
+
+    for(uint32_t i = 0; i < sim_nodes; i++) {
+        struct _gatt_connection_t *node = &sim_node[i];
+
+        if(strcmp(node->addr, dst)) {
+            continue;
+        }
+
+        pthread_mutex_lock(&node->lock);
+        if(node->connected) {
+            /* the radio takes one central per peripheral */
+            pthread_mutex_unlock(&node->lock);
+            return(NULL);
+        }
+        node->connected = true;
+        node->cb = NULL;
+        node->last_cmd = 0;
+        node->down_started = false;
+        node->down_hdr = 0;
+        pthread_mutex_unlock(&node->lock);
+
+        usleep(sim_connect_us);
+        atomic_fetch_add(&sim_connects, 1);
+        return(node);
+    }
+
+    return(NULL);
+}
+
+int gattlib_disconnect(gatt_connection_t* connection)
+{
+    if(connection == NULL) {
+        return(-1);
+    }
+
+    pthread_mutex_lock(&connection->lock);
+    connection->connected = false;
+    connection->cb = NULL;
+    connection->user_data = NULL;
+    connection->generation++;
+    pthread_mutex_unlock(&connection->lock);
+    return(0);
+}
+
+int gattlib_adapter_open(const char* adapter_name, void** adapter)
+{
+    (void)adapter_name;
+    *adapter = sim_node;
+    return(0);
+}
+
+int gattlib_adapter_scan_enable(void* adapter, gattlib_discovered_device_t discovered_device_cb, int timeout)
+{
+    (void)adapter;
+    (void)timeout;
+
+    for(uint32_t i = 0; i < sim_nodes; i++) {
+        discovered_device_cb(sim_node[i].addr, "beeinformed_edge");
+    }
+    discovered_device_cb("00:11:22:33:44:55", "someone_else");
+    return(0);
+}
+
+int gattlib_adapter_scan_disable(void* adapter)
+{
+    (void)adapter;
+    return(0);
+}
+
+int gattlib_adapter_close(void* adapter)
+{
+    (void)adapter;
+    return(0);
+}
+
+int gattlib_discover_primary(gatt_connection_t* connection, gattlib_primary_service_t** services, int* services_count)
+{
+    gattlib_primary_service_t *s = calloc(3, sizeof(*s));
+
+    (void)connection;
+    if(s == NULL) {
+        return(-1);
+    }
+
+    usleep(sim_discover_us / 2);
+    s[0].attr_handle_start = 0x0001;
+    s[0].attr_handle_end = 0x0009;
+    s[0].uuid.type = SDP_UUID16;
+    s[0].uuid.value.uuid16 = 0x1800;
+    s[1].attr_handle_start = 0x000A;
+    s[1].attr_handle_end = 0x000D;
+    s[1].uuid.type = SDP_UUID16;
+    s[1].uuid.value.uuid16 = 0x1801;
+    s[2].attr_handle_start = 0x000E;
+    s[2].attr_handle_end = 0x0014;
+    s[2].uuid.type = SDP_UUID16;
+    s[2].uuid.value.uuid16 = 0xFFE0;
+
+    *services = s;
+    *services_count = 3;
+    return(0);
+}
+
+int gattlib_discover_char(gatt_connection_t* connection, gattlib_characteristic_t** characteristics, int* characteristic_count)
+{
+    gattlib_characteristic_t *c = calloc(3, sizeof(*c));
+
+    (void)connection;
+    if(c == NULL) {
+        return(-1);
+    }
+
+    usleep(sim_discover_us / 2);
+    c[0].handle = SIM_TX_HANDLE - 1;
+    c[0].properties = 0x0C;
+    c[0].value_handle = SIM_TX_HANDLE;
+    c[0].uuid.type = SDP_UUID16;
+    c[0].uuid.value.uuid16 = 0xFFE1;
+    c[1].handle = SIM_NOTI_HANDLE - 2;
+    c[1].properties = 0x12;
+    c[1].value_handle = SIM_NOTI_HANDLE - 1;
+    c[1].uuid.type = SDP_UUID16;
+    c[1].uuid.value.uuid16 = 0xFFE2;
+    c[2].handle = SIM_DB_HASH_HANDLE - 1;
+    c[2].properties = 0x02;
+    c[2].value_handle = SIM_DB_HASH_HANDLE;
+    c[2].uuid.type = SDP_UUID16;
+    c[2].uuid.value.uuid16 = SIM_DB_HASH_UUID;
+
+    *characteristics = c;
+    *characteristic_count = 3;
+    return(0);
+}
+
+int gattlib_read_char_by_uuid(gatt_connection_t* connection, uuid_t* uuid, void* buffer, size_t* buffer_len)
+{
+    uint8_t hash[16];
+
+    if(connection == NULL || !connection->connected || uuid->type != SDP_UUID16 ||
+        uuid->value.uuid16 != SIM_DB_HASH_UUID) {
+        return(-1);
+    }
+
+    /* one round trip, the hash only changes with the database revision */
+    usleep(sim_latency_us);
+    for(uint32_t i = 0; i < sizeof(hash); i++) {
+        hash[i] = (uint8_t)((sim_db_rev * 2654435761u) >> ((i & 3) * 8)) ^ (uint8_t)i;
+    }
+    if(*buffer_len > sizeof(hash)) {
+        *buffer_len = sizeof(hash);
+    }
+    memcpy(buffer, hash, *buffer_len);
+    return(0);
+}
+
+int gattlib_write_char_by_handle(gatt_connection_t* connection, uint16_t handle, const void* buffer, size_t buffer_len)
+{
+    const ble_data_t *cmd = buffer;
+    uint64_t now;
+
+    if(connection == NULL || !connection->connected) {
+        return(-1);
+    }
+
+    if(sim_write_us) {
+        usleep(sim_write_us);
+    }
+
+    if(handle == SIM_TX_HANDLE && buffer_len >= BLE_PACKET_HDR_SIZE && cmd->type == k_data_packet) {
+        sim_take_downstream(connection, cmd, buffer_len);
+        return(0);
+    }
+
+    if(handle != SIM_TX_HANDLE || buffer_len < BLE_PACKET_HDR_SIZE || cmd->type != k_command_packet) {
+        /* descriptors and anything else the node just acknowledges */
+        return(0);
+    }
+
+    switch(cmd->id) {
+    case k_get_sensors:
+        atomic_fetch_add_explicit(&sim_cmds, 1, memory_order_relaxed);
+        now = sim_now_us();
+
+        /* a full cycle is command to command on a clean response */
+        pthread_mutex_lock(&connection->lock);
+        if(connection->last_cmd && connection->last_complete) {
+            sim_hist_record(now - connection->last_cmd);
+        }
+        connection->last_cmd = now;
+        connection->last_complete = false;
+        pthread_mutex_unlock(&connection->lock);
+
+        sim_answer_sensors(connection);
+        break;
+
+    case k_fw_update:
+        sim_ota_offer(connection, cmd);
+        break;
+
+    case k_reboot:
+        sim_ota_reboot(connection);
+        break;
+
+    case k_get_audio:
+        atomic_fetch_add_explicit(&sim_cmds, 1, memory_order_relaxed);
+        if(cmd->payload_size < BLE_AUDIO_REQ_SIZE) {
+            break;
+        }
+
+        pthread_mutex_lock(&connection->lock);
+        memcpy(&connection->audio_left, cmd->pack_data, BLE_AUDIO_REQ_SIZE);
+        connection->last_complete = false;
+        connection->audio_seq = 0;
+        if(connection->audio_left) {
+            sim_audio_next(connection, sim_now_us() + sim_latency_us);
+        }
+        pthread_mutex_unlock(&connection->lock);
+        break;
+
+    default:
+        break;
+    }
+
+    return(0);
+}
+
+int gattlib_write_without_response_char_by_handle(gatt_connection_t* connection, uint16_t handle, const void* buffer, size_t buffer_len)
+{
+    const ble_data_t *frag = buffer;
+    sim_event_t ev;
+    uint64_t now;
+
+    if(connection == NULL || !connection->connected) {
+        return(-1);
+    }
+
+    if(handle != SIM_TX_HANDLE || buffer_len < BLE_PACKET_HDR_SIZE || frag->type != k_sequence_packet) {
+        return(0);
+    }
+
+    /* fragments go out back to back, each one takes its air time */
+    memset(&ev, 0, sizeof(ev));
+    memcpy(&ev.packet, frag, (buffer_len < sizeof(ev.packet)) ? buffer_len : sizeof(ev.packet));
+    ev.node = connection;
+    ev.to_node = true;
+
+    now = sim_now_us();
+    pthread_mutex_lock(&connection->lock);
+    connection->link_free = ((connection->link_free > now) ? connection->link_free : now) + sim_link_us;
+    ev.due = connection->link_free + sim_latency_us;
+    ev.generation = connection->generation;
+    pthread_mutex_unlock(&connection->lock);
+
+    if(sim_loss && (sim_rand() % 1000) < sim_loss) {
+        atomic_fetch_add(&sim_lost, 1);
+        return(0);
+    }
+
+    pthread_mutex_lock(&sim_heap_mutex);
+    sim_heap_push(&ev);
+    pthread_cond_signal(&sim_heap_cond);
+    pthread_mutex_unlock(&sim_heap_mutex);
+    return(0);
+}
+
+void gattlib_register_notification(gatt_connection_t* connection, gatt_event_cb_t notification_handler, void* user_data)
+{
+    if(connection == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&connection->lock);
+    connection->cb = notification_handler;
+    connection->user_data = user_data;
+    pthread_mutex_unlock(&connection->lock);
+}
+
+int gattlib_uuid_to_string(const uuid_t *uuid, char *str, size_t size)
+{
+    if(uuid->type == SDP_UUID16) {
+        snprintf(str, size, "0x%04x", uuid->value.uuid16);
+    } else if(uuid->type == SDP_UUID32) {
+        snprintf(str, size, "0x%08x", uuid->value.uuid32);
+    } else {
+        const uint8_t *d = uuid->value.uuid128.data;
+        snprintf(str, size, "%02x%02x%02x%02x-%02x%02x-%02x%02x-%02x%02x-%02x%02x%02x%02x%02x%02x",
+                d[0], d[1], d[2], d[3], d[4], d[5], d[6], d[7],
+                d[8], d[9], d[10], d[11], d[12], d[13], d[14], d[15]);
+    }
+    return(0);
+}
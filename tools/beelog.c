@@ -0,0 +1,405 @@
+/**
+ *          THE BeeInformed Team
+ *  @file beelog.c
+ *  @brief turns the binary log of the gateway back into text, the file
+ *         describes its own call sites so nothing else is needed
+ *
+ *  usage: beelog [-f] [-w] [-l level] file
+ *         -f keeps reading as the gateway appends, -w prints wall clock
+ *         time instead of seconds since the file was opened
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include "app_log.h"
+
+/** call site as described by the file */
+typedef struct {
+    uint64_t id;
+    uint8_t level;
+    char *func;
+    char *fmt;
+}beelog_site_t;
+
+
+/** static variables */
+static beelog_site_t *beelog_sites;
+static uint32_t beelog_sites_cap;
+static uint32_t beelog_sites_count;
+static uint64_t beelog_clock_mono;
+static uint64_t beelog_clock_real;
+static const char beelog_levels[] = "EWID";
+
+
+/** static functions */
+
+/**
+ *  @fn beelog_level()
+ *  @brief parses a level name or number
+ *  @param
+ *  @return the level, -1 if unknown
+ */
+static int beelog_level(const char *name)
+{
+    static const char *names[] = { "err", "warn", "info", "debug" };
+
+    for(int i = 0; i <= LOG_LEVEL_DEBUG; i++) {
+        if(!strcasecmp(name, names[i]) || (name[0] == '0' + i && name[1] == '\0')) {
+            return(i);
+        }
+    }
+    return(-1);
+}
+
+/**
+ *  @fn beelog_slot()
+ *  @brief finds the slot of a site id, free or taken
+ *  @param
+ *  @return
+ */
+static beelog_site_t *beelog_slot(uint64_t id)
+{
+    uint32_t i = (uint32_t)((id >> 3) * 0x9E3779B97F4A7C15ULL >> 32) & (beelog_sites_cap - 1);
+
+    while(beelog_sites[i].id && beelog_sites[i].id != id) {
+        i = (i + 1) & (beelog_sites_cap - 1);
+    }
+    return(&beelog_sites[i]);
+}
+
+/**
+ *  @fn beelog_site_add()
+ *  @brief keeps a site description, a later one of the same id wins
+ *  @param
+ *  @return
+ */
+static void beelog_site_add(uint64_t id, uint8_t level, const char *func, const char *fmt)
+{
+    beelog_site_t *s;
+
+    if(beelog_sites_count * 2 >= beelog_sites_cap) {
+        beelog_site_t *old = beelog_sites;
+        uint32_t old_cap = beelog_sites_cap;
+
+        beelog_sites_cap = (old_cap) ? old_cap * 2 : 256;
+        beelog_sites = calloc(beelog_sites_cap, sizeof(*beelog_sites));
+        if(beelog_sites == NULL) {
+            fprintf(stderr, "ERROR: out of memory.\n");
+            exit(-1);
+        }
+        for(uint32_t i = 0; i < old_cap; i++) {
+            if(old[i].id) {
+                *beelog_slot(old[i].id) = old[i];
+            }
+        }
+        free(old);
+    }
+
+    s = beelog_slot(id);
+    if(s->id) {
+        free(s->func);
+        free(s->fmt);
+    } else {
+        beelog_sites_count++;
+    }
+    s->id = id;
+    s->level = level;
+    s->func = strdup(func);
+    s->fmt = strdup(fmt);
+}
+
+/**
+ *  @fn beelog_render()
+ *  @brief formats an event with the format of its site, every conversion
+ *         is handed to snprintf with the argument in the type it asks for
+ *  @param out - text buffer
+ *  @param size - text buffer size
+ *  @param fmt - format of the site
+ *  @param r - event record
+ *  @return
+ */
+static void beelog_render(char *out, size_t size, const char *fmt, const app_log_rec_t *r)
+{
+    const uint8_t *types = (const uint8_t *)(r + 1);
+    const uint8_t *p = types + ((r->nargs + 7) & ~7u);
+    const uint8_t *end = (const uint8_t *)r + r->size;
+    size_t len = 0;
+    uint32_t arg = 0;
+
+    while(*fmt && len + 1 < size) {
+        char spec[32];
+        size_t sl = 0;
+        int hmod = 0;
+        char conv;
+        uint8_t type;
+        uint64_t v = 0;
+        char str[LOG_MAX_STR + 1];
+        int n;
+
+        if(*fmt != '%') {
+            out[len++] = *fmt++;
+            continue;
+        }
+        if(fmt[1] == '%') {
+            out[len++] = '%';
+            fmt += 2;
+            continue;
+        }
+
+        /* flags, width and precision are kept, the length is ours to pick */
+        spec[sl++] = *fmt++;
+        while(*fmt && strchr("-+ #0'.123456789", *fmt) && sl < sizeof(spec) - 4) {
+            spec[sl++] = *fmt++;
+        }
+        while(*fmt && strchr("hlLqjzt", *fmt)) {
+            hmod += (*fmt == 'h');
+            fmt++;
+        }
+        conv = *fmt;
+        if(!conv) {
+            break;
+        }
+        fmt++;
+
+        if(arg >= r->nargs || p + sizeof(uint64_t) > end) {
+            n = snprintf(out + len, size - len, "<?>");
+            len += (n > 0) ? (size_t)n : 0;
+            continue;
+        }
+        type = types[arg++];
+        memcpy(&v, p, sizeof(v));
+        p += sizeof(v);
+        if(type == LOG_ARG_STR) {
+            size_t sn = (v <= LOG_MAX_STR && p + v <= end) ? (size_t)v : 0;
+
+            memcpy(str, p, sn);
+            str[sn] = '\0';
+            p += (v + 7) & ~7ULL;
+        }
+
+        switch(conv) {
+        case 'd': case 'i': {
+            long long s = (type == LOG_ARG_I32 || type == LOG_ARG_U32) ? (int32_t)v : (int64_t)v;
+
+            s = (hmod == 1) ? (short)s : (hmod >= 2) ? (signed char)s : s;
+            memcpy(spec + sl, "ll", 2);
+            spec[sl + 2] = conv;
+            spec[sl + 3] = '\0';
+            n = snprintf(out + len, size - len, spec, s);
+            break;
+        }
+        case 'u': case 'o': case 'x': case 'X': {
+            unsigned long long u = (type == LOG_ARG_I32 || type == LOG_ARG_U32) ? (uint32_t)v : v;
+
+            u = (hmod == 1) ? (unsigned short)u : (hmod >= 2) ? (unsigned char)u : u;
+            memcpy(spec + sl, "ll", 2);
+            spec[sl + 2] = conv;
+            spec[sl + 3] = '\0';
+            n = snprintf(out + len, size - len, spec, u);
+            break;
+        }
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A': {
+            double d;
+
+            if(type == LOG_ARG_DBL) {
+                memcpy(&d, &v, sizeof(d));
+            } else {
+                d = (type == LOG_ARG_I32 || type == LOG_ARG_I64) ? (double)(int64_t)v : (double)v;
+            }
+            spec[sl] = conv;
+            spec[sl + 1] = '\0';
+            n = snprintf(out + len, size - len, spec, d);
+            break;
+        }
+        case 'c':
+            spec[sl] = conv;
+            spec[sl + 1] = '\0';
+            n = snprintf(out + len, size - len, spec, (int)v);
+            break;
+        case 's':
+            spec[sl] = conv;
+            spec[sl + 1] = '\0';
+            n = snprintf(out + len, size - len, spec, (type == LOG_ARG_STR) ? str : "<?>");
+            break;
+        case 'p':
+            n = snprintf(out + len, size - len, "%p", (void *)(uintptr_t)v);
+            break;
+        default:
+            n = 0;
+            break;
+        }
+        len += (n > 0) ? (size_t)n : 0;
+        if(len >= size) {
+            len = size - 1;
+        }
+    }
+
+    /* the gateway formats still carry their own line endings */
+    while(len && strchr(" \r\n", out[len - 1])) {
+        len--;
+    }
+    out[len] = '\0';
+}
+
+/**
+ *  @fn beelog_stamp()
+ *  @brief formats the time of a record
+ *  @param
+ *  @return
+ */
+static void beelog_stamp(char *out, size_t size, uint64_t ts_ns, bool wall)
+{
+    if(wall && beelog_clock_real) {
+        uint64_t ns = beelog_clock_real + (ts_ns - beelog_clock_mono);
+        time_t secs = (time_t)(ns / 1000000000ULL);
+        struct tm tm;
+        size_t n;
+
+        localtime_r(&secs, &tm);
+        n = strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+        snprintf(out + n, size - n, ".%06llu", (unsigned long long)(ns % 1000000000ULL / 1000));
+    } else {
+        snprintf(out, size, "%12.6f", (int64_t)(ts_ns - beelog_clock_mono) / 1e9);
+    }
+}
+
+/**
+ *  @fn beelog_read()
+ *  @brief reads exactly len bytes, waiting for the writer in follow mode
+ *  @param
+ *  @return false at the end of the file
+ */
+static bool beelog_read(FILE *fp, void *buf, size_t len, bool follow)
+{
+    size_t got = 0;
+
+    while(got < len) {
+        got += fread((uint8_t *)buf + got, 1, len - got, fp);
+        if(got < len) {
+            if(!follow) {
+                return(false);
+            }
+            clearerr(fp);
+            usleep(200 * 1000);
+        }
+    }
+    return(true);
+}
+
+
+/**
+ *  @fn main()
+ *  @brief beelog entry point
+ *  @param
+ *  @return
+ */
+int main(int argc, char **argv)
+{
+    uint8_t rec[UINT16_MAX + 1];
+    app_log_rec_t *r = (app_log_rec_t *)rec;
+    char magic[8];
+    char text[4096];
+    char stamp[64];
+    bool follow = false;
+    bool wall = false;
+    int level = LOG_LEVEL_DEBUG;
+    FILE *fp;
+    int opt;
+
+    while((opt = getopt(argc, argv, "fwl:h")) != -1) {
+        switch(opt) {
+        case 'f':
+            follow = true;
+            break;
+        case 'w':
+            wall = true;
+            break;
+        case 'l':
+            level = beelog_level(optarg);
+            if(level >= 0) {
+                break;
+            }
+            /* fall through */
+        default:
+            fprintf(stderr, "usage: %s [-f] [-w] [-l err|warn|info|debug] file\n", argv[0]);
+            return((opt == 'h') ? 0 : -1);
+        }
+    }
+    if(optind >= argc) {
+        fprintf(stderr, "usage: %s [-f] [-w] [-l err|warn|info|debug] file\n", argv[0]);
+        return(-1);
+    }
+
+    fp = fopen(argv[optind], "rb");
+    if(fp == NULL) {
+        fprintf(stderr, "ERROR: Failed to open %s.\n", argv[optind]);
+        return(-1);
+    }
+    if(!beelog_read(fp, magic, sizeof(magic), follow) || memcmp(magic, LOG_FILE_MAGIC, sizeof(magic))) {
+        fprintf(stderr, "ERROR: %s is not a beeinformed log.\n", argv[optind]);
+        fclose(fp);
+        return(-1);
+    }
+
+    while(beelog_read(fp, rec, sizeof(*r), follow)) {
+        if(r->size < sizeof(*r) || (r->size & 7) ||
+            !beelog_read(fp, rec + sizeof(*r), r->size - sizeof(*r), follow)) {
+            fprintf(stderr, "ERROR: truncated or corrupt record, stopping.\n");
+            break;
+        }
+
+        switch(r->kind) {
+        case LOG_REC_CLOCK:
+            beelog_clock_mono = r->ts_ns;
+            beelog_clock_real = r->id;
+            break;
+
+        case LOG_REC_SITE: {
+            const char *func = (const char *)&rec[sizeof(*r) + 1];
+            const char *fmt = func + strnlen(func, r->size - sizeof(*r) - 1) + 1;
+
+            rec[r->size - 1] = '\0';
+            beelog_site_add(r->id, rec[sizeof(*r)], func, (fmt < (const char *)rec + r->size) ? fmt : "");
+            break;
+        }
+
+        case LOG_REC_DROP:
+            beelog_stamp(stamp, sizeof(stamp), r->ts_ns, wall);
+            printf("[%s] W %6u beelog: %llu calls lost to a full buffer\n", stamp, r->tid,
+                (unsigned long long)r->id);
+            break;
+
+        case LOG_REC_EVENT: {
+            beelog_site_t *s = (beelog_sites_cap) ? beelog_slot(r->id) : NULL;
+
+            if(s == NULL || !s->id) {
+                fprintf(stderr, "ERROR: event of an undescribed site %llx.\n", (unsigned long long)r->id);
+                break;
+            }
+            if(s->level > level) {
+                break;
+            }
+            beelog_render(text, sizeof(text), s->fmt, r);
+            beelog_stamp(stamp, sizeof(stamp), r->ts_ns, wall);
+            printf("[%s] %c %6u %s: %s\n", stamp, beelog_levels[s->level & 3], r->tid, s->func, text);
+            break;
+        }
+
+        default:
+            break;
+        }
+        if(follow) {
+            fflush(stdout);
+        }
+    }
+
+    fclose(fp);
+    return(0);
+}
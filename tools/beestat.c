@@ -0,0 +1,282 @@
+/**
+ *          THE BeeInformed Team
+ *  @file beestat.c
+ *  @brief prints the per device counters the gateway publishes in shared
+ *         memory, never takes a lock or writes to the segment
+ *
+ *  usage: beestat [-i seconds] [-c samples] [-s segment] [-l] [-a address]
+ *
+ *  -l prints the sensor command cycle latencies instead of the counters,
+ *  gateway wide per phase and per device for the whole cycle, -a adds
+ *  every phase of one device.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "app_hist.h"
+#include "app_stats.h"
+
+
+/** static variables */
+
+/* names of ble_dev_state_t, in its order */
+static const char *beestat_states[] = {
+    "connect", "idle", "wait_resp", "wait_audio", "ota", "disconnect",
+};
+
+/* previous sample, rates are taken against it */
+static uint64_t beestat_prev_rx[STATS_MAX_DEVICES];
+static uint64_t beestat_prev_rx_bytes[STATS_MAX_DEVICES];
+static uint64_t beestat_prev_tx[STATS_MAX_DEVICES];
+static uint64_t beestat_prev_us;
+
+
+/** static functions */
+
+/**
+ *  @fn beestat_now_us()
+ *  @brief monotonic time in microseconds, same clock as the gateway
+ *  @param
+ *  @return
+ */
+static uint64_t beestat_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return((uint64_t)ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000);
+}
+
+/**
+ *  @fn beestat_open()
+ *  @brief maps the segment read only and checks it is the layout we know
+ *  @param name - segment name
+ *  @return the segment, NULL on failure
+ */
+static const stats_shm_t *beestat_open(const char *name)
+{
+    const stats_shm_t *s;
+    int fd;
+
+    fd = shm_open(name, O_RDONLY, 0);
+    if(fd < 0) {
+        fprintf(stderr, "ERROR: %s: %s, is the gateway running?\n", name, strerror(errno));
+        return(NULL);
+    }
+
+    s = mmap(NULL, sizeof(*s), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(s == MAP_FAILED) {
+        fprintf(stderr, "ERROR: Failed to map %s.\n", name);
+        return(NULL);
+    }
+
+    if(atomic_load_explicit(&s->magic, memory_order_acquire) != STATS_MAGIC ||
+        s->version != STATS_VERSION || s->dev_size != sizeof(stats_dev_t)) {
+        fprintf(stderr, "ERROR: %s has an unknown layout, rebuild beestat with the gateway.\n", name);
+        munmap((void *)s, sizeof(*s));
+        return(NULL);
+    }
+    return(s);
+}
+
+/**
+ *  @fn beestat_load()
+ *  @brief reads a counter of the segment
+ *  @param
+ *  @return
+ */
+static inline uint64_t beestat_load(const _Atomic uint64_t *c)
+{
+    return(atomic_load_explicit((_Atomic uint64_t *)c, memory_order_relaxed));
+}
+
+/**
+ *  @fn beestat_print()
+ *  @brief prints one sample, rates are per second since the previous one
+ *  @param s - segment
+ *  @return
+ */
+static void beestat_print(const stats_shm_t *s)
+{
+    uint64_t now = beestat_now_us();
+    uint32_t n = atomic_load_explicit((_Atomic uint32_t *)&s->devices, memory_order_acquire);
+    double secs;
+
+    if(!beestat_prev_us) {
+        beestat_prev_us = s->start_us;
+    }
+    secs = (now > beestat_prev_us) ? (now - beestat_prev_us) / 1e6 : 1.0;
+
+    printf("\ngateway pid %d, up %.0f s, %u devices, %llu scans, %llu sessions\n",
+        s->pid, (now - s->start_us) / 1e6, n,
+        (unsigned long long)beestat_load(&s->scans), (unsigned long long)beestat_load(&s->discoveries));
+    printf("%-17s %-10s %9s %9s %7s %8s %8s %8s %6s %9s %9s %9s\n",
+        "address", "state", "rx/s", "rx kB/s", "tx/s", "rx", "drops", "timeouts", "conns",
+        "rtt ms", "rtt avg", "rtt max");
+
+    for(uint32_t i = 0; i < n && i < STATS_MAX_DEVICES; i++) {
+        const stats_dev_t *d = &s->dev[i];
+        uint64_t rx = beestat_load(&d->rx_packets);
+        uint64_t rx_bytes = beestat_load(&d->rx_bytes);
+        uint64_t tx = beestat_load(&d->tx_writes);
+        uint64_t readings = beestat_load(&d->readings);
+        uint64_t state = beestat_load(&d->state);
+
+        if(!atomic_load_explicit((_Atomic uint32_t *)&d->in_use, memory_order_acquire)) {
+            continue;
+        }
+
+        printf("%-17.17s %-10s %9.1f %9.1f %7.1f %8llu %8llu %8llu %6llu %9.2f %9.2f %9.2f\n",
+            d->bd_addr,
+            (!beestat_load(&d->connected) && state != 0) ? "offline" :
+                (state < sizeof(beestat_states) / sizeof(beestat_states[0])) ? beestat_states[state] : "?",
+            (rx - beestat_prev_rx[i]) / secs, (rx_bytes - beestat_prev_rx_bytes[i]) / secs / 1000.0,
+            (tx - beestat_prev_tx[i]) / secs,
+            (unsigned long long)rx, (unsigned long long)beestat_load(&d->rx_drops),
+            (unsigned long long)beestat_load(&d->timeouts), (unsigned long long)beestat_load(&d->connects),
+            beestat_load(&d->rtt_last_us) / 1000.0,
+            (readings) ? beestat_load(&d->rtt_sum_us) / 1000.0 / readings : 0.0,
+            beestat_load(&d->rtt_max_us) / 1000.0);
+
+        beestat_prev_rx[i] = rx;
+        beestat_prev_rx_bytes[i] = rx_bytes;
+        beestat_prev_tx[i] = tx;
+    }
+    beestat_prev_us = now;
+    fflush(stdout);
+}
+
+/**
+ *  @fn beestat_print_hist()
+ *  @brief prints the percentiles of one phase, in microseconds
+ *  @param
+ *  @return
+ */
+static void beestat_print_hist(const char *who, uint32_t phase, const app_hist_snap_t *snap)
+{
+    printf("%-17.17s %-10s %9llu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+        who, stats_lat_name(phase), (unsigned long long)snap->count,
+        (snap->count) ? snap->sum_ns / 1000.0 / snap->count : 0.0,
+        app_hist_percentile(snap, 0.5) / 1000.0, app_hist_percentile(snap, 0.99) / 1000.0,
+        app_hist_percentile(snap, 0.999) / 1000.0, snap->max_ns / 1000.0);
+}
+
+/**
+ *  @fn beestat_print_latency()
+ *  @brief prints the cycle latencies since the gateway started
+ *  @param s - segment
+ *  @param addr - device to print every phase of, NULL for none
+ *  @return
+ */
+static void beestat_print_latency(const stats_shm_t *s, const char *addr)
+{
+    static app_hist_snap_t snap;
+    uint32_t n = atomic_load_explicit((_Atomic uint32_t *)&s->devices, memory_order_acquire);
+
+    printf("\ngateway pid %d, up %.0f s, %u devices, sensor cycle latency in us\n",
+        s->pid, (beestat_now_us() - s->start_us) / 1e6, n);
+    printf("%-17s %-10s %9s %10s %10s %10s %10s %10s\n",
+        "address", "phase", "cycles", "avg", "p50", "p99", "p999", "max");
+
+    for(uint32_t p = 0; p < k_lat_phases; p++) {
+        stats_latency(s, p, NULL, &snap);
+        beestat_print_hist("gateway", p, &snap);
+    }
+
+    for(uint32_t i = 0; i < n && i < STATS_MAX_DEVICES; i++) {
+        const stats_dev_t *d = &s->dev[i];
+        bool all = (addr != NULL && !strncmp(d->bd_addr, addr, STATS_ADDR_SIZE - 1));
+
+        if(!atomic_load_explicit((_Atomic uint32_t *)&d->in_use, memory_order_acquire)) {
+            continue;
+        }
+
+        for(uint32_t p = (all) ? 0 : k_lat_cycle; p < k_lat_phases; p++) {
+            memset(&snap, 0, sizeof(snap));
+            app_hist_merge(&snap, &d->lat[p]);
+            beestat_print_hist(d->bd_addr, p, &snap);
+        }
+    }
+    fflush(stdout);
+}
+
+
+/**
+ *  @fn main()
+ *  @brief beestat entry point
+ *  @param
+ *  @return
+ */
+int main(int argc, char **argv)
+{
+    const char *name = STATS_SHM_NAME;
+    const char *addr = NULL;
+    bool latency = false;
+    const stats_shm_t *s;
+    double interval = 1.0;
+    long count = 0;
+    int opt;
+
+    while((opt = getopt(argc, argv, "i:c:s:la:h")) != -1) {
+        switch(opt) {
+        case 'i':
+            interval = atof(optarg);
+            break;
+        case 'c':
+            count = atol(optarg);
+            break;
+        case 's':
+            name = optarg;
+            break;
+        case 'l':
+            latency = true;
+            break;
+        case 'a':
+            addr = optarg;
+            latency = true;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-i seconds] [-c samples] [-s segment] [-l] [-a address]\n", argv[0]);
+            return((opt == 'h') ? 0 : -1);
+        }
+    }
+    if(interval <= 0) {
+        interval = 1.0;
+    }
+
+    s = beestat_open(name);
+    if(s == NULL) {
+        return(-1);
+    }
+
+    for(long i = 0; !count || i < count; i++) {
+        /* the segment of a dead gateway stays until the next one starts */
+        if(kill(s->pid, 0) < 0 && errno == ESRCH) {
+            fprintf(stderr, "ERROR: gateway %d is gone.\n", s->pid);
+            return(-1);
+        }
+
+        if(latency) {
+            beestat_print_latency(s, addr);
+        } else {
+            beestat_print(s);
+        }
+        if(!count || i + 1 < count) {
+            usleep((useconds_t)(interval * 1e6));
+        }
+    }
+
+    return(0);
+}